@@ -0,0 +1,160 @@
+/******************************************************************************
+
+PROGRAM:  auth.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: The account work pool, see auth.h.  Submitted jobs wait in one
+          FIFO queue shared by the pool threads; each thread takes the
+          oldest, runs it and passes it back to the event loop it came
+          from.
+
+******************************************************************************/
+#include "auth.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static struct auth_job *queue_head, *queue_tail;
+
+// All protected by queue_lock
+static unsigned long depth, peak_depth;
+static unsigned long completed, rejected;
+static uint64_t latency_total, latency_max; // ns
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Queue a finished job for its event loop and wake the loop up
+void auth_return(struct auth_job *job) {
+  struct auth_done *done = job->home;
+  uint64_t one = 1;
+
+  job->next = NULL;
+  pthread_mutex_lock(&done->lock);
+  if (done->tail)
+    done->tail->next = job;
+  else
+    done->head = job;
+  done->tail = job;
+  pthread_mutex_unlock(&done->lock);
+  // The counter only has to be non-zero; a full counter is just as good
+  if (write(done->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    fprintf(stderr, "Server: Unable to signal an event loop: %s\n",
+            strerror(errno));
+}
+
+static void *pool_main(void *arg) {
+  struct auth_job *job;
+  uint64_t latency;
+
+  for (;;) {
+    pthread_mutex_lock(&queue_lock);
+    while (queue_head == NULL)
+      pthread_cond_wait(&queue_ready, &queue_lock);
+    job = queue_head;
+    if ((queue_head = job->next) == NULL)
+      queue_tail = NULL;
+    depth--;
+    pthread_mutex_unlock(&queue_lock);
+
+    job->run(job);
+
+    latency = now_ns() - job->queued;
+    pthread_mutex_lock(&queue_lock);
+    completed++;
+    latency_total += latency;
+    if (latency > latency_max)
+      latency_max = latency;
+    pthread_mutex_unlock(&queue_lock);
+    auth_return(job);
+  }
+  return NULL;
+}
+
+// Start the pool threads. Called once before the workers start.
+void auth_start(int threads) {
+  pthread_t thread;
+
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&thread, NULL, pool_main, NULL) != 0) {
+      fprintf(stderr, "Server: Unable to start account thread %d\n", i);
+      exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread);
+  }
+}
+
+void auth_done_init(struct auth_done *done) {
+  pthread_mutex_init(&done->lock, NULL);
+  done->head = done->tail = NULL;
+  done->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (done->efd < 0) {
+    fprintf(stderr, "Server: Unable to create eventfd: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+/******************************************************************************
+
+  Queue a job for the pool.  Returns false, without queueing it, if
+  AUTH_QUEUE_LIMIT jobs are already waiting; the job then still belongs to
+  the caller.
+
+ ******************************************************************************/
+bool auth_submit(struct auth_job *job) {
+  job->next = NULL;
+  job->queued = now_ns();
+  pthread_mutex_lock(&queue_lock);
+  if (depth >= AUTH_QUEUE_LIMIT) {
+    rejected++;
+    pthread_mutex_unlock(&queue_lock);
+    return false;
+  }
+  if (queue_tail)
+    queue_tail->next = job;
+  else
+    queue_head = job;
+  queue_tail = job;
+  if (++depth > peak_depth)
+    peak_depth = depth;
+  pthread_cond_signal(&queue_ready);
+  pthread_mutex_unlock(&queue_lock);
+  return true;
+}
+
+// Take every job finished for this event loop, oldest first, chained through
+// 'next'.  Called by the loop when its eventfd is readable.
+struct auth_job *auth_collect(struct auth_done *done) {
+  struct auth_job *jobs;
+  uint64_t count;
+
+  if (read(done->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    fprintf(stderr, "Server: Unable to read eventfd: %s\n", strerror(errno));
+  pthread_mutex_lock(&done->lock);
+  jobs = done->head;
+  done->head = done->tail = NULL;
+  pthread_mutex_unlock(&done->lock);
+  return jobs;
+}
+
+void auth_get_stats(struct auth_stats *stats) {
+  pthread_mutex_lock(&queue_lock);
+  stats->completed = completed;
+  stats->rejected = rejected;
+  stats->depth = depth;
+  stats->peak_depth = peak_depth;
+  stats->mean_latency_ms = completed ? latency_total / 1e6 / completed : 0.0;
+  stats->max_latency_ms = latency_max / 1e6;
+  pthread_mutex_unlock(&queue_lock);
+}
@@ -0,0 +1,71 @@
+/******************************************************************************
+
+PROGRAM:  auth.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: A small pool of threads that does the account work of logins and
+          registrations (looking up and storing users and checking password
+          hashes) away from the event loops, so a burst of logins cannot
+          stall the watchlist requests of everybody else.
+
+          The pool's queue is bounded.  auth_submit() refuses a job at once
+          when AUTH_QUEUE_LIMIT jobs are already waiting, and the caller
+          tells its client to try again, instead of letting the wait for a
+          login grow without limit.
+
+          A finished job is handed back to the event loop that submitted it
+          through that loop's struct auth_done: the job is queued there and
+          the eventfd, which the loop watches with epoll, is signalled.  The
+          loop then takes its jobs back with auth_collect() and calls their
+          'done' functions on its own thread.  Other work that finishes off
+          the event loops uses the same road back with auth_return().
+
+******************************************************************************/
+#ifndef AUTH_H
+#define AUTH_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DEFAULT_AUTH_THREADS 2
+#define AUTH_QUEUE_LIMIT 256 // jobs waiting for a pool thread
+
+struct auth_done;
+
+// Embedded at the start of the caller's own job structure
+struct auth_job {
+  struct auth_job *next;
+  struct auth_done *home;               // where the finished job goes
+  void (*run)(struct auth_job *job);    // called on a pool thread
+  void (*done)(struct auth_job *job);   // called back on the event loop
+  uint64_t queued;                      // submission time, ns
+};
+
+// Jobs finished for one event loop
+struct auth_done {
+  pthread_mutex_t lock;
+  struct auth_job *head, *tail;
+  int efd; // eventfd signalled when jobs are added
+};
+
+// Running totals since startup
+struct auth_stats {
+  unsigned long completed;
+  unsigned long rejected;    // refused because the queue was full
+  unsigned long depth;       // jobs waiting right now
+  unsigned long peak_depth;
+  double mean_latency_ms;    // submission to completion
+  double max_latency_ms;
+};
+
+void auth_start(int threads);
+
+void auth_done_init(struct auth_done *done);
+bool auth_submit(struct auth_job *job);
+void auth_return(struct auth_job *job);
+struct auth_job *auth_collect(struct auth_done *done);
+
+void auth_get_stats(struct auth_stats *stats);
+
+#endif
@@ -0,0 +1,217 @@
+/******************************************************************************
+
+PROGRAM:  cache.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Sharded LRU cache of decoded watchlist entries, see cache.h.
+
+          Every shard has a fixed number of slots, allocated up front, a
+          hash table over the slots in use and a doubly linked list ordered
+          from most to least recently used.  Once a shard is full, adding
+          an entry reuses the slot at the tail of its list.
+
+******************************************************************************/
+#include "cache.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_SHARDS 16
+
+struct cache_node {
+  struct cache_node *chain;      // hash chain
+  struct cache_node *prev, *next; // recency list, most recent first
+  size_t len;                    // title length; the title is in e.title
+  struct entry e;
+};
+
+struct cache_shard {
+  pthread_mutex_t lock;
+  struct cache_node *nodes; // capacity slots
+  struct cache_node **buckets;
+  struct cache_node *head, *tail;
+  struct cache_node *free;  // unused slots, chained through 'chain'
+  size_t nbuckets;          // a power of two
+  size_t count;
+  unsigned long hits, misses, evictions;
+} __attribute__((aligned(64)));
+
+static struct cache_shard shards[CACHE_SHARDS];
+static bool enabled;
+
+// FNV-1a
+static uint32_t hash_title(const char *title, size_t len) {
+  const unsigned char *p = (const unsigned char *)title;
+  uint32_t h = 2166136261u;
+
+  while (len--)
+    h = (h ^ *p++) * 16777619u;
+  return h;
+}
+
+/******************************************************************************
+
+  Size the cache for 'capacity' entries in all, spread evenly over the
+  shards.  A capacity of 0 turns the cache off.  Called once before the
+  workers start.
+
+ ******************************************************************************/
+void cache_init(size_t capacity) {
+  size_t per_shard = (capacity + CACHE_SHARDS - 1) / CACHE_SHARDS;
+  struct cache_shard *s;
+
+  if (capacity == 0)
+    return;
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    s = &shards[i];
+    pthread_mutex_init(&s->lock, NULL);
+    for (s->nbuckets = 16; s->nbuckets < per_shard; s->nbuckets *= 2)
+      ;
+    s->nodes = calloc(per_shard, sizeof(*s->nodes));
+    s->buckets = calloc(s->nbuckets, sizeof(*s->buckets));
+    if (s->nodes == NULL || s->buckets == NULL) {
+      fprintf(stderr, "Server: Unable to allocate a %zu entry cache\n",
+              capacity);
+      exit(EXIT_FAILURE);
+    }
+    for (size_t n = 0; n < per_shard; n++) {
+      s->nodes[n].chain = s->free;
+      s->free = &s->nodes[n];
+    }
+  }
+  enabled = true;
+}
+
+static struct cache_shard *shard_of(uint32_t h) {
+  return &shards[h % CACHE_SHARDS];
+}
+
+static struct cache_node **bucket_of(struct cache_shard *s, uint32_t h) {
+  return &s->buckets[(h / CACHE_SHARDS) & (s->nbuckets - 1)];
+}
+
+// Find the chain link pointing at a title's node, or the end of its chain
+static struct cache_node **find(struct cache_shard *s, uint32_t h,
+                                const char *title, size_t len) {
+  struct cache_node **pp = bucket_of(s, h);
+
+  while (*pp && ((*pp)->len != len || memcmp((*pp)->e.title, title, len)))
+    pp = &(*pp)->chain;
+  return pp;
+}
+
+static void unlink_node(struct cache_shard *s, struct cache_node *n) {
+  if (n->prev)
+    n->prev->next = n->next;
+  else
+    s->head = n->next;
+  if (n->next)
+    n->next->prev = n->prev;
+  else
+    s->tail = n->prev;
+}
+
+static void push_front(struct cache_shard *s, struct cache_node *n) {
+  n->prev = NULL;
+  n->next = s->head;
+  if (s->head)
+    s->head->prev = n;
+  else
+    s->tail = n;
+  s->head = n;
+}
+
+// Take a node out of its hash chain and recency list and free its slot
+static void drop(struct cache_shard *s, struct cache_node **pp) {
+  struct cache_node *n = *pp;
+
+  *pp = n->chain;
+  unlink_node(s, n);
+  n->chain = s->free;
+  s->free = n;
+  s->count--;
+}
+
+// Copy out a cached entry. Returns false on a miss.
+bool cache_get(const char *title, size_t len, struct entry *e) {
+  uint32_t h = hash_title(title, len);
+  struct cache_shard *s = shard_of(h);
+  struct cache_node *n;
+
+  if (!enabled)
+    return false;
+  pthread_mutex_lock(&s->lock);
+  if ((n = *find(s, h, title, len)) == NULL) {
+    s->misses++;
+    pthread_mutex_unlock(&s->lock);
+    return false;
+  }
+  s->hits++;
+  if (s->head != n) {
+    unlink_node(s, n);
+    push_front(s, n);
+  }
+  memcpy(e, &n->e, sizeof(*e));
+  pthread_mutex_unlock(&s->lock);
+  return true;
+}
+
+// Cache an entry just read from the database, evicting the least recently
+// used one if the shard is full
+void cache_put(const char *title, size_t len, const struct entry *e) {
+  uint32_t h = hash_title(title, len);
+  struct cache_shard *s = shard_of(h);
+  struct cache_node **pp, *n;
+
+  if (!enabled || len >= TITLE_LENGTH)
+    return;
+  pthread_mutex_lock(&s->lock);
+  if (*(pp = find(s, h, title, len)) != NULL)
+    drop(s, pp);
+  if (s->free == NULL) {
+    drop(s, find(s, hash_title(s->tail->e.title, s->tail->len),
+                 s->tail->e.title, s->tail->len));
+    s->evictions++;
+  }
+  n = s->free;
+  s->free = n->chain;
+  memcpy(&n->e, e, sizeof(n->e));
+  memcpy(n->e.title, title, len);
+  n->e.title[len] = '\0';
+  n->len = len;
+  n->chain = *bucket_of(s, h);
+  *bucket_of(s, h) = n;
+  push_front(s, n);
+  s->count++;
+  pthread_mutex_unlock(&s->lock);
+}
+
+void cache_invalidate(const char *title, size_t len) {
+  uint32_t h = hash_title(title, len);
+  struct cache_shard *s = shard_of(h);
+  struct cache_node **pp;
+
+  if (!enabled)
+    return;
+  pthread_mutex_lock(&s->lock);
+  if (*(pp = find(s, h, title, len)) != NULL)
+    drop(s, pp);
+  pthread_mutex_unlock(&s->lock);
+}
+
+void cache_get_stats(struct cache_stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (!enabled)
+    return;
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    pthread_mutex_lock(&shards[i].lock);
+    stats->hits += shards[i].hits;
+    stats->misses += shards[i].misses;
+    stats->evictions += shards[i].evictions;
+    stats->entries += shards[i].count;
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+}
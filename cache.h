@@ -0,0 +1,43 @@
+/******************************************************************************
+
+PROGRAM:  cache.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: A bounded cache of decoded watchlist entries, keyed by title, in
+          front of the storage engine.  The cache is split into shards, each
+          with its own lock and least-recently-used list, so worker threads
+          looking up different titles rarely wait for each other.
+
+          The cache never holds anything the database does not: entries are
+          added only by readers holding watchlist_db's lock, and every
+          create, update and remove drops the titles it touches while
+          holding the write lock.
+
+******************************************************************************/
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "protocol.h"
+
+#define DEFAULT_CACHE_ENTRIES 10000
+
+// Running totals since startup
+struct cache_stats {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long entries; // currently cached
+};
+
+void cache_init(size_t capacity);
+
+bool cache_get(const char *title, size_t len, struct entry *e);
+void cache_put(const char *title, size_t len, const struct entry *e);
+void cache_invalidate(const char *title, size_t len);
+
+void cache_get_stats(struct cache_stats *stats);
+
+#endif
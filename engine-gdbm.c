@@ -0,0 +1,146 @@
+/******************************************************************************
+
+PROGRAM:  engine-gdbm.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: The GDBM storage engine, see engine.h.  Each database is one GDBM
+          file opened for reading and writing.  GDBM keeps a bucket cache
+          inside the handle that even a fetch updates, so two readers
+          holding the storage layer's shared lock still take turns on the
+          handle itself for the length of one call.
+
+******************************************************************************/
+#include "engine.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct gdbm_db {
+  GDBM_FILE dbf;
+  pthread_mutex_t lock; // a GDBM handle is not safe for two callers
+};
+
+// Open the database for read/write, create if it doesn't already exist
+static void *gdbm_db_open(const char *path) {
+  struct gdbm_db *db = calloc(1, sizeof(*db));
+
+  if (db == NULL) {
+    fprintf(stderr, "Server: Out of memory opening %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  db->dbf = gdbm_open(path, 0, GDBM_WRCREAT, 0776, 0);
+  if (!db->dbf) {
+    fprintf(stderr, "Could not open database file %s: %s: %s\n", path,
+            gdbm_strerror(gdbm_errno), strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&db->lock, NULL);
+  return db;
+}
+
+static void gdbm_db_close(void *handle) {
+  struct gdbm_db *db = handle;
+
+  gdbm_close(db->dbf);
+  pthread_mutex_destroy(&db->lock);
+  free(db);
+}
+
+static int gdbm_db_sync(void *handle) {
+  struct gdbm_db *db = handle;
+  int ret;
+
+  pthread_mutex_lock(&db->lock);
+  ret = gdbm_sync(db->dbf);
+  pthread_mutex_unlock(&db->lock);
+  return ret;
+}
+
+static int gdbm_db_reorganize(void *handle) {
+  struct gdbm_db *db = handle;
+  int ret;
+
+  pthread_mutex_lock(&db->lock);
+  ret = gdbm_reorganize(db->dbf);
+  pthread_mutex_unlock(&db->lock);
+  return ret;
+}
+
+static datum gdbm_db_fetch(void *handle, datum key) {
+  struct gdbm_db *db = handle;
+  datum value;
+
+  pthread_mutex_lock(&db->lock);
+  value = gdbm_fetch(db->dbf, key);
+  pthread_mutex_unlock(&db->lock);
+  return value;
+}
+
+static int gdbm_db_exists(void *handle, datum key) {
+  struct gdbm_db *db = handle;
+  int found;
+
+  pthread_mutex_lock(&db->lock);
+  found = gdbm_exists(db->dbf, key);
+  pthread_mutex_unlock(&db->lock);
+  return found;
+}
+
+static int gdbm_db_store(void *handle, datum key, datum value, int flag) {
+  struct gdbm_db *db = handle;
+  int ret;
+
+  pthread_mutex_lock(&db->lock);
+  ret = gdbm_store(db->dbf, key, value,
+                   flag == STORAGE_INSERT ? GDBM_INSERT : GDBM_REPLACE);
+  pthread_mutex_unlock(&db->lock);
+  return ret;
+}
+
+static int gdbm_db_delete(void *handle, datum key) {
+  struct gdbm_db *db = handle;
+  int ret;
+
+  pthread_mutex_lock(&db->lock);
+  ret = gdbm_delete(db->dbf, key);
+  pthread_mutex_unlock(&db->lock);
+  return ret;
+}
+
+static datum gdbm_db_firstkey(void *handle) {
+  struct gdbm_db *db = handle;
+  datum key;
+
+  pthread_mutex_lock(&db->lock);
+  key = gdbm_firstkey(db->dbf);
+  pthread_mutex_unlock(&db->lock);
+  return key;
+}
+
+static datum gdbm_db_nextkey(void *handle, datum key) {
+  struct gdbm_db *db = handle;
+  datum next;
+
+  pthread_mutex_lock(&db->lock);
+  next = gdbm_nextkey(db->dbf, key);
+  pthread_mutex_unlock(&db->lock);
+  return next;
+}
+
+const struct storage_engine gdbm_engine = {
+    .name = "gdbm",
+    .extension = ".db",
+    .open = gdbm_db_open,
+    .close = gdbm_db_close,
+    .sync = gdbm_db_sync,
+    .reorganize = gdbm_db_reorganize,
+    .fetch = gdbm_db_fetch,
+    .exists = gdbm_db_exists,
+    .store = gdbm_db_store,
+    .delete = gdbm_db_delete,
+    .firstkey = gdbm_db_firstkey,
+    .nextkey = gdbm_db_nextkey,
+};
@@ -0,0 +1,612 @@
+/******************************************************************************
+
+PROGRAM:  engine-log.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: The log-structured storage engine, see engine.h.  The file is an
+          append-only sequence of records
+
+            u32 check    FNV-1a of the rest of the record
+            u32 key      length of the key, DELETED_BIT for a deletion
+            u32 value    length of the value
+            ... key
+            ... value
+
+          all integers big-endian.  A store appends a record and a delete
+          appends one with DELETED_BIT and no value; nothing in the file is
+          ever changed in place.  An open-addressing hash table in memory
+          maps every live key to its latest record, which is read straight
+          out of a shared mapping of the file, so a fetch costs one probe
+          and one copy and never a read() or a GDBM bucket search.
+
+          Overwritten and deleted records are dead weight.  Once they make
+          up more of the file than live ones do, a background thread copies
+          the live records into a new file and swaps it in.  The copy runs
+          without blocking anybody; only the records appended while it ran
+          are copied with writers shut out, just before the swap.
+
+          Opening the file replays it to rebuild the hash table.  A record
+          cut short by a crash fails its check, and the file is cut off
+          there.
+
+******************************************************************************/
+#include "engine.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define RECORD_HEADER 12
+#define DELETED_BIT 0x80000000u
+#define MAP_MIN (1024 * 1024)
+#define COMPACT_MIN (1024 * 1024) // dead bytes tolerated however few live
+#define COPY_BUFFER (1024 * 1024)
+
+// One key of the hash table
+struct slot {
+  uint64_t off;  // file offset of the key's latest record + 1, 0 if free
+  uint32_t hash;
+  uint32_t size; // of the whole record
+};
+
+struct log_db {
+  char *path;
+  pthread_rwlock_t lock; // everything below; shared for lookups
+  int fd;
+  unsigned char *map;
+  size_t map_len;   // of the mapping, at least 'end'
+  uint64_t end;     // where the next record goes
+  uint64_t live;    // bytes of records the table points at
+  struct slot *slots;
+  size_t nslots;    // a power of two
+  size_t count;
+
+  pthread_t compactor;
+  pthread_mutex_t compacting;   // held for the length of one compaction
+  pthread_mutex_t compact_lock; // the two fields below
+  pthread_cond_t compact_wanted;
+  bool wanted, stopping;
+};
+
+// FNV-1a, continuing from 'h'
+static uint32_t fnv(uint32_t h, const void *data, size_t len) {
+  const unsigned char *p = data;
+
+  while (len--)
+    h = (h ^ *p++) * 16777619u;
+  return h;
+}
+
+static uint32_t hash_key(datum key) {
+  return fnv(2166136261u, key.dptr, key.dsize);
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+void (*engine_reporter)(const char *message);
+
+// Format a report and hand it to engine_reporter, see engine.h
+void engine_report(const char *format, ...) {
+  char message[512];
+  va_list ap;
+
+  va_start(ap, format);
+  vsnprintf(message, sizeof(message), format, ap);
+  va_end(ap);
+  if (engine_reporter != NULL)
+    engine_reporter(message);
+  else
+    fprintf(stderr, "%s\n", message);
+}
+
+static void fail(const char *what, const char *path) {
+  fprintf(stderr, "Server: Unable to %s %s: %s\n", what, path,
+          strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+static void *allocate(size_t size) {
+  void *p = calloc(1, size);
+
+  if (p == NULL) {
+    fprintf(stderr, "Server: Out of memory in the log storage engine\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+// Map at least the first 'end' bytes of the file, leaving room to grow
+static void map_file(struct log_db *db) {
+  size_t len = db->map_len ? db->map_len : MAP_MIN;
+
+  while (len < db->end)
+    len *= 2;
+  if (db->map != NULL && len == db->map_len)
+    return;
+  if (db->map != NULL)
+    munmap(db->map, db->map_len);
+  db->map = mmap(NULL, len, PROT_READ, MAP_SHARED, db->fd, 0);
+  if (db->map == MAP_FAILED)
+    fail("map", db->path);
+  db->map_len = len;
+}
+
+static const unsigned char *record_key(const struct log_db *db,
+                                       const struct slot *s) {
+  return db->map + s->off - 1 + RECORD_HEADER;
+}
+
+static uint32_t record_key_len(const struct log_db *db, const struct slot *s) {
+  return get_u32(db->map + s->off - 1 + 4) & ~DELETED_BIT;
+}
+
+// The slot holding a key, or the free slot where it would go
+static struct slot *find(const struct log_db *db, datum key, uint32_t h) {
+  size_t mask = db->nslots - 1;
+  struct slot *s;
+
+  for (size_t i = h & mask;; i = (i + 1) & mask) {
+    s = &db->slots[i];
+    if (s->off == 0 || (s->hash == h && record_key_len(db, s) == key.dsize &&
+                        memcmp(record_key(db, s), key.dptr, key.dsize) == 0))
+      return s;
+  }
+}
+
+// Double the table once it is 70% full
+static void grow_table(struct log_db *db) {
+  struct slot *old = db->slots;
+  size_t n = db->nslots, mask;
+
+  if (db->nslots && db->count * 10 < db->nslots * 7)
+    return;
+  db->nslots = n ? n * 2 : 1024;
+  db->slots = allocate(db->nslots * sizeof(*db->slots));
+  mask = db->nslots - 1;
+  for (size_t i = 0; i < n; i++) {
+    if (old[i].off == 0)
+      continue;
+    size_t j = old[i].hash & mask;
+    while (db->slots[j].off != 0)
+      j = (j + 1) & mask;
+    db->slots[j] = old[i];
+  }
+  free(old);
+}
+
+// Empty a slot, moving later entries of its probe run back into the gap
+static void remove_slot(struct log_db *db, struct slot *s) {
+  size_t mask = db->nslots - 1, i = s - db->slots, j = i, home;
+
+  for (;;) {
+    j = (j + 1) & mask;
+    if (db->slots[j].off == 0)
+      break;
+    home = db->slots[j].hash & mask;
+    // Move j into the gap at i unless its home lies cyclically in (i, j]
+    if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+      db->slots[i] = db->slots[j];
+      i = j;
+    }
+  }
+  db->slots[i].off = 0;
+  db->count--;
+}
+
+// Point the table at a record just read or written at 'off'
+static void index_record(struct log_db *db, uint64_t off, uint32_t size,
+                         datum key, bool deleted) {
+  uint32_t h = hash_key(key);
+  struct slot *s;
+
+  grow_table(db);
+  s = find(db, key, h);
+  if (s->off != 0) {
+    db->live -= s->size;
+    if (deleted) {
+      remove_slot(db, s);
+      return;
+    }
+  } else if (deleted)
+    return;
+  else
+    db->count++;
+  s->off = off + 1;
+  s->hash = h;
+  s->size = size;
+  db->live += size;
+}
+
+/******************************************************************************
+
+  Read the file from the start, indexing every intact record.  Returns the
+  offset just past the last one.
+
+ ******************************************************************************/
+static uint64_t replay(struct log_db *db, uint64_t size) {
+  uint64_t off = 0;
+  uint32_t key_len, value_len;
+  const unsigned char *p;
+  datum key;
+
+  while (off + RECORD_HEADER <= size) {
+    p = db->map + off;
+    key_len = get_u32(p + 4) & ~DELETED_BIT;
+    value_len = get_u32(p + 8);
+    if (key_len > size || value_len > size ||
+        off + RECORD_HEADER + key_len + value_len > size ||
+        get_u32(p) != fnv(2166136261u, p + 4,
+                          RECORD_HEADER - 4 + key_len + value_len))
+      break;
+    key.dptr = (char *)p + RECORD_HEADER;
+    key.dsize = key_len;
+    index_record(db, off, RECORD_HEADER + key_len + value_len, key,
+                 get_u32(p + 4) & DELETED_BIT);
+    off += RECORD_HEADER + key_len + value_len;
+  }
+  return off;
+}
+
+// Append a record; the caller holds the write lock
+static void append(struct log_db *db, datum key, datum value, bool deleted) {
+  unsigned char header[RECORD_HEADER];
+  struct iovec iov[3];
+  size_t size = RECORD_HEADER + key.dsize + value.dsize;
+  ssize_t n;
+
+  put_u32(header + 4, key.dsize | (deleted ? DELETED_BIT : 0));
+  put_u32(header + 8, value.dsize);
+  put_u32(header, fnv(fnv(fnv(2166136261u, header + 4, 8), key.dptr,
+                          key.dsize),
+                      value.dptr, value.dsize));
+  iov[0] = (struct iovec){header, RECORD_HEADER};
+  iov[1] = (struct iovec){key.dptr, key.dsize};
+  iov[2] = (struct iovec){value.dptr, value.dsize};
+  if ((n = pwritev(db->fd, iov, 3, db->end)) != (ssize_t)size) {
+    // A short write leaves a torn record; replay stops in front of it
+    if (n >= 0)
+      errno = ENOSPC;
+    fail("append to", db->path);
+  }
+  db->end += size;
+  map_file(db);
+  index_record(db, db->end - size, size, key, deleted);
+}
+
+// Called with the lock held after every change
+static void wake_compactor(struct log_db *db) {
+  uint64_t dead = db->end - db->live;
+
+  if (dead < COMPACT_MIN || dead <= db->live)
+    return;
+  pthread_mutex_lock(&db->compact_lock);
+  db->wanted = true;
+  pthread_cond_signal(&db->compact_wanted);
+  pthread_mutex_unlock(&db->compact_lock);
+}
+
+// Copy 'len' bytes at 'from' in the current file to the end of 'out'
+static void copy_out(struct log_db *db, int out, uint64_t from, uint64_t len,
+                     unsigned char *buf) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = pread(db->fd, buf, len < COPY_BUFFER ? len : COPY_BUFFER, from);
+    if (n <= 0 || write(out, buf, n) != n)
+      fail("compact", db->path);
+    from += n;
+    len -= n;
+  }
+}
+
+// Where compaction moves one live record
+struct moved {
+  uint64_t from, to;
+  uint32_t size;
+};
+
+static int by_origin(const void *a, const void *b) {
+  const struct moved *x = a, *y = b;
+
+  return x->from < y->from ? -1 : x->from > y->from;
+}
+
+/******************************************************************************
+
+  Rewrite the file with only its live records.  The records the table
+  points at are listed and written to a new file while other threads carry
+  on; then, with the write lock held, the records appended meanwhile are
+  copied too, the table is pointed at the new offsets and the new file
+  replaces the old one.
+
+ ******************************************************************************/
+static void compact(struct log_db *db) {
+  unsigned char *buf = allocate(COPY_BUFFER);
+  struct moved *list, key, *hit;
+  struct slot *s;
+  char tmp[4096];
+  uint64_t base, before, pos = 0;
+  size_t n = 0;
+  int out;
+
+  pthread_mutex_lock(&db->compacting);
+  snprintf(tmp, sizeof(tmp), "%s.compact", db->path);
+  out = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (out < 0)
+    fail("create", tmp);
+
+  pthread_rwlock_rdlock(&db->lock);
+  list = allocate((db->count + 1) * sizeof(*list));
+  for (size_t i = 0; i < db->nslots; i++)
+    if (db->slots[i].off != 0) {
+      list[n].from = db->slots[i].off - 1;
+      list[n++].size = db->slots[i].size;
+    }
+  base = db->end;
+  pthread_rwlock_unlock(&db->lock);
+
+  // Records in front of 'base' never change, so they are copied unlocked,
+  // in file order
+  qsort(list, n, sizeof(*list), by_origin);
+  for (size_t i = 0; i < n; i++) {
+    copy_out(db, out, list[i].from, list[i].size, buf);
+    list[i].to = pos;
+    pos += list[i].size;
+  }
+
+  pthread_rwlock_wrlock(&db->lock);
+  before = db->end;
+  copy_out(db, out, base, before - base, buf);
+  free(buf);
+  if (fdatasync(out) < 0 || rename(tmp, db->path) < 0)
+    fail("compact", db->path);
+
+  // A key still pointing in front of 'base' was live when the list was made
+  for (size_t i = 0; i < db->nslots; i++) {
+    s = &db->slots[i];
+    if (s->off == 0)
+      continue;
+    if (s->off - 1 >= base)
+      s->off = s->off - 1 - base + pos + 1;
+    else {
+      key.from = s->off - 1;
+      hit = bsearch(&key, list, n, sizeof(*list), by_origin);
+      s->off = hit->to + 1;
+    }
+  }
+  free(list);
+
+  close(db->fd);
+  db->fd = out;
+  db->end = pos + (before - base);
+  munmap(db->map, db->map_len);
+  db->map = NULL;
+  db->map_len = 0;
+  map_file(db);
+  engine_report("Server: Compacted %s from %llu to %llu bytes", db->path,
+                (unsigned long long)before, (unsigned long long)db->end);
+  pthread_rwlock_unlock(&db->lock);
+  pthread_mutex_unlock(&db->compacting);
+}
+
+static void *compactor_main(void *arg) {
+  struct log_db *db = arg;
+
+  for (;;) {
+    pthread_mutex_lock(&db->compact_lock);
+    while (!db->wanted && !db->stopping)
+      pthread_cond_wait(&db->compact_wanted, &db->compact_lock);
+    db->wanted = false;
+    if (db->stopping) {
+      pthread_mutex_unlock(&db->compact_lock);
+      return NULL;
+    }
+    pthread_mutex_unlock(&db->compact_lock);
+    compact(db);
+  }
+}
+
+static void *log_db_open(const char *path) {
+  struct log_db *db = allocate(sizeof(*db));
+  struct stat st;
+  uint64_t valid;
+
+  db->path = strdup(path);
+  db->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (db->path == NULL || db->fd < 0 || fstat(db->fd, &st) < 0)
+    fail("open", path);
+  pthread_rwlock_init(&db->lock, NULL);
+  pthread_mutex_init(&db->compacting, NULL);
+  pthread_mutex_init(&db->compact_lock, NULL);
+  pthread_cond_init(&db->compact_wanted, NULL);
+
+  db->end = st.st_size;
+  map_file(db);
+  grow_table(db);
+  valid = replay(db, st.st_size);
+  if (valid < (uint64_t)st.st_size) {
+    fprintf(stderr, "Server: Discarding %llu damaged bytes at the end of %s\n",
+            (unsigned long long)(st.st_size - valid), path);
+    if (ftruncate(db->fd, valid) < 0)
+      fail("truncate", path);
+  }
+  db->end = valid;
+
+  if (pthread_create(&db->compactor, NULL, compactor_main, db) != 0) {
+    fprintf(stderr, "Server: Unable to start compaction of %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  wake_compactor(db);
+  return db;
+}
+
+static void log_db_close(void *handle) {
+  struct log_db *db = handle;
+
+  pthread_mutex_lock(&db->compact_lock);
+  db->stopping = true;
+  pthread_cond_signal(&db->compact_wanted);
+  pthread_mutex_unlock(&db->compact_lock);
+  pthread_join(db->compactor, NULL);
+
+  fdatasync(db->fd);
+  close(db->fd);
+  munmap(db->map, db->map_len);
+  free(db->slots);
+  free(db->path);
+  free(db);
+}
+
+static int log_db_sync(void *handle) {
+  struct log_db *db = handle;
+  int ret;
+
+  pthread_rwlock_rdlock(&db->lock);
+  ret = fdatasync(db->fd);
+  pthread_rwlock_unlock(&db->lock);
+  return ret;
+}
+
+// Compact now rather than waiting for the dead records to outweigh the
+// live ones, unless there are too few of them to be worth a copy
+static int log_db_reorganize(void *handle) {
+  struct log_db *db = handle;
+  bool dead;
+
+  pthread_rwlock_rdlock(&db->lock);
+  dead = db->end - db->live >= COMPACT_MIN;
+  pthread_rwlock_unlock(&db->lock);
+  if (dead)
+    compact(db);
+  return 0;
+}
+
+// A malloc'd copy of 'len' bytes, as GDBM hands out
+static datum copy_datum(const unsigned char *p, size_t len) {
+  datum d = {malloc(len ? len : 1), len};
+
+  if (d.dptr == NULL)
+    d.dsize = 0;
+  else
+    memcpy(d.dptr, p, len);
+  return d;
+}
+
+static datum log_db_fetch(void *handle, datum key) {
+  struct log_db *db = handle;
+  datum value = {NULL, 0};
+  struct slot *s;
+
+  pthread_rwlock_rdlock(&db->lock);
+  if ((s = find(db, key, hash_key(key)))->off != 0)
+    value = copy_datum(record_key(db, s) + key.dsize,
+                       s->size - RECORD_HEADER - key.dsize);
+  pthread_rwlock_unlock(&db->lock);
+  return value;
+}
+
+static int log_db_exists(void *handle, datum key) {
+  struct log_db *db = handle;
+  int found;
+
+  pthread_rwlock_rdlock(&db->lock);
+  found = find(db, key, hash_key(key))->off != 0;
+  pthread_rwlock_unlock(&db->lock);
+  return found;
+}
+
+static int log_db_store(void *handle, datum key, datum value, int flag) {
+  struct log_db *db = handle;
+
+  pthread_rwlock_wrlock(&db->lock);
+  if (flag == STORAGE_INSERT && find(db, key, hash_key(key))->off != 0) {
+    pthread_rwlock_unlock(&db->lock);
+    return 1;
+  }
+  append(db, key, value, false);
+  wake_compactor(db);
+  pthread_rwlock_unlock(&db->lock);
+  return 0;
+}
+
+static int log_db_delete(void *handle, datum key) {
+  struct log_db *db = handle;
+  datum none = {"", 0};
+
+  pthread_rwlock_wrlock(&db->lock);
+  if (find(db, key, hash_key(key))->off == 0) {
+    pthread_rwlock_unlock(&db->lock);
+    return -1;
+  }
+  append(db, key, none, true);
+  wake_compactor(db);
+  pthread_rwlock_unlock(&db->lock);
+  return 0;
+}
+
+// The key in the first used slot from 'i' on, or a NULL datum at the end
+static datum key_from(struct log_db *db, size_t i) {
+  for (; i < db->nslots; i++)
+    if (db->slots[i].off != 0)
+      return copy_datum(record_key(db, &db->slots[i]),
+                        record_key_len(db, &db->slots[i]));
+  return (datum){NULL, 0};
+}
+
+// Keys come in hash table order, which changes when the table grows or a
+// key is deleted, much as GDBM's changes when a bucket splits
+static datum log_db_firstkey(void *handle) {
+  struct log_db *db = handle;
+  datum key;
+
+  pthread_rwlock_rdlock(&db->lock);
+  key = key_from(db, 0);
+  pthread_rwlock_unlock(&db->lock);
+  return key;
+}
+
+static datum log_db_nextkey(void *handle, datum key) {
+  struct log_db *db = handle;
+  datum next = {NULL, 0};
+  struct slot *s;
+
+  pthread_rwlock_rdlock(&db->lock);
+  if ((s = find(db, key, hash_key(key)))->off != 0)
+    next = key_from(db, s - db->slots + 1);
+  pthread_rwlock_unlock(&db->lock);
+  return next;
+}
+
+const struct storage_engine log_engine = {
+    .name = "log",
+    .extension = ".dat",
+    .open = log_db_open,
+    .close = log_db_close,
+    .sync = log_db_sync,
+    .reorganize = log_db_reorganize,
+    .fetch = log_db_fetch,
+    .exists = log_db_exists,
+    .store = log_db_store,
+    .delete = log_db_delete,
+    .firstkey = log_db_firstkey,
+    .nextkey = log_db_nextkey,
+};
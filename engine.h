@@ -0,0 +1,68 @@
+/******************************************************************************
+
+PROGRAM:  engine.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: The interface a storage engine offers the storage layer of
+          storage.h.  A database is opened with one engine for the life of
+          the server and every get, put, delete and walk over its keys goes
+          through the engine's table of operations, so the engines can be
+          swapped with a command line option and compared on the same
+          workload.
+
+          Two engines are built in:
+
+            gdbm  the GDBM files the server has always used, NAME.db
+            log   an append-only file, NAME.dat, read through mmap(), with
+                  a hash index of its keys in memory and a background
+                  thread that compacts away overwritten records
+
+          Keys and values are passed as GDBM's datum, which all the callers
+          already use.  What fetch, firstkey and nextkey return is malloc'd
+          and must be freed by the caller.  The storage layer's locking
+          rules (storage.h) apply: an engine may assume no other call runs
+          while a store or delete does, but must allow concurrent fetches
+          and walks.
+
+          What the engines and the storage layer have to say while the
+          server runs, such as a compaction finishing, goes through
+          engine_report(): to standard error by default, or wherever the
+          program points engine_reporter, which for the server is its log.
+
+******************************************************************************/
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <gdbm.h>
+
+// Flags of store()
+#define STORAGE_INSERT 0  // fail with 1 if the key exists
+#define STORAGE_REPLACE 1 // add the key or overwrite its value
+
+struct storage_engine {
+  const char *name;
+  const char *extension; // appended to the database's name for its file
+
+  void *(*open)(const char *path); // exits if the file cannot be opened
+  void (*close)(void *handle);
+  int (*sync)(void *handle);       // everything stored is on disk
+  int (*reorganize)(void *handle); // give back the space of dead records
+
+  datum (*fetch)(void *handle, datum key);
+  int (*exists)(void *handle, datum key);
+  int (*store)(void *handle, datum key, datum value, int flag);
+  int (*delete)(void *handle, datum key); // 0 if deleted, -1 if not there
+  datum (*firstkey)(void *handle);
+  datum (*nextkey)(void *handle, datum key);
+};
+
+extern const struct storage_engine gdbm_engine;
+extern const struct storage_engine log_engine;
+
+// Takes one line of report, without a newline; NULL for standard error
+extern void (*engine_reporter)(const char *message);
+
+void engine_report(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,604 @@
+/******************************************************************************
+
+PROGRAM:  index.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Secondary indexes on type, status and rating, see index.h.
+
+          Every indexed entry is one item, found by title through a hash
+          table.  For each field, the items sharing a value are chained in
+          a doubly linked posting list, so moving an item to another list
+          when its entry changes costs a few pointer updates.  A filtered
+          listing walks the shortest posting list among the fields it
+          filters on and checks the other fields on the item itself; its
+          later pages are told which list that was.  Sorted listings pick
+          their entries through a bounded heap.
+
+******************************************************************************/
+#include "index.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "record.h"
+#include "search.h"
+#include "storage.h"
+
+#define REBUILD_CHUNK 1000 // entries indexed per hold of the database lock
+
+struct posting;
+
+// One indexed entry
+struct index_item {
+  struct index_item *next; // title hash chain
+  struct posting *list[INDEX_FIELDS];
+  struct index_item *prev_in[INDEX_FIELDS], *next_in[INDEX_FIELDS];
+  int value[INDEX_FIELDS];
+  int64_t added; // sort key of WL_ORDER_RECENT
+  size_t len;
+  char title[];
+};
+
+// All items with one value of one field, in the order they were indexed
+struct posting {
+  struct posting *next; // posting hash chain
+  int field;
+  int value;
+  size_t count;
+  struct index_item *head, *tail;
+};
+
+// A chained hash table that doubles when it gets as full as it is wide
+struct table {
+  void **buckets;
+  size_t size;
+  size_t count;
+};
+
+static struct table items;
+static struct table postings;
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+static bool ready;
+
+// FNV-1a
+static uint32_t hash_bytes(const void *data, size_t len, uint32_t h) {
+  const unsigned char *p = data;
+
+  while (len--)
+    h = (h ^ *p++) * 16777619u;
+  return h;
+}
+
+static uint32_t hash_title(const char *title, size_t len) {
+  return hash_bytes(title, len, 2166136261u);
+}
+
+static uint32_t hash_value(int field, int value) {
+  return hash_bytes(&value, sizeof(value),
+                    hash_bytes(&field, sizeof(field), 2166136261u));
+}
+
+static void *alloc(size_t size) {
+  void *p = calloc(1, size);
+
+  if (p == NULL) {
+    fprintf(stderr, "Server: Out of memory building the index\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/******************************************************************************
+
+  Make room for one more node.  The chain link is the first member of both
+  node types, so rehashing only needs to know how to hash them.
+
+ ******************************************************************************/
+static void table_grow(struct table *t, uint32_t (*hash)(void *)) {
+  size_t size = t->size ? t->size * 2 : 1024;
+  void **buckets;
+
+  if (t->count < t->size)
+    return;
+  buckets = alloc(size * sizeof(*buckets));
+  for (size_t i = 0; i < t->size; i++) {
+    void *node = t->buckets[i], *next;
+    for (; node; node = next) {
+      next = *(void **)node;
+      *(void **)node = buckets[hash(node) & (size - 1)];
+      buckets[hash(node) & (size - 1)] = node;
+    }
+  }
+  free(t->buckets);
+  t->buckets = buckets;
+  t->size = size;
+}
+
+static uint32_t item_hash(void *node) {
+  struct index_item *item = node;
+  return hash_title(item->title, item->len);
+}
+
+static uint32_t posting_hash(void *node) {
+  struct posting *p = node;
+  return hash_value(p->field, p->value);
+}
+
+static struct index_item **find_item(const char *title, size_t len) {
+  struct index_item **pp;
+
+  if (items.size == 0)
+    return NULL;
+  pp = (struct index_item **)&items.buckets[hash_title(title, len) &
+                                            (items.size - 1)];
+  for (; *pp; pp = &(*pp)->next)
+    if ((*pp)->len == len && memcmp((*pp)->title, title, len) == 0)
+      return pp;
+  return NULL;
+}
+
+static struct posting **find_posting(int field, int value) {
+  struct posting **pp;
+
+  if (postings.size == 0)
+    return NULL;
+  pp = (struct posting **)&postings.buckets[hash_value(field, value) &
+                                            (postings.size - 1)];
+  for (; *pp; pp = &(*pp)->next)
+    if ((*pp)->field == field && (*pp)->value == value)
+      return pp;
+  return NULL;
+}
+
+// Append an item to the posting list for its value of 'field'
+static void link_item(struct index_item *item, int field) {
+  struct posting **pp = find_posting(field, item->value[field]);
+  struct posting *p;
+
+  if (pp)
+    p = *pp;
+  else {
+    table_grow(&postings, posting_hash);
+    p = alloc(sizeof(*p));
+    p->field = field;
+    p->value = item->value[field];
+    pp = (struct posting **)&postings.buckets[hash_value(field, p->value) &
+                                              (postings.size - 1)];
+    p->next = *pp;
+    *pp = p;
+    postings.count++;
+  }
+  item->list[field] = p;
+  item->prev_in[field] = p->tail;
+  item->next_in[field] = NULL;
+  if (p->tail)
+    p->tail->next_in[field] = item;
+  else
+    p->head = item;
+  p->tail = item;
+  p->count++;
+}
+
+// Take an item out of its posting list for 'field', dropping emptied lists
+static void unlink_item(struct index_item *item, int field) {
+  struct posting *p = item->list[field];
+  struct posting **pp;
+
+  if (item->prev_in[field])
+    item->prev_in[field]->next_in[field] = item->next_in[field];
+  else
+    p->head = item->next_in[field];
+  if (item->next_in[field])
+    item->next_in[field]->prev_in[field] = item->prev_in[field];
+  else
+    p->tail = item->prev_in[field];
+
+  if (--p->count == 0) {
+    pp = find_posting(field, p->value);
+    *pp = p->next;
+    postings.count--;
+    free(p);
+  }
+}
+
+static void entry_values(const struct entry *e, int *value) {
+  value[INDEX_TYPE] = e->type;
+  value[INDEX_STATUS] = e->status;
+  value[INDEX_RATING] = e->rating;
+}
+
+// index_put() with index_lock already held for writing
+static void put_locked(const char *title, size_t len, const struct entry *e) {
+  struct index_item **pp = find_item(title, len), *item;
+  int value[INDEX_FIELDS];
+
+  entry_values(e, value);
+  if (pp) {
+    item = *pp;
+    item->added = e->added;
+    for (int f = 0; f < INDEX_FIELDS; f++)
+      if (item->value[f] != value[f]) {
+        unlink_item(item, f);
+        item->value[f] = value[f];
+        link_item(item, f);
+      }
+    return;
+  }
+
+  table_grow(&items, item_hash);
+  item = alloc(sizeof(*item) + len);
+  memcpy(item->title, title, len);
+  item->len = len;
+  item->added = e->added;
+  memcpy(item->value, value, sizeof(value));
+  pp = (struct index_item **)&items.buckets[hash_title(title, len) &
+                                            (items.size - 1)];
+  item->next = *pp;
+  *pp = item;
+  items.count++;
+  for (int f = 0; f < INDEX_FIELDS; f++)
+    link_item(item, f);
+}
+
+// Index a new entry, or move an existing one to its new values
+void index_put(const char *title, size_t len, const struct entry *e) {
+  pthread_rwlock_wrlock(&index_lock);
+  put_locked(title, len, e);
+  pthread_rwlock_unlock(&index_lock);
+}
+
+void index_remove(const char *title, size_t len) {
+  struct index_item **pp, *item;
+
+  pthread_rwlock_wrlock(&index_lock);
+  if ((pp = find_item(title, len)) != NULL) {
+    item = *pp;
+    *pp = item->next;
+    items.count--;
+    for (int f = 0; f < INDEX_FIELDS; f++)
+      unlink_item(item, f);
+    free(item);
+  }
+  pthread_rwlock_unlock(&index_lock);
+}
+
+bool index_ready(void) { return __atomic_load_n(&ready, __ATOMIC_ACQUIRE); }
+
+bool index_match(const struct index_filter *filter, const struct entry *e) {
+  int value[INDEX_FIELDS];
+
+  entry_values(e, value);
+  for (int f = 0; f < INDEX_FIELDS; f++)
+    if (filter->set[f] && filter->value[f] != value[f])
+      return false;
+  return true;
+}
+
+static bool item_matches(const struct index_filter *filter,
+                         const struct index_item *item) {
+  for (int f = 0; f < INDEX_FIELDS; f++)
+    if (filter->set[f] && filter->value[f] != item->value[f])
+      return false;
+  return true;
+}
+
+/******************************************************************************
+
+  Hand the title of every entry matching 'filter' to 'fn' until it returns
+  false, starting after the title 'after' if that is not NULL.  The filter
+  must set at least one field.  The walk follows one posting list, so it
+  costs time in proportion to that list rather than to the database.  A new
+  walk, with '*field' negative, takes the shortest list among the fields
+  set and stores its field in '*field'.  A resumed walk must be given the
+  same field again: each list keeps its items in its own order, and which
+  one is shortest may have changed since.  Returns -1 if 'after' is no
+  longer indexed or no longer matches, or if '*field' is not set in the
+  filter.
+
+ ******************************************************************************/
+int index_scan(const struct index_filter *filter, int *field,
+               const char *after, size_t after_len,
+               bool (*fn)(const char *title, size_t len, void *arg),
+               void *arg) {
+  struct posting *list = NULL, **pp;
+  struct index_item *item, **ip;
+
+  pthread_rwlock_rdlock(&index_lock);
+  if (*field < 0) {
+    for (int f = 0; f < INDEX_FIELDS; f++) {
+      if (!filter->set[f])
+        continue;
+      if ((pp = find_posting(f, filter->value[f])) == NULL) {
+        list = NULL; // nothing has that value
+        *field = f;
+        break;
+      }
+      if (list == NULL || (*pp)->count < list->count) {
+        list = *pp;
+        *field = f;
+      }
+    }
+  } else if (*field < INDEX_FIELDS && filter->set[*field]) {
+    pp = find_posting(*field, filter->value[*field]);
+    list = pp ? *pp : NULL;
+  } else {
+    pthread_rwlock_unlock(&index_lock);
+    return -1;
+  }
+
+  item = list ? list->head : NULL;
+  if (after) {
+    ip = find_item(after, after_len);
+    if (ip == NULL || !item_matches(filter, *ip)) {
+      pthread_rwlock_unlock(&index_lock);
+      return -1;
+    }
+    item = (*ip)->next_in[*field];
+  }
+  for (; item; item = item->next_in[*field])
+    if (item_matches(filter, item) && !fn(item->title, item->len, arg))
+      break;
+  pthread_rwlock_unlock(&index_lock);
+  return 0;
+}
+
+/******************************************************************************
+
+  Sorted listings.  The best 'limit' matching items are kept in a max-heap
+  with the worst of them on top, so each further candidate costs one
+  comparison unless it beats that one; memory stays at 'limit' pointers
+  however many entries there are.  When nothing else narrows the search, a
+  listing by rating takes the rating posting lists from the highest value
+  down and stops as soon as the heap is full at the end of one, since no
+  lower rating can get in.  "Top 20 by rating" thus only looks at the
+  entries with the best few ratings.
+
+ ******************************************************************************/
+
+// Titles in alphabetical order ignoring ASCII case, then byte order
+static int compare_titles(const struct index_item *a,
+                          const struct index_item *b) {
+  size_t len = a->len < b->len ? a->len : b->len;
+  int d;
+
+  for (size_t i = 0; i < len; i++)
+    if ((d = tolower((unsigned char)a->title[i]) -
+             tolower((unsigned char)b->title[i])) != 0)
+      return d;
+  if (a->len != b->len)
+    return a->len < b->len ? -1 : 1;
+  return memcmp(a->title, b->title, len);
+}
+
+// Negative if a is listed before b
+static int compare_items(enum wl_order order, const struct index_item *a,
+                         const struct index_item *b) {
+  if (order == WL_ORDER_RATING &&
+      a->value[INDEX_RATING] != b->value[INDEX_RATING])
+    return a->value[INDEX_RATING] > b->value[INDEX_RATING] ? -1 : 1;
+  if (order == WL_ORDER_RECENT && a->added != b->added)
+    return a->added > b->added ? -1 : 1;
+  return compare_titles(a, b);
+}
+
+struct top {
+  enum wl_order order;
+  const struct index_filter *filter;
+  const struct index_item *after; // only items listed after this one
+  struct index_item **heap;
+  size_t count;
+  size_t limit;
+};
+
+static void sift_down(struct top *t, size_t i) {
+  struct index_item *item = t->heap[i];
+  size_t child;
+
+  while ((child = 2 * i + 1) < t->count) {
+    if (child + 1 < t->count &&
+        compare_items(t->order, t->heap[child + 1], t->heap[child]) > 0)
+      child++;
+    if (compare_items(t->order, t->heap[child], item) <= 0)
+      break;
+    t->heap[i] = t->heap[child];
+    i = child;
+  }
+  t->heap[i] = item;
+}
+
+static void offer(struct top *t, struct index_item *item) {
+  size_t i, parent;
+
+  if (t->filter && !item_matches(t->filter, item))
+    return;
+  if (t->after && compare_items(t->order, item, t->after) <= 0)
+    return;
+  if (t->count == t->limit) {
+    if (compare_items(t->order, item, t->heap[0]) >= 0)
+      return;
+    t->heap[0] = item;
+    sift_down(t, 0);
+    return;
+  }
+  for (i = t->count++; i > 0; i = parent) {
+    parent = (i - 1) / 2;
+    if (compare_items(t->order, t->heap[parent], item) >= 0)
+      break;
+    t->heap[i] = t->heap[parent];
+  }
+  t->heap[i] = item;
+}
+
+static int compare_ints_down(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return x > y ? -1 : x < y;
+}
+
+// Offer the items from the rating posting lists, best rating first
+static void offer_by_rating(struct top *t) {
+  struct posting *p, **pp;
+  struct index_item *item;
+  int *values;
+  size_t n = 0;
+
+  values = alloc((postings.count + 1) * sizeof(*values));
+  for (size_t i = 0; i < postings.size; i++)
+    for (p = postings.buckets[i]; p; p = p->next)
+      if (p->field == INDEX_RATING &&
+          (t->after == NULL || p->value <= t->after->value[INDEX_RATING]))
+        values[n++] = p->value;
+  qsort(values, n, sizeof(*values), compare_ints_down);
+  for (size_t i = 0; i < n && t->count < t->limit; i++) {
+    pp = find_posting(INDEX_RATING, values[i]);
+    for (item = (*pp)->head; item; item = item->next_in[INDEX_RATING])
+      offer(t, item);
+  }
+  free(values);
+}
+
+/******************************************************************************
+
+  Hand the titles of the first 'limit' entries matching 'filter' (which may
+  be NULL) in the given order to 'fn', until it returns false.  With
+  'after' the listing starts behind that title, so it can be taken a page
+  at a time.  Returns -1 if 'after' is no longer indexed or no longer
+  matches.  Only valid once index_ready().
+
+ ******************************************************************************/
+int index_sorted(const struct index_filter *filter, enum wl_order order,
+                 const char *after, size_t after_len, size_t limit,
+                 bool (*fn)(const char *title, size_t len, void *arg),
+                 void *arg) {
+  struct top t = {order, NULL, NULL, NULL, 0, limit};
+  struct posting *shortest = NULL, **pp;
+  struct index_item *item, **ip;
+  size_t found;
+  int field = -1;
+
+  if (limit == 0)
+    return 0;
+  t.heap = alloc(limit * sizeof(*t.heap));
+  pthread_rwlock_rdlock(&index_lock);
+  for (int f = 0; filter && f < INDEX_FIELDS; f++) {
+    if (!filter->set[f])
+      continue;
+    t.filter = filter;
+    if ((pp = find_posting(f, filter->value[f])) == NULL) {
+      shortest = NULL; // nothing has that value
+      break;
+    }
+    if (shortest == NULL || (*pp)->count < shortest->count) {
+      shortest = *pp;
+      field = f;
+    }
+  }
+  if (after) {
+    ip = find_item(after, after_len);
+    if (ip == NULL || (t.filter && !item_matches(t.filter, *ip))) {
+      pthread_rwlock_unlock(&index_lock);
+      free(t.heap);
+      return -1;
+    }
+    t.after = *ip;
+  }
+
+  if (shortest != NULL) {
+    for (item = shortest->head; item; item = item->next_in[field])
+      offer(&t, item);
+  } else if (t.filter == NULL && order == WL_ORDER_RATING) {
+    offer_by_rating(&t);
+  } else if (t.filter == NULL) {
+    for (size_t i = 0; i < items.size; i++)
+      for (item = items.buckets[i]; item; item = item->next)
+        offer(&t, item);
+  }
+
+  // Taking the worst off the top each time leaves the heap sorted best
+  // first
+  found = t.count;
+  for (size_t n = found; n > 1; n--) {
+    item = t.heap[0];
+    t.heap[0] = t.heap[n - 1];
+    t.heap[n - 1] = item;
+    t.count = n - 1;
+    sift_down(&t, 0);
+  }
+  for (size_t i = 0; i < found; i++)
+    if (!fn(t.heap[i]->title, t.heap[i]->len, arg))
+      break;
+  pthread_rwlock_unlock(&index_lock);
+  free(t.heap);
+  return 0;
+}
+
+/******************************************************************************
+
+  Index everything in watchlist.db.  The database lock is taken shared for
+  REBUILD_CHUNK entries at a time and dropped in between, so requests are
+  served while this runs.  Entries created, changed or removed meanwhile
+  are indexed by the requests themselves, and indexing one twice is
+  harmless.  If the key the next chunk starts at disappears in between, the
+  walk starts over from the first key.
+
+ ******************************************************************************/
+static void *rebuild_main(void *arg) {
+  datum key, value, next;
+  unsigned long total = 0;
+  struct entry e;
+  int n;
+
+  storage_rdlock(&watchlist_db);
+  key = storage_firstkey(&watchlist_db);
+  while (key.dptr) {
+    pthread_rwlock_wrlock(&index_lock);
+    for (n = 0; key.dptr && n < REBUILD_CHUNK; n++) {
+      value = storage_fetch(&watchlist_db, key);
+      if (value.dptr) {
+        record_decode(value.dptr, value.dsize, &e);
+        put_locked(key.dptr, key.dsize, &e);
+        search_put(key.dptr, key.dsize);
+        free(value.dptr);
+        total++;
+      }
+      next = storage_nextkey(&watchlist_db, key);
+      if (next.dptr == NULL)
+        break;
+      free(key.dptr);
+      key = next;
+    }
+    pthread_rwlock_unlock(&index_lock);
+    if (n < REBUILD_CHUNK)
+      break;
+
+    storage_unlock(&watchlist_db);
+    sched_yield();
+    storage_rdlock(&watchlist_db);
+    if (!storage_exists(&watchlist_db, key)) {
+      free(key.dptr);
+      key = storage_firstkey(&watchlist_db);
+    }
+  }
+  storage_unlock(&watchlist_db);
+  free(key.dptr);
+
+  __atomic_store_n(&ready, true, __ATOMIC_RELEASE);
+  LOG(LOGGER_INFO, "Server: Indexed %lu watchlist entries", total);
+  return NULL;
+}
+
+// Start rebuilding the indexes in the background
+void index_start(void) {
+  pthread_t thread;
+
+  if (pthread_create(&thread, NULL, rebuild_main, NULL) != 0) {
+    fprintf(stderr, "Server: Unable to start the index rebuild\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_detach(thread);
+}
@@ -0,0 +1,58 @@
+/******************************************************************************
+
+PROGRAM:  index.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: In-memory secondary indexes on the type, status and rating of the
+          entries in watchlist.db, so a filtered listing such as "everything
+          with status 2" visits only the matching entries instead of
+          scanning the whole database, and sorted listings such as "the 20
+          best rated" find their entries without reading the database or
+          sorting all of it.
+
+          The indexes live only in memory.  index_start() rebuilds them, and
+          the title search index of search.h, from watchlist.db on a
+          background thread a chunk at a time, so the server can serve while
+          the rebuild runs; until index_ready() says it has finished,
+          filtered listings have to scan.  Every change to watchlist.db is
+          mirrored with index_put() or index_remove() while the caller still
+          holds the database's write lock.
+
+          Lock order: watchlist_db's lock is always taken before the
+          index's own lock, and that before the search index's.
+
+******************************************************************************/
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "protocol.h"
+
+// The indexed fields of struct entry
+enum index_field { INDEX_TYPE, INDEX_STATUS, INDEX_RATING, INDEX_FIELDS };
+
+// Entries must have value[f] for every field f with set[f]
+struct index_filter {
+  bool set[INDEX_FIELDS];
+  int value[INDEX_FIELDS];
+};
+
+void index_start(void);
+bool index_ready(void);
+
+void index_put(const char *title, size_t len, const struct entry *e);
+void index_remove(const char *title, size_t len);
+
+bool index_match(const struct index_filter *filter, const struct entry *e);
+int index_scan(const struct index_filter *filter, int *field,
+               const char *after, size_t after_len,
+               bool (*fn)(const char *title, size_t len, void *arg),
+               void *arg);
+int index_sorted(const struct index_filter *filter, enum wl_order order,
+                 const char *after, size_t after_len, size_t limit,
+                 bool (*fn)(const char *title, size_t len, void *arg),
+                 void *arg);
+
+#endif
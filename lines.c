@@ -0,0 +1,233 @@
+/******************************************************************************
+
+PROGRAM:  lines.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Reading and writing JSONL and CSV lines, see lines.h.
+
+******************************************************************************/
+#include "lines.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/******************************************************************************
+
+  Decode the JSON string starting at the quote '*pp' points to, in place,
+  and move '*pp' past its closing quote.  Returns NULL if the string is
+  malformed.
+
+ ******************************************************************************/
+static char *json_string(char **pp) {
+  char *in = *pp + 1, *out = in, *start = in;
+  unsigned long code;
+  char hex[5] = {0};
+
+  while (*in != '"') {
+    if (*in == '\0')
+      return NULL;
+    if (*in != '\\') {
+      *out++ = *in++;
+      continue;
+    }
+    in++;
+    switch (*in++) {
+    case '"':
+    case '\\':
+    case '/':
+      *out++ = in[-1];
+      break;
+    case 'b':
+      *out++ = '\b';
+      break;
+    case 'f':
+      *out++ = '\f';
+      break;
+    case 'n':
+      *out++ = '\n';
+      break;
+    case 'r':
+      *out++ = '\r';
+      break;
+    case 't':
+      *out++ = '\t';
+      break;
+    case 'u':
+      // Six characters of escape become at most three bytes of UTF-8
+      memcpy(hex, in, 4);
+      if (strspn(hex, "0123456789abcdefABCDEF") != 4)
+        return NULL;
+      code = strtoul(hex, NULL, 16);
+      in += 4;
+      if (code < 0x80)
+        *out++ = code;
+      else if (code < 0x800) {
+        *out++ = 0xc0 | code >> 6;
+        *out++ = 0x80 | (code & 0x3f);
+      } else {
+        *out++ = 0xe0 | code >> 12;
+        *out++ = 0x80 | (code >> 6 & 0x3f);
+        *out++ = 0x80 | (code & 0x3f);
+      }
+      break;
+    default:
+      return NULL;
+    }
+  }
+  *out = '\0';
+  *pp = in + 1;
+  return start;
+}
+
+/******************************************************************************
+
+  Split a line holding one flat JSON object into its members.  Returns the
+  number of members, or -1 if the line is not such an object or has more
+  than 'max' of them.
+
+ ******************************************************************************/
+int lines_json(char *line, struct line_field *fields, int max) {
+  const char *name;
+  char *p = line, *value;
+  char end;
+  int n = 0;
+
+  p += strspn(p, " \t");
+  if (*p++ != '{')
+    return -1;
+  p += strspn(p, " \t");
+  if (*p == '}')
+    return 0;
+
+  for (;;) {
+    if (n == max || *p != '"' || (name = json_string(&p)) == NULL)
+      return -1;
+    p += strspn(p, " \t");
+    if (*p++ != ':')
+      return -1;
+    p += strspn(p, " \t");
+    if (*p == '"') {
+      if ((value = json_string(&p)) == NULL)
+        return -1;
+    } else {
+      value = p;
+      p += strspn(p, "-0123456789");
+      if (p == value)
+        return -1;
+    }
+
+    // Terminate the value where the next member or the object's end starts
+    end = *p;
+    *p++ = '\0';
+    if (end == ' ' || end == '\t') {
+      p += strspn(p, " \t");
+      end = *p++;
+    }
+    fields[n].name = name;
+    fields[n++].value = value;
+    if (end == '}')
+      return n;
+    if (end != ',')
+      return -1;
+    p += strspn(p, " \t");
+  }
+}
+
+/******************************************************************************
+
+  Split one CSV row into its fields, removing the quotes around quoted ones
+  and undoubling the quotes inside them.  A quoted field may hold commas and
+  line breaks; see lines_csv_complete().  Returns the number of fields, or
+  -1 if the row is malformed or has more than 'max' of them.
+
+ ******************************************************************************/
+int lines_csv(char *line, char **fields, int max) {
+  char *in = line, *out = line;
+  int n = 0;
+
+  for (;;) {
+    if (n == max)
+      return -1;
+    fields[n++] = out;
+    if (*in == '"') {
+      for (in++; *in != '"' || in[1] == '"'; in++) {
+        if (*in == '\0')
+          return -1;
+        if (*in == '"')
+          in++; // the first of a doubled quote
+        *out++ = *in;
+      }
+      if (*++in != ',' && *in != '\0')
+        return -1;
+    } else
+      while (*in != ',' && *in != '\0')
+        *out++ = *in++;
+
+    if (*in == '\0') {
+      *out = '\0';
+      return n;
+    }
+    *out++ = '\0';
+    in++;
+  }
+}
+
+// Whether a CSV row read so far ends outside any quoted field, so that a
+// line break after it ends the row rather than belonging to a field
+bool lines_csv_complete(const char *row) {
+  bool quoted = false;
+
+  for (; *row != '\0'; row++)
+    if (*row == '"')
+      quoted = !quoted;
+  return !quoted;
+}
+
+// Write 'len' bytes of 's' as a JSON string
+void lines_put_json(FILE *fp, const char *s, size_t len) {
+  size_t i = 0, plain;
+  unsigned char c;
+
+  putc('"', fp);
+  while (i < len) {
+    // Runs that need no escaping go out in one call
+    for (plain = i; plain < len && (unsigned char)s[plain] >= 0x20 &&
+                    s[plain] != '"' && s[plain] != '\\';
+         plain++)
+      ;
+    fwrite(s + i, 1, plain - i, fp);
+    if ((i = plain) == len)
+      break;
+
+    c = s[i++];
+    if (c == '"' || c == '\\') {
+      putc('\\', fp);
+      putc(c, fp);
+    } else if (c == '\n')
+      fputs("\\n", fp);
+    else if (c == '\t')
+      fputs("\\t", fp);
+    else
+      fprintf(fp, "\\u%04x", c);
+  }
+  putc('"', fp);
+}
+
+// Write 'len' bytes of 's' as a CSV field, quoted only where it has to be
+void lines_put_csv(FILE *fp, const char *s, size_t len) {
+  size_t plain = 0;
+
+  while (plain < len && memchr(",\"\r\n", s[plain], 4) == NULL)
+    plain++;
+  if (plain == len) {
+    fwrite(s, 1, len, fp);
+    return;
+  }
+  putc('"', fp);
+  for (size_t i = 0; i < len; i++) {
+    if (s[i] == '"')
+      putc('"', fp);
+    putc(s[i], fp);
+  }
+  putc('"', fp);
+}
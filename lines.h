@@ -0,0 +1,37 @@
+/******************************************************************************
+
+PROGRAM:  lines.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: The text formats entries and operations are kept in outside the
+          binary protocol: one flat JSON object per line (JSONL), or
+          comma-separated rows (CSV, as in RFC 4180).  ssl-client reads its
+          scripts with these, and wl-bulk imports and exports databases.
+
+          Parsing works in place on a NUL-terminated line: the names and
+          values handed back point into it, unescaped and NUL-terminated.
+          JSON members must be strings or integers; \uXXXX escapes outside
+          the basic multilingual plane are not supported.
+
+******************************************************************************/
+#ifndef LINES_H
+#define LINES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// One member of a JSON object, or a named field of some other line
+struct line_field {
+  const char *name;
+  char *value;
+};
+
+int lines_json(char *line, struct line_field *fields, int max);
+int lines_csv(char *line, char **fields, int max);
+bool lines_csv_complete(const char *row);
+
+void lines_put_json(FILE *fp, const char *s, size_t len);
+void lines_put_csv(FILE *fp, const char *s, size_t len);
+
+#endif
@@ -0,0 +1,419 @@
+/******************************************************************************
+
+PROGRAM:  logger.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Per-thread ring buffers of log messages and the writer thread
+          that drains them.  See logger.h.
+
+******************************************************************************/
+#include "logger.h"
+
+#include <errno.h>
+#include <openssl/err.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+// Put in front of every message in a ring
+struct record {
+  uint32_t len; // bytes of text following
+  uint8_t level;
+  uint64_t time; // CLOCK_REALTIME, ns
+};
+
+// One thread's messages. The owner only moves head and the writer only
+// moves tail, so neither needs a lock.
+struct ring {
+  struct ring *next;
+  bool in_use;            // a live thread owns it
+  uint64_t head;          // bytes ever written
+  uint64_t tail;          // bytes ever drained
+  unsigned long dropped;  // messages that did not fit, written by the owner
+  unsigned long reported; // drops already reported, the writer's own
+  unsigned char data[LOGGER_RING];
+};
+
+// A drained message waiting to be put in order
+struct drained {
+  uint64_t time;
+  unsigned long seq; // keeps one thread's messages in order on equal times
+  uint8_t level;
+  size_t off; // into drained_text
+  uint32_t len;
+};
+
+enum logger_level logger_level = LOGGER_INFO;
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+// The list only grows, and only under rings_lock
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ring *rings;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static __thread struct ring *mine;
+
+// The writer's, protected by drain_lock so logger_flush() can run at exit
+// while the writer thread is busy
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct drained *drained;
+static size_t drained_count, drained_cap;
+static char *drained_text;
+static size_t text_len, text_cap;
+static char *out[2]; // standard output, standard error
+static size_t out_len[2], out_cap[2];
+
+// Take a level name as given on the command line
+bool logger_parse_level(const char *name, enum logger_level *level) {
+  for (size_t i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++)
+    if (strcasecmp(name, level_names[i]) == 0) {
+      *level = i;
+      return true;
+    }
+  return false;
+}
+
+// A thread is exiting: its ring goes to the next new thread once drained
+static void release_ring(void *arg) {
+  struct ring *r = arg;
+
+  __atomic_store_n(&r->in_use, false, __ATOMIC_RELEASE);
+}
+
+static void make_key(void) { pthread_key_create(&ring_key, release_ring); }
+
+// The calling thread's ring, or NULL if there is no memory for one
+static struct ring *get_ring(void) {
+  struct ring *r;
+
+  if (mine != NULL)
+    return mine;
+  pthread_once(&ring_once, make_key);
+  pthread_mutex_lock(&rings_lock);
+  for (r = rings; r != NULL; r = r->next)
+    if (!__atomic_load_n(&r->in_use, __ATOMIC_ACQUIRE))
+      break;
+  if (r == NULL && (r = malloc(sizeof(*r))) != NULL) {
+    r->head = r->tail = 0;
+    r->dropped = r->reported = 0;
+    r->next = rings;
+    rings = r;
+  }
+  if (r != NULL) {
+    r->in_use = true;
+    pthread_setspecific(ring_key, r);
+  }
+  pthread_mutex_unlock(&rings_lock);
+  return mine = r;
+}
+
+// Copy in and out of a ring across its end
+static void ring_put(struct ring *r, uint64_t pos, const void *src, size_t n) {
+  size_t off = pos % LOGGER_RING, first = LOGGER_RING - off;
+
+  if (first > n)
+    first = n;
+  memcpy(r->data + off, src, first);
+  memcpy(r->data, (const char *)src + first, n - first);
+}
+
+static void ring_get(const struct ring *r, uint64_t pos, void *dst,
+                     size_t n) {
+  size_t off = pos % LOGGER_RING, first = LOGGER_RING - off;
+
+  if (first > n)
+    first = n;
+  memcpy(dst, r->data + off, first);
+  memcpy((char *)dst + first, r->data, n - first);
+}
+
+// Characters crypt(3) uses in salts and hashes
+static bool crypt_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '.' || c == '/' || c == '$';
+}
+
+/******************************************************************************
+
+  Copy 'len' bytes of 'text' to 'dst', replacing every crypt(3) style salt
+  or hash, a '$', an id of one or two letters or digits, another '$' and
+  whatever follows of the crypt alphabet, with "[redacted]".  Returns the
+  length of the result, which is never longer than 'size' - 1.
+
+ ******************************************************************************/
+static size_t redact(char *dst, size_t size, const char *text, size_t len) {
+  static const char mask[] = "[redacted]";
+  size_t i = 0, n = 0, id;
+
+  while (i < len && n + 1 < size) {
+    if (text[i] == '$') {
+      for (id = 1; i + id < len && id <= 2 &&
+                   ((text[i + id] >= 'a' && text[i + id] <= 'z') ||
+                    (text[i + id] >= 'A' && text[i + id] <= 'Z') ||
+                    (text[i + id] >= '0' && text[i + id] <= '9'));
+           id++)
+        ;
+      if (id > 1 && i + id < len && text[i + id] == '$') {
+        for (i += id + 1; i < len && crypt_char(text[i]); i++)
+          ;
+        for (size_t m = 0; m < sizeof(mask) - 1 && n + 1 < size; m++)
+          dst[n++] = mask[m];
+        continue;
+      }
+    }
+    dst[n++] = text[i++];
+  }
+  dst[n] = '\0';
+  return n;
+}
+
+// Whether a LOG() statement is over its rate; if it is not, 'suppressed' is
+// how many of its messages were dropped since the last one that went out
+static bool over_rate(struct logger_site *site, unsigned long *suppressed) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  if (__atomic_load_n(&site->second, __ATOMIC_RELAXED) !=
+      (unsigned long)ts.tv_sec) {
+    __atomic_store_n(&site->second, ts.tv_sec, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+  }
+  if (__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) >= LOGGER_RATE) {
+    __atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+    return true;
+  }
+  *suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+  return false;
+}
+
+/******************************************************************************
+
+  Format a message and add it to the calling thread's ring.  Called through
+  LOG(), which has already checked the level.  A trailing newline is
+  dropped; the writer adds its own.
+
+ ******************************************************************************/
+void logger_write(struct logger_site *site, enum logger_level level,
+                  const char *format, ...) {
+  char line[LOGGER_LINE], text[LOGGER_LINE];
+  unsigned long suppressed;
+  struct record rec;
+  struct timespec ts;
+  struct ring *r;
+  uint64_t head;
+  va_list ap;
+  int n;
+
+  if (over_rate(site, &suppressed) || (r = get_ring()) == NULL)
+    return;
+
+  va_start(ap, format);
+  n = vsnprintf(line, sizeof(line), format, ap);
+  va_end(ap);
+  if (n < 0)
+    return;
+  if ((size_t)n >= sizeof(line))
+    n = sizeof(line) - 1;
+  if (n > 0 && line[n - 1] == '\n')
+    n--;
+  if (suppressed > 0)
+    n += snprintf(line + n, sizeof(line) - n,
+                  " (%lu more like this suppressed)", suppressed);
+  if ((size_t)n >= sizeof(line))
+    n = sizeof(line) - 1;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  rec.len = redact(text, sizeof(text), line, n);
+  rec.level = level;
+  rec.time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+  head = r->head;
+  if (LOGGER_RING - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) <
+      sizeof(rec) + rec.len) {
+    __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+    return;
+  }
+  ring_put(r, head, &rec, sizeof(rec));
+  ring_put(r, head + sizeof(rec), text, rec.len);
+  __atomic_store_n(&r->head, head + sizeof(rec) + rec.len, __ATOMIC_RELEASE);
+}
+
+static int ssl_error_line(const char *str, size_t len, void *arg) {
+  static struct logger_site site;
+
+  logger_write(&site, *(enum logger_level *)arg, "%.*s", (int)len, str);
+  return 1;
+}
+
+// Log whatever OpenSSL has queued for this thread, one line per error
+void logger_ssl_errors(enum logger_level level) {
+  if (LOG_ENABLED(level))
+    ERR_print_errors_cb(ssl_error_line, &level);
+  else
+    ERR_clear_error();
+}
+
+// Make room for 'extra' more elements in a growable array
+static bool grow(void **p, size_t *cap, size_t len, size_t extra,
+                 size_t size) {
+  size_t want = *cap ? *cap : 4096 / size;
+  void *q;
+
+  if (len + extra <= *cap)
+    return true;
+  while (want < len + extra)
+    want *= 2;
+  if ((q = realloc(*p, want * size)) == NULL)
+    return false;
+  *p = q;
+  *cap = want;
+  return true;
+}
+
+static int by_time(const void *a, const void *b) {
+  const struct drained *x = a, *y = b;
+
+  if (x->time != y->time)
+    return x->time < y->time ? -1 : 1;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Add one line of output for standard output (0) or standard error (1)
+static void put_line(int which, uint64_t time, const char *level,
+                     const char *text, size_t len) {
+  static time_t last_second = -1;
+  static char stamp[32];
+  time_t second = time / 1000000000;
+  struct tm tm;
+  int n;
+
+  if (second != last_second) {
+    localtime_r(&second, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    last_second = second;
+  }
+  if (!grow((void **)&out[which], &out_cap[which], out_len[which],
+            len + 64, 1))
+    return;
+  n = snprintf(out[which] + out_len[which], 64, "%s.%06lu %-5s ", stamp,
+               (unsigned long)(time % 1000000000 / 1000), level);
+  memcpy(out[which] + out_len[which] + n, text, len);
+  out[which][out_len[which] + n + len] = '\n';
+  out_len[which] += n + len + 1;
+}
+
+static void write_all(int fd, const char *data, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, data, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    data += n;
+    len -= n;
+  }
+}
+
+/******************************************************************************
+
+  Drain every ring, sort what came out by time and write it.  Called by
+  the writer thread every LOGGER_INTERVAL milliseconds and at exit.
+
+ ******************************************************************************/
+void logger_flush(void) {
+  struct ring *r, *first;
+  struct record rec;
+  unsigned long dropped, seq = 0;
+  uint64_t tail, head;
+
+  pthread_mutex_lock(&drain_lock);
+  drained_count = text_len = 0;
+  pthread_mutex_lock(&rings_lock);
+  first = rings;
+  pthread_mutex_unlock(&rings_lock);
+
+  for (r = first; r != NULL; r = r->next) {
+    tail = r->tail;
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    while (tail < head) {
+      ring_get(r, tail, &rec, sizeof(rec));
+      if (!grow((void **)&drained, &drained_cap, drained_count, 1,
+                sizeof(*drained)) ||
+          !grow((void **)&drained_text, &text_cap, text_len, rec.len, 1))
+        break;
+      ring_get(r, tail + sizeof(rec), drained_text + text_len, rec.len);
+      drained[drained_count++] =
+          (struct drained){rec.time, seq++, rec.level, text_len, rec.len};
+      text_len += rec.len;
+      tail += sizeof(rec) + rec.len;
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+    dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    if (dropped != r->reported) {
+      char note[80];
+      struct timespec ts;
+      int n = snprintf(note, sizeof(note),
+                       "Logger: %lu messages dropped, output too slow",
+                       dropped - r->reported);
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      put_line(1, (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec, "WARN",
+               note, n);
+      r->reported = dropped;
+    }
+  }
+
+  qsort(drained, drained_count, sizeof(*drained), by_time);
+  for (size_t i = 0; i < drained_count; i++)
+    put_line(drained[i].level >= LOGGER_WARN, drained[i].time,
+             level_names[drained[i].level], drained_text + drained[i].off,
+             drained[i].len);
+
+  write_all(STDOUT_FILENO, out[0], out_len[0]);
+  write_all(STDERR_FILENO, out[1], out_len[1]);
+  out_len[0] = out_len[1] = 0;
+  pthread_mutex_unlock(&drain_lock);
+}
+
+static void *writer_main(void *arg) {
+  struct timespec pause = {0, LOGGER_INTERVAL * 1000000L};
+
+  for (;;) {
+    nanosleep(&pause, NULL);
+    logger_flush();
+  }
+  return NULL;
+}
+
+/******************************************************************************
+
+  Set the lowest level that is logged and start the writer thread.  Called
+  once, before the other threads start.  Standard output is flushed and
+  made line buffered, so that what is still printed with stdio, before
+  and after, does not sit in its buffer while the log goes past it.
+
+ ******************************************************************************/
+void logger_start(enum logger_level level) {
+  pthread_t thread;
+
+  logger_level = level;
+  fflush(stdout);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  if (pthread_create(&thread, NULL, writer_main, NULL) != 0) {
+    fprintf(stderr, "Server: Unable to start the log writer\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_detach(thread);
+  atexit(logger_flush);
+}
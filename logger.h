@@ -0,0 +1,70 @@
+/******************************************************************************
+
+PROGRAM:  logger.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Leveled, asynchronous logging for the server.
+
+          LOG() formats its message on the calling thread into a ring
+          buffer that belongs to that thread alone, so logging takes no
+          lock and makes no system call.  A background writer drains all
+          rings every LOGGER_INTERVAL milliseconds, puts the messages in
+          time order and writes them out with a timestamp and level:
+          DEBUG and INFO go to standard output, WARN and ERROR to standard
+          error.  When a ring is full because the output cannot keep up,
+          messages are dropped rather than stalling the event loops, and
+          the writer says how many.
+
+          A message below the level given to logger_start() costs one
+          comparison: its arguments are not even evaluated.  Each LOG()
+          statement may print at most LOGGER_RATE messages a second; the
+          rest are counted and the count is added to its next message.
+
+          Anything that looks like a crypt(3) hash or salt ("$1$..." and
+          friends) is replaced by "[redacted]" before it reaches a ring,
+          so a careless LOG() cannot leak credentials into the log.
+
+          Fatal errors at startup are still written straight to standard
+          error before the process exits; logger_flush() is run at exit so
+          nothing logged before is lost.
+
+******************************************************************************/
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdbool.h>
+
+#define LOGGER_RING (64 * 1024) // bytes of messages each thread may buffer
+#define LOGGER_LINE 1024        // longest message; longer ones are cut
+#define LOGGER_INTERVAL 10      // milliseconds between drains
+#define LOGGER_RATE 100         // messages per second from one LOG()
+
+enum logger_level { LOGGER_DEBUG, LOGGER_INFO, LOGGER_WARN, LOGGER_ERROR };
+
+// Where one LOG() statement is in its rate limit; one per statement
+struct logger_site {
+  unsigned long second;
+  unsigned int count;
+  unsigned long suppressed;
+};
+
+extern enum logger_level logger_level;
+
+#define LOG_ENABLED(level) ((level) >= logger_level)
+
+#define LOG(level, ...)                                                        \
+  do {                                                                         \
+    static struct logger_site log_site_;                                       \
+    if (LOG_ENABLED(level))                                                    \
+      logger_write(&log_site_, (level), __VA_ARGS__);                          \
+  } while (0)
+
+bool logger_parse_level(const char *name, enum logger_level *level);
+void logger_start(enum logger_level level);
+void logger_write(struct logger_site *site, enum logger_level level,
+                  const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+void logger_ssl_errors(enum logger_level level);
+void logger_flush(void);
+
+#endif
@@ -0,0 +1,368 @@
+/******************************************************************************
+
+PROGRAM:  metrics.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Per-thread counters and latency histograms, summed up on demand
+          for WL_STATS and the admin socket.  See metrics.h.
+
+******************************************************************************/
+#include "metrics.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "protocol.h"
+
+#define ADMIN_TIMEOUT 1 // seconds a reader of the admin socket may stall
+
+struct histogram {
+  uint64_t count;
+  uint64_t sum; // ns
+  uint64_t max; // ns
+  uint64_t buckets[METRICS_BUCKETS];
+};
+
+// Everything one thread has recorded. Only the owner writes, with relaxed
+// atomic stores so that readers on other threads never see a torn value.
+struct shard {
+  struct shard *next;
+  bool in_use; // a live thread owns it
+  uint64_t counters[METRIC_COUNTERS];
+  struct histogram timers[METRIC_TIMERS];
+};
+
+static const char *counter_names[METRIC_COUNTERS] = {
+    "connections.accepted",        "connections.accept_errors",
+    "handshakes.full",             "handshakes.resumed",
+    "handshakes.failed",           "sessions.text",
+    "sessions.binary",             "frames.bad",
+    "connections.rejected_per_ip", "connections.accept_paused",
+    "timeouts.handshake",          "timeouts.idle",
+    "timeouts.request",            "bytes.in",
+    "bytes.out",                   "compress.bytes_in",
+    "compress.bytes_out",          "replies.ok",
+    "replies.not_found",           "replies.exists",
+    "replies.bad_request",         "replies.auth_failed",
+    "replies.not_logged_in",       "replies.server_error",
+    "replies.busy",                "replies.read_only"};
+
+static const char *timer_names[METRIC_TIMERS] = {
+    "accept",           "handshake",       "op.hello",
+    "op.register",      "op.salt",         "op.login",
+    "op.create",        "op.find",         "op.display",
+    "op.update",        "op.remove",       "op.search",
+    "op.stats",         "op.batch",        "op.replicate",
+    "op.apply",         "op.other",        "op.text",
+    "storage.fetch",    "storage.exists",  "storage.store",
+    "storage.delete",   "storage.firstkey", "storage.nextkey",
+    "storage.sync",     "compress"};
+
+// The list only grows, and only under shards_lock; readers walk it under the
+// lock too
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct shard *shards;
+static pthread_key_t shard_key;
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+
+static __thread struct shard *mine;
+
+static uint64_t started; // ns, set by metrics_serve()
+
+uint64_t metrics_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// A thread is exiting: the next new thread may carry on with its shard
+static void release_shard(void *arg) {
+  struct shard *s = arg;
+
+  __atomic_store_n(&s->in_use, false, __ATOMIC_RELEASE);
+}
+
+static void make_key(void) { pthread_key_create(&shard_key, release_shard); }
+
+/******************************************************************************
+
+  The calling thread's shard, found the first time through.  A shard given
+  up by a thread that exited is reused before a new one is allocated; the
+  counts in it stay, since they are part of the totals.  If memory runs out
+  the thread's recordings go to a shard nobody reads rather than failing.
+
+ ******************************************************************************/
+static struct shard *get_shard(void) {
+  static struct shard overflow;
+  struct shard *s;
+
+  if (mine != NULL)
+    return mine;
+  pthread_once(&shard_once, make_key);
+  pthread_mutex_lock(&shards_lock);
+  for (s = shards; s != NULL; s = s->next)
+    if (!__atomic_load_n(&s->in_use, __ATOMIC_ACQUIRE))
+      break;
+  if (s == NULL && (s = calloc(1, sizeof(*s))) != NULL) {
+    s->next = shards;
+    shards = s;
+  }
+  if (s != NULL) {
+    s->in_use = true;
+    pthread_setspecific(shard_key, s);
+  }
+  pthread_mutex_unlock(&shards_lock);
+  mine = s != NULL ? s : &overflow;
+  return mine;
+}
+
+// Only the owning thread writes a shard, so a load and a store will do
+static void bump(uint64_t *p, uint64_t n) {
+  __atomic_store_n(p, *p + n, __ATOMIC_RELAXED);
+}
+
+void metrics_count(enum metric_counter c, uint64_t n) {
+  bump(&get_shard()->counters[c], n);
+}
+
+/******************************************************************************
+
+  Log-linear histogram buckets: values below 2 * METRICS_SUB have one each,
+  and every power of two above that is split into METRICS_SUB buckets.
+
+ ******************************************************************************/
+static size_t bucket_of(uint64_t value) {
+  int shift;
+
+  if (value >= (uint64_t)1 << METRICS_MAX_BITS)
+    value = ((uint64_t)1 << METRICS_MAX_BITS) - 1;
+  if (value < 2 * METRICS_SUB)
+    return value;
+  shift = 63 - __builtin_clzll(value) - METRICS_SUB_BITS;
+  return (shift + 1) * METRICS_SUB + (value >> shift) - METRICS_SUB;
+}
+
+// The largest value that falls into a bucket
+static uint64_t bucket_value(size_t bucket) {
+  int shift;
+
+  if (bucket < 2 * METRICS_SUB)
+    return bucket;
+  shift = bucket / METRICS_SUB - 1;
+  return ((uint64_t)(bucket % METRICS_SUB + METRICS_SUB + 1) << shift) - 1;
+}
+
+// Record the time since 'start', which came from metrics_now()
+void metrics_time(enum metric_timer t, uint64_t start) {
+  struct histogram *h = &get_shard()->timers[t];
+  uint64_t ns = metrics_now() - start;
+
+  bump(&h->buckets[bucket_of(ns)], 1);
+  bump(&h->count, 1);
+  bump(&h->sum, ns);
+  if (ns > h->max)
+    __atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+}
+
+// Count a reply by its enum wl_status
+void metrics_reply(uint16_t status) {
+  if (status <= WL_READ_ONLY)
+    metrics_count(MC_REPLY_OK + status, 1);
+}
+
+// The histogram for requests of a frame type
+enum metric_timer metrics_opcode(uint8_t type) {
+  switch (type) {
+  case WL_HELLO:
+    return MT_HELLO;
+  case WL_REGISTER:
+    return MT_REGISTER;
+  case WL_SALT:
+    return MT_SALT;
+  case WL_LOGIN:
+    return MT_LOGIN;
+  case WL_CREATE:
+    return MT_CREATE;
+  case WL_FIND:
+    return MT_FIND;
+  case WL_DISPLAY:
+    return MT_DISPLAY;
+  case WL_UPDATE:
+    return MT_UPDATE;
+  case WL_REMOVE:
+    return MT_REMOVE;
+  case WL_SEARCH:
+    return MT_SEARCH;
+  case WL_STATS:
+    return MT_STATS;
+  case WL_BATCH:
+    return MT_BATCH;
+  case WL_REPLICATE:
+    return MT_REPLICATE;
+  case WL_APPLY:
+    return MT_APPLY;
+  default:
+    return MT_OTHER;
+  }
+}
+
+// A counter summed over all threads
+uint64_t metrics_total(enum metric_counter c) {
+  uint64_t total = 0;
+
+  pthread_mutex_lock(&shards_lock);
+  for (struct shard *s = shards; s != NULL; s = s->next)
+    total += __atomic_load_n(&s->counters[c], __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&shards_lock);
+  return total;
+}
+
+/******************************************************************************
+
+  Add up one histogram over all threads.  The count is taken from the
+  buckets themselves so that percentiles stay consistent even while the
+  owners keep recording.
+
+ ******************************************************************************/
+static void merge_timer(enum metric_timer t, struct histogram *into) {
+  memset(into, 0, sizeof(*into));
+  pthread_mutex_lock(&shards_lock);
+  for (struct shard *s = shards; s != NULL; s = s->next) {
+    const struct histogram *h = &s->timers[t];
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+    into->sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+    if (max > into->max)
+      into->max = max;
+    for (size_t i = 0; i < METRICS_BUCKETS; i++) {
+      uint64_t n = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+
+      into->buckets[i] += n;
+      into->count += n;
+    }
+  }
+  pthread_mutex_unlock(&shards_lock);
+}
+
+// The smallest recorded value at or above fraction p of all values
+static uint64_t percentile(const struct histogram *h, double p) {
+  uint64_t rank = (uint64_t)(p * h->count + 0.5), seen = 0;
+
+  if (rank == 0)
+    rank = 1;
+  for (size_t i = 0; i < METRICS_BUCKETS; i++)
+    if ((seen += h->buckets[i]) >= rank)
+      return bucket_value(i) < h->max ? bucket_value(i) : h->max;
+  return h->max;
+}
+
+/******************************************************************************
+
+  Write every counter, then a summary of every histogram in microseconds,
+  one per line.  Lines starting with '#' are comments, so the output is
+  easy to read and easy to pick apart with awk.
+
+ ******************************************************************************/
+void metrics_dump(FILE *out) {
+  struct histogram *h = malloc(sizeof(*h));
+  int i;
+
+  if (started != 0)
+    fprintf(out, "# uptime %.1f s\n", (metrics_now() - started) / 1e9);
+  for (i = 0; i < METRIC_COUNTERS; i++)
+    fprintf(out, "%s %llu\n", counter_names[i],
+            (unsigned long long)metrics_total(i));
+  if (h == NULL)
+    return;
+  fprintf(out, "# latency in microseconds: count mean p50 p90 p99 p99.9 "
+               "max\n");
+  for (i = 0; i < METRIC_TIMERS; i++) {
+    merge_timer(i, h);
+    fprintf(out, "%s %llu %.1f %.1f %.1f %.1f %.1f %.1f\n", timer_names[i],
+            (unsigned long long)h->count,
+            h->count ? (double)h->sum / h->count / 1e3 : 0.0,
+            percentile(h, 0.50) / 1e3, percentile(h, 0.90) / 1e3,
+            percentile(h, 0.99) / 1e3, percentile(h, 0.999) / 1e3,
+            h->max / 1e3);
+  }
+  free(h);
+}
+
+// Answer every connection to the admin socket with a dump, then hang up
+static void *admin_main(void *arg) {
+  int sockfd = (int)(intptr_t)arg, client;
+  struct timeval timeout = {ADMIN_TIMEOUT, 0};
+  FILE *out;
+
+  for (;;) {
+    client = accept(sockfd, NULL, NULL);
+    if (client < 0) {
+      if (errno != EINTR)
+        fprintf(stderr, "Server: Admin socket accept failed: %s\n",
+                strerror(errno));
+      continue;
+    }
+    // A reader that stops reading must not keep the next one waiting
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if ((out = fdopen(client, "w")) == NULL) {
+      close(client);
+      continue;
+    }
+    metrics_dump(out);
+    fclose(out);
+  }
+  return NULL;
+}
+
+/******************************************************************************
+
+  Listen on the unix socket 'path' for admin connections and start the
+  thread that answers them.  A socket left behind by an earlier run is
+  replaced.  Only the user running the server may connect.  Not being able
+  to offer the socket is reported but not fatal: the server can do without.
+  Returns whether the socket is up.
+
+ ******************************************************************************/
+bool metrics_serve(const char *path) {
+  struct sockaddr_un addr;
+  pthread_t thread;
+  int sockfd;
+
+  started = metrics_now();
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Server: Admin socket path too long: %s\n", path);
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sockfd < 0) {
+    fprintf(stderr, "Server: Unable to create admin socket: %s\n",
+            strerror(errno));
+    return false;
+  }
+  unlink(path);
+  if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      chmod(path, S_IRUSR | S_IWUSR) < 0 || listen(sockfd, 8) < 0 ||
+      pthread_create(&thread, NULL, admin_main, (void *)(intptr_t)sockfd) !=
+          0) {
+    fprintf(stderr, "Server: Unable to offer admin socket %s: %s\n", path,
+            strerror(errno));
+    close(sockfd);
+    return false;
+  }
+  pthread_detach(thread);
+  return true;
+}
@@ -0,0 +1,116 @@
+/******************************************************************************
+
+PROGRAM:  metrics.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: In-process metrics of the server: counters of connections,
+          handshakes and replies, and latency histograms of accepting a
+          connection, the TLS handshake, each request type, each call
+          into the storage engine and compressing a reply.
+
+          Every thread that records anything gets a shard of its own the
+          first time it does, and only that thread ever writes to it, so
+          recording is a few plain stores with no lock and no shared cache
+          line.  Readers add up all shards.  A shard outlives its thread
+          and is handed to the next new thread, so totals never go down.
+
+          Latencies are kept in nanoseconds in log-linear histograms, like
+          those of HdrHistogram: every power of two is split into
+          METRICS_SUB buckets, so a percentile is within about 3% of the
+          true value.  Times above 2^METRICS_MAX_BITS ns count as that.
+
+          metrics_dump() writes everything as plain text, one counter or
+          histogram per line.  The server sends the same text in reply to
+          WL_STATS and to anyone who connects to the admin socket, for
+          instance with
+
+            socat - UNIX-CONNECT:watchlist.sock
+
+******************************************************************************/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define METRICS_SOCKET "watchlist.sock" // admin socket, in the server's dir
+#define METRICS_SUB_BITS 5
+#define METRICS_SUB (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BITS 40 // about 18 minutes
+#define METRICS_BUCKETS                                                        \
+  ((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) * METRICS_SUB)
+
+// Counters. The MC_REPLY_ ones follow the order of enum wl_status.
+enum metric_counter {
+  MC_ACCEPTED,
+  MC_ACCEPT_ERRORS,
+  MC_HANDSHAKES_FULL,
+  MC_HANDSHAKES_RESUMED,
+  MC_HANDSHAKE_FAILURES,
+  MC_TEXT_SESSIONS,
+  MC_BINARY_SESSIONS,
+  MC_BAD_FRAMES,
+  MC_REJECTED_PER_IP,
+  MC_ACCEPT_PAUSES,
+  MC_TIMEOUTS_HANDSHAKE, // one per connection deadline, see enum conn_timer
+  MC_TIMEOUTS_IDLE,
+  MC_TIMEOUTS_REQUEST,
+  MC_BYTES_IN,
+  MC_BYTES_OUT,
+  MC_COMPRESS_BYTES_IN, // reply payloads before and after compression
+  MC_COMPRESS_BYTES_OUT,
+  MC_REPLY_OK,
+  MC_REPLY_NOT_FOUND,
+  MC_REPLY_EXISTS,
+  MC_REPLY_BAD_REQUEST,
+  MC_REPLY_AUTH_FAILED,
+  MC_REPLY_NOT_LOGGED_IN,
+  MC_REPLY_SERVER_ERROR,
+  MC_REPLY_BUSY,
+  MC_REPLY_READ_ONLY,
+  METRIC_COUNTERS
+};
+
+// Latency histograms
+enum metric_timer {
+  MT_ACCEPT,    // accept4() until the connection is in the epoll set
+  MT_HANDSHAKE, // accepted until SSL_accept() succeeds
+  MT_HELLO,     // one per request type, see metrics_opcode()
+  MT_REGISTER,
+  MT_SALT,
+  MT_LOGIN,
+  MT_CREATE,
+  MT_FIND,
+  MT_DISPLAY,
+  MT_UPDATE,
+  MT_REMOVE,
+  MT_SEARCH,
+  MT_STATS,
+  MT_BATCH,
+  MT_REPLICATE,
+  MT_APPLY,
+  MT_OTHER, // request types the server does not know
+  MT_TEXT,  // one message of the old text protocol
+  MT_FETCH, // one per call into the storage engine
+  MT_EXISTS,
+  MT_STORE,
+  MT_DELETE,
+  MT_FIRSTKEY,
+  MT_NEXTKEY,
+  MT_SYNC,
+  MT_COMPRESS, // compressing one reply frame
+  METRIC_TIMERS
+};
+
+uint64_t metrics_now(void);
+void metrics_count(enum metric_counter c, uint64_t n);
+void metrics_time(enum metric_timer t, uint64_t start);
+void metrics_reply(uint16_t status);
+enum metric_timer metrics_opcode(uint8_t type);
+
+uint64_t metrics_total(enum metric_counter c);
+void metrics_dump(FILE *out);
+bool metrics_serve(const char *path);
+
+#endif
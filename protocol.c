@@ -0,0 +1,408 @@
+/******************************************************************************
+
+PROGRAM:  protocol.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Encoding and decoding of the binary wire protocol described in
+          protocol.h, plus blocking send/receive helpers for clients.  The
+          server drives its non-blocking sockets itself and only uses the
+          encoder, the parser and the compressor.
+
+******************************************************************************/
+#include "protocol.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static uint16_t get16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+
+static uint32_t get32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         p[3];
+}
+
+/******************************************************************************
+
+  Make room for at least 'extra' more bytes.  Running out of memory is
+  treated like the other unrecoverable errors in this project.
+
+ ******************************************************************************/
+void wl_buf_reserve(struct wl_buf *b, size_t extra) {
+  size_t cap;
+
+  if (b->len + extra <= b->cap)
+    return;
+  cap = b->cap ? b->cap : 1024;
+  while (cap < b->len + extra)
+    cap *= 2;
+  b->data = realloc(b->data, cap);
+  if (b->data == NULL) {
+    fprintf(stderr, "Out of memory growing a %zu byte buffer\n", cap);
+    exit(EXIT_FAILURE);
+  }
+  b->cap = cap;
+}
+
+// Drop the first n bytes, keeping whatever follows them
+void wl_buf_consume(struct wl_buf *b, size_t n) {
+  if (n >= b->len) {
+    b->len = 0;
+    return;
+  }
+  memmove(b->data, b->data + n, b->len - n);
+  b->len -= n;
+}
+
+void wl_buf_free(struct wl_buf *b) {
+  free(b->data);
+  b->data = NULL;
+  b->len = b->cap = 0;
+}
+
+/******************************************************************************
+
+  Frames are built in place at the end of a buffer: wl_begin() writes the
+  header with a zero length and returns where the frame starts, the wl_put
+  functions append fields, and wl_end() fills in the final length.
+
+ ******************************************************************************/
+size_t wl_begin(struct wl_buf *b, uint8_t type, uint8_t flags,
+                uint16_t status, uint32_t id) {
+  size_t start = b->len;
+  uint8_t *p;
+
+  wl_buf_reserve(b, WL_HEADER_SIZE);
+  p = b->data + start;
+  put32(p, 0);
+  p[4] = type;
+  p[5] = flags;
+  put16(p + 6, status);
+  put32(p + 8, id);
+  b->len += WL_HEADER_SIZE;
+  return start;
+}
+
+void wl_put_bytes(struct wl_buf *b, uint8_t tag, const void *data,
+                  size_t len) {
+  if (len > UINT16_MAX)
+    len = UINT16_MAX;
+  wl_buf_reserve(b, WL_FIELD_HEADER_SIZE + len);
+  b->data[b->len] = tag;
+  put16(b->data + b->len + 1, len);
+  memcpy(b->data + b->len + WL_FIELD_HEADER_SIZE, data, len);
+  b->len += WL_FIELD_HEADER_SIZE + len;
+}
+
+void wl_put_str(struct wl_buf *b, uint8_t tag, const char *s) {
+  wl_put_bytes(b, tag, s, strlen(s));
+}
+
+void wl_put_u32(struct wl_buf *b, uint8_t tag, uint32_t value) {
+  uint8_t v[4];
+
+  put32(v, value);
+  wl_put_bytes(b, tag, v, sizeof(v));
+}
+
+void wl_put_u64(struct wl_buf *b, uint8_t tag, uint64_t value) {
+  uint8_t v[8];
+
+  put32(v, value >> 32);
+  put32(v + 4, value);
+  wl_put_bytes(b, tag, v, sizeof(v));
+}
+
+void wl_put_entry(struct wl_buf *b, const char *title, size_t title_len,
+                  const struct entry *e) {
+  wl_put_bytes(b, WL_F_TITLE, title, title_len);
+  wl_put_u32(b, WL_F_TYPE, e->type);
+  wl_put_str(b, WL_F_DESCRIPTION, e->description);
+  wl_put_u32(b, WL_F_STATUS, e->status);
+  wl_put_u32(b, WL_F_RATING, e->rating);
+}
+
+void wl_end(struct wl_buf *b, size_t start) {
+  put32(b->data + start, b->len - start - WL_HEADER_SIZE);
+}
+
+// Change the flags and status of a frame that has already been begun
+void wl_amend(struct wl_buf *b, size_t start, uint8_t flags, uint16_t status) {
+  b->data[start + 5] = flags;
+  put16(b->data + start + 6, status);
+}
+
+/******************************************************************************
+
+  Compress the payload of the frame at 'start' in place, as described in
+  protocol.h; frames after it in the buffer move up.  A payload that does
+  not shrink is left as it is.  Returns the size of the frame afterwards.
+
+  Each thread keeps its zlib state from call to call, since setting one up
+  costs more than compressing a page of a listing.
+
+ ******************************************************************************/
+static __thread z_stream deflater, inflater;
+static __thread bool deflater_ready, inflater_ready;
+static __thread struct wl_buf scratch;
+
+long wl_deflate(struct wl_buf *b, size_t start) {
+  uint32_t len = get32(b->data + start);
+  size_t end = start + WL_HEADER_SIZE + len, packed;
+  uint8_t *payload;
+
+  if (!deflater_ready) {
+    if (deflateInit(&deflater, WL_COMPRESS_LEVEL) != Z_OK) {
+      fprintf(stderr, "Out of memory setting up zlib\n");
+      exit(EXIT_FAILURE);
+    }
+    deflater_ready = true;
+  } else {
+    deflateReset(&deflater);
+  }
+  scratch.len = 0;
+  wl_buf_reserve(&scratch, deflateBound(&deflater, len));
+  deflater.next_in = b->data + start + WL_HEADER_SIZE;
+  deflater.avail_in = len;
+  deflater.next_out = scratch.data;
+  deflater.avail_out = scratch.cap;
+  if (deflate(&deflater, Z_FINISH) != Z_STREAM_END ||
+      4 + deflater.total_out >= len)
+    return WL_HEADER_SIZE + len;
+
+  packed = 4 + deflater.total_out;
+  payload = b->data + start + WL_HEADER_SIZE;
+  put32(b->data + start, packed);
+  b->data[start + 5] |= WL_FLAG_COMPRESSED;
+  put32(payload, len);
+  memcpy(payload + 4, scratch.data, deflater.total_out);
+  memmove(payload + packed, b->data + end, b->len - end);
+  b->len -= len - packed;
+  return WL_HEADER_SIZE + packed;
+}
+
+/******************************************************************************
+
+  Undo wl_deflate() on the frame at 'start'.  Returns the size of the plain
+  frame, or -1 if the payload is not what the flag promises.
+
+ ******************************************************************************/
+long wl_inflate(struct wl_buf *b, size_t start) {
+  uint32_t len = get32(b->data + start), plain;
+  size_t end = start + WL_HEADER_SIZE + len;
+  uint8_t *payload;
+
+  if (len < 4 || (plain = get32(b->data + start + WL_HEADER_SIZE)) == 0 ||
+      plain > WL_MAX_FRAME)
+    return -1;
+  if (!inflater_ready) {
+    if (inflateInit(&inflater) != Z_OK) {
+      fprintf(stderr, "Out of memory setting up zlib\n");
+      exit(EXIT_FAILURE);
+    }
+    inflater_ready = true;
+  } else {
+    inflateReset(&inflater);
+  }
+  scratch.len = 0;
+  wl_buf_reserve(&scratch, plain);
+  inflater.next_in = b->data + start + WL_HEADER_SIZE + 4;
+  inflater.avail_in = len - 4;
+  inflater.next_out = scratch.data;
+  inflater.avail_out = plain;
+  if (inflate(&inflater, Z_FINISH) != Z_STREAM_END ||
+      inflater.total_out != plain)
+    return -1;
+
+  if (plain > len)
+    wl_buf_reserve(b, plain - len);
+  payload = b->data + start + WL_HEADER_SIZE;
+  memmove(payload + plain, b->data + end, b->len - end);
+  memcpy(payload, scratch.data, plain);
+  b->len = b->len - len + plain;
+  put32(b->data + start, plain);
+  b->data[start + 5] &= ~WL_FLAG_COMPRESSED;
+  return WL_HEADER_SIZE + plain;
+}
+
+/******************************************************************************
+
+  Decode the frame at the start of 'data' without copying it.  Returns the
+  number of bytes the whole frame occupies, 0 if more bytes are needed, or
+  -1 if the header is invalid and the stream cannot be resynchronized.
+
+ ******************************************************************************/
+long wl_parse(const uint8_t *data, size_t len, struct wl_frame *frame) {
+  uint32_t payload_len;
+
+  if (len < WL_HEADER_SIZE)
+    return 0;
+  payload_len = get32(data);
+  if (payload_len > WL_MAX_FRAME)
+    return -1;
+  if (len < WL_HEADER_SIZE + (size_t)payload_len)
+    return 0;
+
+  frame->type = data[4];
+  frame->flags = data[5];
+  frame->status = get16(data + 6);
+  frame->id = get32(data + 8);
+  frame->payload = data + WL_HEADER_SIZE;
+  frame->len = payload_len;
+  return WL_HEADER_SIZE + payload_len;
+}
+
+/******************************************************************************
+
+  Iterate over the fields of a frame.  *pos starts at 0.  Returns 1 with the
+  next field, 0 at the end of the payload, or -1 if a field runs past it.
+
+ ******************************************************************************/
+int wl_next(const struct wl_frame *frame, size_t *pos, struct wl_field *field) {
+  const uint8_t *p;
+
+  if (*pos >= frame->len)
+    return 0;
+  if (frame->len - *pos < WL_FIELD_HEADER_SIZE)
+    return -1;
+  p = frame->payload + *pos;
+  field->tag = p[0];
+  field->len = get16(p + 1);
+  if (frame->len - *pos - WL_FIELD_HEADER_SIZE < field->len)
+    return -1;
+  field->data = p + WL_FIELD_HEADER_SIZE;
+  *pos += WL_FIELD_HEADER_SIZE + field->len;
+  return 1;
+}
+
+// Find the first field with the given tag. Returns 1 if found.
+int wl_find(const struct wl_frame *frame, uint8_t tag, struct wl_field *field) {
+  size_t pos = 0;
+
+  while (wl_next(frame, &pos, field) == 1)
+    if (field->tag == tag)
+      return 1;
+  return 0;
+}
+
+/******************************************************************************
+
+  Iterate over the frames nested in a WL_BATCH payload, the same way
+  wl_next() iterates over fields.
+
+ ******************************************************************************/
+int wl_next_frame(const struct wl_frame *batch, size_t *pos,
+                  struct wl_frame *frame) {
+  long size;
+
+  if (*pos >= batch->len)
+    return 0;
+  size = wl_parse(batch->payload + *pos, batch->len - *pos, frame);
+  if (size <= 0)
+    return -1;
+  *pos += size;
+  return 1;
+}
+
+uint32_t wl_u32(const struct wl_field *field) {
+  return field->len == 4 ? get32(field->data) : 0;
+}
+
+uint64_t wl_u64(const struct wl_field *field) {
+  return field->len == 8
+             ? (uint64_t)get32(field->data) << 32 | get32(field->data + 4)
+             : 0;
+}
+
+// Copy a string field into a NUL terminated buffer, truncating if needed
+void wl_copy_str(const struct wl_field *field, char *dst, size_t size) {
+  size_t n = field->len < size - 1 ? field->len : size - 1;
+
+  memcpy(dst, field->data, n);
+  dst[n] = '\0';
+}
+
+const char *wl_status_str(uint16_t status) {
+  switch (status) {
+  case WL_OK:
+    return "ok";
+  case WL_NOT_FOUND:
+    return "not found";
+  case WL_EXISTS:
+    return "already exists";
+  case WL_BAD_REQUEST:
+    return "bad request";
+  case WL_AUTH_FAILED:
+    return "authentication failed";
+  case WL_NOT_LOGGED_IN:
+    return "not logged in";
+  case WL_BUSY:
+    return "server busy, try again later";
+  case WL_READ_ONLY:
+    return "backup server, changes go to the primary";
+  default:
+    return "server error";
+  }
+}
+
+/******************************************************************************
+
+  Write everything in 'out' to a blocking SSL connection and empty it.
+  Returns 0 on success, -1 if the connection failed.
+
+ ******************************************************************************/
+int wl_send(SSL *ssl, struct wl_buf *out) {
+  size_t off = 0;
+  int n;
+
+  while (off < out->len) {
+    n = SSL_write(ssl, out->data + off, out->len - off);
+    if (n <= 0)
+      return -1;
+    off += n;
+  }
+  out->len = 0;
+  return 0;
+}
+
+/******************************************************************************
+
+  Read from a blocking SSL connection until a whole frame sits at the front
+  of 'in', and inflate it if it came compressed.  Returns its size, which
+  the caller passes to wl_buf_consume() once it is done with the frame, or
+  -1 if the connection failed or the server sent something that is not a
+  frame.
+
+ ******************************************************************************/
+long wl_recv(SSL *ssl, struct wl_buf *in, struct wl_frame *frame) {
+  long size;
+  int n;
+
+  while ((size = wl_parse(in->data, in->len, frame)) == 0) {
+    wl_buf_reserve(in, 4096);
+    n = SSL_read(ssl, in->data + in->len, in->cap - in->len);
+    if (n <= 0)
+      return -1;
+    in->len += n;
+  }
+  if (size > 0 && (frame->flags & WL_FLAG_COMPRESSED)) {
+    if ((size = wl_inflate(in, 0)) < 0)
+      return -1;
+    wl_parse(in->data, in->len, frame);
+  }
+  return size;
+}
@@ -0,0 +1,243 @@
+/******************************************************************************
+
+PROGRAM:  protocol.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Binary wire protocol spoken between ssl-client and ssl-server.
+
+          A binary client starts the session with the four byte preface
+          WL_MAGIC followed by a WL_HELLO frame carrying the highest protocol
+          version it speaks; the server answers with the version it picked.
+          A successful WL_REGISTER or WL_LOGIN is answered with a login
+          token, and a client that sends that token in a later WL_HELLO is
+          logged in straight away: the reply names the user.  When too
+          many logins are already waiting the server answers WL_BUSY at
+          once; the client may simply try again.
+          A client whose first bytes are not WL_MAGIC is served with the old
+          colon separated text protocol, so both can coexist while clients
+          are migrated.
+
+          Every message after the preface is a frame:
+
+            u32 length   bytes of payload following the header
+            u8  type     enum wl_type
+            u8  flags    WL_FLAG_REPLY on replies
+            u16 status   enum wl_status on replies, 0 on requests
+            u32 id       chosen by the client, echoed in the reply
+            payload      a sequence of typed fields
+
+          and every field is
+
+            u8  tag      enum wl_tag, which also fixes the field's type
+            u16 length   bytes of data following
+            data         raw bytes for strings, big-endian for integers
+
+          Requests may be pipelined: a client can send any number of frames
+          without waiting, and the server answers them in order.  A WL_BATCH
+          frame carries several request frames back to back as its payload
+          and is answered by a WL_BATCH reply whose payload holds one reply
+          frame per request, in the same order.  A reply too big for one
+          frame is split over several frames with the same id, all but the
+          last marked WL_FLAG_MORE.
+
+          A primary server streams its changes to backups over the same
+          protocol: it logs in to each with WL_REPLICATE instead of
+          WL_LOGIN and then sends WL_APPLY frames (see replica.h).  A
+          backup answers changes from clients with WL_READ_ONLY while its
+          primary is connected.
+
+          Listings are paged so neither side holds a whole watchlist at
+          once.  A WL_DISPLAY reply that stops short of the end carries a
+          CURSOR field; sending it back in the next WL_DISPLAY resumes the
+          listing after the last entry received.  A WL_DISPLAY with an
+          ORDER field lists the entries sorted instead, so "the 20 best
+          rated" is one request with ORDER WL_ORDER_RATING and LIMIT 20.
+
+          A client that can inflate zlib data says so with a COMPRESS
+          field in its WL_HELLO, and the server names the algorithm it
+          picked in its reply.  From then on the server may compress the
+          payload of any reply frame longer than it cares to send as is:
+          such a frame is marked WL_FLAG_COMPRESSED and its payload is the
+          u32 length of the original payload followed by the zlib stream.
+          wl_recv() undoes this, so callers only ever see plain frames.
+          Requests are never compressed.
+
+          All integers are big-endian.  Strings are not NUL terminated, so a
+          title may contain any byte including ':', except NUL itself, since
+          the server stores titles as C strings.  Frames are decoded in
+          place: a struct wl_field points into the receive buffer and is
+          only valid until that buffer is consumed.
+
+******************************************************************************/
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <openssl/ssl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WL_MAGIC "WLST"
+#define WL_MAGIC_LEN 4
+#define WL_VERSION 1
+#define WL_HEADER_SIZE 12
+#define WL_FIELD_HEADER_SIZE 3
+#define WL_MAX_FRAME (1024 * 1024)
+
+#define TITLE_LENGTH 256
+#define DESCRIPTION_LENGTH 500
+#define USERNAME_LENGTH 32
+#define HASH_LENGTH 256
+#define SALT_LENGTH 12
+#define CURSOR_LENGTH (TITLE_LENGTH + 1) // longest CURSOR a reply carries
+
+// Frame types. A reply carries the type of the request it answers.
+enum wl_type {
+  WL_HELLO = 0x01,     // VERSION [TOKEN] -> VERSION [USERNAME]
+  WL_REGISTER = 0x02,  // USERNAME HASH SALT -> TOKEN
+  WL_SALT = 0x03,      // USERNAME -> SALT
+  WL_LOGIN = 0x04,     // USERNAME HASH -> TOKEN
+  WL_CREATE = 0x10,    // TITLE TYPE DESCRIPTION STATUS [RATING]
+  WL_FIND = 0x11,      // TITLE -> entry
+  WL_DISPLAY = 0x12,   // [CURSOR] [LIMIT] [ORDER] [TYPE STATUS RATING
+                       // filters] -> entries [CURSOR]
+  WL_UPDATE = 0x13,    // TITLE and any of NEW_TITLE TYPE DESCRIPTION ...
+  WL_REMOVE = 0x14,    // TITLE
+  WL_SEARCH = 0x15,    // TITLE [MATCH] [LIMIT] -> TITLEs
+  WL_STATS = 0x16,     // -> STATS, see metrics.h
+  WL_BATCH = 0x20,     // request frames -> reply frames
+  WL_REPLICATE = 0x30, // KEY -> EPOCH LSN, see replica.h
+  WL_APPLY = 0x31      // EPOCH HEAD [SNAPSHOT] [LSN] RECORDS... -> LSN
+};
+
+#define WL_FLAG_REPLY 0x01
+#define WL_FLAG_MORE 0x02       // further frames of this reply follow
+#define WL_FLAG_COMPRESSED 0x04 // payload deflated, see wl_deflate()
+
+#define WL_COMPRESS_MIN 1024 // payloads shorter than this are sent as is
+#define WL_COMPRESS_LEVEL 1  // zlib level; listings shrink well even at 1
+
+enum wl_status {
+  WL_OK = 0,
+  WL_NOT_FOUND,
+  WL_EXISTS,
+  WL_BAD_REQUEST,
+  WL_AUTH_FAILED,
+  WL_NOT_LOGGED_IN,
+  WL_SERVER_ERROR,
+  WL_BUSY,     // the server is overloaded; nothing was done, try again later
+  WL_READ_ONLY // a backup following its primary takes no changes
+};
+
+// Field tags. Integer fields are 4 bytes; everything else is a string.
+// An entry is sent as TITLE followed by its TYPE DESCRIPTION STATUS RATING.
+enum wl_tag {
+  WL_F_VERSION = 1, // u32
+  WL_F_USERNAME,
+  WL_F_HASH,
+  WL_F_SALT,
+  WL_F_TITLE,
+  WL_F_TYPE, // u32
+  WL_F_DESCRIPTION,
+  WL_F_STATUS, // u32
+  WL_F_RATING, // u32
+  WL_F_NEW_TITLE,
+  WL_F_MESSAGE,  // human readable error text
+  WL_F_CURSOR,   // opaque resume token of a paged listing
+  WL_F_LIMIT,    // u32, most entries wanted on one page
+  WL_F_MATCH,    // u32, enum wl_match
+  WL_F_TOKEN,    // opaque login token
+  WL_F_KEY,      // replication key
+  WL_F_EPOCH,    // u64, names one run of a primary
+  WL_F_LSN,      // u64, log sequence number
+  WL_F_HEAD,     // u64, the primary's last durable LSN
+  WL_F_SNAPSHOT, // u32, enum wl_snapshot
+  WL_F_RECORDS,  // whole write-ahead log records, see wal.h
+  WL_F_STATS,    // the server's metrics as text, one per line
+  WL_F_COMPRESS, // u32, enum wl_compress bits offered, or the one picked
+  WL_F_ORDER     // u32, enum wl_order
+};
+
+// How a WL_SEARCH query is matched against titles, ignoring ASCII case
+enum wl_match { WL_MATCH_PREFIX = 0, WL_MATCH_SUBSTRING };
+
+// How a WL_DISPLAY listing is sorted. Ties are broken by title.
+enum wl_order {
+  WL_ORDER_KEY = 0, // unsorted: the order the database keeps its keys in
+  WL_ORDER_TITLE,   // alphabetical, ignoring ASCII case
+  WL_ORDER_RATING,  // highest rating first
+  WL_ORDER_RECENT,  // most recently created first
+  WL_ORDERS
+};
+
+// Compression algorithms for reply payloads
+enum wl_compress { WL_COMPRESS_ZLIB = 0x01 };
+
+// Where a WL_APPLY frame stands in a snapshot of the primary's databases
+enum wl_snapshot { WL_SNAPSHOT_FIRST = 1, WL_SNAPSHOT_MORE };
+
+// Struct entry in database
+struct entry {
+  char title[TITLE_LENGTH];
+  char description[DESCRIPTION_LENGTH];
+  int type;
+  int status;
+  int rating;
+  int64_t added; // seconds since the epoch when created, 0 if not known
+};
+
+// A growable byte buffer, used for frames being built and bytes received
+struct wl_buf {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+};
+
+// A decoded frame header. payload points into the buffer it was parsed from.
+struct wl_frame {
+  uint8_t type;
+  uint8_t flags;
+  uint16_t status;
+  uint32_t id;
+  const uint8_t *payload;
+  uint32_t len;
+};
+
+// A decoded field. data points into the frame's payload.
+struct wl_field {
+  uint8_t tag;
+  uint16_t len;
+  const uint8_t *data;
+};
+
+void wl_buf_reserve(struct wl_buf *b, size_t extra);
+void wl_buf_consume(struct wl_buf *b, size_t n);
+void wl_buf_free(struct wl_buf *b);
+
+size_t wl_begin(struct wl_buf *b, uint8_t type, uint8_t flags,
+                uint16_t status, uint32_t id);
+void wl_put_bytes(struct wl_buf *b, uint8_t tag, const void *data,
+                  size_t len);
+void wl_put_str(struct wl_buf *b, uint8_t tag, const char *s);
+void wl_put_u32(struct wl_buf *b, uint8_t tag, uint32_t value);
+void wl_put_u64(struct wl_buf *b, uint8_t tag, uint64_t value);
+void wl_put_entry(struct wl_buf *b, const char *title, size_t title_len,
+                  const struct entry *e);
+void wl_end(struct wl_buf *b, size_t start);
+void wl_amend(struct wl_buf *b, size_t start, uint8_t flags, uint16_t status);
+long wl_deflate(struct wl_buf *b, size_t start);
+long wl_inflate(struct wl_buf *b, size_t start);
+
+long wl_parse(const uint8_t *data, size_t len, struct wl_frame *frame);
+int wl_next(const struct wl_frame *frame, size_t *pos, struct wl_field *field);
+int wl_find(const struct wl_frame *frame, uint8_t tag, struct wl_field *field);
+int wl_next_frame(const struct wl_frame *batch, size_t *pos,
+                  struct wl_frame *frame);
+uint32_t wl_u32(const struct wl_field *field);
+uint64_t wl_u64(const struct wl_field *field);
+void wl_copy_str(const struct wl_field *field, char *dst, size_t size);
+const char *wl_status_str(uint16_t status);
+
+int wl_send(SSL *ssl, struct wl_buf *out);
+long wl_recv(SSL *ssl, struct wl_buf *in, struct wl_frame *frame);
+
+#endif
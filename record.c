@@ -0,0 +1,152 @@
+/******************************************************************************
+
+PROGRAM:  record.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Encoding and decoding of watchlist.db values, see record.h.
+
+******************************************************************************/
+#include "record.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/******************************************************************************
+
+  Values in watchlist.db used to be stored as "type:description:status:rating",
+  and the text protocol still sends entries that way.  Descriptions sent with
+  the binary protocol may contain ':', so decoding takes the type from the
+  front and status and rating from the back.  Values written by old text
+  clients without a rating have only three fields.
+
+ ******************************************************************************/
+static bool is_number(const char *p, const char *end) {
+  if (p < end && *p == '-')
+    p++;
+  if (p == end)
+    return false;
+  for (; p < end; p++)
+    if (*p < '0' || *p > '9')
+      return false;
+  return true;
+}
+
+// atoi() of the text from p to end, which need not be NUL terminated
+static int to_int(const char *p, const char *end) {
+  bool negative = p < end && *p == '-';
+  int n = 0;
+
+  for (p += negative; p < end && *p >= '0' && *p <= '9'; p++)
+    n = n * 10 + (*p - '0');
+  return negative ? -n : n;
+}
+
+void record_decode_text(const char *value, int len, struct entry *e) {
+  const char *end = value + len;
+  const char *desc, *last, *prev;
+
+  e->type = e->status = e->rating = 0;
+  e->added = 0;
+  e->description[0] = '\0';
+  if ((desc = memchr(value, ':', len)) == NULL)
+    return;
+  e->type = to_int(value, desc);
+  desc++;
+
+  // Walk back over ":status:rating" (or just ":status")
+  last = end;
+  while (last > desc && last[-1] != ':')
+    last--;
+  if (last == desc) {
+    snprintf(e->description, sizeof(e->description), "%.*s",
+             (int)(end - desc), desc);
+    return;
+  }
+  prev = last - 1;
+  while (prev > desc && prev[-1] != ':')
+    prev--;
+  if (prev > desc && is_number(prev, last - 1)) {
+    e->status = to_int(prev, last - 1);
+    e->rating = to_int(last, end);
+    end = prev - 1;
+  } else {
+    e->status = to_int(last, end);
+    end = last - 1;
+  }
+  snprintf(e->description, sizeof(e->description), "%.*s", (int)(end - desc),
+           desc);
+}
+
+static int32_t get_i32(const unsigned char *p) {
+  return (int32_t)((uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+}
+
+static void put_i32(unsigned char *p, int32_t v) {
+  p[0] = (uint32_t)v >> 24;
+  p[1] = (uint32_t)v >> 16;
+  p[2] = (uint32_t)v >> 8;
+  p[3] = v;
+}
+
+static int64_t get_i64(const unsigned char *p) {
+  return (int64_t)((uint64_t)(uint32_t)get_i32(p) << 32 |
+                   (uint32_t)get_i32(p + 4));
+}
+
+static void put_i64(unsigned char *p, int64_t v) {
+  put_i32(p, (uint64_t)v >> 32);
+  put_i32(p + 4, v);
+}
+
+bool record_is_binary(const char *value, int len) {
+  return len > 0 && (unsigned char)value[0] == RECORD_V1;
+}
+
+// Decode a value in either format. A binary record too short for what its
+// header claims decodes as an empty entry.
+void record_decode(const char *value, int len, struct entry *e) {
+  const unsigned char *p = (const unsigned char *)value;
+  size_t desc_len;
+
+  if (!record_is_binary(value, len)) {
+    record_decode_text(value, len, e);
+    return;
+  }
+  e->type = e->status = e->rating = 0;
+  e->added = 0;
+  e->description[0] = '\0';
+  if (len < RECORD_HEADER)
+    return;
+  desc_len = p[13] << 8 | p[14];
+  if (desc_len > (size_t)len - RECORD_HEADER)
+    return;
+  if ((size_t)len >= RECORD_HEADER + desc_len + RECORD_ADDED)
+    e->added = get_i64(p + RECORD_HEADER + desc_len);
+  if (desc_len >= sizeof(e->description))
+    desc_len = sizeof(e->description) - 1;
+  e->type = get_i32(p + 1);
+  e->status = get_i32(p + 5);
+  e->rating = get_i32(p + 9);
+  memcpy(e->description, p + RECORD_HEADER, desc_len);
+  e->description[desc_len] = '\0';
+}
+
+// Encode an entry as a binary record. Like snprintf(), returns the length
+// the record needs and writes nothing if that is more than 'size'.
+int record_encode(const struct entry *e, char *value, size_t size) {
+  unsigned char *p = (unsigned char *)value;
+  size_t desc_len = strnlen(e->description, sizeof(e->description));
+
+  if (RECORD_HEADER + desc_len + RECORD_ADDED > size)
+    return RECORD_HEADER + desc_len + RECORD_ADDED;
+  p[0] = RECORD_V1;
+  put_i32(p + 1, e->type);
+  put_i32(p + 5, e->status);
+  put_i32(p + 9, e->rating);
+  p[13] = desc_len >> 8;
+  p[14] = desc_len;
+  memcpy(p + RECORD_HEADER, e->description, desc_len);
+  put_i64(p + RECORD_HEADER + desc_len, e->added);
+  return RECORD_HEADER + desc_len + RECORD_ADDED;
+}
@@ -0,0 +1,47 @@
+/******************************************************************************
+
+PROGRAM:  record.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Encoding of struct entry as a value in watchlist.db.  Everything
+          that reads or writes watchlist records goes through here, so the
+          layout is known in one place only.
+
+          Records are written in a fixed binary layout, version 1:
+
+            u8  format       RECORD_V1
+            i32 type
+            i32 status
+            i32 rating
+            u16 length       of the description
+            ... description  not NUL terminated
+            i64 added        optional, see struct entry
+
+          all integers big-endian, so a read copies the fields out without
+          parsing anything.  The format byte has its top bit set, which no
+          value in the old "type:description:status:rating" text form can
+          start with; record_decode() still reads those, and wl-convert
+          rewrites a database of them in place.  Records written before
+          the creation time was kept end after the description; they
+          decode with added 0, and older readers ignore the extra bytes.
+
+******************************************************************************/
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "protocol.h"
+
+#define RECORD_V1 0x81
+#define RECORD_HEADER 15
+#define RECORD_ADDED 8 // bytes of the trailing creation time
+#define RECORD_MAX (RECORD_HEADER + DESCRIPTION_LENGTH + RECORD_ADDED)
+
+bool record_is_binary(const char *value, int len);
+void record_decode(const char *value, int len, struct entry *e);
+void record_decode_text(const char *value, int len, struct entry *e);
+int record_encode(const struct entry *e, char *value, size_t size);
+
+#endif
@@ -0,0 +1,623 @@
+/******************************************************************************
+
+PROGRAM:  replica.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Replication between a primary and its backups, see replica.h.
+          The primary runs one thread per backup, each with its own
+          blocking TLS connection, so a slow or unreachable backup never
+          holds up the others or the event loops.  The backlog is a list
+          of the runs of records the log committed, oldest first.
+
+******************************************************************************/
+#include "replica.h"
+
+#include <netdb.h>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "protocol.h"
+#include "storage.h"
+#include "wal.h"
+
+#define KEY_LENGTH 256
+
+// Records committed together, LSNs first_lsn to last_lsn
+struct chunk {
+  struct chunk *next;
+  uint64_t first_lsn;
+  uint64_t last_lsn;
+  size_t len;
+  unsigned char data[];
+};
+
+// One backup and the thread feeding it. The counters are under ring_lock.
+struct backup {
+  char name[64];
+  char host[64];
+  char port[8];
+  const char *state;
+  uint64_t acked_lsn;
+  unsigned long snapshots;
+};
+
+static uint8_t replica_key[KEY_LENGTH];
+static size_t key_len;
+static uint64_t epoch;
+static SSL_CTX *client_ctx;
+
+static struct backup backups[REPLICA_MAX_BACKUPS];
+static int num_backups;
+
+// The backlog, all protected by ring_lock
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_grew;
+static struct chunk *oldest, *newest;
+static size_t ring_bytes;
+static uint64_t published_lsn;
+
+// This server as a backup, all protected by follow_lock
+static pthread_mutex_t follow_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool attached;
+static uint64_t follow_epoch, follow_lsn, follow_head;
+static uint64_t follow_heard; // ns
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/******************************************************************************
+
+  Name a backup, as "host:port", for replica_start() to feed.  Returns
+  false if the address is malformed or there are too many backups.
+
+ ******************************************************************************/
+bool replica_add_backup(const char *address) {
+  struct backup *b = &backups[num_backups];
+  const char *colon = strrchr(address, ':');
+
+  if (num_backups == REPLICA_MAX_BACKUPS || colon == NULL ||
+      colon == address || colon[1] == '\0' ||
+      (size_t)(colon - address) >= sizeof(b->host) ||
+      strlen(colon + 1) >= sizeof(b->port))
+    return false;
+  snprintf(b->name, sizeof(b->name), "%s", address);
+  snprintf(b->host, sizeof(b->host), "%.*s", (int)(colon - address), address);
+  snprintf(b->port, sizeof(b->port), "%s", colon + 1);
+  b->state = "connecting";
+  num_backups++;
+  return true;
+}
+
+// Called by the log's commit thread with every run of durable records
+static void publish(const unsigned char *records, size_t len, uint64_t lsn) {
+  struct chunk *c, *old;
+  struct wal_record r;
+  size_t off = 0, size;
+  uint64_t count = 0;
+
+  while ((size = wal_read(records + off, len - off, &r)) > 0) {
+    off += size;
+    count++;
+  }
+  if (count == 0)
+    return;
+  if ((c = malloc(sizeof(*c) + off)) == NULL) {
+    fprintf(stderr, "Server: Out of memory keeping the replication backlog\n");
+    exit(EXIT_FAILURE);
+  }
+  c->next = NULL;
+  c->first_lsn = lsn - count + 1;
+  c->last_lsn = lsn;
+  c->len = off;
+  memcpy(c->data, records, off);
+
+  pthread_mutex_lock(&ring_lock);
+  if (newest)
+    newest->next = c;
+  else
+    oldest = c;
+  newest = c;
+  ring_bytes += c->len;
+  while (ring_bytes > REPLICA_BACKLOG && oldest != newest) {
+    old = oldest;
+    oldest = old->next;
+    ring_bytes -= old->len;
+    free(old);
+  }
+  published_lsn = lsn;
+  pthread_cond_broadcast(&ring_grew);
+  pthread_mutex_unlock(&ring_lock);
+}
+
+// Whether the records after 'lsn' can still be streamed. Called with
+// ring_lock held.
+static bool in_backlog(uint64_t lsn) {
+  return lsn >= published_lsn || (oldest && lsn + 1 >= oldest->first_lsn);
+}
+
+/******************************************************************************
+
+  Copy whole records following *lsn from the backlog into 'buf', up to
+  REPLICA_FRAME bytes, waiting up to REPLICA_HEARTBEAT for some to be
+  committed, and advance *lsn past them.  Returns -1 if the records after
+  *lsn have left the backlog.
+
+ ******************************************************************************/
+static int copy_backlog(uint64_t *lsnp, struct wl_buf *buf, uint64_t *head) {
+  struct timespec deadline;
+  struct wal_record r;
+  struct chunk *c;
+  uint64_t lsn = *lsnp, n;
+  size_t off, size;
+  bool full = false;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += REPLICA_HEARTBEAT;
+
+  pthread_mutex_lock(&ring_lock);
+  while (lsn >= published_lsn &&
+         pthread_cond_timedwait(&ring_grew, &ring_lock, &deadline) == 0)
+    ;
+  *head = published_lsn;
+  if (!in_backlog(lsn)) {
+    pthread_mutex_unlock(&ring_lock);
+    return -1;
+  }
+  for (c = oldest; c != NULL && !full; c = c->next) {
+    if (c->last_lsn <= lsn)
+      continue;
+    for (off = 0, n = c->first_lsn;
+         (size = wal_read(c->data + off, c->len - off, &r)) > 0; n++) {
+      if (n > lsn) {
+        if (buf->len + size > REPLICA_FRAME && buf->len > 0) {
+          full = true;
+          break;
+        }
+        wl_buf_reserve(buf, size);
+        memcpy(buf->data + buf->len, c->data + off, size);
+        buf->len += size;
+        lsn = n;
+      }
+      off += size;
+    }
+  }
+  pthread_mutex_unlock(&ring_lock);
+  *lsnp = lsn;
+  return 0;
+}
+
+static void set_state(struct backup *b, const char *state) {
+  pthread_mutex_lock(&ring_lock);
+  b->state = state;
+  pthread_mutex_unlock(&ring_lock);
+}
+
+// Add whole records as RECORDS fields, each as full as a field may be
+static void put_records(struct wl_buf *out, const unsigned char *data,
+                        size_t len) {
+  struct wal_record r;
+  size_t start = 0, off = 0, size;
+
+  while ((size = wal_read(data + off, len - off, &r)) > 0) {
+    if (off + size - start > UINT16_MAX) {
+      wl_put_bytes(out, WL_F_RECORDS, data + start, off - start);
+      start = off;
+    }
+    off += size;
+  }
+  if (off > start)
+    wl_put_bytes(out, WL_F_RECORDS, data + start, off - start);
+}
+
+/******************************************************************************
+
+  Send one WL_APPLY frame and wait for the backup to have it on disk.
+  'snapshot' is 0 outside a snapshot.  'lsn' is where the backup stands
+  once it has applied the frame, or NULL if the frame leaves it where it
+  was (a heartbeat) or between positions (inside a snapshot).  Returns -1
+  if the connection failed or the backup refused the frame.
+
+ ******************************************************************************/
+static int send_apply(struct backup *b, SSL *ssl, struct wl_buf *out,
+                      struct wl_buf *in, int snapshot, const uint64_t *lsn,
+                      uint64_t head, const unsigned char *records,
+                      size_t len) {
+  struct wl_frame reply;
+  struct wl_field f;
+  size_t start;
+  long size;
+
+  start = wl_begin(out, WL_APPLY, 0, 0, 0);
+  wl_put_u64(out, WL_F_EPOCH, epoch);
+  wl_put_u64(out, WL_F_HEAD, head);
+  if (snapshot)
+    wl_put_u32(out, WL_F_SNAPSHOT, snapshot);
+  if (lsn)
+    wl_put_u64(out, WL_F_LSN, *lsn);
+  put_records(out, records, len);
+  wl_end(out, start);
+  if (wl_send(ssl, out) < 0 || (size = wl_recv(ssl, in, &reply)) < 0)
+    return -1;
+  if (reply.type != WL_APPLY || reply.status != WL_OK) {
+    LOG(LOGGER_WARN, "Server: Backup %s refused replication: %s", b->name,
+        wl_status_str(reply.status));
+    return -1;
+  }
+  if (wl_find(&reply, WL_F_LSN, &f)) {
+    pthread_mutex_lock(&ring_lock);
+    b->acked_lsn = wl_u64(&f);
+    pthread_mutex_unlock(&ring_lock);
+  }
+  wl_buf_consume(in, size);
+  return 0;
+}
+
+// Add a record of every key in a database to 'snap'. Called with the
+// database's lock held.
+static void snapshot_database(struct database *db, enum wal_op op,
+                              struct wl_buf *snap) {
+  struct wal_record r = {op};
+  datum key, next, value;
+
+  for (key = storage_firstkey(db); key.dptr != NULL; key = next) {
+    value = storage_fetch(db, key);
+    if (value.dptr != NULL) {
+      r.key = key.dptr;
+      r.key_len = key.dsize;
+      r.value = value.dptr;
+      r.value_len = value.dsize;
+      wl_buf_reserve(snap, WAL_RECORD_SIZE(r.key_len, r.value_len));
+      snap->len += wal_write(snap->data + snap->len, &r);
+      free(value.dptr);
+    }
+    next = storage_nextkey(db, key);
+    free(key.dptr);
+  }
+}
+
+/******************************************************************************
+
+  Send the backup everything both databases hold.  With both locks held
+  nothing can be stored, so the copy is exactly the state after the last
+  record appended to the log, whose LSN it ends with and stores in *lsn.
+  Returns -1 if the connection failed.
+
+ ******************************************************************************/
+static int send_snapshot(struct backup *b, SSL *ssl, struct wl_buf *out,
+                         struct wl_buf *in, uint64_t *lsn) {
+  struct wl_buf snap = {NULL, 0, 0};
+  struct wal_record r;
+  size_t off = 0, end, size, total;
+  uint64_t head;
+  int part = WL_SNAPSHOT_FIRST;
+
+  pthread_mutex_lock(&ring_lock);
+  b->state = "snapshot";
+  b->snapshots++;
+  head = published_lsn;
+  pthread_mutex_unlock(&ring_lock);
+
+  storage_rdlock(&users_db);
+  storage_rdlock(&watchlist_db);
+  *lsn = wal_last_lsn();
+  snapshot_database(&users_db, WAL_USER_STORE, &snap);
+  snapshot_database(&watchlist_db, WAL_STORE, &snap);
+  storage_unlock(&watchlist_db);
+  storage_unlock(&users_db);
+
+  do {
+    for (end = off; end < snap.len && end - off < REPLICA_FRAME; end += size)
+      if ((size = wal_read(snap.data + end, snap.len - end, &r)) == 0)
+        break;
+    if (send_apply(b, ssl, out, in, part, end == snap.len ? lsn : NULL, head,
+                   snap.data + off, end - off) < 0) {
+      wl_buf_free(&snap);
+      return -1;
+    }
+    part = WL_SNAPSHOT_MORE;
+    off = end;
+  } while (off < snap.len);
+  total = snap.len;
+  wl_buf_free(&snap);
+  LOG(LOGGER_INFO, "Server: Sent a snapshot of %zu bytes to backup %s", total,
+      b->name);
+  return 0;
+}
+
+// Open a TLS connection to a backup. Returns NULL if it cannot be reached.
+static SSL *connect_backup(struct backup *b, int *fdp) {
+  struct addrinfo hints = {0}, *res, *ai;
+  struct timeval tv = {REPLICA_TIMEOUT, 0};
+  SSL *ssl;
+  int fd = -1;
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(b->host, b->port, &hints, &res) != 0)
+    return NULL;
+  for (ai = res; ai != NULL; ai = ai->ai_next) {
+    if ((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                     ai->ai_protocol)) < 0)
+      continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd < 0)
+    return NULL;
+
+  // A backup that stops answering must not stall its thread for good
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  ssl = SSL_new(client_ctx);
+  SSL_set_fd(ssl, fd);
+  if (SSL_connect(ssl) != 1) {
+    LOG(LOGGER_WARN, "Server: Unable to establish TLS with backup %s", b->name);
+    logger_ssl_errors(LOGGER_WARN);
+    SSL_free(ssl);
+    close(fd);
+    return NULL;
+  }
+  *fdp = fd;
+  return ssl;
+}
+
+/******************************************************************************
+
+  Log in to a backup and keep it up to date until the connection fails.
+
+ ******************************************************************************/
+static void feed_backup(struct backup *b, SSL *ssl) {
+  struct wl_buf out = {NULL, 0, 0}, in = {NULL, 0, 0}, records = {NULL, 0, 0};
+  struct wl_frame reply;
+  struct wl_field f;
+  uint64_t their_epoch = 0, lsn = 0, head;
+  size_t start;
+  long size;
+  bool caught_up;
+
+  wl_buf_reserve(&out, WL_MAGIC_LEN);
+  memcpy(out.data, WL_MAGIC, WL_MAGIC_LEN);
+  out.len = WL_MAGIC_LEN;
+  start = wl_begin(&out, WL_HELLO, 0, 0, 0);
+  wl_put_u32(&out, WL_F_VERSION, WL_VERSION);
+  wl_end(&out, start);
+  start = wl_begin(&out, WL_REPLICATE, 0, 0, 0);
+  wl_put_bytes(&out, WL_F_KEY, replica_key, key_len);
+  wl_end(&out, start);
+  if (wl_send(ssl, &out) < 0 || (size = wl_recv(ssl, &in, &reply)) < 0)
+    goto done;
+  wl_buf_consume(&in, size);
+  if ((size = wl_recv(ssl, &in, &reply)) < 0)
+    goto done;
+  if (reply.type != WL_REPLICATE || reply.status != WL_OK) {
+    LOG(LOGGER_WARN, "Server: Backup %s refused replication: %s", b->name,
+        wl_status_str(reply.status));
+    goto done;
+  }
+  if (wl_find(&reply, WL_F_EPOCH, &f))
+    their_epoch = wl_u64(&f);
+  if (wl_find(&reply, WL_F_LSN, &f))
+    lsn = wl_u64(&f);
+  wl_buf_consume(&in, size);
+  LOG(LOGGER_INFO, "Server: Replicating to backup %s", b->name);
+
+  pthread_mutex_lock(&ring_lock);
+  caught_up = their_epoch == epoch && in_backlog(lsn);
+  pthread_mutex_unlock(&ring_lock);
+  if (!caught_up && send_snapshot(b, ssl, &out, &in, &lsn) < 0)
+    goto done;
+
+  set_state(b, "streaming");
+  for (;;) {
+    records.len = 0;
+    if (copy_backlog(&lsn, &records, &head) < 0) {
+      // Fell out of the backlog; start over from a snapshot
+      if (send_snapshot(b, ssl, &out, &in, &lsn) < 0)
+        goto done;
+      set_state(b, "streaming");
+      continue;
+    }
+    if (send_apply(b, ssl, &out, &in, 0, records.len > 0 ? &lsn : NULL, head,
+                   records.data, records.len) < 0)
+      goto done;
+  }
+
+done:
+  wl_buf_free(&out);
+  wl_buf_free(&in);
+  wl_buf_free(&records);
+}
+
+static void *backup_main(void *arg) {
+  struct backup *b = arg;
+  SSL *ssl;
+  int fd;
+
+  for (;;) {
+    if ((ssl = connect_backup(b, &fd)) != NULL) {
+      feed_backup(b, ssl);
+      SSL_free(ssl);
+      close(fd);
+      LOG(LOGGER_WARN, "Server: Lost backup %s", b->name);
+    }
+    ERR_clear_error();
+    set_state(b, "down");
+    sleep(REPLICA_RETRY);
+  }
+  return NULL;
+}
+
+/******************************************************************************
+
+  Load the replication key, if this server has one, and pick the epoch.  On
+  a primary, also start collecting committed records into the backlog; this
+  has to happen before the log starts.  Exits if backups were named but
+  there is no key.
+
+ ******************************************************************************/
+void replica_init(void) {
+  pthread_condattr_t attr;
+  FILE *fp;
+
+  if ((fp = fopen(REPLICA_KEY_FILE, "r")) != NULL) {
+    key_len = fread(replica_key, 1, sizeof(replica_key), fp);
+    while (key_len > 0 && (replica_key[key_len - 1] == '\n' ||
+                           replica_key[key_len - 1] == '\r'))
+      key_len--;
+    fclose(fp);
+  }
+  if (num_backups > 0 && key_len == 0) {
+    fprintf(stderr, "Server: Replication needs a key in %s\n",
+            REPLICA_KEY_FILE);
+    exit(EXIT_FAILURE);
+  }
+
+  while (epoch == 0)
+    if (RAND_bytes((unsigned char *)&epoch, sizeof(epoch)) != 1) {
+      fprintf(stderr, "Server: Unable to pick a replication epoch\n");
+      exit(EXIT_FAILURE);
+    }
+
+  // Backlog deadlines are on the monotonic clock
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&ring_grew, &attr);
+  pthread_condattr_destroy(&attr);
+
+  if (num_backups > 0)
+    wal_subscribe(publish);
+}
+
+/******************************************************************************
+
+  Start a thread feeding each backup.  Called after the log has started
+  and OpenSSL has been initialized.
+
+ ******************************************************************************/
+void replica_start(void) {
+  pthread_t thread;
+
+  if (num_backups == 0)
+    return;
+  client_ctx = SSL_CTX_new(TLS_client_method());
+  if (client_ctx == NULL ||
+      SSL_CTX_load_verify_locations(client_ctx, REPLICA_CA_FILE, NULL) != 1) {
+    fprintf(stderr, "Server: Unable to load %s to check backups\n",
+            REPLICA_CA_FILE);
+    ERR_print_errors_fp(stderr);
+    exit(EXIT_FAILURE);
+  }
+  SSL_CTX_set_verify(client_ctx, SSL_VERIFY_PEER, NULL);
+
+  for (int i = 0; i < num_backups; i++) {
+    if (pthread_create(&thread, NULL, backup_main, &backups[i]) != 0) {
+      fprintf(stderr, "Server: Unable to start replication to %s\n",
+              backups[i].name);
+      exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread);
+  }
+}
+
+/******************************************************************************
+
+  Backup side.  A connection that presents the right key becomes this
+  server's one link to its primary.  Returns WL_OK, WL_AUTH_FAILED for a
+  wrong key, or WL_BUSY if another primary is connected already.
+
+ ******************************************************************************/
+uint16_t replica_attach(const uint8_t *key, size_t len) {
+  uint16_t status = WL_OK;
+
+  if (key_len == 0 || len != key_len || CRYPTO_memcmp(key, replica_key, len))
+    return WL_AUTH_FAILED;
+  pthread_mutex_lock(&follow_lock);
+  if (attached)
+    status = WL_BUSY;
+  else {
+    attached = true;
+    follow_heard = now_ns();
+  }
+  pthread_mutex_unlock(&follow_lock);
+  return status;
+}
+
+void replica_detach(void) {
+  pthread_mutex_lock(&follow_lock);
+  attached = false;
+  pthread_mutex_unlock(&follow_lock);
+}
+
+bool replica_attached(void) {
+  bool ret;
+
+  pthread_mutex_lock(&follow_lock);
+  ret = attached;
+  pthread_mutex_unlock(&follow_lock);
+  return ret;
+}
+
+// The primary run and LSN this server has applied up to
+void replica_position(uint64_t *epochp, uint64_t *lsnp) {
+  pthread_mutex_lock(&follow_lock);
+  *epochp = follow_epoch;
+  *lsnp = follow_lsn;
+  pthread_mutex_unlock(&follow_lock);
+}
+
+// A WL_APPLY frame has been applied. A NULL 'lsn' leaves the position as
+// it was; an 'epoch' of 0 marks it unknown, as in the middle of a snapshot.
+void replica_applied(uint64_t epoch_, const uint64_t *lsn, uint64_t head) {
+  pthread_mutex_lock(&follow_lock);
+  if (epoch_ == 0)
+    follow_epoch = follow_lsn = 0;
+  else if (lsn != NULL) {
+    follow_epoch = epoch_;
+    follow_lsn = *lsn;
+  }
+  follow_head = head;
+  follow_heard = now_ns();
+  pthread_mutex_unlock(&follow_lock);
+}
+
+void replica_get_stats(struct replica_stats *stats) {
+  pthread_mutex_lock(&ring_lock);
+  stats->backups = num_backups;
+  for (int i = 0; i < num_backups; i++) {
+    snprintf(stats->backup[i].name, sizeof(stats->backup[i].name), "%s",
+             backups[i].name);
+    stats->backup[i].state = backups[i].state;
+    stats->backup[i].acked_lsn = backups[i].acked_lsn;
+    stats->backup[i].behind = published_lsn > backups[i].acked_lsn
+                                  ? published_lsn - backups[i].acked_lsn
+                                  : 0;
+    stats->backup[i].snapshots = backups[i].snapshots;
+  }
+  pthread_mutex_unlock(&ring_lock);
+
+  pthread_mutex_lock(&follow_lock);
+  stats->following = attached;
+  stats->epoch = follow_epoch;
+  stats->applied_lsn = follow_lsn;
+  stats->behind = follow_head > follow_lsn ? follow_head - follow_lsn : 0;
+  stats->heard_secs = attached ? (now_ns() - follow_heard) / 1e9 : 0.0;
+  pthread_mutex_unlock(&follow_lock);
+}
@@ -0,0 +1,82 @@
+/******************************************************************************
+
+PROGRAM:  replica.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Streaming replication from a primary server to its backups, so
+          the server ssl-client falls back to on BACKUP_PORT has the same
+          users and watchlist as the one that went away.
+
+          A primary started with -r host:port keeps a TLS connection open
+          to each backup named, checking that the backup presents the
+          certificate in REPLICA_CA_FILE, and logs in with WL_REPLICATE and
+          the key in REPLICA_KEY_FILE, which both servers must have.  The
+          backup answers with how far it got: the epoch, a random number
+          naming one run of the primary, and the last LSN of that run it
+          has applied.
+
+          Every record the primary's write-ahead log commits (see wal.h) is
+          kept in a backlog of the last REPLICA_BACKLOG bytes.  A backup
+          whose position is still in the backlog is sent the records after
+          it; one that is too far behind, or has never followed this run of
+          the primary, first gets a snapshot of both databases and then the
+          records from the snapshot's LSN on.  Records are applied on the
+          backup asynchronously: the primary never waits for its backups
+          before answering its own clients.  A backup acknowledges each
+          WL_APPLY frame once its own log has it on disk, and both sides
+          report how many records the backup is behind.
+
+          While a primary is connected, a backup answers changes from its
+          own clients with WL_READ_ONLY, so the two cannot drift apart.
+          Once the primary is gone the backup takes changes itself.
+
+******************************************************************************/
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define REPLICA_KEY_FILE "replica.key"
+#define REPLICA_CA_FILE "cert.pem"
+#define REPLICA_BACKLOG (8 * 1024 * 1024) // bytes of records kept
+#define REPLICA_MAX_BACKUPS 8
+#define REPLICA_FRAME (512 * 1024)  // most record bytes in one WL_APPLY
+#define REPLICA_RETRY 1             // seconds between attempts to reconnect
+#define REPLICA_TIMEOUT 10          // seconds a backup may take to answer
+#define REPLICA_HEARTBEAT 1         // seconds between frames when idle
+
+// How replication looks from this server
+struct replica_stats {
+  int backups;
+  struct {
+    char name[64];     // host:port
+    const char *state; // "connecting", "snapshot", "streaming" or "down"
+    uint64_t acked_lsn;
+    uint64_t behind; // records
+    unsigned long snapshots;
+  } backup[REPLICA_MAX_BACKUPS];
+
+  bool following; // a primary is connected to this server
+  uint64_t epoch;
+  uint64_t applied_lsn;
+  uint64_t behind;   // records, as of the primary's last frame
+  double heard_secs; // since the primary's last frame
+};
+
+// Primary
+bool replica_add_backup(const char *address);
+void replica_init(void);
+void replica_start(void);
+
+// Backup
+uint16_t replica_attach(const uint8_t *key, size_t len);
+void replica_detach(void);
+bool replica_attached(void);
+void replica_position(uint64_t *epoch, uint64_t *lsn);
+void replica_applied(uint64_t epoch, const uint64_t *lsn, uint64_t head);
+
+void replica_get_stats(struct replica_stats *stats);
+
+#endif
@@ -0,0 +1,322 @@
+/******************************************************************************
+
+PROGRAM:  search.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Title search, see search.h.
+
+          Each title is broken into n-grams of its lowercase form: every
+          three byte sequence in it, plus its first one to PREFIX_GRAMS bytes
+          as separate "start" grams.  Each gram has a posting list of the
+          titles containing it.  A query walks the shortest list among the
+          grams it must contain: its three byte grams, and for a prefix
+          query also the start gram of its first bytes.  Every candidate is
+          checked against the whole query and the walk stops at the result
+          limit, so a query costs time in proportion to the results it
+          returns rather than to the number of titles.
+
+          Titles are numbered in the order they are added and posting lists
+          hold those numbers in increasing order.  Removing a title only
+          marks its number dead; once dead numbers outnumber live ones
+          everything is renumbered and the lists rebuilt.
+
+******************************************************************************/
+#define _GNU_SOURCE // memmem()
+
+#include "search.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+
+#define COMPACT_MIN 1024 // dead titles tolerated before renumbering
+#define PREFIX_GRAMS 8   // longest start gram
+
+// One indexed title. text holds the title followed by its lowercase copy.
+struct title {
+  uint32_t next; // hash chain: number + 1 of the next title, 0 at the end
+  uint32_t len;
+  char *text;    // NULL once removed
+};
+
+// The posting list of one n-gram
+struct gram {
+  uint32_t next; // hash chain: index + 1 of the next gram, 0 at the end
+  uint32_t key;  // see gram_key()
+  uint32_t *ids;
+  uint32_t len;
+  uint32_t cap;
+};
+
+static struct title *titles;
+static uint32_t ntitles, titles_cap, live_titles;
+static uint32_t *title_buckets, title_nbuckets;
+
+static struct gram *grams;
+static uint32_t ngrams, grams_cap;
+static uint32_t *gram_buckets, gram_nbuckets;
+
+static pthread_rwlock_t search_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void *grow(void *array, uint32_t *cap, size_t size, uint32_t need) {
+  uint32_t n = *cap ? *cap : 64;
+
+  if (need <= *cap)
+    return array;
+  while (n < need)
+    n *= 2;
+  if ((array = realloc(array, n * size)) == NULL) {
+    fprintf(stderr, "Server: Out of memory building the search index\n");
+    exit(EXIT_FAILURE);
+  }
+  *cap = n;
+  return array;
+}
+
+// FNV-1a
+static uint32_t hash_bytes(const void *data, size_t len) {
+  const unsigned char *p = data;
+  uint32_t h = 2166136261u;
+
+  while (len--)
+    h = (h ^ *p++) * 16777619u;
+  return h;
+}
+
+static void lower(char *dst, const char *src, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    dst[i] = src[i] >= 'A' && src[i] <= 'Z' ? src[i] + 'a' - 'A' : src[i];
+}
+
+// Kind 0 is a three byte gram anywhere in a title, kept in the low bytes.
+// Kinds 1 to PREFIX_GRAMS are the first that many bytes of a title; those
+// longer than three are hashed, and the final check of every candidate
+// weeds out the odd collision.
+static uint32_t gram_key(int kind, const char *p, int n) {
+  uint32_t key = (uint32_t)kind << 24;
+
+  if (n > 3)
+    return key | (hash_bytes(p, n) & 0xffffff);
+  for (int i = 0; i < n; i++)
+    key |= (uint32_t)(unsigned char)p[i] << (8 * (2 - i));
+  return key;
+}
+
+static struct gram *find_gram(uint32_t key) {
+  uint32_t i;
+
+  if (gram_nbuckets == 0)
+    return NULL;
+  for (i = gram_buckets[hash_bytes(&key, sizeof(key)) & (gram_nbuckets - 1)];
+       i; i = grams[i - 1].next)
+    if (grams[i - 1].key == key)
+      return &grams[i - 1];
+  return NULL;
+}
+
+// Double the bucket array of a chain table once it is as full as it is wide
+static uint32_t *grow_buckets(uint32_t *buckets, uint32_t *nbuckets,
+                              uint32_t count) {
+  if (count < *nbuckets)
+    return buckets;
+  *nbuckets = *nbuckets ? *nbuckets * 2 : 1024;
+  free(buckets);
+  if ((buckets = calloc(*nbuckets, sizeof(*buckets))) == NULL) {
+    fprintf(stderr, "Server: Out of memory building the search index\n");
+    exit(EXIT_FAILURE);
+  }
+  return buckets;
+}
+
+static void add_posting(uint32_t key, uint32_t id) {
+  struct gram *g = find_gram(key);
+  uint32_t b, n = gram_nbuckets;
+
+  if (g == NULL) {
+    gram_buckets = grow_buckets(gram_buckets, &gram_nbuckets, ngrams);
+    if (gram_nbuckets != n) {
+      for (uint32_t i = 0; i < ngrams; i++) {
+        b = hash_bytes(&grams[i].key, sizeof(key)) & (gram_nbuckets - 1);
+        grams[i].next = gram_buckets[b];
+        gram_buckets[b] = i + 1;
+      }
+    }
+    grams = grow(grams, &grams_cap, sizeof(*grams), ngrams + 1);
+    g = &grams[ngrams++];
+    memset(g, 0, sizeof(*g));
+    g->key = key;
+    b = hash_bytes(&key, sizeof(key)) & (gram_nbuckets - 1);
+    g->next = gram_buckets[b];
+    gram_buckets[b] = ngrams;
+  }
+  // A title repeating a gram lists it once
+  if (g->len > 0 && g->ids[g->len - 1] == id)
+    return;
+  g->ids = grow(g->ids, &g->cap, sizeof(*g->ids), g->len + 1);
+  g->ids[g->len++] = id;
+}
+
+static void add_grams(uint32_t id) {
+  const char *s = titles[id].text + titles[id].len;
+  uint32_t len = titles[id].len;
+
+  for (uint32_t k = 1; k <= PREFIX_GRAMS && k <= len; k++)
+    add_posting(gram_key(k, s, k), id);
+  for (uint32_t i = 0; i + 3 <= len; i++)
+    add_posting(gram_key(0, s + i, 3), id);
+}
+
+static void link_title(uint32_t id) {
+  uint32_t b, n = title_nbuckets;
+
+  // Titles numbered below id are the ones already linked, also while
+  // compact() relinks everything in order
+  title_buckets = grow_buckets(title_buckets, &title_nbuckets, live_titles);
+  if (title_nbuckets != n)
+    for (uint32_t i = 0; i < id; i++)
+      if (titles[i].text) {
+        b = hash_bytes(titles[i].text, titles[i].len) & (title_nbuckets - 1);
+        titles[i].next = title_buckets[b];
+        title_buckets[b] = i + 1;
+      }
+  b = hash_bytes(titles[id].text, titles[id].len) & (title_nbuckets - 1);
+  titles[id].next = title_buckets[b];
+  title_buckets[b] = id + 1;
+  live_titles++;
+}
+
+// The chain link pointing at a title, or NULL if it is not indexed
+static uint32_t *find_title(const char *title, size_t len) {
+  uint32_t *link;
+
+  if (title_nbuckets == 0)
+    return NULL;
+  for (link = &title_buckets[hash_bytes(title, len) & (title_nbuckets - 1)];
+       *link; link = &titles[*link - 1].next)
+    if (titles[*link - 1].len == len &&
+        memcmp(titles[*link - 1].text, title, len) == 0)
+      return link;
+  return NULL;
+}
+
+/******************************************************************************
+
+  Renumber the live titles from zero and rebuild every posting list and the
+  title hash, dropping the dead numbers left behind by removals.
+
+ ******************************************************************************/
+static void compact(void) {
+  uint32_t n = 0;
+
+  for (uint32_t i = 0; i < ngrams; i++)
+    free(grams[i].ids);
+  ngrams = 0;
+  memset(gram_buckets, 0, gram_nbuckets * sizeof(*gram_buckets));
+  memset(title_buckets, 0, title_nbuckets * sizeof(*title_buckets));
+
+  for (uint32_t i = 0; i < ntitles; i++)
+    if (titles[i].text)
+      titles[n++] = titles[i];
+  ntitles = n;
+  live_titles = 0;
+  for (uint32_t i = 0; i < ntitles; i++) {
+    link_title(i);
+    add_grams(i);
+  }
+}
+
+// Index a title; indexing one that is already there does nothing
+void search_put(const char *title, size_t len) {
+  uint32_t id;
+
+  pthread_rwlock_wrlock(&search_lock);
+  if (find_title(title, len) == NULL) {
+    titles = grow(titles, &titles_cap, sizeof(*titles), ntitles + 1);
+    id = ntitles++;
+    titles[id].len = len;
+    if ((titles[id].text = malloc(2 * len)) == NULL) {
+      fprintf(stderr, "Server: Out of memory building the search index\n");
+      exit(EXIT_FAILURE);
+    }
+    memcpy(titles[id].text, title, len);
+    lower(titles[id].text + len, title, len);
+    link_title(id);
+    add_grams(id);
+  }
+  pthread_rwlock_unlock(&search_lock);
+}
+
+void search_remove(const char *title, size_t len) {
+  uint32_t *link, id;
+
+  pthread_rwlock_wrlock(&search_lock);
+  if ((link = find_title(title, len)) != NULL) {
+    id = *link - 1;
+    *link = titles[id].next;
+    free(titles[id].text);
+    titles[id].text = NULL;
+    live_titles--;
+    if (ntitles - live_titles > live_titles &&
+        ntitles - live_titles >= COMPACT_MIN)
+      compact();
+  }
+  pthread_rwlock_unlock(&search_lock);
+}
+
+/******************************************************************************
+
+  Hand up to 'limit' titles matching the query to 'fn' and return how many
+  there were.  Substring queries shorter than three bytes have no gram to
+  go by and check titles in order until the limit is reached.  'fn' runs
+  with the search index locked and must not call back into it.
+
+ ******************************************************************************/
+size_t search_titles(const char *query, size_t len, enum search_mode mode,
+                     size_t limit,
+                     void (*fn)(const char *title, size_t len, void *arg),
+                     void *arg) {
+  char q[TITLE_LENGTH];
+  struct gram *g = NULL, *c;
+  const struct title *t;
+  size_t found = 0;
+  bool none = false;
+  uint32_t n;
+  int k;
+
+  if (len == 0 || len >= sizeof(q) || limit == 0)
+    return 0;
+  lower(q, query, len);
+
+  // A gram no title has means no results
+  pthread_rwlock_rdlock(&search_lock);
+  if (mode == SEARCH_PREFIX) {
+    k = len < PREFIX_GRAMS ? len : PREFIX_GRAMS;
+    none = (g = find_gram(gram_key(k, q, k))) == NULL;
+  }
+  for (size_t i = 0; !none && i + 3 <= len; i++) {
+    if ((c = find_gram(gram_key(0, q + i, 3))) == NULL)
+      none = true;
+    else if (g == NULL || c->len < g->len)
+      g = c;
+  }
+
+  n = none ? 0 : g ? g->len : ntitles;
+  for (uint32_t i = 0; i < n && found < limit; i++) {
+    t = &titles[g ? g->ids[i] : i];
+    if (t->text == NULL || t->len < len)
+      continue;
+    if (mode == SEARCH_PREFIX
+            ? memcmp(t->text + t->len, q, len) == 0
+            : memmem(t->text + t->len, t->len, q, len) != NULL) {
+      fn(t->text, t->len, arg);
+      found++;
+    }
+  }
+  pthread_rwlock_unlock(&search_lock);
+  return found;
+}
@@ -0,0 +1,32 @@
+/******************************************************************************
+
+PROGRAM:  search.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: In-memory title search over the keys of watchlist.db.  Titles can
+          be looked up by prefix, for autocompletion, or by any substring,
+          ignoring ASCII case in both.  Queries only read memory, so they
+          never wait for the database.
+
+          The search index is filled by the same background rebuild as the
+          secondary indexes (see index.h) and kept current by the requests
+          that create, rename or remove entries.  Until index_ready() is
+          true it may be missing titles.
+
+******************************************************************************/
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+
+enum search_mode { SEARCH_PREFIX, SEARCH_SUBSTRING };
+
+void search_put(const char *title, size_t len);
+void search_remove(const char *title, size_t len);
+
+size_t search_titles(const char *query, size_t len, enum search_mode mode,
+                     size_t limit,
+                     void (*fn)(const char *title, size_t len, void *arg),
+                     void *arg);
+
+#endif
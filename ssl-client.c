@@ -1,514 +1,1197 @@
-/******************************************************************************
-
-PROGRAM:  ssl-client.c for Watchlist Project
-AUTHOR:   Thomas, Riley, Stephanie
-COURSE:   CS469 - Distributed Systems (Regis University)
-SYNOPSIS: This program is a small client application that establishes a secure
-TCP connection to a server and simply exchanges messages.  It uses a SSL/TLS
-connection using X509 certificates generated with the openssl application.
-The purpose is to demonstrate how to establish and use secure communication
-channels between a client and server using public key cryptography.
-
-Some of the code and descriptions can be found in "Network Security with
-OpenSSL", O'Reilly Media, 2002.
-
-Some code was provided by Prof. Hemmes for use. This is the client side for the
-Watchlist project.
-
- ******************************************************************************/
-#include <arpa/inet.h>
-#include <crypt.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include <resolv.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/socket.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <termios.h>
-#include <time.h>
-#include <unistd.h>
-
-#include <openssl/bio.h>
-#include <openssl/err.h>
-#include <openssl/pem.h>
-#include <openssl/ssl.h>
-#include <openssl/x509.h>
-#include <openssl/x509_vfy.h>
-
-#define DEFAULT_PORT 4433
-#define BACKUP_PORT 4465
-#define DEFAULT_HOST "localhost"
-#define MAX_HOSTNAME_LENGTH 256
-#define BUFFER_SIZE 256
-#define PATH_LENGTH 248
-#define STR_LENGTH 512
-#define SEED_LENGTH 8
-#define PASSWORD_LENGTH 32
-#define USERNAME_LENGTH 32
-
-/******************************************************************************
-
-  This function does the basic necessary housekeeping to establish a secure TCP
-  connection to the server specified by 'hostname'.
-
- *******************************************************************************/
-int create_socket(char *hostname, unsigned int port) {
-  int sockfd;
-  struct hostent *host;
-  struct sockaddr_in dest_addr;
-
-  host = gethostbyname(hostname);
-  if (host == NULL) {
-    fprintf(stderr, "Client: Cannot resolve hostname %s\n", hostname);
-    exit(EXIT_FAILURE);
-  }
-
-  // Create a socket (endpoint) for network communication.  The socket()
-  // call returns a socket descriptor, which works exactly like a file
-  // descriptor for file system operations we worked with in CS431
-  //
-  // Sockets are by default blocking, so the server will block while reading
-  // from or writing to a socket. For most applications this is acceptable.
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sockfd < 0) {
-    fprintf(stderr, "Server: Unable to create socket: %s", strerror(errno));
-    exit(EXIT_FAILURE);
-  }
-
-  // First we set up a network socket. An IP socket address is a combination
-  // of an IP interface address plus a 16-bit port number. The struct field
-  // sin_family is *always* set to AF_INET. Anything else returns an error.
-  // The TCP port is stored in sin_port, but needs to be converted to the
-  // format on the host machine to network byte order, which is why htons()
-  // is called. The s_addr field is the network address of the remote host
-  // specified on the command line. The earlier call to gethostbyname()
-  // retrieves the IP address for the given hostname.
-  dest_addr.sin_family = AF_INET;
-  dest_addr.sin_port = htons(port);
-  dest_addr.sin_addr.s_addr = *(long *)(host->h_addr);
-
-  // Now we connect to the remote host.  We pass the connect() system call the
-  // socket descriptor, the address of the remote host, and the size in bytes
-  // of the remote host's address
-  if (connect(sockfd, (struct sockaddr *)&dest_addr, sizeof(struct sockaddr)) <
-      0) {
-    fprintf(stderr, "Client: Cannot connect to host %s [%s] on port %d: %s\n",
-            hostname, inet_ntoa(dest_addr.sin_addr), port, strerror(errno));
-    exit(EXIT_FAILURE);
-  }
-
-  return sockfd;
-}
-
-void getPassword(char *password) {
-  static struct termios oldsettings, newsettings;
-  int c, i = 0;
-
-  // Save the current terminal settings and copy settings for resetting
-  tcgetattr(STDIN_FILENO, &oldsettings);
-  newsettings = oldsettings;
-
-  // Hide, i.e., turn off echoing, the characters typed to the console
-  newsettings.c_lflag &= ~(ECHO);
-
-  // Set the new terminal settings
-  tcsetattr(STDIN_FILENO, TCSANOW, &newsettings);
-
-  // Read the password from the console one character at a time
-  while ((c = getchar()) != '\n' && c != EOF && i < BUFFER_SIZE)
-    password[i++] = c;
-
-  password[i] = '\0';
-
-  // Restore the old (saved) terminal settings
-  tcsetattr(STDIN_FILENO, TCSANOW, &oldsettings);
-}
-
-/******************************************************************************
-
-  The sequence of steps required to establish a secure SSL/TLS connection is:
-
-  1.  Initialize the SSL algorithms
-  2.  Create and configure an SSL context object
-  3.  Create an SSL session object
-  4.  Create a new network socket in the traditional way
-  5.  Bind the SSL object to the network socket descriptor
-  6.  Establish an SSL session on top of the network connection
-
-  Once these steps are completed successfully, use the functions SSL_read() and
-  SSL_write() to read from/write to the socket, but using the SSL object rather
-  then the socket descriptor.  Once the session is complete, free the memory
-  allocated to the SSL object and close the socket descriptor.
-
- ******************************************************************************/
-int main(int argc, char **argv) {
-  const SSL_METHOD *method;
-  unsigned int port = DEFAULT_PORT;
-  char remote_host[MAX_HOSTNAME_LENGTH];
-  char filename[PATH_LENGTH] = {0};
-  char buffer[BUFFER_SIZE] = {0};
-  char *temp_ptr;
-  int sockfd;
-  int writefd;
-  int rcount;
-  int error_code;
-  int total = 0;
-  int op;
-  SSL_CTX *ssl_ctx;
-  SSL *ssl;
-  char title[BUFFER_SIZE] = {0};
-  char newTitle[BUFFER_SIZE] = {0};
-  int type, status, rating;
-  char description[500] = {0};
-  char opChar[20];
-  char updateChar[20];
-  char s[800];
-  char user_pass[512];
-  char temp[STR_LENGTH];
-  char username[USERNAME_LENGTH];
-  char password[PASSWORD_LENGTH];
-  char verifyPassword[PASSWORD_LENGTH];
-  char hash[BUFFER_SIZE];
-  char verifyHash[BUFFER_SIZE];
-  char *verify;
-  const char *const seedchars = "./0123456789"
-                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                                "abcdefghijklmnopqrstuvwxyz";
-  unsigned long int seed[2];
-
-  if (argc != 2) {
-    fprintf(stderr, "Client: Usage: ssl-client <server name>:<port>\n");
-    exit(EXIT_FAILURE);
-  } else {
-    // Search for ':' in the argument to see if port is specified
-    temp_ptr = strchr(argv[1], ':');
-    if (temp_ptr == NULL) // Hostname only. Use default port
-      strncpy(remote_host, argv[1], MAX_HOSTNAME_LENGTH);
-    else {
-      // Argument is formatted as <hostname>:<port>. Need to separate
-      // First, split out the hostname from port, delineated with a colon
-      // remote_host will have the <hostname> substring
-      strncpy(remote_host, strtok(argv[1], ":"), MAX_HOSTNAME_LENGTH);
-      // Port number will be the substring after the ':'. At this point
-      // temp is a pointer to the array element containing the ':'
-      port = (unsigned int)atoi(temp_ptr + sizeof(char));
-    }
-  }
-
-  // Initialize OpenSSL ciphers and digests
-  OpenSSL_add_all_algorithms();
-
-  // SSL_library_init() registers the available SSL/TLS ciphers and digests.
-  if (SSL_library_init() < 0) {
-    fprintf(stderr, "Client: Could not initialize the OpenSSL library!\n");
-    exit(EXIT_FAILURE);
-  }
-
-  // Use the SSL/TLS method for clients
-  method = SSLv23_client_method();
-
-  // Create new context instance
-  ssl_ctx = SSL_CTX_new(method);
-  if (ssl_ctx == NULL) {
-    fprintf(stderr, "Unable to create a new SSL context structure.\n");
-    exit(EXIT_FAILURE);
-  }
-
-  // This disables SSLv2, which means only SSLv3 and TLSv1 are available
-  // to be negotiated between client and server
-  SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_SSLv2);
-
-  // Create a new SSL connection state object
-  ssl = SSL_new(ssl_ctx);
-
-  // Create the underlying TCP socket connection to the remote host
-  sockfd = create_socket(remote_host, port);
-  if (sockfd != 0)
-    fprintf(stderr, "Client: Established TCP connection to '%s' on port %u\n",
-            remote_host, port);
-
-  // First attempt to connect did not succeed. Try the backup server
-  else {
-    port = BACKUP_PORT;
-    printf("Trying backup server on port %u\n", port);
-    sockfd = create_socket(remote_host, port);
-    if (sockfd != 0)
-      fprintf(stderr, "Client: Established TCP connection to '%s' on port %u\n",
-              remote_host, port);
-
-    // Welp, neither worked. There are limits to everything
-    else {
-      fprintf(stderr,
-              "Client: Could not establish TCP connection to %s on port %u\n",
-              remote_host, port);
-      exit(EXIT_FAILURE);
-    }
-  }
-
-  // Bind the SSL object to the network socket descriptor.  The socket
-  // descriptor will be used by OpenSSL to communicate with a server. This
-  // function should only be called once the TCP connection is established,
-  // i.e., after create_socket()
-  SSL_set_fd(ssl, sockfd);
-
-  // Initiates an SSL session over the existing socket connection. SSL_connect()
-  // will return 1 if successful.
-  if (SSL_connect(ssl) == 1)
-    fprintf(stdout, "Client: Established SSL/TLS session to '%s' on port %u\n",
-            remote_host, port);
-  else {
-    fprintf(stderr,
-            "Client: Could not establish SSL session to '%s' on port %u\n",
-            remote_host, port);
-    exit(EXIT_FAILURE);
-  }
-
-  // identifier and two '$" separators
-  char salt[] = "$1$........";
-
-  fprintf(stdout,
-          "Please choose an operation (1 - Create Account, 2 - Log In) ");
-  fgets(opChar, 20, stdin);
-  op = opChar[0] - '0';
-  fprintf(stdout, "got %d\n", op);
-  switch (op) {
-  case 1:
-    fprintf(stdout, "Enter username: ");
-    fgets(username, USERNAME_LENGTH, stdin);
-    username[strlen(username) - 1] = '\0';
-    // The first three characters indicate which hashing algorithm to
-    // use.  "$5$ selects the SHA256 algorithm.  I use MD5 ($1$) because
-    // the hash is shorter. It still illustrates how this works. The length
-    // of this char array is the seed length plus 3 to account for the
-    // identifier and two '$" separators
-    char salt[] = "$1$........";
-
-    // Generate a (not very) random seed. There are better ways to do this.
-    // Specified in the GNU C Library documentation
-    seed[0] = time(NULL);
-    seed[1] = getpid() ^ (seed[0] >> 14 & 0x30000);
-
-    // Convert the salt into printable characters from the seedchars string
-    for (int i = 0; i < 8; i++)
-      salt[3 + i] = seedchars[(seed[i / 5] >> (i % 5) * 6) & 0x3f];
-
-    // Enter the password
-    fprintf(stdout, "Enter password: ");
-    getPassword(password);
-
-    // Now we create a cryptographic hash of the password with the SHA256
-    // algorithm using the generated salt string
-    strncpy(hash, crypt(password, salt), BUFFER_SIZE);
-
-    fprintf(stdout, "The password entered is: %s\n", password);
-    fprintf(stdout, "The salt is: %s\n", salt);
-    fprintf(stdout, "The hash of the password (w/ salt) is: %s\n", hash);
-
-    // Format string
-    sprintf(user_pass, "1:%s:%s:%s", username, hash, salt);
-
-    SSL_write(ssl, user_pass, sizeof(user_pass));
-    break;
-
-  case 2:
-    fprintf(stdout, "Enter username: ");
-    fgets(username, USERNAME_LENGTH, stdin);
-    username[strlen(username) - 1] = '\0';
-
-    // Enter the password
-    fprintf(stdout, "Enter password: ");
-    getPassword(password);
-    sprintf(user_pass, "2:%s", username);
-    SSL_write(ssl, user_pass, sizeof(user_pass));
-    bzero(user_pass, 100);
-
-    SSL_read(ssl, salt, sizeof(salt));
-    strncpy(hash, crypt(password, salt), BUFFER_SIZE);
-
-    fprintf(stdout, "The password entered is: %s\n", password);
-    fprintf(stdout, "The salt is: %s\n", salt);
-    fprintf(stdout, "The hash of the password (w/ salt) is: %s\n", hash);
-    // Format string
-    SSL_write(ssl, hash, sizeof(hash));
-
-    SSL_read(ssl, verify, sizeof(verify));
-    if(!atoi(verify)){
-	    fprintf(stdout, "client: User couldn't be verifed. Please make an account.");
-    }
-    exit(1);
-    break;
-  }
-
-
-  do {
-    fprintf(stdout, "Please choose an operation: ('c' = create, 'f' = find, "
-                    "'d' = display, 'u' = update, 'r' = remove)\n");
-    fgets(opChar, 20, stdin);
-    switch (opChar[0]) {
-    case 'c':
-    case 'C':
-      // create
-      fprintf(stdout, "Enter the title: (do not include colons (':'))\n");
-      fgets(title, BUFFER_SIZE, stdin);
-      title[strlen(title) - 1] = '\0';
-      fprintf(stdout,
-              "Enter type (1 - movie, 2 - Tv show, 3 - cartoon, 4 - anime):\n");
-      fgets(temp, BUFFER_SIZE, stdin);
-      type = atoi(temp);
-      bzero(temp, sizeof(temp));
-      fprintf(stdout, "Enter description (max of %d characters):\n",
-              STR_LENGTH);
-      fgets(description, STR_LENGTH, stdin);
-      description[strlen(description) - 1] = '\0';
-      fprintf(stdout, "Enter status (1 - Plan to watch, 2 - Watching "
-                      "currently, 3 - Completed):\n");
-      fgets(temp, BUFFER_SIZE, stdin);
-      status = atoi(temp);
-      bzero(temp, sizeof(temp));
-      if (status > 1) {
-        fprintf(stdout, "Enter rating (1 - 5, 1 being terrible and 5 being "
-                        "amazing):\n"); // for 1 or 2
-        fgets(temp, BUFFER_SIZE, stdin);
-        rating = atoi(temp);
-        bzero(temp, sizeof(temp));
-        sprintf(s, "c:%s:%d:%s:%d:%d", title, type, description, status,
-                rating);
-      } else {
-        sprintf(s, "c:%s:%d:%s:%d", title, type, description, status);
-      }
-      break;
-
-    case 'f':
-    case 'F':
-      // find
-      fprintf(stdout, "Enter title you wish to search for:\n");
-      fgets(title, BUFFER_SIZE, stdin);
-      title[strlen(title) - 1] = '\0';
-      sprintf(s, "f:%s", title);
-
-      break;
-
-    case 'd':
-    case 'D':
-      // display whole list
-      fprintf(stdout, "The whole list will be displayed:\n");
-      sprintf(s, "d");
-      break;
-
-    case 'u':
-    case 'U':
-      // update
-      fprintf(stdout, "Enter title you wish to update:\n");
-      fgets(title, BUFFER_SIZE, stdin);
-      title[strlen(title) - 1] = '\0';
-      fprintf(stdout, "Which field would you like to update? (Title, Media "
-                      "Type, Description, Status, Rating)\n");
-      fgets(updateChar, 20, stdin);
-      switch (updateChar[0]) {
-      case 't':
-      case 'T':
-        fprintf(stdout, "Enter new title:\n");
-        fgets(newTitle, BUFFER_SIZE, stdin);
-        newTitle[strlen(newTitle) - 1] = '\0';
-        sprintf(s, "u:t:%s:%s", title, newTitle);
-        break;
-
-      case 'm':
-      case 'M':
-        fprintf(stdout, "Enter new type:\n");
-        fgets(temp, BUFFER_SIZE, stdin);
-        type = atoi(temp);
-        bzero(temp, sizeof(temp));
-        sprintf(s, "u:m:%s:%d", title, type);
-        break;
-
-      case 'd':
-      case 'D':
-        fprintf(stdout, "Enter new description:\n");
-        fgets(description, BUFFER_SIZE, stdin);
-        title[strlen(description) - 1] = '\0';
-        sprintf(s, "u:d:%s:%s", title, description);
-        break;
-
-      case 's':
-      case 'S':
-        fprintf(stdout, "Enter new status:\n");
-        fgets(temp, BUFFER_SIZE, stdin);
-        status = atoi(temp);
-        bzero(temp, sizeof(temp));
-        sprintf(s, "u:s:%s:%d", title, status);
-        break;
-
-      case 'r':
-      case 'R':
-        fprintf(stdout, "Enter new rating:\n");
-        fgets(temp, BUFFER_SIZE, stdin);
-        rating = atoi(temp);
-        bzero(temp, sizeof(temp));
-        sprintf(s, "u:r:%s:%d", title, rating);
-        break;
-      }
-      break;
-
-    case 'r':
-    case 'R':
-      // remove
-      fprintf(stdout, "Enter title of entry you wish to delete:\n");
-      fgets(temp, sizeof(temp), stdin);
-      sprintf(s, "r:%s", temp);
-      break;
-
-    default:
-      fprintf(stdout, "Invalid statement\n");
-    }
-    // send message to server
-    SSL_write(ssl, s, strlen(s));
-
-    fprintf(stdout, "built string: '%s'\n", s);
-    fprintf(stdout,
-            "Would you like to choose another operation? (yes or no)\n");
-    fgets(temp, BUFFER_SIZE, stdin);
-    SSL_write(ssl, temp, strlen(s));
-
-  } while (temp[0] == 'y' || temp[0] == 'Y');
-
-  //  Request filename from user and strip trailing newline character
-  //  fprintf(stdout, "Enter file name: ");
-  //  fgets(filename, PATH_LENGTH, stdin);
-  //  filename[strlen(filename)-1] = '\0';
-  //
-  //  // Marshal the parameter into an RPC message
-  //  sprintf(buffer, "getfile %s", filename);
-  //  SSL_write(ssl, buffer, strlen(buffer));
-  //
-  //  // Clear the buffer and await the reply
-  //  bzero(buffer, BUFFER_SIZE);
-  //  rcount = SSL_read(ssl, buffer, BUFFER_SIZE);
-  //  if (sscanf(buffer, "error %d", &error_code) == 1) {
-  //    fprintf(stderr, "Client: Could not retrieve file: %s\n",
-  //    strerror(error_code));
-  //  } else {
-  //    writefd = creat(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-  //    do {
-  //      total += rcount;
-  //      write(writefd, buffer, rcount);
-  //      rcount = SSL_read(ssl, buffer, BUFFER_SIZE);
-  //    } while (rcount > 0);
-  //    close(writefd);
-  //    fprintf(stdout, "Client: Successfully transferred file '%s' (%d bytes)
-  //    from server\n", filename, total);
-  //  }
-  //
-  //  // Deallocate memory for the SSL data structures and close the socket
-  //  SSL_free(ssl);
-  //  SSL_CTX_free(ssl_ctx);
-  //  close(sockfd);
-  //  fprintf(stdout, "Client: Terminated SSL/TLS connection with server
-  //  '%s'\n", remote_host);
-
-  return (0);
-}
+/******************************************************************************
+
+PROGRAM:  ssl-client.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: This program is a small client application that establishes a secure
+TCP connection to a server and simply exchanges messages.  It uses a SSL/TLS
+connection using X509 certificates generated with the openssl application.
+The purpose is to demonstrate how to establish and use secure communication
+channels between a client and server using public key cryptography.
+
+Some of the code and descriptions can be found in "Network Security with
+OpenSSL", O'Reilly Media, 2002.
+
+Some code was provided by Prof. Hemmes for use. This is the client side for the
+Watchlist project.
+
+The client talks to the server with the binary protocol described in
+protocol.h: every request is one frame and the server answers each with one
+reply frame.  Long replies such as listings come compressed with zlib if the
+server agrees to it.
+
+The TLS session is saved in ~/.watchlist-session-<host>-<port> so the next
+run can resume it and skip the full handshake, and the login token the
+server hands out in ~/.watchlist-token-<host>-<port> so the next run is
+logged in without asking for the password.
+
+Usage: ssl-client [-f script] [-u user] [-w window] [-q] <server>[:<port>]
+
+With -f the client runs the operations in the script ("-" for standard
+input) instead of prompting, one per line, either as fields separated by '|'
+
+  create|<title>|<type>|<description>|<status>[|<rating>]
+  update|<title>|<field>=<value>...   (new_title, type, description, status,
+                                       rating)
+  remove|<title>
+  find|<title>
+  search|<title>[|prefix or substring]
+  display[|order=<title, rating or recent>][|limit=<n>][|<field>=<value>...]
+  stats                               (the server's metrics, see metrics.h)
+
+or as a JSON object with the same names, e.g.
+
+  {"op": "update", "title": "Alien", "rating": 5}
+
+Blank lines and lines starting with '#' are skipped.  Up to 'window' requests
+(SCRIPT_WINDOW by default) are sent before their replies are read, so a
+script does not wait a round trip per line.  The result of every operation is
+printed with its line number (only failures with -q), and the totals and
+throughput at the end.  A script uses the saved login token; without one it
+logs in as -u user with the password in the environment variable
+WATCHLIST_PASSWORD.
+
+ ******************************************************************************/
+#include <arpa/inet.h>
+#include <crypt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <resolv.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+
+#include "lines.h"
+#include "protocol.h"
+
+#define DEFAULT_PORT 4433
+#define BACKUP_PORT 4465
+#define DEFAULT_HOST "localhost"
+#define MAX_HOSTNAME_LENGTH 256
+#define BUFFER_SIZE 256
+#define PATH_LENGTH 248
+#define STR_LENGTH 512
+#define SEED_LENGTH 8
+#define PASSWORD_LENGTH 32
+#define SCRIPT_WINDOW 128        // requests in flight when running a script
+#define SCRIPT_FLUSH (64 * 1024) // bytes of requests sent in one go
+#define SCRIPT_FIELDS 16
+
+// Where the TLS session and login token for this server are kept between
+// runs
+static char session_file[STR_LENGTH];
+static char token_file[STR_LENGTH];
+
+/******************************************************************************
+
+  This function does the basic necessary housekeeping to establish a secure TCP
+  connection to the server specified by 'hostname'.
+
+ *******************************************************************************/
+int create_socket(char *hostname, unsigned int port) {
+  int sockfd;
+  struct hostent *host;
+  struct sockaddr_in dest_addr;
+
+  host = gethostbyname(hostname);
+  if (host == NULL) {
+    fprintf(stderr, "Client: Cannot resolve hostname %s\n", hostname);
+    exit(EXIT_FAILURE);
+  }
+
+  // Create a socket (endpoint) for network communication.  The socket()
+  // call returns a socket descriptor, which works exactly like a file
+  // descriptor for file system operations we worked with in CS431
+  //
+  // Sockets are by default blocking, so the server will block while reading
+  // from or writing to a socket. For most applications this is acceptable.
+  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (sockfd < 0) {
+    fprintf(stderr, "Server: Unable to create socket: %s", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // First we set up a network socket. An IP socket address is a combination
+  // of an IP interface address plus a 16-bit port number. The struct field
+  // sin_family is *always* set to AF_INET. Anything else returns an error.
+  // The TCP port is stored in sin_port, but needs to be converted to the
+  // format on the host machine to network byte order, which is why htons()
+  // is called. The s_addr field is the network address of the remote host
+  // specified on the command line. The earlier call to gethostbyname()
+  // retrieves the IP address for the given hostname.
+  dest_addr.sin_family = AF_INET;
+  dest_addr.sin_port = htons(port);
+  dest_addr.sin_addr.s_addr = *(long *)(host->h_addr);
+
+  // Now we connect to the remote host.  We pass the connect() system call the
+  // socket descriptor, the address of the remote host, and the size in bytes
+  // of the remote host's address
+  if (connect(sockfd, (struct sockaddr *)&dest_addr, sizeof(struct sockaddr)) <
+      0) {
+    fprintf(stderr, "Client: Cannot connect to host %s [%s] on port %d: %s\n",
+            hostname, inet_ntoa(dest_addr.sin_addr), port, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  return sockfd;
+}
+
+void getPassword(char *password, int size) {
+  static struct termios oldsettings, newsettings;
+  int c, i = 0;
+
+  // Save the current terminal settings and copy settings for resetting
+  tcgetattr(STDIN_FILENO, &oldsettings);
+  newsettings = oldsettings;
+
+  // Hide, i.e., turn off echoing, the characters typed to the console
+  newsettings.c_lflag &= ~(ECHO);
+
+  // Set the new terminal settings
+  tcsetattr(STDIN_FILENO, TCSANOW, &newsettings);
+
+  // Read the password from the console one character at a time
+  while ((c = getchar()) != '\n' && c != EOF && i < size - 1)
+    password[i++] = c;
+
+  password[i] = '\0';
+
+  // Restore the old (saved) terminal settings
+  tcsetattr(STDIN_FILENO, TCSANOW, &oldsettings);
+}
+
+/******************************************************************************
+
+  Read one line from the console into 'buf', dropping the trailing newline.
+
+ ******************************************************************************/
+static void read_line(char *buf, int size) {
+  if (fgets(buf, size, stdin) == NULL)
+    buf[0] = '\0';
+  buf[strcspn(buf, "\n")] = '\0';
+}
+
+/******************************************************************************
+
+  OpenSSL calls this with every session the server hands us, which for TLS
+  1.3 is after the handshake.  The newest one is written out for the next
+  run; it holds the session's secrets, so only we may read it.
+
+ ******************************************************************************/
+static int save_session(SSL *ssl, SSL_SESSION *session) {
+  FILE *fp;
+  int fd;
+
+  fd = open(session_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+    return 0;
+  if ((fp = fdopen(fd, "w")) == NULL) {
+    close(fd);
+    return 0;
+  }
+  PEM_write_SSL_SESSION(fp, session);
+  fclose(fp);
+  return 0; // no reference to the session was kept
+}
+
+// Offer the session saved by the last run, if there is one
+static void load_session(SSL *ssl) {
+  SSL_SESSION *session;
+  FILE *fp;
+
+  if ((fp = fopen(session_file, "r")) == NULL)
+    return;
+  session = PEM_read_SSL_SESSION(fp, NULL, NULL, NULL);
+  fclose(fp);
+  if (session != NULL) {
+    SSL_set_session(ssl, session);
+    SSL_SESSION_free(session);
+  }
+}
+
+// Keep the login token from a register or login reply for the next run
+static void save_token(const struct wl_frame *reply) {
+  struct wl_field f;
+  int fd;
+
+  if (!wl_find(reply, WL_F_TOKEN, &f))
+    return;
+  fd = open(token_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+    return;
+  if (write(fd, f.data, f.len) != f.len)
+    unlink(token_file);
+  close(fd);
+}
+
+// Add the saved login token, if there is one, to the hello being built
+static void put_token(struct wl_buf *out) {
+  uint8_t token[BUFFER_SIZE];
+  ssize_t n;
+  int fd;
+
+  if ((fd = open(token_file, O_RDONLY)) < 0)
+    return;
+  n = read(fd, token, sizeof(token));
+  close(fd);
+  if (n > 0)
+    wl_put_bytes(out, WL_F_TOKEN, token, n);
+}
+
+/******************************************************************************
+
+  Send the request frame built in 'out' and wait for the server's reply.
+  Returns the reply's size, to be consumed from 'in' once it has been used.
+  Losing the server is fatal for this interactive client.
+
+ ******************************************************************************/
+static long exchange(SSL *ssl, struct wl_buf *out, struct wl_buf *in,
+                     struct wl_frame *reply) {
+  long size;
+
+  if (wl_send(ssl, out) < 0 || (size = wl_recv(ssl, in, reply)) < 0) {
+    fprintf(stderr, "Client: Lost connection to the server\n");
+    exit(EXIT_FAILURE);
+  }
+  return size;
+}
+
+/******************************************************************************
+
+  Print the entries carried by a find or display reply and return how many
+  there were.  Each entry starts with its TITLE field, followed by the rest
+  of its fields.
+
+ ******************************************************************************/
+static int print_entries(const struct wl_frame *reply) {
+  struct wl_field f;
+  struct entry e;
+  size_t pos = 0;
+  int count = 0;
+
+  while (wl_next(reply, &pos, &f) == 1) {
+    switch (f.tag) {
+    case WL_F_TITLE:
+      if (count++ > 0)
+        fprintf(stdout, "%s, %s, %d, %d, %d\n", e.title, e.description,
+                e.type, e.status, e.rating);
+      memset(&e, 0, sizeof(e));
+      wl_copy_str(&f, e.title, sizeof(e.title));
+      break;
+    case WL_F_TYPE:
+      e.type = wl_u32(&f);
+      break;
+    case WL_F_DESCRIPTION:
+      wl_copy_str(&f, e.description, sizeof(e.description));
+      break;
+    case WL_F_STATUS:
+      e.status = wl_u32(&f);
+      break;
+    case WL_F_RATING:
+      e.rating = wl_u32(&f);
+      break;
+    }
+  }
+  if (count > 0)
+    fprintf(stdout, "%s, %s, %d, %d, %d\n", e.title, e.description, e.type,
+            e.status, e.rating);
+  return count;
+}
+
+// Print the titles carried by a search reply
+static void print_titles(const struct wl_frame *reply) {
+  struct wl_field f;
+  size_t pos = 0;
+  int count = 0;
+
+  while (wl_next(reply, &pos, &f) == 1)
+    if (f.tag == WL_F_TITLE) {
+      fprintf(stdout, "%.*s\n", f.len, f.data);
+      count++;
+    }
+  if (count == 0)
+    fprintf(stdout, "No titles match\n");
+}
+
+/******************************************************************************
+
+  Show the whole watchlist one page at a time, handing the cursor from each
+  reply back to the server until a page comes without one.  Only one page
+  is held in memory however long the list is.  'query' holds fields sent
+  with every page, such as an ORDER; with 'one_page' only the first page is
+  shown, which for a sorted listing with a LIMIT is the top of the list.
+
+ ******************************************************************************/
+static void display_list(SSL *ssl, struct wl_buf *out, struct wl_buf *in,
+                         uint32_t *next_id, const struct wl_buf *query,
+                         bool one_page) {
+  char cursor[CURSOR_LENGTH];
+  struct wl_frame reply;
+  struct wl_field f;
+  size_t start;
+  long size;
+  int cursor_len = 0, count = 0;
+
+  do {
+    start = wl_begin(out, WL_DISPLAY, 0, 0, (*next_id)++);
+    if (cursor_len > 0)
+      wl_put_bytes(out, WL_F_CURSOR, cursor, cursor_len);
+    if (query != NULL) {
+      wl_buf_reserve(out, query->len);
+      memcpy(out->data + out->len, query->data, query->len);
+      out->len += query->len;
+    }
+    wl_end(out, start);
+    size = exchange(ssl, out, in, &reply);
+    if (reply.status != WL_OK) {
+      fprintf(stdout, "Server: %s\n", wl_status_str(reply.status));
+      wl_buf_consume(in, size);
+      return;
+    }
+    count += print_entries(&reply);
+    cursor_len = 0;
+    if (!one_page && wl_find(&reply, WL_F_CURSOR, &f) &&
+        f.len <= sizeof(cursor)) {
+      memcpy(cursor, f.data, f.len);
+      cursor_len = f.len;
+    }
+    wl_buf_consume(in, size);
+  } while (cursor_len > 0);
+
+  if (count == 0)
+    fprintf(stdout, "The list is empty\n");
+}
+
+// A request sent from a script whose reply has not been read yet
+struct script_op {
+  unsigned long line;
+  uint32_t id;
+  const char *op;
+};
+
+static const struct {
+  const char *name;
+  uint8_t type;
+} script_ops[] = {{"create", WL_CREATE}, {"find", WL_FIND},
+                  {"update", WL_UPDATE}, {"remove", WL_REMOVE},
+                  {"search", WL_SEARCH}, {"display", WL_DISPLAY},
+                  {"stats", WL_STATS}};
+
+static const struct {
+  const char *name;
+  uint8_t tag;
+  bool number;
+} script_tags[] = {{"title", WL_F_TITLE, false},
+                   {"new_title", WL_F_NEW_TITLE, false},
+                   {"type", WL_F_TYPE, true},
+                   {"description", WL_F_DESCRIPTION, false},
+                   {"status", WL_F_STATUS, true},
+                   {"rating", WL_F_RATING, true},
+                   {"limit", WL_F_LIMIT, true}};
+
+// The orders a display can be sorted in
+static const struct {
+  const char *name;
+  uint32_t order;
+} script_orders[] = {{"title", WL_ORDER_TITLE},
+                     {"rating", WL_ORDER_RATING},
+                     {"recent", WL_ORDER_RECENT}};
+
+// Fields of the '|' form, after the operation, that are not name=value
+static const char *const create_fields[] = {"title", "type", "description",
+                                            "status", "rating"};
+static const char *const search_fields[] = {"title", "match"};
+
+/******************************************************************************
+
+  Split a script line of the '|' form into 'fields', in place.  The first
+  field is the operation; the rest are named by their position for create
+  and search, and otherwise name=value apart from the title.  Returns the
+  number of fields, or -1 if the line has too many.
+
+ ******************************************************************************/
+static int split_line(char *line, struct line_field *fields, int max) {
+  char *part[SCRIPT_FIELDS];
+  char *p, *eq;
+  int n = 1;
+
+  part[0] = line;
+  for (p = line; *p != '\0'; p++)
+    if (*p == '|') {
+      if (n == max)
+        return -1;
+      *p = '\0';
+      part[n++] = p + 1;
+    }
+
+  fields[0].name = "op";
+  fields[0].value = part[0];
+  for (int i = 1; i < n; i++) {
+    fields[i].value = part[i];
+    if (strcmp(part[0], "create") == 0 && i <= 5)
+      fields[i].name = create_fields[i - 1];
+    else if (strcmp(part[0], "search") == 0 && i <= 2)
+      fields[i].name = search_fields[i - 1];
+    else if (i == 1 && strcmp(part[0], "display") != 0)
+      fields[i].name = "title";
+    else if ((eq = strchr(part[i], '=')) != NULL) {
+      *eq = '\0';
+      fields[i].name = part[i];
+      fields[i].value = eq + 1;
+    } else
+      return -1;
+  }
+  return n;
+}
+
+/******************************************************************************
+
+  Append the request for one script operation to 'out'.  Returns its frame
+  type, or 0 with 'error' set if the operation cannot be sent.  Since a
+  display is paged, its frame only carries the query the pages share.
+
+ ******************************************************************************/
+static uint8_t put_request(struct wl_buf *out, uint32_t id,
+                           const struct line_field *fields, int n,
+                           const char **error) {
+  uint8_t type = 0;
+  size_t start, i;
+  long number;
+  char *end;
+
+  for (i = 0; i < sizeof(script_ops) / sizeof(script_ops[0]); i++)
+    for (int f = 0; f < n; f++)
+      if (strcmp(fields[f].name, "op") == 0 &&
+          strcmp(fields[f].value, script_ops[i].name) == 0)
+        type = script_ops[i].type;
+  if (type == 0) {
+    *error = "unknown operation";
+    return 0;
+  }
+
+  start = wl_begin(out, type, 0, 0, id);
+  for (int f = 0; f < n; f++) {
+    if (strcmp(fields[f].name, "op") == 0)
+      continue;
+
+    if (strcmp(fields[f].name, "match") == 0) {
+      if (strcmp(fields[f].value, "substring") == 0)
+        wl_put_u32(out, WL_F_MATCH, WL_MATCH_SUBSTRING);
+      else if (strcmp(fields[f].value, "prefix") == 0)
+        wl_put_u32(out, WL_F_MATCH, WL_MATCH_PREFIX);
+      else {
+        *error = "match must be prefix or substring";
+        out->len = start;
+        return 0;
+      }
+      continue;
+    }
+
+    if (strcmp(fields[f].name, "order") == 0) {
+      for (i = 0; i < sizeof(script_orders) / sizeof(script_orders[0]); i++)
+        if (strcmp(fields[f].value, script_orders[i].name) == 0)
+          break;
+      if (i == sizeof(script_orders) / sizeof(script_orders[0])) {
+        *error = "order must be title, rating or recent";
+        out->len = start;
+        return 0;
+      }
+      wl_put_u32(out, WL_F_ORDER, script_orders[i].order);
+      continue;
+    }
+
+    for (i = 0; i < sizeof(script_tags) / sizeof(script_tags[0]); i++)
+      if (strcmp(fields[f].name, script_tags[i].name) == 0)
+        break;
+    if (i == sizeof(script_tags) / sizeof(script_tags[0])) {
+      *error = "unknown field";
+      out->len = start;
+      return 0;
+    }
+    if (!script_tags[i].number) {
+      wl_put_str(out, script_tags[i].tag, fields[f].value);
+      continue;
+    }
+    number = strtol(fields[f].value, &end, 10);
+    if (end == fields[f].value || *end != '\0' || number < 0) {
+      *error = "field is not a number";
+      out->len = start;
+      return 0;
+    }
+    wl_put_u32(out, script_tags[i].tag, number);
+  }
+  wl_end(out, start);
+  return type;
+}
+
+/******************************************************************************
+
+  Read the reply to the oldest request still in flight and report it.
+  Returns whether the operation succeeded.
+
+ ******************************************************************************/
+static bool script_reply(SSL *ssl, struct wl_buf *in,
+                         const struct script_op *op, bool quiet) {
+  struct wl_frame reply;
+  struct wl_field f;
+  long size;
+  bool ok;
+
+  if ((size = wl_recv(ssl, in, &reply)) < 0) {
+    fprintf(stderr, "Client: Lost connection to the server\n");
+    exit(EXIT_FAILURE);
+  }
+  if (reply.id != op->id) {
+    fprintf(stderr, "Client: Reply %u does not answer line %lu\n", reply.id,
+            op->line);
+    exit(EXIT_FAILURE);
+  }
+
+  ok = reply.status == WL_OK;
+  if (!ok || !quiet)
+    fprintf(stdout, "%lu: %s: %s\n", op->line, op->op,
+            ok ? "ok" : wl_status_str(reply.status));
+  if (ok && !quiet && reply.type == WL_FIND)
+    print_entries(&reply);
+  else if (ok && !quiet && reply.type == WL_SEARCH)
+    print_titles(&reply);
+  else if (ok && !quiet && reply.type == WL_STATS &&
+           wl_find(&reply, WL_F_STATS, &f))
+    fwrite(f.data, 1, f.len, stdout);
+  wl_buf_consume(in, size);
+  return ok;
+}
+
+/******************************************************************************
+
+  Run every operation in 'script' over the connection without prompting.
+  Requests are sent in groups and up to 'window' of them are in flight at
+  once: the server answers pipelined requests in order, so the replies are
+  matched to the lines they answer by arriving in the same order.
+
+ ******************************************************************************/
+static void run_script(SSL *ssl, FILE *script, const char *name, int window,
+                       bool quiet, struct wl_buf *out, struct wl_buf *in,
+                       uint32_t *next_id) {
+  struct line_field fields[SCRIPT_FIELDS];
+  struct wl_buf query = {0};
+  struct script_op *pending;
+  struct timespec begin, end;
+  unsigned long line = 0, ops = 0, failed = 0;
+  size_t head = 0, count = 0, at;
+  const char *error;
+  char *buf = NULL, *p;
+  size_t cap = 0;
+  double secs;
+  uint8_t type;
+  int n, i;
+
+  if ((pending = calloc(window, sizeof(*pending))) == NULL) {
+    fprintf(stderr, "Client: Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  while (getline(&buf, &cap, script) != -1) {
+    line++;
+    buf[strcspn(buf, "\r\n")] = '\0';
+    p = buf + strspn(buf, " \t");
+    if (*p == '\0' || *p == '#')
+      continue;
+    ops++;
+
+    error = "malformed line";
+    n = *p == '{' ? lines_json(p, fields, SCRIPT_FIELDS)
+                  : split_line(p, fields, SCRIPT_FIELDS);
+    at = out->len;
+    type = n < 0 ? 0 : put_request(out, *next_id, fields, n, &error);
+    if (type == 0) {
+      fprintf(stdout, "%lu: %s\n", line, error);
+      failed++;
+      continue;
+    }
+
+    // A display is paged one exchange at a time once the rest is answered.
+    // Its frame is taken back out; only the fields go with every page.
+    if (type == WL_DISPLAY) {
+      query.len = 0;
+      wl_buf_reserve(&query, out->len - at - WL_HEADER_SIZE);
+      memcpy(query.data, out->data + at + WL_HEADER_SIZE,
+             out->len - at - WL_HEADER_SIZE);
+      query.len = out->len - at - WL_HEADER_SIZE;
+      out->len = at;
+      if (wl_send(ssl, out) < 0) {
+        fprintf(stderr, "Client: Lost connection to the server\n");
+        exit(EXIT_FAILURE);
+      }
+      for (; count > 0; count--, head = (head + 1) % window)
+        failed += !script_reply(ssl, in, &pending[head], quiet);
+      fprintf(stdout, "%lu: display:\n", line);
+      for (i = 0; i < n && strcmp(fields[i].name, "limit") != 0; i++)
+        ;
+      display_list(ssl, out, in, next_id, &query, i < n);
+      continue;
+    }
+
+    // The names point into the line, which the next getline() overwrites
+    for (size_t i = 0; i < sizeof(script_ops) / sizeof(script_ops[0]); i++)
+      if (script_ops[i].type == type)
+        pending[(head + count) % window].op = script_ops[i].name;
+    pending[(head + count) % window].line = line;
+    pending[(head + count) % window].id = (*next_id)++;
+    count++;
+
+    // Once the window is full, send what was built and read replies until
+    // half of it is free again
+    if (count == (size_t)window || out->len >= SCRIPT_FLUSH) {
+      if (wl_send(ssl, out) < 0) {
+        fprintf(stderr, "Client: Lost connection to the server\n");
+        exit(EXIT_FAILURE);
+      }
+      for (; count > (size_t)window / 2; count--, head = (head + 1) % window)
+        failed += !script_reply(ssl, in, &pending[head], quiet);
+    }
+  }
+
+  if (wl_send(ssl, out) < 0) {
+    fprintf(stderr, "Client: Lost connection to the server\n");
+    exit(EXIT_FAILURE);
+  }
+  for (; count > 0; count--, head = (head + 1) % window)
+    failed += !script_reply(ssl, in, &pending[head], quiet);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+  fprintf(stderr,
+          "Client: %lu operations from %s in %.3f s (%.0f per second), "
+          "%lu failed\n",
+          ops, name, secs, secs > 0 ? ops / secs : 0.0, failed);
+  wl_buf_free(&query);
+  free(pending);
+  free(buf);
+}
+
+/******************************************************************************
+
+  Prompt for operations one at a time and show the server's answer to each,
+  until the user has had enough.
+
+ ******************************************************************************/
+static void run_prompts(SSL *ssl, struct wl_buf *out, struct wl_buf *in,
+                        uint32_t *next_id) {
+  char title[TITLE_LENGTH] = {0};
+  char newTitle[TITLE_LENGTH] = {0};
+  int type, status, rating;
+  char description[DESCRIPTION_LENGTH] = {0};
+  char opChar[20];
+  char updateChar[20];
+  char temp[STR_LENGTH];
+  struct wl_frame reply;
+  size_t start;
+  long size;
+
+  do {
+    fprintf(stdout, "Please choose an operation: ('c' = create, 'f' = find, "
+                    "'s' = search, 'd' = display, 'u' = update, "
+                    "'r' = remove)\n");
+    read_line(opChar, sizeof(opChar));
+    switch (opChar[0]) {
+    case 'c':
+    case 'C':
+      // create
+      fprintf(stdout, "Enter the title:\n");
+      read_line(title, TITLE_LENGTH);
+      fprintf(stdout,
+              "Enter type (1 - movie, 2 - Tv show, 3 - cartoon, 4 - anime):\n");
+      read_line(temp, sizeof(temp));
+      type = atoi(temp);
+      fprintf(stdout, "Enter description (max of %d characters):\n",
+              DESCRIPTION_LENGTH - 1);
+      read_line(description, DESCRIPTION_LENGTH);
+      fprintf(stdout, "Enter status (1 - Plan to watch, 2 - Watching "
+                      "currently, 3 - Completed):\n");
+      read_line(temp, sizeof(temp));
+      status = atoi(temp);
+      rating = 0;
+      if (status > 1) {
+        fprintf(stdout, "Enter rating (1 - 5, 1 being terrible and 5 being "
+                        "amazing):\n"); // for 1 or 2
+        read_line(temp, sizeof(temp));
+        rating = atoi(temp);
+      }
+      start = wl_begin(out, WL_CREATE, 0, 0, (*next_id)++);
+      wl_put_str(out, WL_F_TITLE, title);
+      wl_put_u32(out, WL_F_TYPE, type);
+      wl_put_str(out, WL_F_DESCRIPTION, description);
+      wl_put_u32(out, WL_F_STATUS, status);
+      wl_put_u32(out, WL_F_RATING, rating);
+      wl_end(out, start);
+      break;
+
+    case 'f':
+    case 'F':
+      // find
+      fprintf(stdout, "Enter title you wish to search for:\n");
+      read_line(title, TITLE_LENGTH);
+      start = wl_begin(out, WL_FIND, 0, 0, (*next_id)++);
+      wl_put_str(out, WL_F_TITLE, title);
+      wl_end(out, start);
+      break;
+
+    case 's':
+    case 'S':
+      // search titles
+      fprintf(stdout, "Enter the start of the title, or any part of it:\n");
+      read_line(title, TITLE_LENGTH);
+      fprintf(stdout, "Match anywhere in the title? (yes or no)\n");
+      read_line(temp, sizeof(temp));
+      start = wl_begin(out, WL_SEARCH, 0, 0, (*next_id)++);
+      wl_put_str(out, WL_F_TITLE, title);
+      wl_put_u32(out, WL_F_MATCH,
+                 temp[0] == 'y' || temp[0] == 'Y' ? WL_MATCH_SUBSTRING
+                                                  : WL_MATCH_PREFIX);
+      wl_end(out, start);
+      break;
+
+    case 'd':
+    case 'D':
+      // display whole list
+      fprintf(stdout, "The whole list will be displayed:\n");
+      display_list(ssl, out, in, next_id, NULL, false);
+      break;
+
+    case 'u':
+    case 'U':
+      // update
+      fprintf(stdout, "Enter title you wish to update:\n");
+      read_line(title, TITLE_LENGTH);
+      fprintf(stdout, "Which field would you like to update? (Title, Media "
+                      "Type, Description, Status, Rating)\n");
+      read_line(updateChar, sizeof(updateChar));
+      start = wl_begin(out, WL_UPDATE, 0, 0, (*next_id)++);
+      wl_put_str(out, WL_F_TITLE, title);
+      switch (updateChar[0]) {
+      case 't':
+      case 'T':
+        fprintf(stdout, "Enter new title:\n");
+        read_line(newTitle, TITLE_LENGTH);
+        wl_put_str(out, WL_F_NEW_TITLE, newTitle);
+        break;
+
+      case 'm':
+      case 'M':
+        fprintf(stdout, "Enter new type:\n");
+        read_line(temp, sizeof(temp));
+        wl_put_u32(out, WL_F_TYPE, atoi(temp));
+        break;
+
+      case 'd':
+      case 'D':
+        fprintf(stdout, "Enter new description:\n");
+        read_line(description, DESCRIPTION_LENGTH);
+        wl_put_str(out, WL_F_DESCRIPTION, description);
+        break;
+
+      case 's':
+      case 'S':
+        fprintf(stdout, "Enter new status:\n");
+        read_line(temp, sizeof(temp));
+        wl_put_u32(out, WL_F_STATUS, atoi(temp));
+        break;
+
+      case 'r':
+      case 'R':
+        fprintf(stdout, "Enter new rating:\n");
+        read_line(temp, sizeof(temp));
+        wl_put_u32(out, WL_F_RATING, atoi(temp));
+        break;
+      }
+      wl_end(out, start);
+      break;
+
+    case 'r':
+    case 'R':
+      // remove
+      fprintf(stdout, "Enter title of entry you wish to delete:\n");
+      read_line(title, TITLE_LENGTH);
+      start = wl_begin(out, WL_REMOVE, 0, 0, (*next_id)++);
+      wl_put_str(out, WL_F_TITLE, title);
+      wl_end(out, start);
+      break;
+
+    default:
+      fprintf(stdout, "Invalid statement\n");
+    }
+
+    // send the request to the server and show its answer
+    if (out->len > 0) {
+      size = exchange(ssl, out, in, &reply);
+      if (reply.status != WL_OK)
+        fprintf(stdout, "Server: %s\n", wl_status_str(reply.status));
+      else if (reply.type == WL_FIND)
+        print_entries(&reply);
+      else if (reply.type == WL_SEARCH)
+        print_titles(&reply);
+      else
+        fprintf(stdout, "Server: ok\n");
+      wl_buf_consume(in, size);
+    }
+
+    fprintf(stdout,
+            "Would you like to choose another operation? (yes or no)\n");
+    read_line(temp, sizeof(temp));
+  } while (temp[0] == 'y' || temp[0] == 'Y');
+}
+
+/******************************************************************************
+
+  The sequence of steps required to establish a secure SSL/TLS connection is:
+
+  1.  Initialize the SSL algorithms
+  2.  Create and configure an SSL context object
+  3.  Create an SSL session object
+  4.  Create a new network socket in the traditional way
+  5.  Bind the SSL object to the network socket descriptor
+  6.  Establish an SSL session on top of the network connection
+
+  Once these steps are completed successfully, use the functions SSL_read() and
+  SSL_write() to read from/write to the socket, but using the SSL object rather
+  then the socket descriptor.  Once the session is complete, free the memory
+  allocated to the SSL object and close the socket descriptor.
+
+ ******************************************************************************/
+int main(int argc, char **argv) {
+  const SSL_METHOD *method;
+  unsigned int port = DEFAULT_PORT;
+  char remote_host[MAX_HOSTNAME_LENGTH];
+  char *temp_ptr;
+  int sockfd;
+  int op;
+  SSL_CTX *ssl_ctx;
+  SSL *ssl;
+  char opChar[20];
+  char temp[STR_LENGTH];
+  char username[USERNAME_LENGTH];
+  char password[PASSWORD_LENGTH];
+  char hash[BUFFER_SIZE];
+  const char *const seedchars = "./0123456789"
+                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "abcdefghijklmnopqrstuvwxyz";
+  unsigned long int seed[2];
+  struct wl_buf out = {0}, in = {0};
+  struct wl_frame reply;
+  struct wl_field field;
+  size_t start;
+  long size;
+  uint32_t next_id = 1;
+  FILE *script = NULL;
+  const char *script_name = NULL, *user = NULL;
+  int window = SCRIPT_WINDOW;
+  bool quiet = false;
+
+  while ((op = getopt(argc, argv, "f:u:w:q")) != -1) {
+    switch (op) {
+    case 'f':
+      script_name = optarg;
+      break;
+    case 'u':
+      user = optarg;
+      break;
+    case 'w':
+      window = atoi(optarg);
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    default:
+      argc = 0; // show the usage
+    }
+  }
+
+  if (argc - optind != 1 || window < 1) {
+    fprintf(stderr, "Client: Usage: ssl-client [-f script] [-u user] "
+                    "[-w window] [-q] <server name>:<port>\n");
+    exit(EXIT_FAILURE);
+  } else {
+    argv += optind - 1;
+    // Search for ':' in the argument to see if port is specified
+    temp_ptr = strchr(argv[1], ':');
+    if (temp_ptr == NULL) // Hostname only. Use default port
+      strncpy(remote_host, argv[1], MAX_HOSTNAME_LENGTH);
+    else {
+      // Argument is formatted as <hostname>:<port>. Need to separate
+      // First, split out the hostname from port, delineated with a colon
+      // remote_host will have the <hostname> substring
+      strncpy(remote_host, strtok(argv[1], ":"), MAX_HOSTNAME_LENGTH);
+      // Port number will be the substring after the ':'. At this point
+      // temp is a pointer to the array element containing the ':'
+      port = (unsigned int)atoi(temp_ptr + sizeof(char));
+    }
+  }
+
+  // A script is opened first so a bad name fails before connecting
+  if (script_name != NULL) {
+    if (strcmp(script_name, "-") == 0)
+      script = stdin;
+    else if ((script = fopen(script_name, "r")) == NULL) {
+      fprintf(stderr, "Client: Cannot open %s: %s\n", script_name,
+              strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Initialize OpenSSL ciphers and digests
+  OpenSSL_add_all_algorithms();
+
+  // SSL_library_init() registers the available SSL/TLS ciphers and digests.
+  if (SSL_library_init() < 0) {
+    fprintf(stderr, "Client: Could not initialize the OpenSSL library!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Use the SSL/TLS method for clients
+  method = SSLv23_client_method();
+
+  // Create new context instance
+  ssl_ctx = SSL_CTX_new(method);
+  if (ssl_ctx == NULL) {
+    fprintf(stderr, "Unable to create a new SSL context structure.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // This disables SSLv2, which means only SSLv3 and TLSv1 are available
+  // to be negotiated between client and server
+  SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_SSLv2);
+
+  // Hand every new session to save_session() rather than keeping it
+  SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT |
+                                              SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ssl_ctx, save_session);
+
+  // Create a new SSL connection state object
+  ssl = SSL_new(ssl_ctx);
+
+  // Create the underlying TCP socket connection to the remote host
+  sockfd = create_socket(remote_host, port);
+  if (sockfd != 0)
+    fprintf(stderr, "Client: Established TCP connection to '%s' on port %u\n",
+            remote_host, port);
+
+  // First attempt to connect did not succeed. Try the backup server
+  else {
+    port = BACKUP_PORT;
+    printf("Trying backup server on port %u\n", port);
+    sockfd = create_socket(remote_host, port);
+    if (sockfd != 0)
+      fprintf(stderr, "Client: Established TCP connection to '%s' on port %u\n",
+              remote_host, port);
+
+    // Welp, neither worked. There are limits to everything
+    else {
+      fprintf(stderr,
+              "Client: Could not establish TCP connection to %s on port %u\n",
+              remote_host, port);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Bind the SSL object to the network socket descriptor.  The socket
+  // descriptor will be used by OpenSSL to communicate with a server. This
+  // function should only be called once the TCP connection is established,
+  // i.e., after create_socket()
+  SSL_set_fd(ssl, sockfd);
+
+  // Try to resume the session from the last run with this server
+  snprintf(session_file, sizeof(session_file), "%s/.watchlist-session-%s-%u",
+           getenv("HOME") ? getenv("HOME") : ".", remote_host, port);
+  snprintf(token_file, sizeof(token_file), "%s/.watchlist-token-%s-%u",
+           getenv("HOME") ? getenv("HOME") : ".", remote_host, port);
+  load_session(ssl);
+
+  // Initiates an SSL session over the existing socket connection. SSL_connect()
+  // will return 1 if successful.
+  if (SSL_connect(ssl) == 1)
+    fprintf(stdout,
+            "Client: Established SSL/TLS session to '%s' on port %u%s\n",
+            remote_host, port, SSL_session_reused(ssl) ? " (resumed)" : "");
+  else {
+    fprintf(stderr,
+            "Client: Could not establish SSL session to '%s' on port %u\n",
+            remote_host, port);
+    exit(EXIT_FAILURE);
+  }
+
+  // Announce the binary protocol, agree on a version with the server and
+  // offer to take compressed replies
+  wl_buf_reserve(&out, WL_MAGIC_LEN);
+  memcpy(out.data, WL_MAGIC, WL_MAGIC_LEN);
+  out.len = WL_MAGIC_LEN;
+  start = wl_begin(&out, WL_HELLO, 0, 0, next_id++);
+  wl_put_u32(&out, WL_F_VERSION, WL_VERSION);
+  wl_put_u32(&out, WL_F_COMPRESS, WL_COMPRESS_ZLIB);
+  put_token(&out);
+  wl_end(&out, start);
+  size = exchange(ssl, &out, &in, &reply);
+  if (reply.type != WL_HELLO || reply.status != WL_OK ||
+      !wl_find(&reply, WL_F_VERSION, &field)) {
+    fprintf(stderr, "Client: Server does not speak the watchlist protocol\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // The server accepted our saved token: we are logged in already
+  if (wl_find(&reply, WL_F_USERNAME, &field)) {
+    wl_copy_str(&field, username, USERNAME_LENGTH);
+    fprintf(stdout, "Client: Logged in as %s\n", username);
+    op = 0;
+  } else if (script != NULL) {
+    // A script cannot answer prompts, so it logs in as -u without them
+    if (user == NULL || getenv("WATCHLIST_PASSWORD") == NULL) {
+      fprintf(stderr, "Client: Not logged in; a script needs -u and "
+                      "WATCHLIST_PASSWORD\n");
+      exit(EXIT_FAILURE);
+    }
+    op = 2;
+  } else {
+    fprintf(stdout,
+            "Please choose an operation (1 - Create Account, 2 - Log In) ");
+    read_line(opChar, sizeof(opChar));
+    op = opChar[0] - '0';
+    fprintf(stdout, "got %d\n", op);
+  }
+  wl_buf_consume(&in, size);
+
+  switch (op) {
+  case 0:
+    break;
+
+  case 1:
+    fprintf(stdout, "Enter username: ");
+    read_line(username, USERNAME_LENGTH);
+    // The first three characters indicate which hashing algorithm to
+    // use.  "$5$ selects the SHA256 algorithm.  I use MD5 ($1$) because
+    // the hash is shorter. It still illustrates how this works. The length
+    // of this char array is the seed length plus 3 to account for the
+    // identifier and two '$" separators
+    char salt[] = "$1$........";
+
+    // Generate a (not very) random seed. There are better ways to do this.
+    // Specified in the GNU C Library documentation
+    seed[0] = time(NULL);
+    seed[1] = getpid() ^ (seed[0] >> 14 & 0x30000);
+
+    // Convert the salt into printable characters from the seedchars string
+    for (int i = 0; i < 8; i++)
+      salt[3 + i] = seedchars[(seed[i / 5] >> (i % 5) * 6) & 0x3f];
+
+    // Enter the password
+    fprintf(stdout, "Enter password: ");
+    getPassword(password, PASSWORD_LENGTH);
+
+    // Now we create a cryptographic hash of the password with the SHA256
+    // algorithm using the generated salt string
+    strncpy(hash, crypt(password, salt), BUFFER_SIZE);
+
+    fprintf(stdout, "The password entered is: %s\n", password);
+    fprintf(stdout, "The salt is: %s\n", salt);
+    fprintf(stdout, "The hash of the password (w/ salt) is: %s\n", hash);
+
+    start = wl_begin(&out, WL_REGISTER, 0, 0, next_id++);
+    wl_put_str(&out, WL_F_USERNAME, username);
+    wl_put_str(&out, WL_F_HASH, hash);
+    wl_put_str(&out, WL_F_SALT, salt);
+    wl_end(&out, start);
+    size = exchange(ssl, &out, &in, &reply);
+    if (reply.status != WL_OK) {
+      fprintf(stdout, "client: Could not create account: %s\n",
+              wl_status_str(reply.status));
+      exit(EXIT_FAILURE);
+    }
+    save_token(&reply);
+    wl_buf_consume(&in, size);
+    break;
+
+  case 2:
+    if (script != NULL) {
+      snprintf(username, USERNAME_LENGTH, "%s", user);
+      snprintf(password, PASSWORD_LENGTH, "%s", getenv("WATCHLIST_PASSWORD"));
+    } else {
+      fprintf(stdout, "Enter username: ");
+      read_line(username, USERNAME_LENGTH);
+
+      // Enter the password
+      fprintf(stdout, "Enter password: ");
+      getPassword(password, PASSWORD_LENGTH);
+    }
+
+    // Ask for this user's salt
+    start = wl_begin(&out, WL_SALT, 0, 0, next_id++);
+    wl_put_str(&out, WL_F_USERNAME, username);
+    wl_end(&out, start);
+    size = exchange(ssl, &out, &in, &reply);
+    if (!wl_find(&reply, WL_F_SALT, &field)) {
+      fprintf(stderr, "Client: Server did not send a salt\n");
+      exit(EXIT_FAILURE);
+    }
+    wl_copy_str(&field, temp, SALT_LENGTH);
+    wl_buf_consume(&in, size);
+    strncpy(hash, crypt(password, temp), BUFFER_SIZE);
+
+    if (script == NULL) {
+      fprintf(stdout, "The password entered is: %s\n", password);
+      fprintf(stdout, "The salt is: %s\n", temp);
+      fprintf(stdout, "The hash of the password (w/ salt) is: %s\n", hash);
+    }
+
+    start = wl_begin(&out, WL_LOGIN, 0, 0, next_id++);
+    wl_put_str(&out, WL_F_USERNAME, username);
+    wl_put_str(&out, WL_F_HASH, hash);
+    wl_end(&out, start);
+    size = exchange(ssl, &out, &in, &reply);
+    if (reply.status != WL_OK) {
+      fprintf(stdout,
+              "client: User couldn't be verifed. Please make an account.\n");
+      exit(EXIT_FAILURE);
+    }
+    save_token(&reply);
+    wl_buf_consume(&in, size);
+    break;
+
+  default:
+    fprintf(stdout, "client: error, please input 1 or 2\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (script != NULL)
+    run_script(ssl, script, script_name, window, quiet, &out, &in, &next_id);
+  else
+    run_prompts(ssl, &out, &in, &next_id);
+
+  // Deallocate memory for the SSL data structures and close the socket
+  SSL_shutdown(ssl);
+  SSL_free(ssl);
+  SSL_CTX_free(ssl_ctx);
+  close(sockfd);
+  wl_buf_free(&out);
+  wl_buf_free(&in);
+  if (script != NULL && script != stdin)
+    fclose(script);
+  fprintf(stdout, "Client: Terminated SSL/TLS connection with server '%s'\n",
+          remote_host);
+
+  return (0);
+}
@@ -1,672 +1,2875 @@
-/******************************************************************************
-
-PROGRAM:  ssl-server.c for Watchlist Project
-AUTHOR:   Thomas, Riley, Stephanie
-COURSE:   CS469 - Distributed Systems (Regis University)
-SYNOPSIS: This program is a small server application that receives incoming TCP
-          connections from clients and transfers a requested file from the
-          server to the client.  It uses a secure SSL/TLS connection using
-          a certificate generated with the openssl application.
-
-          To create a self-signed certificate your server can use, at the
-command prompt type:
-
-          openssl req -newkey rsa:2048 -nodes -keyout key.pem -x509 -days 365
--out cert.pem
-
-          This will create two files: a private key contained in the file
-'key.pem' and a certificate containing a public key in the file 'cert.pem'. Your
-          server will require both in order to operate properly.
-
-          Some of the code and descriptions can be found in "Network Security
-with OpenSSL", O'Reilly Media, 2002.
-
-Some code provided by Prof. Hemmes for use in these projects. This is the server
-side for the Watchlist project.
-
-******************************************************************************/
-#include <arpa/inet.h>
-#include <fcntl.h>
-#include <gdbm.h>
-#include <openssl/err.h>
-#include <openssl/ssl.h>
-#include <signal.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <string.h>
-#include <sys/socket.h>
-#include <sys/stat.h>
-#include <unistd.h>
-
-#define BUFFER_SIZE 800
-#define PATH_LENGTH 256
-#define DEFAULT_PORT 4433
-#define CERTIFICATE_FILE "cert.pem"
-#define KEY_FILE "key.pem"
-
-/******************************************************************************
-
-  This function does the basic necessary housekeeping to establish TCP
- connections to the server.  It first creates a new socket, binds the network
- interface of the machine to that socket, then listens on the socket for
- incoming TCP connections.
-
- *******************************************************************************/
-int create_socket(unsigned int port) {
-  int s;
-  struct sockaddr_in addr;
-
-  // First we set up a network socket. An IP socket address is a combination
-  // of an IP interface address plus a 16-bit port number. The struct field
-  // sin_family is *always* set to AF_INET. Anything else returns an error.
-  // The TCP port is stored in sin_port, but needs to be converted to the
-  // format on the host machine to network byte order, which is why htons()
-  // is called. Setting s_addr to INADDR_ANY binds the socket and listen on
-  // any available network interface on the machine, so clients can connect
-  // through any, e.g., external network interface, localhost, etc.
-
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(port);
-  addr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-  // Create a socket (endpoint) for network communication.  The socket()
-  // call returns a socket descriptor, which works exactly like a file
-  // descriptor for file system operations we worked with in CS431
-  //
-  // Sockets are by default blocking, so the server will block while reading
-  // from or writing to a socket. For most applications this is acceptable.
-  s = socket(AF_INET, SOCK_STREAM, 0);
-  if (s < 0) {
-    fprintf(stderr, "Server: Unable to create socket: %s", strerror(errno));
-    exit(EXIT_FAILURE);
-  }
-
-  // When you create a socket, it exists within a namespace, but does not have
-  // a network address associated with it.  The bind system call creates the
-  // association between the socket and the network interface.
-  //
-  // An error could result from an invalid socket descriptor, an address already
-  // in use, or an invalid network address
-  if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-    fprintf(stderr, "Server: Unable to bind to socket: %s", strerror(errno));
-    exit(EXIT_FAILURE);
-  }
-
-  // Listen for incoming TCP connections using the newly created and configured
-  // socket. The second argument (1) indicates the number of pending connections
-  // allowed, which in this case is one.  That means if the server is connected
-  // to one client, a second client attempting to connect may receive an error,
-  // e.g., connection refused.
-  //
-  // Failure could result from an invalid socket descriptor or from using a
-  // socket descriptor that is already in use.
-  if (listen(s, 1) < 0) {
-    fprintf(stderr, "Server: Unable to listen: %s", strerror(errno));
-    exit(EXIT_FAILURE);
-  }
-
-  fprintf(stdout, "Server: Listening on TCP port %u\n", port);
-
-  return s;
-}
-
-/******************************************************************************
-
-  This function does some initialization of the OpenSSL library functions used
- in this program.  The function SSL_load_error_strings registers the error
- strings for all of the libssl and libcrypto functions so that appropriate
- textual error messages can be displayed when error conditions arise.
- OpenSSL_add_ssl_algorithms registers the available SSL/TLS ciphers and digests
- used for encryption.
-
- ******************************************************************************/
-void init_openssl() {
-  SSL_load_error_strings();
-  OpenSSL_add_ssl_algorithms();
-}
-
-/******************************************************************************
-
-  EVP_cleanup removes all of the SSL/TLS ciphers and digests registered earlier.
-
- ******************************************************************************/
-void cleanup_openssl() { EVP_cleanup(); }
-
-/******************************************************************************
-
-  An SSL_CTX object is an instance of a factory design pattern that produces SSL
-  connection objects, each called a context. A context is used to set parameters
-  for the connection, and in this program, each context is configured using the
-  configure_context() function below. Each context object is created using the
-  function SSL_CTX_new(), and the result of that call is what is returned by
- this function and subsequently configured with connection information.
-
-  One other thing to point out is when creating a context, the SSL protocol must
-  be specified ahead of time using an instance of an SSL_method object.  In this
-  case, we are creating an instance of an SSLv23_server_method, which is an
-  SSL_METHOD object for an SSL/TLS server. Of the available types in the OpenSSL
-  library, this provides the most functionality.
-
- ******************************************************************************/
-SSL_CTX *create_new_context() {
-  const SSL_METHOD
-      *ssl_method; // This should be declared 'const' to avoid getting
-  // a warning from the call to SSLv23_server_method()
-  SSL_CTX *ssl_ctx;
-
-  // Use SSL/TLS method for server
-  ssl_method = SSLv23_server_method();
-
-  // Create new context instance
-  ssl_ctx = SSL_CTX_new(ssl_method);
-  if (ssl_ctx == NULL) {
-    fprintf(stderr, "Server: cannot create SSL context:\n");
-    ERR_print_errors_fp(stderr);
-    exit(EXIT_FAILURE);
-  }
-
-  return ssl_ctx;
-}
-
-/******************************************************************************
-
-  We will use Elliptic Curve Diffie Hellman anonymous key agreement protocol for
-  the session key shared between client and server.  We first configure the SSL
-  context to use that protocol by calling the function SSL_CTX_set_ecdh_auto().
-  The second argument (onoff) tells the function to automatically use the
- highest preference curve (supported by both client and server) for the key
- agreement.
-
-  Note that for error conditions specific to SSL/TLS, the OpenSSL library does
-  not set the variable errno, so we must use the built-in error printing
- routines.
-
- ******************************************************************************/
-void configure_context(SSL_CTX *ssl_ctx) {
-  SSL_CTX_set_ecdh_auto(ssl_ctx, 1);
-
-  // Set the certificate to use, i.e., 'cert.pem'
-  if (SSL_CTX_use_certificate_file(ssl_ctx, CERTIFICATE_FILE,
-                                   SSL_FILETYPE_PEM) <= 0) {
-    fprintf(stderr, "Server: cannot set certificate:\n");
-    ERR_print_errors_fp(stderr);
-    exit(EXIT_FAILURE);
-  }
-
-  // Set the private key contained in the key file, i.e., 'key.pem'
-  if (SSL_CTX_use_PrivateKey_file(ssl_ctx, KEY_FILE, SSL_FILETYPE_PEM) <= 0) {
-    fprintf(stderr, "Server: cannot set certificate:\n");
-    ERR_print_errors_fp(stderr);
-    exit(EXIT_FAILURE);
-  }
-}
-// Struct entry in database
-struct entry {
-  char title[256];
-  char description[500];
-  int type;
-  int status;
-  int rating;
-};
-
-// Struct user entry in database
-struct user {
-  char username[32];
-  char hash[256];
-  char salt[12];
-};
-
-/******************************************************************************
-
-  The sequence of steps required to establish a secure SSL/TLS connection is:
-
-  1.  Initialize the SSL algorithms
-  2.  Create and configure an SSL context object
-  3.  Create a new network socket in the traditional way
-  4.  Listen for incoming connections
-  5.  Accept incoming connections as they arrive
-  6.  Create a new SSL object for the newly arrived connection
-  7.  Bind the SSL object to the network socket descriptor
-
-  Once these steps are completed successfully, use the functions SSL_read() and
-  SSL_write() to read from/write to the socket, but using the SSL object rather
-  then the socket descriptor.  Once the session is complete, free the memory
-  allocated to the SSL object and close the socket descriptor.
-
- ******************************************************************************/
-int main(int argc, char **argv) {
-  SSL_CTX *ssl_ctx;
-  unsigned int sockfd;
-  unsigned int port;
-  char buffer[BUFFER_SIZE];
-  char filename[PATH_LENGTH];
-  char title[BUFFER_SIZE] = {0};
-  char username[32];
-  char hash[256];
-  char verifyHash[256];
-  char salt[12];
-  int type, status, rating;
-  char *verify;
-  char description[500] = {0};
-  char temp[500] = {0};
-  char opChar, uOpChar;
-  char *ptr;
-
-  // Initialize and create SSL data structures and algorithms
-  init_openssl();
-  ssl_ctx = create_new_context();
-  configure_context(ssl_ctx);
-
-  // Pointer to a GDBM file
-  GDBM_FILE dbf;
-
-  // Represents the database file name
-  const char *dbfilename = "watchlist.db";
-
-  // Open the database for read/write, create if it doesn't already exist
-  /*dbf = gdbm_open(dbfilename, 0, GDBM_WRCREAT, 0776, 0);
-    if (!dbf) {
-    fprintf (stderr, "Could not open database file %s: %s\n", dbfilename,
-    gdbm_strerror(GDBM_FILE_OPEN_ERROR));
-    return EXIT_FAILURE;
-    }*/
-
-  // Port can be specified on the command line. If it's not, use the default
-  // port
-  switch (argc) {
-  case 1:
-    port = DEFAULT_PORT;
-    break;
-  case 2:
-    port = atoi(argv[1]);
-    break;
-  default:
-    fprintf(stderr, "Usage: ssl-server <port> (optional)\n");
-    exit(EXIT_FAILURE);
-  }
-
-  // This will create a network socket and return a socket descriptor, which is
-  // and works just like a file descriptor, but for network communcations. Note
-  // we have to specify which TCP/UDP port on which we are communicating as an
-  // argument to our user-defined create_socket() function.
-  sockfd = create_socket(port);
-
-  struct entry tempEntry;
-
-  // Wait for incoming connections and handle them as the arrive
-  while (1) {
-    SSL *ssl;
-    int client;
-    int readfd;
-    int rcount;
-    struct sockaddr_in addr;
-    unsigned int len = sizeof(addr);
-    char client_addr[INET_ADDRSTRLEN];
-    char *titlePtr;
-    char *usernamePtr;
-    char values[BUFFER_SIZE];
-
-    // Once an incoming connection arrives, accept it.  If this is successful,
-    // we now have a connection between client and server and can communicate
-    // using the socket descriptor
-    client = accept(sockfd, (struct sockaddr *)&addr, &len);
-    if (client < 0) {
-      fprintf(stderr, "Server: Unable to accept connection: %s\n",
-              strerror(errno));
-      exit(EXIT_FAILURE);
-    }
-
-    // Display the IPv4 network address of the connected client
-    inet_ntop(AF_INET, (struct in_addr *)&addr.sin_addr, client_addr,
-              INET_ADDRSTRLEN);
-    fprintf(stdout,
-            "Server: Established TCP connection with client (%s) on port %u\n",
-            client_addr, port);
-
-    // Here we are creating a new SSL object to bind to the socket descriptor
-    ssl = SSL_new(ssl_ctx);
-
-    // Bind the SSL object to the network socket descriptor.  The socket
-    // descriptor will be used by OpenSSL to communicate with a client. This
-    // function should only be called once the TCP connection is established.
-    SSL_set_fd(ssl, client);
-
-    // The last step in establishing a secure connection is calling
-    // SSL_accept(), which executes the SSL/TLS handshake.  Because network
-    // sockets are blocking by default, this function will block as well until
-    // the handshake is complete.
-    if (SSL_accept(ssl) <= 0) {
-      fprintf(stderr, "Server: Could not establish secure connection:\n");
-      ERR_print_errors_fp(stderr);
-    } else
-      fprintf(stdout,
-              "Server: Established SSL/TLS connection with client (%s)\n",
-              client_addr);
-
-    SSL_read(ssl, buffer, BUFFER_SIZE);
-
-    switch (buffer[0] - '0') {
-    case 1:
-
-      // Open the database for read/write, create if it doesn't already exist
-      dbf = gdbm_open("users.db", 0, GDBM_WRCREAT, 0776, 0);
-      if (!dbf) {
-        fprintf(stderr, "Could not open database file %s: %s: %s\n", "users.db",
-                gdbm_strerror(GDBM_FILE_OPEN_ERROR), strerror(errno));
-        return EXIT_FAILURE;
-      }
-      // store values in variables
-      fprintf(stdout, "%s\n", buffer);
-      ptr = strtok(buffer, ":");
-      strcpy(&opChar, ptr);
-      ptr = strtok(NULL, ":");
-      strcpy(username, ptr);
-      ptr = strtok(NULL, ":");
-      strcpy(hash, ptr);
-      ptr = strtok(NULL, ":");
-      strcpy(salt, ptr);
-
-      sprintf(temp, "%s:%s", hash, salt);
-
-      fprintf(stdout, "%s:%s:%s\n", username, hash, salt);
-
-      usernamePtr = username;
-
-      // Create a key-value pair to insert in the database. Must specify the
-      // size of each datum in bytes.
-      datum userKey = {usernamePtr, strlen(usernamePtr)};
-      datum userValue = {temp, strlen(temp)};
-
-      // Add the key-value pair to the database
-      gdbm_store(dbf, userKey, userValue, GDBM_INSERT);
-      fprintf(stdout, "Successfully inserted new username with key: %s\n",
-              userKey.dptr);
-      break;
-
-    case 2:
-      // Open the database for read/write, create if it doesn't already exist
-      dbf = gdbm_open("users.db", 0, GDBM_WRCREAT, 0776, 0);
-      if (!dbf) {
-        fprintf(stderr, "Could not open database file %s: %s: %s\n", "users.db",
-                gdbm_strerror(GDBM_FILE_OPEN_ERROR), strerror(errno));
-        return EXIT_FAILURE;
-      }
-
-      // store values in variables (only capturing username)
-      ptr = strtok(buffer, ":");
-      strcpy(&opChar, ptr);
-      ptr = strtok(NULL, ":");
-      strcpy(username, ptr);
-
-      usernamePtr = username;
-
-      datum loginKey = {usernamePtr, strlen(usernamePtr)};
-      datum loginValue = gdbm_fetch(dbf, loginKey);
-
-      // access salt and write back to client
-      ptr = strtok(loginValue.dptr, ":");
-      strcpy(hash, ptr);
-      ptr = strtok(NULL, ":");
-      strcpy(salt, ptr);
-
-      SSL_write(ssl, salt, sizeof(salt));
-
-      // read hash from client
-      SSL_read(ssl, verifyHash, sizeof(hash));
-
-      fprintf(stdout, "server: hash = |%s|, verifyHash = |%s|\n", hash, verifyHash);
-
-      if (strncmp(hash, verifyHash, BUFFER_SIZE) == 0) {
-        fprintf(stdout, "Passwords match. User authenticated\n");
-        verify = "1";
-      } else {
-        fprintf(stdout, "Passwords do not match\n");
-        verify = "0";
-      }
-
-      SSL_write(ssl, verify, sizeof(verify));
-      break;
-
-    default:
-      fprintf(stdout, "server: error, please input 0 or 1\n");
-    }
-
-    gdbm_close(dbf);
-    dbf = gdbm_open(dbfilename, 0, GDBM_WRCREAT, 0776, 0);
-    if (!dbf) {
-      fprintf(stderr, "Could not open database file %s: %s: %s\n", dbfilename,
-              gdbm_strerror(GDBM_FILE_OPEN_ERROR), strerror(errno));
-      return EXIT_FAILURE;
-    }
-
-    do {
-
-      bzero(buffer, BUFFER_SIZE);
-      SSL_read(ssl, buffer, BUFFER_SIZE);
-
-      switch (buffer[0]) {
-
-      case 'c':
-      case 'C':
-        // store values in variables
-        ptr = strtok(buffer, ":");
-        strcpy(&opChar, ptr);
-        ptr = strtok(NULL, ":");
-        strcpy(title, ptr);
-        ptr = strtok(NULL, "");
-        // Represents the key and value for the database entry
-        titlePtr = title;
-        strcpy(values, ptr);
-
-        // Create a key-value pair to insert in the database. Must specify the
-        // size of each datum in bytes.
-        datum cKey = {titlePtr, strlen(titlePtr)};
-        datum cValue = {values, strlen(values)};
-
-        // Add the key-value pair to the database
-        gdbm_store(dbf, cKey, cValue, GDBM_INSERT);
-        fprintf(stdout, "Successfully inserted new item with key: %s\n",
-                cKey.dptr);
-        break;
-      case 'f':
-      case 'F':
-        fprintf(stdout, "begin find op\n");
-        // store values in variables
-        ptr = strtok(buffer, ":");
-        strcpy(&opChar, ptr);
-        ptr = strtok(NULL, ":");
-        strcpy(title, ptr);
-        ptr = strtok(NULL, "");
-        // Represents the key and value for the database entry
-        titlePtr = title;
-        datum fKey = {titlePtr, strlen(titlePtr)};
-        datum fValue = gdbm_fetch(dbf, fKey);
-        fprintf(stdout, "value fetched: %s\n", fValue.dptr);
-        break;
-      case 'd':
-      case 'D':
-        fprintf(stdout, "begin display op\n");
-        datum dKey = gdbm_firstkey(dbf);
-        // fprintf(stdout, "dbf val: %s\n", dKey.dptr);
-        struct entry tempEntry;
-        while (dKey.dptr) {
-          datum dValue = gdbm_fetch(dbf, dKey);
-          ptr = strtok(dValue.dptr, ":");
-          tempEntry.type = atoi(ptr);
-          ptr = strtok(NULL, ":");
-          strcpy(tempEntry.description, ptr);
-          ptr = strtok(NULL, ":");
-          tempEntry.status = atoi(ptr);
-          ptr = strtok(NULL, ":");
-          tempEntry.rating = atoi(ptr);
-          fprintf(stdout, "The entry is: %s, %s, %d, %d, %d\n", dKey.dptr,
-                  tempEntry.description, tempEntry.type, tempEntry.status,
-                  tempEntry.rating);
-          free(dValue.dptr);
-          free(dKey.dptr);
-          gdbm_nextkey(dbf, dKey);
-        }
-        break;
-
-      case 'u':
-      case 'U':
-        strtok(buffer, ":");
-        ptr = strtok(NULL, ":");
-        strcpy(&uOpChar, ptr);
-        ptr = strtok(NULL, ":");
-        strcpy(title, ptr);
-        ptr = strtok(NULL, ":");
-        strcpy(temp, ptr);
-
-        fprintf(stdout, "begin update op\n");
-        // Represents the key and value for the database entry
-        titlePtr = title;
-        datum uKey = {titlePtr, strlen(titlePtr)};
-
-        if (gdbm_exists(dbf, fKey)) {
-          datum uValue = gdbm_fetch(dbf, uKey);
-          ptr = strtok(uValue.dptr, ":");
-          strcpy(tempEntry.description, ptr);
-          ptr = strtok(NULL, ":");
-          tempEntry.type = atoi(ptr);
-          ptr = strtok(NULL, ":");
-          tempEntry.status = atoi(ptr);
-          ptr = strtok(NULL, ":");
-          tempEntry.rating = atoi(ptr);
-          ptr = strtok(NULL, ":");
-          switch (uOpChar) {
-          case 't':
-          case 'T':
-            strcpy(tempEntry.title, temp);
-            break;
-
-          case 'm':
-          case 'M':
-            tempEntry.type = atoi(temp);
-            break;
-
-          case 'd':
-          case 'D':
-            strcpy(tempEntry.description, temp);
-            break;
-
-          case 's':
-          case 'S':
-            tempEntry.status = atoi(temp);
-            break;
-
-          case 'r':
-          case 'R':
-            tempEntry.rating = atoi(temp);
-            break;
-          }
-
-        } else {
-          fprintf(stdout, "Item %s doesn't exist \n", title);
-        }
-      case 'r':
-      case 'R':
-        fprintf(stdout, "begin delete op\n");
-        strtok(buffer, ":");
-        ptr = strtok(NULL, "");
-        strcpy(temp, ptr);
-        datum rKey = {temp, strlen(temp)};
-
-        // store values in variables
-        if (gdbm_exists(dbf, rKey)) {
-          ptr = strtok(buffer, ":");
-          strcpy(&opChar, ptr);
-          ptr = strtok(NULL, ":");
-          strcpy(title, ptr);
-          ptr = strtok(NULL, "");
-          // Represents the key and value for the database entry
-          titlePtr = title;
-          datum rKey = {titlePtr, strlen(titlePtr)};
-          gdbm_delete(dbf, rKey);
-          fprintf(stdout, "Successfully deleted %s\n", title);
-        } else {
-          fprintf(stdout, "Item %s doesn't exist \n", title);
-        }
-        break;
-        //      case 1:
-        //      	gdbm_close(dbf);
-        //
-        //      	// Open the database for read/write, create if it
-        //      doesn't already exist
-        //	    dbf = gdbm_open("users.db", 0, GDBM_WRCREAT, 0776, 0);
-        //	    if (!dbf) {
-        //	      fprintf(stderr, "Could not open database file %s: %s:
-        //%s\n", "users.db", 	              gdbm_strerror(GDBM_FILE_OPEN_ERROR),
-        //strerror(errno)); 	      return EXIT_FAILURE;
-        //	    }
-        //	    // store values in variables
-        //        ptr = strtok(buffer, ":");
-        //        strcpy(&opChar, ptr);
-        //        ptr = strtok(NULL, ":");
-        //        strcpy(username, ptr);
-        //        ptr = strtok(NULL, "");
-        //        strcpy(hash, ptr);
-        //        ptr = strtok(NULL, ":");
-        //        strcpy(salt, ptr);
-        //        ptr = strtok(NULL, ":");
-        //
-        //        sprintf(temp, "%s:%s", hash, salt);
-        //
-        //        usernamePtr = username;
-        //
-        //        // Create a key-value pair to insert in the database. Must
-        //        specify the
-        //	    // size of each datum in bytes.
-        //	    datum userKey = {usernamePtr, strlen(usernamePtr)};
-        //	    datum userValue = {temp, strlen(temp)};
-        //
-        //	    // Add the key-value pair to the database
-        //        gdbm_store(dbf, userKey, userValue, GDBM_INSERT);
-        //        fprintf(stdout, "Successfully inserted new username with key:
-        //        %s\n",
-        //                userKey.dptr);
-        //        break;
-      }
-      SSL_read(ssl, buffer, BUFFER_SIZE);
-
-    } while (buffer[0] == 'y' || buffer[0] == 'Y');
-    gdbm_close(dbf);
-
-    //	// Receive RPC request and transfer the file
-    //	bzero(buffer, BUFFER_SIZE);
-    //	rcount = SSL_read(ssl, buffer, BUFFER_SIZE);
-    //	if (sscanf(buffer, "getfile %s", filename) == 1) {
-    //	  readfd = open(filename, O_RDONLY);
-    //	  if (readfd < 0) {
-    //	    fprintf(stderr, "Server: Could not open file \"%s\": %s\n",
-    // filename, strerror(errno)); 	    sprintf(buffer, "error %d", errno);
-    //	    SSL_write(ssl, buffer, strlen(buffer)+1);
-    //	  } else {
-    //	    do {
-    //	      rcount = read(readfd, buffer, BUFFER_SIZE);
-    //	      SSL_write(ssl, buffer, rcount);
-    //	    } while (rcount > 0);
-    //	    close(readfd);
-    //	    // File transfer complete
-    //	    fprintf(stdout, "Server: Completed file transfer to client (%s)\n",
-    // client_addr);
-    //	  }
-    //	}
-
-    // Terminate the SSL session, close the TCP connection, and clean up
-    fprintf(
-        stdout,
-        "Server: Terminating SSL session and TCP connection with client (%s)\n",
-        client_addr);
-    SSL_free(ssl);
-    close(client);
-  }
-
-  // Tear down and clean up server data structures before terminating
-  SSL_CTX_free(ssl_ctx);
-  gdbm_close(dbf);
-  cleanup_openssl();
-  close(sockfd);
-  fprintf(stdout, "server: closed successfully\n");
-  return 0;
-}
+/******************************************************************************
+
+PROGRAM:  ssl-server.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: This program is a small server application that receives incoming TCP
+          connections from clients and transfers a requested file from the
+          server to the client.  It uses a secure SSL/TLS connection using
+          a certificate generated with the openssl application.
+
+          To create a self-signed certificate your server can use, at the
+command prompt type:
+
+          openssl req -newkey rsa:2048 -nodes -keyout key.pem -x509 -days 365
+-out cert.pem
+
+          This will create two files: a private key contained in the file
+'key.pem' and a certificate containing a public key in the file 'cert.pem'. Your
+          server will require both in order to operate properly.
+
+          Some of the code and descriptions can be found in "Network Security
+with OpenSSL", O'Reilly Media, 2002.
+
+Some code provided by Prof. Hemmes for use in these projects. This is the server
+side for the Watchlist project.
+
+          The server is event driven: every socket is non-blocking and a single
+          epoll loop drives the TLS handshake, reads and writes of all connected
+          clients as small per-connection state machines, so one slow or idle
+          client no longer holds up everybody else.  With -t the server runs
+          several worker threads, each with its own SO_REUSEPORT listening
+          socket, event loop and SSL_CTX, and the kernel spreads incoming
+          connections across them.
+
+          Logins and registrations of binary clients are handed to a
+          small pool of account threads (see auth.h) so a rush of logins
+          never holds up the event loops; -a sets how many there are.
+
+          Changes to the watchlist go through a write-ahead log with group
+          commit (see wal.h) and are only acknowledged once the log has them
+          on disk.  -i sets how many microseconds a commit waits for more
+          writes to join it and -g how many it waits for at most.
+
+          Clients speak the binary protocol described in protocol.h; old
+          clients that still send the colon separated text messages are
+          detected from their first bytes and served as before.
+
+          The users and the watchlist are kept in GDBM files unless -e log
+          picks the log-structured storage engine (see engine.h).
+
+          Each -r host:port names a backup server this one streams every
+          committed change to (see replica.h); any server with the key in
+          replica.key can be a backup.  To try it on one machine, run the
+          backup from a directory of its own on BACKUP_PORT:
+
+            ssl-server 4465
+            ssl-server -r localhost:4465
+
+          Counters and latency histograms of connections, requests and
+          storage calls are kept as described in metrics.h.  A logged in
+          client can ask for them with WL_STATS, and they are written to
+          whoever connects to the unix socket named with -s, by default
+          METRICS_SOCKET in the directory the server runs in.
+
+          Messages are logged asynchronously (see logger.h); -l sets the
+          lowest level that is logged, "info" by default.  At "debug" every
+          request is logged.
+
+          A client gets -T handshake:idle:request seconds (10:300:30 by
+          default, 0 for no limit) to finish the TLS handshake, to start
+          its next request and to send the rest of a request or take its
+          reply; otherwise it is disconnected.  At -m connections
+          (DEFAULT_MAX_CONNECTIONS) new clients wait in the listen backlog
+          until others leave, and with -p a client address may only hold
+          that many connections at once.  A client that does not read its
+          replies is not served more than OUT_LIMIT bytes ahead.
+
+          Clients that offer it in their WL_HELLO get reply frames of -z
+          bytes and more (WL_COMPRESS_MIN by default) compressed with zlib,
+          which shrinks long listings several times over; -z 0 turns
+          compression off.
+
+          Usage: ssl-server [-a auth-threads] [-b backlog] [-c cache-entries]
+                            [-e gdbm|log] [-g commit-batch]
+                            [-i commit-interval] [-l debug|info|warn|error]
+                            [-m max-connections] [-p max-per-ip]
+                            [-r host:port]... [-s admin-socket]
+                            [-t threads] [-T handshake:idle:request]
+                            [-z compress-min] [port]
+
+******************************************************************************/
+#define _GNU_SOURCE // accept4()
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "auth.h"
+#include "cache.h"
+#include "index.h"
+#include "logger.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "record.h"
+#include "replica.h"
+#include "search.h"
+#include "storage.h"
+#include "ticket.h"
+#include "token.h"
+#include "wal.h"
+
+#define BUFFER_SIZE 800
+#define PATH_LENGTH 256
+#define DEFAULT_PORT 4433
+#define DEFAULT_BACKLOG 128
+#define MAX_THREADS 64
+#define MAX_EVENTS 64
+#define STATS_INTERVAL 10
+#define SESSION_CACHE_SIZE 20000 // TLS sessions remembered per worker
+#define DISPLAY_PAGE 100      // entries per display page unless asked otherwise
+#define DISPLAY_MAX_PAGE 1000 // enough to fill most of a WL_MAX_FRAME
+#define SEARCH_LIMIT 20       // titles per search unless asked otherwise
+#define SEARCH_MAX_LIMIT 1000
+#define DEFAULT_MAX_CONNECTIONS 4096
+#define DEFAULT_HANDSHAKE_TIMEOUT 10 // seconds to finish the TLS handshake
+#define DEFAULT_IDLE_TIMEOUT 300     // seconds to wait for the next request
+#define DEFAULT_REQUEST_TIMEOUT 30   // seconds to send a request, take a reply
+#define ACCEPT_RETRY 100       // ms between checks while at the connection cap
+#define OUT_LIMIT (256 * 1024) // queued reply bytes that stop further requests
+#define CERTIFICATE_FILE "cert.pem"
+#define KEY_FILE "key.pem"
+
+/******************************************************************************
+
+  This function does the basic necessary housekeeping to establish TCP
+ connections to the server.  It first creates a new socket, binds the network
+ interface of the machine to that socket, then listens on the socket for
+ incoming TCP connections.
+
+ *******************************************************************************/
+int create_socket(unsigned int port, int backlog, bool reuseport) {
+  int s;
+  int optval = 1;
+  struct sockaddr_in addr;
+
+  // First we set up a network socket. An IP socket address is a combination
+  // of an IP interface address plus a 16-bit port number. The struct field
+  // sin_family is *always* set to AF_INET. Anything else returns an error.
+  // The TCP port is stored in sin_port, but needs to be converted to the
+  // format on the host machine to network byte order, which is why htons()
+  // is called. Setting s_addr to INADDR_ANY binds the socket and listen on
+  // any available network interface on the machine, so clients can connect
+  // through any, e.g., external network interface, localhost, etc.
+
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  // Create a socket (endpoint) for network communication.  The socket()
+  // call returns a socket descriptor, which works exactly like a file
+  // descriptor for file system operations we worked with in CS431
+  //
+  // Sockets are by default blocking. The event loop must never block on a
+  // single client, so the listening socket (and every socket accepted from
+  // it) is created non-blocking.
+  s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (s < 0) {
+    fprintf(stderr, "Server: Unable to create socket: %s", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // Allow a restarted server to bind the port again right away instead of
+  // waiting for connections from the previous run to leave TIME_WAIT
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+  // In multi-threaded mode every worker binds its own socket to the same
+  // port.  SO_REUSEPORT lets the kernel hash incoming connections across all
+  // of them, so the workers never contend on a shared accept queue.
+  if (reuseport &&
+      setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+    fprintf(stderr, "Server: Unable to set SO_REUSEPORT: %s", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // When you create a socket, it exists within a namespace, but does not have
+  // a network address associated with it.  The bind system call creates the
+  // association between the socket and the network interface.
+  //
+  // An error could result from an invalid socket descriptor, an address already
+  // in use, or an invalid network address
+  if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "Server: Unable to bind to socket: %s", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // Listen for incoming TCP connections using the newly created and configured
+  // socket. The second argument is the number of completed connections the
+  // kernel queues for us until the event loop gets around to accepting them.
+  // A backlog of one refuses connections under any burst, so it can be set
+  // on the command line (-b) and defaults to DEFAULT_BACKLOG.
+  //
+  // Failure could result from an invalid socket descriptor or from using a
+  // socket descriptor that is already in use.
+  if (listen(s, backlog) < 0) {
+    fprintf(stderr, "Server: Unable to listen: %s", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  LOG(LOGGER_INFO, "Server: Listening on TCP port %u (backlog %d)", port,
+      backlog);
+
+  return s;
+}
+
+/******************************************************************************
+
+  This function does some initialization of the OpenSSL library functions used
+ in this program.  The function SSL_load_error_strings registers the error
+ strings for all of the libssl and libcrypto functions so that appropriate
+ textual error messages can be displayed when error conditions arise.
+ OpenSSL_add_ssl_algorithms registers the available SSL/TLS ciphers and digests
+ used for encryption.
+
+ ******************************************************************************/
+void init_openssl() {
+  SSL_load_error_strings();
+  OpenSSL_add_ssl_algorithms();
+}
+
+/******************************************************************************
+
+  EVP_cleanup removes all of the SSL/TLS ciphers and digests registered earlier.
+
+ ******************************************************************************/
+void cleanup_openssl() { EVP_cleanup(); }
+
+/******************************************************************************
+
+  An SSL_CTX object is an instance of a factory design pattern that produces SSL
+  connection objects, each called a context. A context is used to set parameters
+  for the connection, and in this program, each context is configured using the
+  configure_context() function below. Each context object is created using the
+  function SSL_CTX_new(), and the result of that call is what is returned by
+ this function and subsequently configured with connection information.
+
+  One other thing to point out is when creating a context, the SSL protocol must
+  be specified ahead of time using an instance of an SSL_method object.  In this
+  case, we are creating an instance of an SSLv23_server_method, which is an
+  SSL_METHOD object for an SSL/TLS server. Of the available types in the OpenSSL
+  library, this provides the most functionality.
+
+ ******************************************************************************/
+SSL_CTX *create_new_context() {
+  const SSL_METHOD
+      *ssl_method; // This should be declared 'const' to avoid getting
+  // a warning from the call to SSLv23_server_method()
+  SSL_CTX *ssl_ctx;
+
+  // Use SSL/TLS method for server
+  ssl_method = SSLv23_server_method();
+
+  // Create new context instance
+  ssl_ctx = SSL_CTX_new(ssl_method);
+  if (ssl_ctx == NULL) {
+    fprintf(stderr, "Server: cannot create SSL context:\n");
+    ERR_print_errors_fp(stderr);
+    exit(EXIT_FAILURE);
+  }
+
+  return ssl_ctx;
+}
+
+/******************************************************************************
+
+  We will use Elliptic Curve Diffie Hellman anonymous key agreement protocol for
+  the session key shared between client and server.  We first configure the SSL
+  context to use that protocol by calling the function SSL_CTX_set_ecdh_auto().
+  The second argument (onoff) tells the function to automatically use the
+ highest preference curve (supported by both client and server) for the key
+ agreement.
+
+  Note that for error conditions specific to SSL/TLS, the OpenSSL library does
+  not set the variable errno, so we must use the built-in error printing
+ routines.
+
+  Because the sockets are non-blocking, SSL_write() may accept only part of a
+  buffer, or ask to be retried later with the same buffer.  Partial writes are
+  enabled and the buffer is allowed to move between retries so a connection's
+  output buffer can be compacted while a write is pending.
+
+ ******************************************************************************/
+void configure_context(SSL_CTX *ssl_ctx) {
+  SSL_CTX_set_ecdh_auto(ssl_ctx, 1);
+  SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+  // Set the certificate to use, i.e., 'cert.pem'
+  if (SSL_CTX_use_certificate_file(ssl_ctx, CERTIFICATE_FILE,
+                                   SSL_FILETYPE_PEM) <= 0) {
+    fprintf(stderr, "Server: cannot set certificate:\n");
+    ERR_print_errors_fp(stderr);
+    exit(EXIT_FAILURE);
+  }
+
+  // Set the private key contained in the key file, i.e., 'key.pem'
+  if (SSL_CTX_use_PrivateKey_file(ssl_ctx, KEY_FILE, SSL_FILETYPE_PEM) <= 0) {
+    fprintf(stderr, "Server: cannot set certificate:\n");
+    ERR_print_errors_fp(stderr);
+    exit(EXIT_FAILURE);
+  }
+
+  // Let returning clients resume their session instead of repeating the
+  // full key exchange: TLS 1.3 clients with a session ticket that any
+  // worker can open, older ones from this worker's session cache
+  SSL_CTX_set_session_id_context(ssl_ctx, (const unsigned char *)"watchlist",
+                                 9);
+  SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ssl_ctx, SESSION_CACHE_SIZE);
+  SSL_CTX_set_timeout(ssl_ctx, TICKET_KEY_LIFETIME);
+  SSL_CTX_set_num_tickets(ssl_ctx, 1);
+  ticket_configure(ssl_ctx);
+}
+
+// Struct user entry in database
+struct user {
+  char username[USERNAME_LENGTH];
+  char hash[HASH_LENGTH];
+  char salt[SALT_LENGTH];
+};
+
+// Where a connection is in the conversation with its client. Each state names
+// the next thing the server is waiting for.
+enum conn_state {
+  CONN_HANDSHAKE, // SSL_accept() has not completed yet
+  CONN_PREFACE,   // first bytes decide between binary and text protocol
+  CONN_LOGIN,     // text: waiting for "1:user:hash:salt" or "2:user"
+  CONN_HASH,      // text: salt sent, waiting for the client's password hash
+  CONN_OP,        // text: waiting for a watchlist operation
+  CONN_CONTINUE,  // text: waiting for the "another operation?" answer
+  CONN_HELLO,     // binary: preface seen, waiting for the WL_HELLO frame
+  CONN_FRAMES,    // binary: serving request frames
+  CONN_CLOSING    // flush whatever is queued, then hang up
+};
+
+// The deadline a connection is running against.  A connection that misses
+// it is closed, so a client cannot hold on to the server by going quiet in
+// the middle of a handshake or request, or by not reading its replies.
+enum conn_timer {
+  TIMER_HANDSHAKE, // accepted, handshake not finished
+  TIMER_IDLE,      // nothing buffered, waiting for the next request
+  TIMER_REQUEST,   // part of a request received, or a reply not yet taken
+  CONN_TIMERS,
+  TIMER_NONE = CONN_TIMERS // held by the server itself, no deadline
+};
+
+// Connections running against the same timer, oldest deadline first. All
+// of them got the same timeout, so appending keeps the list in order.
+struct timer_list {
+  struct connection *head;
+  struct connection *tail;
+};
+
+// One event loop thread.  Everything in here except the counters is only
+// touched by the thread that owns it.
+struct worker {
+  pthread_t thread;
+  int id;
+  int sockfd;       // this worker's SO_REUSEPORT listening socket
+  int epfd;         // this worker's epoll instance
+  SSL_CTX *ssl_ctx; // this worker's SSL object factory
+  struct auth_done done; // account requests finished by the pool
+  unsigned long active; // connections currently open on this worker
+  bool paused; // listening socket taken out of the epoll set at the cap
+  struct timer_list timers[CONN_TIMERS];
+};
+
+// Per-client state kept by the event loop between readiness notifications
+struct connection {
+  struct worker *worker;
+  int fd;
+  SSL *ssl;
+  enum conn_state state;
+  uint32_t events; // epoll interest currently registered for fd
+  char client_addr[INET_ADDRSTRLEN];
+  char hash[HASH_LENGTH]; // stored hash of the user logging in (CONN_HASH)
+  bool authenticated;     // binary: registered or logged in on this session
+  bool waiting;           // held until a job comes back, see hold_connection()
+  bool replica;           // the link from this backup's primary
+  bool compress;          // binary: the client takes compressed replies
+  struct wal_waiter commit; // replies wait for the log up to commit.lsn
+  struct wl_buf in;       // received bytes not yet consumed
+  struct wl_buf out;      // replies not yet written
+  size_t woff;            // bytes of out already handed to SSL_write()
+  uint64_t accepted;      // metrics_now() when accept4() returned it
+  in_addr_t peer;         // client address, counted against max_per_ip
+  bool more_input;        // frames left unhandled because out is full
+  unsigned long progress; // requests handled and replies drained
+  enum conn_timer timer;  // list this connection is on in its worker
+  uint64_t deadline;      // now_ms() at which the timer runs out
+  struct connection *prev;
+  struct connection *next;
+};
+
+// Connection counters reported every STATS_INTERVAL seconds, updated by all
+// workers with atomic operations
+static unsigned long active_connections;
+static unsigned long peak_connections;
+static unsigned long total_connections;
+
+// Settings shared by all workers, fixed before they start
+static unsigned int port = DEFAULT_PORT;
+static int backlog = DEFAULT_BACKLOG;
+static int num_threads = 1;
+static int auth_threads = DEFAULT_AUTH_THREADS;
+static int cache_entries = DEFAULT_CACHE_ENTRIES;
+static long commit_interval = DEFAULT_COMMIT_INTERVAL;
+static int commit_batch = DEFAULT_COMMIT_BATCH;
+static const char *admin_socket = METRICS_SOCKET;
+static unsigned long max_connections = DEFAULT_MAX_CONNECTIONS;
+static unsigned int max_per_ip; // 0 for no limit
+static unsigned int compress_min = WL_COMPRESS_MIN; // 0 never compresses
+static unsigned int timeouts[CONN_TIMERS] = {DEFAULT_HANDSHAKE_TIMEOUT,
+                                             DEFAULT_IDLE_TIMEOUT,
+                                             DEFAULT_REQUEST_TIMEOUT};
+
+/******************************************************************************
+
+  Storage operations shared by the text and the binary protocol.  Titles are
+  passed as pointer and length so binary requests can use the bytes where
+  they sit in the receive buffer.
+
+ ******************************************************************************/
+
+// Look up a user's stored hash and salt. Returns 0 if the user exists.
+static int lookup_user(const char *name, size_t len, struct user *u) {
+  datum key = {(char *)name, len};
+  datum value;
+  char *sep;
+
+  storage_rdlock(&users_db);
+  value = storage_fetch(&users_db, key);
+  storage_unlock(&users_db);
+  if (value.dptr == NULL)
+    return -1;
+
+  snprintf(u->username, sizeof(u->username), "%.*s", (int)len, name);
+  sep = memchr(value.dptr, ':', value.dsize);
+  if (sep == NULL)
+    sep = value.dptr + value.dsize;
+  snprintf(u->hash, sizeof(u->hash), "%.*s", (int)(sep - value.dptr),
+           value.dptr);
+  if (sep < value.dptr + value.dsize)
+    snprintf(u->salt, sizeof(u->salt), "%.*s",
+             (int)(value.dptr + value.dsize - sep - 1), sep + 1);
+  else
+    u->salt[0] = '\0';
+  free(value.dptr);
+  return 0;
+}
+
+// Add a new user. Returns 0 on success, 1 if the name is taken.
+static int add_user(const char *name, size_t len, const char *hash,
+                    const char *salt) {
+  char temp[HASH_LENGTH + SALT_LENGTH + 1];
+  int ret;
+
+  // Create a key-value pair to insert in the database. Must specify the
+  // size of each datum in bytes.
+  datum userKey = {(char *)name, len};
+  datum userValue = {temp, snprintf(temp, sizeof(temp), "%s:%s", hash, salt)};
+
+  // Add the key-value pair to the database
+  storage_wrlock(&users_db);
+  ret = storage_store(&users_db, userKey, userValue, STORAGE_INSERT);
+  storage_unlock(&users_db);
+  return ret;
+}
+
+// Store an entry. Returns 0 on success, 1 if flag is STORAGE_INSERT and
+// the title already exists.
+static int store_entry(const char *title, size_t len, const struct entry *e,
+                       int flag) {
+  char values[RECORD_MAX];
+  int ret;
+
+  datum key = {(char *)title, len};
+  datum value = {values, record_encode(e, values, sizeof(values))};
+  storage_wrlock(&watchlist_db);
+  ret = storage_store(&watchlist_db, key, value, flag);
+  if (ret == 0) {
+    cache_invalidate(title, len);
+    index_put(title, len, e);
+    search_put(title, len);
+  }
+  storage_unlock(&watchlist_db);
+  return ret;
+}
+
+// Fetch and decode an entry, from the cache if it is there. Returns 0 if
+// found. Caching under the shared lock means no writer can be changing the
+// record at the same time.
+static int fetch_entry(const char *title, size_t len, struct entry *e) {
+  datum key = {(char *)title, len};
+  datum value;
+
+  storage_rdlock(&watchlist_db);
+  if (cache_get(title, len, e)) {
+    storage_unlock(&watchlist_db);
+    return 0;
+  }
+  value = storage_fetch(&watchlist_db, key);
+  if (value.dptr == NULL) {
+    storage_unlock(&watchlist_db);
+    return -1;
+  }
+  record_decode(value.dptr, value.dsize, e);
+  free(value.dptr);
+  snprintf(e->title, sizeof(e->title), "%.*s", (int)len, title);
+  cache_put(title, len, e);
+  storage_unlock(&watchlist_db);
+  return 0;
+}
+
+// Bits of 'changes' that update_entry() applies
+#define CHANGE_TITLE 0x01
+#define CHANGE_TYPE 0x02
+#define CHANGE_DESCRIPTION 0x04
+#define CHANGE_STATUS 0x08
+#define CHANGE_RATING 0x10
+
+/******************************************************************************
+
+  Read-modify-write of one entry.  The lock is held exclusively so no other
+  session can change the record between our fetch and store.  A new title is
+  a new key, so the old record goes away.  Returns 0 on success, -1 if the
+  entry does not exist and 1 if the new title is already taken.
+
+ ******************************************************************************/
+static int update_entry(const char *title, size_t len,
+                        const struct entry *changes, int mask) {
+  struct entry e;
+  char values[RECORD_MAX];
+  int ret = 0;
+
+  datum key = {(char *)title, len};
+  storage_wrlock(&watchlist_db);
+  if (!cache_get(title, len, &e)) {
+    datum value = storage_fetch(&watchlist_db, key);
+    if (value.dptr == NULL) {
+      storage_unlock(&watchlist_db);
+      return -1;
+    }
+    record_decode(value.dptr, value.dsize, &e);
+    free(value.dptr);
+  }
+  snprintf(e.title, sizeof(e.title), "%.*s", (int)len, title);
+
+  if (mask & CHANGE_TITLE)
+    memcpy(e.title, changes->title, sizeof(e.title));
+  if (mask & CHANGE_TYPE)
+    e.type = changes->type;
+  if (mask & CHANGE_DESCRIPTION)
+    memcpy(e.description, changes->description, sizeof(e.description));
+  if (mask & CHANGE_STATUS)
+    e.status = changes->status;
+  if (mask & CHANGE_RATING)
+    e.rating = changes->rating;
+
+  datum newKey = {e.title, strlen(e.title)};
+  datum newVal = {values, record_encode(&e, values, sizeof(values))};
+  cache_invalidate(title, len);
+  if (newKey.dsize == key.dsize && memcmp(e.title, title, len) == 0)
+    storage_store(&watchlist_db, newKey, newVal, STORAGE_REPLACE);
+  else if ((ret = storage_store(&watchlist_db, newKey, newVal,
+                                STORAGE_INSERT)) == 0) {
+    storage_delete(&watchlist_db, key);
+    index_remove(title, len);
+    search_remove(title, len);
+    search_put(newKey.dptr, newKey.dsize);
+  }
+  if (ret == 0)
+    index_put(newKey.dptr, newKey.dsize, &e);
+  storage_unlock(&watchlist_db);
+  return ret;
+}
+
+// Remove an entry. Returns 0 on success, -1 if it does not exist.
+static int remove_entry(const char *title, size_t len) {
+  datum key = {(char *)title, len};
+  int ret;
+
+  storage_wrlock(&watchlist_db);
+  ret = storage_delete(&watchlist_db, key);
+  if (ret == 0) {
+    cache_invalidate(title, len);
+    index_remove(title, len);
+    search_remove(title, len);
+  }
+  storage_unlock(&watchlist_db);
+  return ret == 0 ? 0 : -1;
+}
+
+// Adapts an index_scan() walk over titles to scan_entries()'s callback
+struct indexed_scan {
+  bool (*fn)(const datum *key, const struct entry *e, void *arg);
+  void *arg;
+};
+
+static bool fetch_indexed(const char *title, size_t len, void *arg) {
+  struct indexed_scan *s = arg;
+  datum key = {(char *)title, len};
+  struct entry tempEntry;
+  bool more = true;
+
+  datum dValue = storage_fetch(&watchlist_db, key);
+  if (dValue.dptr) {
+    record_decode(dValue.dptr, dValue.dsize, &tempEntry);
+    more = s->fn(&key, &tempEntry, s->arg);
+    free(dValue.dptr);
+  }
+  return more;
+}
+
+/******************************************************************************
+
+  Hand every decoded entry matching 'filter' (all of them if it is NULL) to
+  'fn' until it returns false.  The walk starts after the key 'after', or at
+  the beginning if 'after' is NULL, so a long listing can be taken a page at
+  a time with the last key of one page resuming the next.  The shared lock
+  is held for the walk so writers cannot move records around under us, but
+  not between pages.  Returns -1 if 'after' is no longer in the database.
+
+  Filtered walks follow the secondary indexes once they are built and only
+  touch matching entries; until then, and for unfiltered walks, this is a
+  walk of the whole database in the engine's key order.  For a filtered
+  walk '*walk' says which: a posting list's field, INDEX_FIELDS for the key
+  order, or -1 for a new walk, for which it is set to the one chosen.  Each
+  page of a listing is walked the same way as the first, so it neither
+  repeats nor skips entries when the indexes become ready in between.
+
+ ******************************************************************************/
+static int scan_entries(const struct index_filter *filter, int *walk,
+                        const datum *after,
+                        bool (*fn)(const datum *key, const struct entry *e,
+                                   void *arg),
+                        void *arg) {
+  struct indexed_scan s = {fn, arg};
+  struct entry tempEntry;
+  datum dKey;
+  bool more = true;
+  int ret;
+
+  storage_rdlock(&watchlist_db);
+  if (filter && *walk != INDEX_FIELDS && index_ready()) {
+    ret = index_scan(filter, walk, after ? after->dptr : NULL,
+                     after ? after->dsize : 0, fetch_indexed, &s);
+    storage_unlock(&watchlist_db);
+    return ret;
+  }
+  if (filter)
+    *walk = INDEX_FIELDS;
+
+  if (after == NULL)
+    dKey = storage_firstkey(&watchlist_db);
+  else if (storage_exists(&watchlist_db, *after))
+    dKey = storage_nextkey(&watchlist_db, *after);
+  else {
+    storage_unlock(&watchlist_db);
+    return -1;
+  }
+  while (dKey.dptr && more) {
+    datum dValue = storage_fetch(&watchlist_db, dKey);
+    if (dValue.dptr) {
+      record_decode(dValue.dptr, dValue.dsize, &tempEntry);
+      if (filter == NULL || index_match(filter, &tempEntry))
+        more = fn(&dKey, &tempEntry, arg);
+      free(dValue.dptr);
+    }
+    datum nextKey = more ? storage_nextkey(&watchlist_db, dKey) : (datum){0};
+    free(dKey.dptr);
+    dKey = nextKey;
+  }
+  storage_unlock(&watchlist_db);
+  return 0;
+}
+
+// Like scan_entries(), but only the first 'limit' entries in 'order', see
+// index_sorted().  Only once the indexes are ready.
+static int sort_entries(const struct index_filter *filter, enum wl_order order,
+                        const datum *after, size_t limit,
+                        bool (*fn)(const datum *key, const struct entry *e,
+                                   void *arg),
+                        void *arg) {
+  struct indexed_scan s = {fn, arg};
+  int ret;
+
+  storage_rdlock(&watchlist_db);
+  ret = index_sorted(filter, order, after ? after->dptr : NULL,
+                     after ? after->dsize : 0, limit, fetch_indexed, &s);
+  storage_unlock(&watchlist_db);
+  return ret;
+}
+
+/******************************************************************************
+
+  Queue a reply for the client.  Nothing is written here; the event loop hands
+  the buffer to SSL_write() whenever the socket can take more data.
+
+ ******************************************************************************/
+static void queue_reply(struct connection *conn, const void *data, int len) {
+  wl_buf_reserve(&conn->out, len);
+  memcpy(conn->out.data + conn->out.len, data, len);
+  conn->out.len += len;
+}
+
+/******************************************************************************
+
+  Account requests of the text protocol, the first message of every session:
+
+    1:<username>:<hash>:<salt>   create an account
+    2:<username>                 log in; the salt is sent back and the client
+                                 answers with its hash of the password
+
+ ******************************************************************************/
+static void handle_account(struct connection *conn, char *buffer) {
+  struct user u;
+  char salt[SALT_LENGTH] = "$1$........";
+  char *username, *hash, *ptr;
+
+  strtok(buffer, ":");
+  username = strtok(NULL, ":");
+
+  switch (buffer[0] - '0') {
+  case 1:
+    hash = strtok(NULL, ":");
+    ptr = strtok(NULL, ":");
+    if (username == NULL || hash == NULL || ptr == NULL) {
+      LOG(LOGGER_WARN, "Server: Malformed account request from client (%s)",
+          conn->client_addr);
+      break;
+    }
+    if (replica_attached()) {
+      LOG(LOGGER_INFO, "Server: Refusing a change while following a primary");
+      break;
+    }
+    add_user(username, strlen(username), hash, ptr);
+    LOG(LOGGER_DEBUG, "Successfully inserted new username with key: %s",
+        username);
+    break;
+
+  case 2:
+    // access salt and write back to client. Unknown users still get a salt
+    // so the exchange looks the same; their stored hash is empty and
+    // verification will fail.
+    conn->hash[0] = '\0';
+    if (username != NULL && lookup_user(username, strlen(username), &u) == 0) {
+      memcpy(conn->hash, u.hash, sizeof(conn->hash));
+      if (u.salt[0] != '\0')
+        memcpy(salt, u.salt, sizeof(salt));
+    }
+    queue_reply(conn, salt, sizeof(salt));
+    conn->state = CONN_HASH;
+    return;
+
+  default:
+    LOG(LOGGER_WARN, "server: error, please input 0 or 1");
+  }
+  conn->state = CONN_OP;
+}
+
+/******************************************************************************
+
+  Second half of a text login: compare the hash the client computed with the
+  salt we sent against the one stored in users.db.
+
+ ******************************************************************************/
+static void handle_hash(struct connection *conn, char *verifyHash) {
+  const char *verify;
+
+  if (conn->hash[0] != '\0' &&
+      strncmp(conn->hash, verifyHash, sizeof(conn->hash)) == 0) {
+    LOG(LOGGER_DEBUG, "Passwords match. User authenticated");
+    verify = "1";
+  } else {
+    LOG(LOGGER_INFO, "Server: Failed login from client (%s)",
+        conn->client_addr);
+    verify = "0";
+  }
+
+  queue_reply(conn, verify, strlen(verify) + 1);
+  conn->state = CONN_OP;
+}
+
+// scan_entries() callback for the text protocol's display operation
+static bool print_entry(const datum *key, const struct entry *e, void *arg) {
+  LOG(LOGGER_DEBUG, "The entry is: %.*s, %s, %d, %d, %d", key->dsize, key->dptr,
+      e->description, e->type, e->status, e->rating);
+  return true;
+}
+
+/******************************************************************************
+
+  Watchlist operations of the text protocol, one per message:
+
+    c:<title>:<type>:<description>:<status>[:<rating>]   create
+    f:<title>                                           find
+    d                                                   display all
+    u:<field>:<title>:<value>                           update one field
+    r:<title>                                           remove
+
+ ******************************************************************************/
+static void handle_op(struct connection *conn, char *buffer) {
+  struct entry tempEntry;
+  char *title, *ptr;
+  int mask = 0;
+
+  // A backup following its primary takes no changes of its own
+  if (replica_attached() && buffer[0] != '\0' && strchr("cCuUrR", buffer[0])) {
+    LOG(LOGGER_INFO, "Server: Refusing a change while following a primary");
+    conn->state = CONN_CONTINUE;
+    return;
+  }
+
+  switch (buffer[0]) {
+
+  case 'c':
+  case 'C':
+    // store values in variables
+    strtok(buffer, ":");
+    title = strtok(NULL, ":");
+    ptr = strtok(NULL, "");
+    if (title == NULL || ptr == NULL)
+      break;
+    record_decode_text(ptr, strlen(ptr), &tempEntry);
+    tempEntry.added = time(NULL);
+    if (store_entry(title, strlen(title), &tempEntry, STORAGE_INSERT) == 0)
+      LOG(LOGGER_DEBUG, "Successfully inserted new item with key: %s", title);
+    else
+      LOG(LOGGER_DEBUG, "Item %s already exists", title);
+    break;
+
+  case 'f':
+  case 'F':
+    LOG(LOGGER_DEBUG, "begin find op");
+    strtok(buffer, ":");
+    if ((title = strtok(NULL, "")) == NULL)
+      break;
+    if (fetch_entry(title, strlen(title), &tempEntry) == 0)
+      LOG(LOGGER_DEBUG, "value fetched: %d:%s:%d:%d", tempEntry.type,
+          tempEntry.description, tempEntry.status, tempEntry.rating);
+    else
+      LOG(LOGGER_DEBUG, "Item %s doesn't exist", title);
+    break;
+
+  case 'd':
+  case 'D':
+    LOG(LOGGER_DEBUG, "begin display op");
+    // The listing only goes to the log, so skip the scan unless it is kept
+    if (LOG_ENABLED(LOGGER_DEBUG))
+      scan_entries(NULL, NULL, NULL, print_entry, NULL);
+    break;
+
+  case 'u':
+  case 'U':
+    LOG(LOGGER_DEBUG, "begin update op");
+    strtok(buffer, ":");
+    ptr = strtok(NULL, ":");
+    title = strtok(NULL, ":");
+    char *newValue = strtok(NULL, "");
+    if (ptr == NULL || title == NULL || newValue == NULL)
+      break;
+    newValue[strcspn(newValue, "\n")] = '\0';
+
+    switch (ptr[0]) {
+    case 't':
+    case 'T':
+      snprintf(tempEntry.title, sizeof(tempEntry.title), "%s", newValue);
+      mask = CHANGE_TITLE;
+      break;
+
+    case 'm':
+    case 'M':
+      tempEntry.type = atoi(newValue);
+      mask = CHANGE_TYPE;
+      break;
+
+    case 'd':
+    case 'D':
+      snprintf(tempEntry.description, sizeof(tempEntry.description), "%s",
+               newValue);
+      mask = CHANGE_DESCRIPTION;
+      break;
+
+    case 's':
+    case 'S':
+      tempEntry.status = atoi(newValue);
+      mask = CHANGE_STATUS;
+      break;
+
+    case 'r':
+    case 'R':
+      tempEntry.rating = atoi(newValue);
+      mask = CHANGE_RATING;
+      break;
+    }
+
+    if (update_entry(title, strlen(title), &tempEntry, mask) == 0)
+      LOG(LOGGER_DEBUG, "Successfully updated %s", title);
+    else
+      LOG(LOGGER_DEBUG, "Could not update %s", title);
+    break;
+
+  case 'r':
+  case 'R':
+    LOG(LOGGER_DEBUG, "begin delete op");
+    strtok(buffer, ":");
+    if ((title = strtok(NULL, "")) == NULL)
+      break;
+    title[strcspn(title, "\n")] = '\0';
+    if (remove_entry(title, strlen(title)) == 0)
+      LOG(LOGGER_DEBUG, "Successfully deleted %s", title);
+    else
+      LOG(LOGGER_DEBUG, "Item %s doesn't exist", title);
+    break;
+  }
+
+  conn->state = CONN_CONTINUE;
+}
+
+/******************************************************************************
+
+  Dispatch one complete message of the text protocol according to where the
+  connection is in the conversation.  The text protocol relies on each
+  SSL_write() from the client arriving as one SSL_read() on our side.
+
+ ******************************************************************************/
+static void handle_message(struct connection *conn, char *buffer) {
+  switch (conn->state) {
+  case CONN_LOGIN:
+    handle_account(conn, buffer);
+    break;
+  case CONN_HASH:
+    handle_hash(conn, buffer);
+    break;
+  case CONN_OP:
+    handle_op(conn, buffer);
+    break;
+  case CONN_CONTINUE:
+    conn->state = (buffer[0] == 'y' || buffer[0] == 'Y') ? CONN_OP
+                                                         : CONN_CLOSING;
+    break;
+  default:
+    break;
+  }
+}
+
+/******************************************************************************
+
+  Binary protocol.  Each handler below answers one request frame by
+  appending exactly one reply frame, with the request's type and id, to the
+  connection's output buffer.
+
+ ******************************************************************************/
+
+// Reply carrying only a status
+static void reply_status(struct connection *conn, const struct wl_frame *req,
+                         uint16_t status) {
+  wl_end(&conn->out, wl_begin(&conn->out, req->type, WL_FLAG_REPLY, status,
+                              req->id));
+}
+
+// A title must be non-empty, fit struct entry and hold no NUL, which would
+// cut it short once copied into one
+static bool valid_title(const struct wl_field *f) {
+  return f->len > 0 && f->len < TITLE_LENGTH &&
+         memchr(f->data, '\0', f->len) == NULL;
+}
+
+// A title field must be present and valid
+static bool get_title(const struct wl_frame *req, uint8_t tag,
+                      struct wl_field *f) {
+  return wl_find(req, tag, f) && valid_title(f);
+}
+
+static void frame_hello(struct connection *conn, const struct wl_frame *req) {
+  char name[USERNAME_LENGTH];
+  struct wl_field f;
+  uint32_t version;
+  size_t start;
+
+  if (!wl_find(req, WL_F_VERSION, &f) || (version = wl_u32(&f)) < 1) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    conn->state = CONN_CLOSING;
+    return;
+  }
+  if (version > WL_VERSION)
+    version = WL_VERSION;
+  start = wl_begin(&conn->out, WL_HELLO, WL_FLAG_REPLY, WL_OK, req->id);
+  wl_put_u32(&conn->out, WL_F_VERSION, version);
+  // A valid login token saves the salt and hash round trips
+  if (wl_find(req, WL_F_TOKEN, &f) &&
+      token_check(f.data, f.len, name, sizeof(name)) == 0) {
+    conn->authenticated = true;
+    wl_put_str(&conn->out, WL_F_USERNAME, name);
+  }
+  // Large replies are compressed if the client can inflate them
+  if (compress_min > 0 && wl_find(req, WL_F_COMPRESS, &f) &&
+      (wl_u32(&f) & WL_COMPRESS_ZLIB)) {
+    conn->compress = true;
+    wl_put_u32(&conn->out, WL_F_COMPRESS, WL_COMPRESS_ZLIB);
+  }
+  wl_end(&conn->out, start);
+  conn->state = CONN_FRAMES;
+}
+
+/******************************************************************************
+
+  Account requests.  WL_REGISTER, WL_SALT and WL_LOGIN go to the account
+  pool instead of being answered on the spot.  The request's fields are
+  checked and copied into a struct account_job here; a pool thread does the
+  users.db work and fills in the outcome; and account_done(), back on the
+  connection's own event loop, appends the reply.
+
+  While a connection has a request with the pool it is 'waiting' (see
+  hold_connection()) and no further frames are handled, so replies still go
+  out in request order.  When the queue is full the request is answered
+  WL_BUSY straight away.
+
+ ******************************************************************************/
+
+struct account_job {
+  struct auth_job job; // must come first
+  struct connection *conn;
+  uint8_t type;
+  uint32_t id;
+  char name[USERNAME_LENGTH];
+  size_t name_len;
+  char hash[HASH_LENGTH];
+  char salt[SALT_LENGTH];
+  uint16_t status; // the outcome, set by the pool thread
+  uint64_t lsn;     // the log record of a new user, 0 if none
+  uint64_t started; // metrics_now() when the request was handled
+};
+
+// Runs on a pool thread: nothing here may touch the connection
+static void run_account(struct auth_job *job) {
+  struct account_job *a = (struct account_job *)job;
+  struct user u;
+
+  switch (a->type) {
+  case WL_REGISTER:
+    if (add_user(a->name, a->name_len, a->hash, a->salt) != 0) {
+      a->status = WL_EXISTS;
+      break;
+    }
+    LOG(LOGGER_DEBUG, "Successfully inserted new username with key: %s",
+        a->name);
+    a->lsn = wal_thread_lsn();
+    a->status = WL_OK;
+    break;
+  case WL_SALT:
+    // Unknown users get a salt too so the exchange looks the same
+    if (lookup_user(a->name, a->name_len, &u) != 0 || u.salt[0] == '\0')
+      strcpy(u.salt, "$1$........");
+    strcpy(a->salt, u.salt);
+    a->status = WL_OK;
+    break;
+  case WL_LOGIN:
+    if (lookup_user(a->name, a->name_len, &u) != 0 ||
+        strlen(u.hash) != strlen(a->hash) ||
+        CRYPTO_memcmp(u.hash, a->hash, strlen(a->hash)) != 0) {
+      LOG(LOGGER_INFO, "Server: Failed login as %s", a->name);
+      a->status = WL_AUTH_FAILED;
+      break;
+    }
+    LOG(LOGGER_DEBUG, "Passwords match. User authenticated");
+    a->status = WL_OK;
+    break;
+  }
+}
+
+// Copy the user name, and the hash and salt where the request type has
+// them, out of an account request.  Returns NULL if a field is missing or
+// malformed.
+static struct account_job *get_account_fields(const struct wl_frame *req) {
+  struct account_job *a;
+  struct wl_field f;
+
+  if (!wl_find(req, WL_F_USERNAME, &f) || f.len >= USERNAME_LENGTH ||
+      (f.len == 0 && req->type == WL_REGISTER))
+    return NULL;
+  if ((a = calloc(1, sizeof(*a))) == NULL)
+    return NULL;
+  wl_copy_str(&f, a->name, sizeof(a->name));
+  a->name_len = f.len;
+  if (req->type != WL_SALT) {
+    if (!wl_find(req, WL_F_HASH, &f)) {
+      free(a);
+      return NULL;
+    }
+    wl_copy_str(&f, a->hash, sizeof(a->hash));
+  }
+  if (req->type == WL_REGISTER) {
+    if (!wl_find(req, WL_F_SALT, &f)) {
+      free(a);
+      return NULL;
+    }
+    wl_copy_str(&f, a->salt, sizeof(a->salt));
+  }
+  return a;
+}
+
+static void account_done(struct auth_job *job);
+
+static void frame_account(struct connection *conn, const struct wl_frame *req) {
+  struct account_job *a = get_account_fields(req);
+
+  if (a == NULL) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    return;
+  }
+  a->job.home = &conn->worker->done;
+  a->job.run = run_account;
+  a->job.done = account_done;
+  a->conn = conn;
+  a->type = req->type;
+  a->id = req->id;
+  a->started = metrics_now();
+  if (!auth_submit(&a->job)) {
+    free(a);
+    reply_status(conn, req, WL_BUSY);
+    return;
+  }
+  conn->waiting = true;
+}
+
+// Append the reply to a finished account request, carrying the salt for
+// WL_SALT and a login token the client can log in with next time after a
+// successful WL_REGISTER or WL_LOGIN
+static void reply_account(struct connection *conn,
+                          const struct account_job *a) {
+  uint8_t token[TOKEN_MAX_LENGTH];
+  size_t start;
+
+  start = wl_begin(&conn->out, a->type, WL_FLAG_REPLY, a->status, a->id);
+  if (a->status == WL_OK && a->type == WL_SALT)
+    wl_put_str(&conn->out, WL_F_SALT, a->salt);
+  else if (a->status == WL_OK) {
+    conn->authenticated = true;
+    wl_put_bytes(&conn->out, WL_F_TOKEN, token,
+                 token_issue(a->name, a->name_len, token));
+  }
+  wl_end(&conn->out, start);
+}
+
+/******************************************************************************
+
+  Fill 'e' from whichever entry fields a request carries.  Returns the
+  CHANGE_ bits for the fields present, or -1 if one of them is malformed.
+
+ ******************************************************************************/
+static int get_entry_fields(const struct wl_frame *req, struct entry *e) {
+  struct wl_field f;
+  size_t pos = 0;
+  int mask = 0, r;
+
+  while ((r = wl_next(req, &pos, &f)) == 1) {
+    switch (f.tag) {
+    case WL_F_NEW_TITLE:
+      if (!valid_title(&f))
+        return -1;
+      wl_copy_str(&f, e->title, sizeof(e->title));
+      mask |= CHANGE_TITLE;
+      break;
+    case WL_F_TYPE:
+      e->type = wl_u32(&f);
+      mask |= CHANGE_TYPE;
+      break;
+    case WL_F_DESCRIPTION:
+      if (f.len >= DESCRIPTION_LENGTH)
+        return -1;
+      wl_copy_str(&f, e->description, sizeof(e->description));
+      mask |= CHANGE_DESCRIPTION;
+      break;
+    case WL_F_STATUS:
+      e->status = wl_u32(&f);
+      mask |= CHANGE_STATUS;
+      break;
+    case WL_F_RATING:
+      e->rating = wl_u32(&f);
+      mask |= CHANGE_RATING;
+      break;
+    }
+  }
+  return r < 0 ? -1 : mask;
+}
+
+static void frame_create(struct connection *conn, const struct wl_frame *req) {
+  struct wl_field title;
+  struct entry e = {0};
+
+  if (!get_title(req, WL_F_TITLE, &title) || get_entry_fields(req, &e) < 0) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    return;
+  }
+  e.added = time(NULL);
+  if (store_entry((const char *)title.data, title.len, &e, STORAGE_INSERT) !=
+      0) {
+    reply_status(conn, req, WL_EXISTS);
+    return;
+  }
+  LOG(LOGGER_DEBUG, "Successfully inserted new item with key: %.*s", title.len,
+      title.data);
+  reply_status(conn, req, WL_OK);
+}
+
+static void frame_find(struct connection *conn, const struct wl_frame *req) {
+  struct wl_field title;
+  struct entry e;
+  size_t start;
+
+  if (!get_title(req, WL_F_TITLE, &title)) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    return;
+  }
+  if (fetch_entry((const char *)title.data, title.len, &e) != 0) {
+    reply_status(conn, req, WL_NOT_FOUND);
+    return;
+  }
+  start = wl_begin(&conn->out, WL_FIND, WL_FLAG_REPLY, WL_OK, req->id);
+  wl_put_entry(&conn->out, (const char *)title.data, title.len, &e);
+  wl_end(&conn->out, start);
+}
+
+// Display page under construction
+struct display_reply {
+  struct wl_buf *out;
+  size_t start;    // offset of the reply frame in out
+  uint32_t count;  // entries put so far
+  uint32_t limit;  // entries wanted on this page
+  bool more;       // the walk stopped with entries left over
+  char last[TITLE_LENGTH]; // title of the last entry put, the next cursor
+  size_t last_len;
+};
+
+/******************************************************************************
+
+  scan_entries() callback encoding each entry straight into the connection's
+  output buffer.  The page ends at the requested limit or when another entry
+  might not fit in the frame.  Being handed an entry after that only tells
+  us the listing goes on.
+
+ ******************************************************************************/
+static bool put_entry(const datum *key, const struct entry *e, void *arg) {
+  struct display_reply *r = arg;
+
+  if (r->count == r->limit ||
+      r->out->len - r->start + TITLE_LENGTH + DESCRIPTION_LENGTH + 64 >
+          WL_MAX_FRAME) {
+    r->more = true;
+    return false;
+  }
+  wl_put_entry(r->out, key->dptr, key->dsize, e);
+  r->last_len = key->dsize < TITLE_LENGTH ? key->dsize : TITLE_LENGTH;
+  memcpy(r->last, key->dptr, r->last_len);
+  r->count++;
+  return true;
+}
+
+/******************************************************************************
+
+  One page of the watchlist.  A request may carry LIMIT, the most entries it
+  wants, and CURSOR, taken from the previous page's reply.  Any TYPE, STATUS
+  or RATING fields restrict the listing to entries with those values.  When
+  entries are left over the reply ends with a CURSOR to resume from.  The
+  cursor is the last title sent, so the server keeps nothing between pages;
+  if that title has been removed in the meantime the page is answered
+  WL_NOT_FOUND and the client starts over.  Entries added or removed between
+  pages may or may not be listed, as with any walk of a hash table.  The
+  cursor of a filtered listing starts with one more byte, saying how
+  scan_entries() walked it.
+
+  With ORDER the page holds the first entries in that order after the
+  cursor, picked from the indexes; while they are still being built such a
+  request is answered WL_BUSY.
+
+ ******************************************************************************/
+static void frame_display(struct connection *conn, const struct wl_frame *req) {
+  struct display_reply r = {&conn->out, conn->out.len, 0, DISPLAY_PAGE};
+  struct index_filter filter = {{false}}, *filter_p = &filter;
+  struct wl_field f;
+  struct entry values;
+  uint32_t order = WL_ORDER_KEY;
+  char next[CURSOR_LENGTH];
+  datum cursor;
+  bool resume;
+  int mask, ret, walk = -1;
+
+  if ((mask = get_entry_fields(req, &values)) < 0) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    return;
+  }
+  filter.set[INDEX_TYPE] = mask & CHANGE_TYPE;
+  filter.value[INDEX_TYPE] = values.type;
+  filter.set[INDEX_STATUS] = mask & CHANGE_STATUS;
+  filter.value[INDEX_STATUS] = values.status;
+  filter.set[INDEX_RATING] = mask & CHANGE_RATING;
+  filter.value[INDEX_RATING] = values.rating;
+
+  if (wl_find(req, WL_F_ORDER, &f) && (order = wl_u32(&f)) >= WL_ORDERS) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    return;
+  }
+  if (order != WL_ORDER_KEY && !index_ready()) {
+    reply_status(conn, req, WL_BUSY);
+    return;
+  }
+  if (wl_find(req, WL_F_LIMIT, &f) && (r.limit = wl_u32(&f)) == 0)
+    r.limit = DISPLAY_PAGE;
+  if (r.limit > DISPLAY_MAX_PAGE)
+    r.limit = DISPLAY_MAX_PAGE;
+  if (!(mask & (CHANGE_TYPE | CHANGE_STATUS | CHANGE_RATING)))
+    filter_p = NULL;
+  if ((resume = wl_find(req, WL_F_CURSOR, &f))) {
+    cursor.dptr = (char *)f.data;
+    cursor.dsize = f.len;
+    // A filtered listing resumes the walk its first page chose
+    if (filter_p && order == WL_ORDER_KEY && cursor.dsize > 0) {
+      walk = (unsigned char)*cursor.dptr++;
+      cursor.dsize--;
+    }
+    if (cursor.dsize == 0 || cursor.dsize >= TITLE_LENGTH ||
+        walk > INDEX_FIELDS || (walk >= 0 && walk < INDEX_FIELDS &&
+                                !filter.set[walk])) {
+      reply_status(conn, req, WL_BAD_REQUEST);
+      return;
+    }
+  }
+
+  wl_begin(&conn->out, WL_DISPLAY, WL_FLAG_REPLY, WL_OK, req->id);
+  // A sorted listing picks one entry more than fits on the page, which
+  // tells whether it goes on
+  if (order == WL_ORDER_KEY)
+    ret = scan_entries(filter_p, &walk, resume ? &cursor : NULL, put_entry,
+                       &r);
+  else
+    ret = sort_entries(filter_p, order, resume ? &cursor : NULL, r.limit + 1,
+                       put_entry, &r);
+  if (ret < 0) {
+    conn->out.len = r.start;
+    reply_status(conn, req, WL_NOT_FOUND);
+    return;
+  }
+  if (r.more && r.count > 0 && walk >= 0) {
+    next[0] = walk;
+    memcpy(next + 1, r.last, r.last_len);
+    wl_put_bytes(&conn->out, WL_F_CURSOR, next, r.last_len + 1);
+  } else if (r.more && r.count > 0)
+    wl_put_bytes(&conn->out, WL_F_CURSOR, r.last, r.last_len);
+  wl_end(&conn->out, r.start);
+}
+
+static void frame_update(struct connection *conn, const struct wl_frame *req) {
+  struct wl_field title;
+  struct entry changes;
+  int mask, ret;
+
+  if (!get_title(req, WL_F_TITLE, &title) ||
+      (mask = get_entry_fields(req, &changes)) < 0) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    return;
+  }
+  ret = update_entry((const char *)title.data, title.len, &changes, mask);
+  if (ret == 0)
+    LOG(LOGGER_DEBUG, "Successfully updated %.*s", title.len, title.data);
+  reply_status(conn, req,
+               ret == 0 ? WL_OK : ret < 0 ? WL_NOT_FOUND : WL_EXISTS);
+}
+
+static void frame_remove(struct connection *conn, const struct wl_frame *req) {
+  struct wl_field title;
+
+  if (!get_title(req, WL_F_TITLE, &title)) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    return;
+  }
+  if (remove_entry((const char *)title.data, title.len) != 0) {
+    reply_status(conn, req, WL_NOT_FOUND);
+    return;
+  }
+  LOG(LOGGER_DEBUG, "Successfully deleted %.*s", title.len, title.data);
+  reply_status(conn, req, WL_OK);
+}
+
+// Search reply under construction
+struct search_reply {
+  struct wl_buf *out;
+  enum search_mode mode;
+  const char *query; // lowercase, for matching by hand
+  size_t len;
+  size_t count;
+  size_t limit;
+};
+
+static void put_title(const char *title, size_t len, void *arg) {
+  struct search_reply *r = arg;
+
+  wl_put_bytes(r->out, WL_F_TITLE, title, len);
+  r->count++;
+}
+
+// scan_entries() callback matching titles by hand until the index is built
+static bool match_title(const datum *key, const struct entry *e, void *arg) {
+  struct search_reply *r = arg;
+  char title[TITLE_LENGTH];
+  int len = key->dsize < TITLE_LENGTH ? key->dsize : TITLE_LENGTH;
+
+  for (int i = 0; i < len; i++)
+    title[i] = tolower((unsigned char)key->dptr[i]);
+  if (r->mode == SEARCH_PREFIX
+          ? len >= r->len && memcmp(title, r->query, r->len) == 0
+          : memmem(title, len, r->query, r->len) != NULL)
+    put_title(key->dptr, key->dsize, r);
+  return r->count < r->limit;
+}
+
+/******************************************************************************
+
+  Titles starting with or containing the query, without regard to case, for
+  autocompletion.  The reply lists up to LIMIT titles and nothing else; the
+  client finds whichever entry it wants.
+
+ ******************************************************************************/
+static void frame_search(struct connection *conn, const struct wl_frame *req) {
+  struct search_reply r = {&conn->out, SEARCH_PREFIX};
+  struct wl_field query, f;
+  char lowered[TITLE_LENGTH];
+  size_t start;
+
+  if (!get_title(req, WL_F_TITLE, &query)) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    return;
+  }
+  if (wl_find(req, WL_F_MATCH, &f) && wl_u32(&f) == WL_MATCH_SUBSTRING)
+    r.mode = SEARCH_SUBSTRING;
+  r.limit = SEARCH_LIMIT;
+  if (wl_find(req, WL_F_LIMIT, &f) && wl_u32(&f) > 0)
+    r.limit = wl_u32(&f) < SEARCH_MAX_LIMIT ? wl_u32(&f) : SEARCH_MAX_LIMIT;
+
+  start = wl_begin(&conn->out, WL_SEARCH, WL_FLAG_REPLY, WL_OK, req->id);
+  if (index_ready())
+    search_titles((const char *)query.data, query.len, r.mode, r.limit,
+                  put_title, &r);
+  else {
+    for (int i = 0; i < query.len; i++)
+      lowered[i] = tolower(query.data[i]);
+    r.query = lowered;
+    r.len = query.len;
+    scan_entries(NULL, NULL, NULL, match_title, &r);
+  }
+  wl_end(&conn->out, start);
+}
+
+static void handle_frame(struct connection *conn, const struct wl_frame *req);
+
+/******************************************************************************
+
+  Replication, backup side (see replica.h).  A primary logs in with
+  WL_REPLICATE and then sends WL_APPLY frames of log records, which are
+  applied through the same functions as changes from clients, so the cache
+  and indexes stay right, and go to this server's own write-ahead log.  The
+  reply to each WL_APPLY therefore waits, like any change, until the log
+  has it on disk.
+
+ ******************************************************************************/
+
+// Redo one record from the primary's log
+static void apply_record(const struct wal_record *r) {
+  datum key = {(char *)r->key, r->key_len};
+  datum value = {(char *)r->value, r->value_len};
+  struct entry e;
+
+  switch (r->op) {
+  case WAL_STORE:
+    if (r->key_len == 0 || r->key_len >= TITLE_LENGTH)
+      break;
+    record_decode(r->value, r->value_len, &e);
+    store_entry(r->key, r->key_len, &e, STORAGE_REPLACE);
+    break;
+  case WAL_DELETE:
+    remove_entry(r->key, r->key_len);
+    break;
+  case WAL_USER_STORE:
+  case WAL_USER_DELETE:
+    storage_wrlock(&users_db);
+    if (r->op == WAL_USER_STORE)
+      storage_store(&users_db, key, value, STORAGE_REPLACE);
+    else
+      storage_delete(&users_db, key);
+    storage_unlock(&users_db);
+    break;
+  }
+}
+
+// Empty a database before a snapshot refills it. The keys are collected
+// first: neither engine can carry on a walk over keys being deleted.
+static void wipe_database(struct database *db) {
+  datum *keys = NULL, key, next;
+  size_t n = 0, cap = 0;
+
+  storage_rdlock(db);
+  for (key = storage_firstkey(db); key.dptr != NULL; key = next) {
+    if (n == cap) {
+      cap = cap ? cap * 2 : 256;
+      if ((keys = realloc(keys, cap * sizeof(*keys))) == NULL) {
+        fprintf(stderr, "Server: Out of memory applying a snapshot\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    keys[n++] = key;
+    next = storage_nextkey(db, key);
+  }
+  storage_unlock(db);
+
+  for (size_t i = 0; i < n; i++) {
+    if (db == &watchlist_db)
+      remove_entry(keys[i].dptr, keys[i].dsize);
+    else {
+      storage_wrlock(db);
+      storage_delete(db, keys[i]);
+      storage_unlock(db);
+    }
+    free(keys[i].dptr);
+  }
+  free(keys);
+}
+
+static void frame_replicate(struct connection *conn,
+                            const struct wl_frame *req) {
+  struct wl_field key;
+  uint64_t epoch, lsn;
+  uint16_t status;
+  size_t start;
+
+  if (!wl_find(req, WL_F_KEY, &key)) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    conn->state = CONN_CLOSING;
+    return;
+  }
+  if ((status = replica_attach(key.data, key.len)) != WL_OK) {
+    reply_status(conn, req, status);
+    conn->state = CONN_CLOSING;
+    return;
+  }
+  conn->replica = true;
+  LOG(LOGGER_INFO, "Server: Following the primary at %s", conn->client_addr);
+
+  replica_position(&epoch, &lsn);
+  start = wl_begin(&conn->out, WL_REPLICATE, WL_FLAG_REPLY, WL_OK, req->id);
+  wl_put_u64(&conn->out, WL_F_EPOCH, epoch);
+  wl_put_u64(&conn->out, WL_F_LSN, lsn);
+  wl_end(&conn->out, start);
+}
+
+static void frame_apply(struct connection *conn, const struct wl_frame *req) {
+  struct wl_field f, lsn_field;
+  struct wal_record r;
+  uint64_t epoch, head, lsn, current_epoch, current_lsn;
+  uint32_t snapshot = 0;
+  bool positioned;
+  size_t pos = 0, off, size, start;
+
+  if (!conn->replica) {
+    reply_status(conn, req, WL_NOT_LOGGED_IN);
+    return;
+  }
+  if (!wl_find(req, WL_F_EPOCH, &f) || (epoch = wl_u64(&f)) == 0 ||
+      !wl_find(req, WL_F_HEAD, &f)) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    return;
+  }
+  head = wl_u64(&f);
+  if (wl_find(req, WL_F_SNAPSHOT, &f))
+    snapshot = wl_u32(&f);
+  if ((positioned = wl_find(req, WL_F_LSN, &lsn_field)))
+    lsn = wl_u64(&lsn_field);
+
+  // Records only follow on from where this server stands; anything else
+  // has to start with a snapshot
+  replica_position(&current_epoch, &current_lsn);
+  if (snapshot == WL_SNAPSHOT_FIRST) {
+    replica_applied(0, NULL, head);
+    wipe_database(&users_db);
+    wipe_database(&watchlist_db);
+  } else if (snapshot == 0 && epoch != current_epoch) {
+    reply_status(conn, req, WL_BAD_REQUEST);
+    return;
+  }
+
+  while (wl_next(req, &pos, &f) == 1) {
+    if (f.tag != WL_F_RECORDS)
+      continue;
+    for (off = 0; off < f.len; off += size) {
+      if ((size = wal_read(f.data + off, f.len - off, &r)) == 0) {
+        reply_status(conn, req, WL_BAD_REQUEST);
+        return;
+      }
+      apply_record(&r);
+    }
+  }
+  replica_applied(snapshot && !positioned ? 0 : epoch,
+                  positioned ? &lsn : NULL, head);
+
+  replica_position(&current_epoch, &current_lsn);
+  start = wl_begin(&conn->out, WL_APPLY, WL_FLAG_REPLY, WL_OK, req->id);
+  wl_put_u64(&conn->out, WL_F_LSN, current_lsn);
+  wl_end(&conn->out, start);
+}
+
+/******************************************************************************
+
+  Answer WL_STATS with the same text the admin socket gives, see metrics.h.
+  It is a few kilobytes, well within one field.
+
+ ******************************************************************************/
+static void frame_stats(struct connection *conn, const struct wl_frame *req) {
+  char *text = NULL;
+  size_t len = 0, start;
+  FILE *out = open_memstream(&text, &len);
+
+  if (out == NULL) {
+    reply_status(conn, req, WL_SERVER_ERROR);
+    return;
+  }
+  metrics_dump(out);
+  fclose(out);
+  start = wl_begin(&conn->out, WL_STATS, WL_FLAG_REPLY, WL_OK, req->id);
+  wl_put_bytes(&conn->out, WL_F_STATS, text,
+               len < UINT16_MAX ? len : UINT16_MAX);
+  wl_end(&conn->out, start);
+  free(text);
+}
+
+/******************************************************************************
+
+  Run the requests nested in a WL_BATCH frame in order, collecting their
+  replies into one WL_BATCH reply so a whole batch costs one round trip.
+  When the collected replies approach the frame limit the reply frame is
+  closed with WL_FLAG_MORE and continued in a new one.  Batches do not nest,
+  and account requests, which are answered later by the pool, cannot be
+  batched.
+
+ ******************************************************************************/
+static void frame_batch(struct connection *conn, const struct wl_frame *req) {
+  struct wl_frame sub;
+  size_t pos = 0, start;
+  int r;
+
+  start = wl_begin(&conn->out, WL_BATCH, WL_FLAG_REPLY, WL_OK, req->id);
+  while ((r = wl_next_frame(req, &pos, &sub)) == 1) {
+    // A display reply may take up a whole frame by itself; any other reply
+    // is a few hundred bytes
+    if (conn->out.len - start > WL_HEADER_SIZE &&
+        (sub.type == WL_DISPLAY ||
+         conn->out.len - start > WL_MAX_FRAME - 4096)) {
+      wl_amend(&conn->out, start, WL_FLAG_REPLY | WL_FLAG_MORE, WL_OK);
+      wl_end(&conn->out, start);
+      start = wl_begin(&conn->out, WL_BATCH, WL_FLAG_REPLY, WL_OK, req->id);
+    }
+    if (sub.type == WL_BATCH || sub.type == WL_HELLO ||
+        sub.type == WL_REGISTER || sub.type == WL_SALT ||
+        sub.type == WL_LOGIN || sub.type == WL_REPLICATE ||
+        sub.type == WL_APPLY)
+      reply_status(conn, &sub, WL_BAD_REQUEST);
+    else
+      handle_frame(conn, &sub);
+  }
+
+  // Requests before a malformed one have been run; say the rest was not
+  if (r < 0)
+    wl_amend(&conn->out, start, WL_FLAG_REPLY, WL_BAD_REQUEST);
+  wl_end(&conn->out, start);
+}
+
+/******************************************************************************
+
+  Dispatch one request frame.  The first frame of a binary session must be
+  WL_HELLO, and the watchlist itself is only available after a successful
+  WL_REGISTER or WL_LOGIN.  While this server is a backup following its
+  primary, changes from clients are refused.  handle_frame() times each
+  request into the histogram of its type and counts its reply by status;
+  account requests are timed when the pool's answer is appended instead.
+
+ ******************************************************************************/
+static void dispatch_frame(struct connection *conn,
+                           const struct wl_frame *req) {
+  if (conn->state == CONN_HELLO) {
+    if (req->type == WL_HELLO)
+      frame_hello(conn, req);
+    else {
+      reply_status(conn, req, WL_BAD_REQUEST);
+      conn->state = CONN_CLOSING;
+    }
+    return;
+  }
+
+  switch (req->type) {
+  case WL_REPLICATE:
+    frame_replicate(conn, req);
+    return;
+  case WL_APPLY:
+    frame_apply(conn, req);
+    return;
+  case WL_REGISTER:
+  case WL_CREATE:
+  case WL_UPDATE:
+  case WL_REMOVE:
+    if (replica_attached()) {
+      reply_status(conn, req, WL_READ_ONLY);
+      return;
+    }
+  }
+
+  switch (req->type) {
+  case WL_REGISTER:
+  case WL_SALT:
+  case WL_LOGIN:
+    frame_account(conn, req);
+    return;
+  }
+
+  if (!conn->authenticated) {
+    reply_status(conn, req, WL_NOT_LOGGED_IN);
+    return;
+  }
+
+  switch (req->type) {
+  case WL_CREATE:
+    frame_create(conn, req);
+    break;
+  case WL_FIND:
+    frame_find(conn, req);
+    break;
+  case WL_DISPLAY:
+    frame_display(conn, req);
+    break;
+  case WL_UPDATE:
+    frame_update(conn, req);
+    break;
+  case WL_REMOVE:
+    frame_remove(conn, req);
+    break;
+  case WL_SEARCH:
+    frame_search(conn, req);
+    break;
+  case WL_STATS:
+    frame_stats(conn, req);
+    break;
+  case WL_BATCH:
+    frame_batch(conn, req);
+    break;
+  default:
+    reply_status(conn, req, WL_BAD_REQUEST);
+  }
+}
+
+static void handle_frame(struct connection *conn, const struct wl_frame *req) {
+  uint64_t start = metrics_now();
+  size_t at = conn->out.len;
+  bool waiting = conn->waiting;
+
+  dispatch_frame(conn, req);
+  if (conn->waiting && !waiting)
+    return;
+  metrics_time(metrics_opcode(req->type), start);
+  // The status of the (first) reply frame, see protocol.h
+  if (conn->out.len >= at + WL_HEADER_SIZE)
+    metrics_reply(conn->out.data[at + 6] << 8 | conn->out.data[at + 7]);
+}
+
+/******************************************************************************
+
+  Compress the reply frames queued from 'at' on whose payload is at least
+  compress_min bytes, for a client that asked for it in its WL_HELLO.  The
+  frames of a batch reply are compressed as a whole, never one by one.
+
+ ******************************************************************************/
+static void compress_replies(struct connection *conn, size_t at) {
+  struct wl_frame frame;
+  uint64_t start;
+  long size;
+
+  while ((size = wl_parse(conn->out.data + at, conn->out.len - at, &frame)) >
+         0) {
+    if (frame.len >= compress_min) {
+      start = metrics_now();
+      size = wl_deflate(&conn->out, at);
+      metrics_time(MT_COMPRESS, start);
+      metrics_count(MC_COMPRESS_BYTES_IN, frame.len);
+      metrics_count(MC_COMPRESS_BYTES_OUT, size - WL_HEADER_SIZE);
+    }
+    at += size;
+  }
+}
+
+/******************************************************************************
+
+  Consume whatever complete messages have been received.  The first bytes of
+  a session pick the protocol: WL_MAGIC starts a binary session, anything
+  else is an old text client.  Binary frames may arrive split across reads
+  or several to a read; only whole frames are handled and the rest waits
+  in the buffer for more data, as do frames following an account request
+  until the pool has answered it, and frames following a reply that fills
+  the output up to OUT_LIMIT until the client has taken it.
+
+ ******************************************************************************/
+static void process_input(struct connection *conn) {
+  struct wl_frame frame;
+  size_t off = 0, at;
+  long size = 0;
+
+  if (conn->state == CONN_PREFACE) {
+    if (conn->in.len < WL_MAGIC_LEN &&
+        memcmp(conn->in.data, WL_MAGIC, conn->in.len) == 0)
+      return;
+    if (memcmp(conn->in.data, WL_MAGIC, WL_MAGIC_LEN) == 0) {
+      wl_buf_consume(&conn->in, WL_MAGIC_LEN);
+      conn->state = CONN_HELLO;
+      metrics_count(MC_BINARY_SESSIONS, 1);
+    } else {
+      conn->state = CONN_LOGIN;
+      metrics_count(MC_TEXT_SESSIONS, 1);
+    }
+  }
+
+  if (conn->state >= CONN_LOGIN && conn->state <= CONN_CONTINUE) {
+    uint64_t start = metrics_now();
+
+    wl_buf_reserve(&conn->in, 1);
+    conn->in.data[conn->in.len] = '\0';
+    handle_message(conn, (char *)conn->in.data);
+    conn->in.len = 0;
+    conn->progress++;
+    metrics_time(MT_TEXT, start);
+    return;
+  }
+
+  while (conn->state != CONN_CLOSING && !conn->waiting &&
+         conn->out.len < OUT_LIMIT &&
+         (size = wl_parse(conn->in.data + off, conn->in.len - off, &frame)) >
+             0) {
+    at = conn->out.len;
+    handle_frame(conn, &frame);
+    if (conn->compress)
+      compress_replies(conn, at);
+    conn->progress++;
+    off += size;
+  }
+  conn->more_input = conn->out.len >= OUT_LIMIT;
+  if (size < 0) {
+    LOG(LOGGER_WARN, "Server: Invalid frame from client (%s)",
+        conn->client_addr);
+    metrics_count(MC_BAD_FRAMES, 1);
+    conn->state = CONN_CLOSING;
+  }
+  wl_buf_consume(&conn->in, off);
+}
+
+/******************************************************************************
+
+  Change the set of events epoll reports for a connection, skipping the system
+  call when nothing changed.
+
+ ******************************************************************************/
+static void set_interest(int epfd, struct connection *conn, uint32_t events) {
+  struct epoll_event ev;
+
+  if (conn->events == events)
+    return;
+  ev.events = events;
+  ev.data.ptr = conn;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+  conn->events = events;
+}
+
+/******************************************************************************
+
+  Open connections per client address, shared by all workers so that -p
+  holds however the kernel spreads a client's connections.  The table uses
+  linear probing and is sized to twice the connection cap, so it never
+  fills; a slot with a zero count is free.  Only the accept path and
+  close_connection() take the lock.
+
+ ******************************************************************************/
+struct peer {
+  in_addr_t addr;
+  unsigned int count;
+};
+
+static struct peer *peers;
+static size_t peer_mask;
+static pthread_mutex_t peers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void peers_init(void) {
+  size_t slots = 16;
+
+  if (max_per_ip == 0)
+    return;
+  // The workers may overshoot the cap by one connection each
+  while (slots < 2 * (max_connections + MAX_THREADS))
+    slots *= 2;
+  peers = calloc(slots, sizeof(*peers));
+  if (peers == NULL) {
+    fprintf(stderr, "Server: Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  peer_mask = slots - 1;
+}
+
+static size_t peer_home(in_addr_t addr) {
+  uint32_t h = (uint32_t)addr * 0x9e3779b1u;
+
+  return (h ^ (h >> 16)) & peer_mask;
+}
+
+// Count a new connection from addr. Returns false if it has too many.
+static bool peer_acquire(in_addr_t addr) {
+  size_t i;
+  bool ok = true;
+
+  if (max_per_ip == 0)
+    return true;
+  pthread_mutex_lock(&peers_lock);
+  for (i = peer_home(addr); peers[i].count != 0 && peers[i].addr != addr;
+       i = (i + 1) & peer_mask)
+    ;
+  if (peers[i].count >= max_per_ip) {
+    ok = false;
+  } else {
+    peers[i].addr = addr;
+    peers[i].count++;
+  }
+  pthread_mutex_unlock(&peers_lock);
+  return ok;
+}
+
+// Uncount a connection from addr. Emptied slots are filled from behind so
+// no search has to step over a hole.
+static void peer_release(in_addr_t addr) {
+  size_t i, j, home;
+
+  if (max_per_ip == 0)
+    return;
+  pthread_mutex_lock(&peers_lock);
+  for (i = peer_home(addr); peers[i].addr != addr; i = (i + 1) & peer_mask)
+    ;
+  if (--peers[i].count == 0) {
+    for (j = (i + 1) & peer_mask; peers[j].count != 0;
+         j = (j + 1) & peer_mask) {
+      // An entry may move back into the hole unless its home lies
+      // cyclically after the hole
+      home = peer_home(peers[j].addr);
+      if (((j - home) & peer_mask) >= ((j - i) & peer_mask)) {
+        peers[i] = peers[j];
+        peers[j].count = 0;
+        i = j;
+      }
+    }
+  }
+  pthread_mutex_unlock(&peers_lock);
+}
+
+/******************************************************************************
+
+  Connection deadlines.  Each worker keeps a list per timer; arm_timer()
+  moves a connection to the end of the list that fits what it is waiting
+  for after every turn of service_connection().  The deadline is only
+  pushed back when the connection made progress, so a client that trickles
+  in a request a byte at a time still runs out of time.  The event loop
+  sleeps until the earliest deadline and expire_connections() closes
+  whoever has missed theirs.  A timeout of 0 turns its timer off.
+
+ ******************************************************************************/
+static uint64_t now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void unlink_timer(struct connection *conn) {
+  struct timer_list *list;
+
+  if (conn->timer == TIMER_NONE)
+    return;
+  list = &conn->worker->timers[conn->timer];
+  if (conn->prev != NULL)
+    conn->prev->next = conn->next;
+  else
+    list->head = conn->next;
+  if (conn->next != NULL)
+    conn->next->prev = conn->prev;
+  else
+    list->tail = conn->prev;
+  conn->prev = conn->next = NULL;
+  conn->timer = TIMER_NONE;
+}
+
+static void arm_timer(struct connection *conn, bool progress) {
+  struct timer_list *list;
+  enum conn_timer timer;
+
+  if (conn->state == CONN_HANDSHAKE)
+    timer = TIMER_HANDSHAKE;
+  else if (conn->waiting)
+    timer = TIMER_NONE;
+  else if (conn->in.len > 0 || conn->woff < conn->out.len)
+    timer = TIMER_REQUEST;
+  else
+    timer = TIMER_IDLE;
+  if (timer != TIMER_NONE && timeouts[timer] == 0)
+    timer = TIMER_NONE;
+  if (timer == conn->timer && !progress)
+    return;
+
+  unlink_timer(conn);
+  if (timer == TIMER_NONE)
+    return;
+  list = &conn->worker->timers[timer];
+  conn->timer = timer;
+  conn->deadline = now_ms() + timeouts[timer] * 1000ULL;
+  conn->prev = list->tail;
+  if (list->tail != NULL)
+    list->tail->next = conn;
+  else
+    list->head = conn;
+  list->tail = conn;
+}
+
+// How long the event loop may sleep, in milliseconds, or -1 for as long as
+// nothing happens
+static int next_timeout(struct worker *w) {
+  uint64_t now = now_ms();
+  long wait = w->paused ? ACCEPT_RETRY : -1;
+  int i;
+
+  for (i = 0; i < CONN_TIMERS; i++) {
+    if (w->timers[i].head == NULL)
+      continue;
+    if (w->timers[i].head->deadline <= now)
+      return 0;
+    if (wait < 0 || w->timers[i].head->deadline - now < (uint64_t)wait)
+      wait = w->timers[i].head->deadline - now;
+  }
+  return wait;
+}
+
+static void close_connection(struct connection *conn);
+
+static void expire_connections(struct worker *w) {
+  static const char *const waiting_for[CONN_TIMERS] = {
+      "the handshake", "a request", "the rest of a request"};
+  struct connection *conn;
+  uint64_t now = now_ms();
+  int i;
+
+  for (i = 0; i < CONN_TIMERS; i++) {
+    while ((conn = w->timers[i].head) != NULL && conn->deadline <= now) {
+      LOG(LOGGER_INFO, "Server: Gave up waiting for %s from client (%s)",
+          waiting_for[i], conn->client_addr);
+      metrics_count(MC_TIMEOUTS_HANDSHAKE + i, 1);
+      close_connection(conn);
+    }
+  }
+}
+
+/******************************************************************************
+
+  Stop accepting while the server is at its connection cap.  New clients
+  then wait in the kernel's listen backlog (-b) instead of being turned
+  away, and are accepted as soon as connections close; the event loop
+  checks every ACCEPT_RETRY milliseconds.
+
+ ******************************************************************************/
+static void pause_accepting(struct worker *w) {
+  if (w->paused)
+    return;
+  epoll_ctl(w->epfd, EPOLL_CTL_DEL, w->sockfd, NULL);
+  w->paused = true;
+  metrics_count(MC_ACCEPT_PAUSES, 1);
+  LOG(LOGGER_WARN,
+      "Server: At the cap of %lu connections, new clients have to wait",
+      max_connections);
+}
+
+static void resume_accepting(struct worker *w) {
+  struct epoll_event ev;
+
+  if (!w->paused || __atomic_load_n(&active_connections, __ATOMIC_RELAXED) >=
+                        max_connections)
+    return;
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->sockfd, &ev);
+  w->paused = false;
+}
+
+/******************************************************************************
+
+  Terminate the SSL session, close the TCP connection, and clean up.  The
+  close_notify alert is sent once without waiting for the client's answer.
+
+ ******************************************************************************/
+static void close_connection(struct connection *conn) {
+  LOG(LOGGER_INFO,
+      "Server: Terminating SSL session and TCP connection with client (%s)",
+      conn->client_addr);
+  if (conn->replica) {
+    replica_detach();
+    LOG(LOGGER_INFO, "Server: No longer following the primary at %s",
+        conn->client_addr);
+  }
+  if (conn->state != CONN_HANDSHAKE)
+    SSL_shutdown(conn->ssl);
+  // The error queue is per thread; whatever this connection left there
+  // would make SSL_get_error() fail the next connection's WANT_READ
+  ERR_clear_error();
+  SSL_free(conn->ssl);
+  close(conn->fd); // also removes it from the epoll set
+  wl_buf_free(&conn->in);
+  wl_buf_free(&conn->out);
+  unlink_timer(conn);
+  peer_release(conn->peer);
+  __atomic_sub_fetch(&conn->worker->active, 1, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&active_connections, 1, __ATOMIC_RELAXED);
+  free(conn);
+}
+
+/******************************************************************************
+
+  Hand as much of the queued output to OpenSSL as the socket will take.
+  Returns 0 when everything has been written, 1 if the socket is full and -1
+  if the connection failed.
+
+ ******************************************************************************/
+static int flush_replies(struct connection *conn) {
+  int n;
+
+  while (conn->woff < conn->out.len) {
+    n = SSL_write(conn->ssl, conn->out.data + conn->woff,
+                  conn->out.len - conn->woff);
+    if (n <= 0) {
+      switch (SSL_get_error(conn->ssl, n)) {
+      case SSL_ERROR_WANT_WRITE:
+      case SSL_ERROR_WANT_READ:
+        return 1;
+      default:
+        return -1;
+      }
+    }
+    conn->woff += n;
+    metrics_count(MC_BYTES_OUT, n);
+  }
+  if (conn->woff > 0)
+    conn->progress++;
+  // Do not keep a large reply's buffer around for an idle connection
+  if (conn->out.cap > OUT_LIMIT)
+    wl_buf_free(&conn->out);
+  conn->out.len = conn->woff = 0;
+  return 0;
+}
+
+/******************************************************************************
+
+  Handle whatever input is buffered and note whether it changed the
+  watchlist: if so the replies must wait until the write-ahead log has the
+  changes on disk.
+
+ ******************************************************************************/
+static void run_input(struct connection *conn) {
+  uint64_t lsn = wal_thread_lsn();
+
+  process_input(conn);
+  if (wal_thread_lsn() != lsn)
+    conn->commit.lsn = wal_thread_lsn();
+}
+
+/******************************************************************************
+
+  Hold a connection whose queued replies may not go out yet: while one of
+  its account requests is with the pool, or until the log is durable up to
+  its last write.  A held connection is out of the epoll set, so it is
+  neither read from nor closed until the job comes back.  Returns true if
+  the connection is held.
+
+ ******************************************************************************/
+static bool hold_connection(int epfd, struct connection *conn) {
+  if (!conn->waiting && conn->commit.lsn != 0) {
+    if (wal_wait(&conn->commit))
+      conn->waiting = true;
+    else
+      conn->commit.lsn = 0;
+  }
+  if (!conn->waiting)
+    return false;
+  if (conn->events != 0) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn->events = 0;
+  }
+  return true;
+}
+
+/******************************************************************************
+
+  Advance a connection's state machine as far as it will go without blocking.
+  Returns false if the connection was closed.
+
+ ******************************************************************************/
+static bool advance_connection(int epfd, struct connection *conn) {
+  int n, err;
+
+  // The last step in establishing a secure connection is calling
+  // SSL_accept(), which executes the SSL/TLS handshake.  On a non-blocking
+  // socket it returns as soon as it needs to wait for the client, telling us
+  // which direction it is waiting on, and is simply called again later.
+  if (conn->state == CONN_HANDSHAKE) {
+    n = SSL_accept(conn->ssl);
+    if (n <= 0) {
+      err = SSL_get_error(conn->ssl, n);
+      if (err == SSL_ERROR_WANT_READ) {
+        set_interest(epfd, conn, EPOLLIN);
+        return true;
+      }
+      if (err == SSL_ERROR_WANT_WRITE) {
+        set_interest(epfd, conn, EPOLLOUT);
+        return true;
+      }
+      LOG(LOGGER_WARN,
+          "Server: Could not establish secure connection with client (%s):",
+          conn->client_addr);
+      logger_ssl_errors(LOGGER_WARN);
+      metrics_count(MC_HANDSHAKE_FAILURES, 1);
+      close_connection(conn);
+      return false;
+    }
+    LOG(LOGGER_INFO, "Server: Established SSL/TLS connection with client (%s)",
+        conn->client_addr);
+    metrics_time(MT_HANDSHAKE, conn->accepted);
+    metrics_count(SSL_session_reused(conn->ssl) ? MC_HANDSHAKES_RESUMED
+                                                : MC_HANDSHAKES_FULL,
+                  1);
+    conn->state = CONN_PREFACE;
+  }
+
+  for (;;) {
+    // Never read a new request while the reply to the last one is still
+    // queued; a client that does not read its replies just stops being served
+    if ((n = flush_replies(conn)) != 0) {
+      if (n < 0) {
+        close_connection(conn);
+        return false;
+      }
+      set_interest(epfd, conn, EPOLLOUT);
+      return true;
+    }
+    if (conn->state == CONN_CLOSING) {
+      close_connection(conn);
+      return false;
+    }
+
+    // Frames left over when the replies filled the output can be handled
+    // now that it has drained
+    if (conn->more_input) {
+      run_input(conn);
+      if (hold_connection(epfd, conn))
+        return true;
+      continue;
+    }
+
+    // Keep reading until OpenSSL runs dry.  Records it already decrypted are
+    // not visible to epoll, so stopping early could strand a request.
+    wl_buf_reserve(&conn->in, 4096);
+    n = SSL_read(conn->ssl, conn->in.data + conn->in.len,
+                 conn->in.cap - conn->in.len);
+    if (n <= 0) {
+      err = SSL_get_error(conn->ssl, n);
+      if (err == SSL_ERROR_WANT_READ) {
+        set_interest(epfd, conn, EPOLLIN);
+        return true;
+      }
+      if (err == SSL_ERROR_WANT_WRITE) {
+        set_interest(epfd, conn, EPOLLOUT);
+        return true;
+      }
+      // Orderly shutdown by the client, or a broken connection
+      close_connection(conn);
+      return false;
+    }
+    conn->in.len += n;
+    metrics_count(MC_BYTES_IN, n);
+    run_input(conn);
+    if (hold_connection(epfd, conn))
+      return true;
+  }
+}
+
+/******************************************************************************
+
+  Serve a connection whenever epoll reports its socket readable or writable,
+  then set the deadline for what it is waiting for next.
+
+ ******************************************************************************/
+static void service_connection(int epfd, struct connection *conn) {
+  unsigned long progress = conn->progress;
+
+  if (advance_connection(epfd, conn))
+    arm_timer(conn, conn->progress != progress);
+}
+
+/******************************************************************************
+
+  Carry on serving a connection that was held: handle the frames that
+  queued up meanwhile, then put the socket back into the epoll set and
+  catch up on it.
+
+ ******************************************************************************/
+static void resume_connection(struct connection *conn) {
+  struct worker *w = conn->worker;
+  struct epoll_event ev;
+
+  conn->waiting = false;
+  run_input(conn);
+  if (hold_connection(w->epfd, conn))
+    return;
+  ev.events = EPOLLIN;
+  ev.data.ptr = conn;
+  epoll_ctl(w->epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+  conn->events = EPOLLIN;
+  service_connection(w->epfd, conn);
+}
+
+// An account request is back from the pool
+static void account_done(struct auth_job *job) {
+  struct account_job *a = (struct account_job *)job;
+  struct connection *conn = a->conn;
+
+  reply_account(conn, a);
+  metrics_time(metrics_opcode(a->type), a->started);
+  metrics_reply(a->status);
+  // A new user, like any write, is only confirmed once the log holds it
+  if (a->lsn > conn->commit.lsn)
+    conn->commit.lsn = a->lsn;
+  free(a);
+  resume_connection(conn);
+}
+
+// The log is on disk up to the connection's last write
+static void commit_done(struct auth_job *job) {
+  struct connection *conn = (struct connection *)((char *)job -
+                                                  offsetof(struct connection,
+                                                           commit));
+
+  conn->commit.lsn = 0;
+  resume_connection(conn);
+}
+
+// Finish the work handed back to this event loop by the account pool and
+// the write-ahead log
+static void finish_jobs(struct worker *w) {
+  struct auth_job *job, *next;
+
+  for (job = auth_collect(&w->done); job != NULL; job = next) {
+    next = job->next;
+    job->done(job);
+  }
+}
+
+/******************************************************************************
+
+  Accept every pending connection on the listening socket, wrap each in a new
+  SSL object and add it to the epoll set.  The handshake itself is driven by
+  service_connection() as the client's data arrives.  At the connection cap
+  the worker stops accepting, and a client already holding max_per_ip
+  connections has the new one closed right away.
+
+ ******************************************************************************/
+static void accept_connections(struct worker *w) {
+  struct connection *conn;
+  struct epoll_event ev;
+  struct sockaddr_in addr;
+  socklen_t len;
+  unsigned long active, peak;
+  uint64_t start;
+  char name[INET_ADDRSTRLEN];
+  int client;
+
+  for (;;) {
+    if (__atomic_load_n(&active_connections, __ATOMIC_RELAXED) >=
+        max_connections) {
+      pause_accepting(w);
+      return;
+    }
+    len = sizeof(addr);
+    start = metrics_now();
+    client = accept4(w->sockfd, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK);
+    if (client < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        LOG(LOGGER_WARN, "Server: Unable to accept connection: %s",
+            strerror(errno));
+        metrics_count(MC_ACCEPT_ERRORS, 1);
+      }
+      return;
+    }
+    if (!peer_acquire(addr.sin_addr.s_addr)) {
+      inet_ntop(AF_INET, &addr.sin_addr, name, sizeof(name));
+      LOG(LOGGER_WARN, "Server: Too many connections from %s, rejected",
+          name);
+      metrics_count(MC_REJECTED_PER_IP, 1);
+      close(client);
+      continue;
+    }
+
+    conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+      LOG(LOGGER_ERROR, "Server: Out of memory, dropping connection");
+      peer_release(addr.sin_addr.s_addr);
+      close(client);
+      continue;
+    }
+    conn->worker = w;
+    conn->commit.job.home = &w->done;
+    conn->commit.job.done = commit_done;
+    conn->fd = client;
+    conn->state = CONN_HANDSHAKE;
+    conn->accepted = metrics_now();
+    conn->peer = addr.sin_addr.s_addr;
+    conn->timer = TIMER_NONE;
+
+    // Display the IPv4 network address of the connected client
+    inet_ntop(AF_INET, (struct in_addr *)&addr.sin_addr, conn->client_addr,
+              INET_ADDRSTRLEN);
+    LOG(LOGGER_INFO, "Server: Established TCP connection with client (%s)",
+        conn->client_addr);
+
+    // Here we are creating a new SSL object to bind to the socket descriptor
+    // and binding it. The socket descriptor will be used by OpenSSL to
+    // communicate with a client.
+    conn->ssl = SSL_new(w->ssl_ctx);
+    SSL_set_fd(conn->ssl, client);
+
+    // The client speaks first in a TLS handshake, so wait for it to be
+    // readable
+    conn->events = EPOLLIN;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    if (conn->ssl == NULL ||
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, client, &ev) < 0) {
+      LOG(LOGGER_WARN, "Server: Unable to register client (%s)",
+          conn->client_addr);
+      SSL_free(conn->ssl);
+      close(client);
+      peer_release(conn->peer);
+      free(conn);
+      continue;
+    }
+    arm_timer(conn, true);
+
+    metrics_time(MT_ACCEPT, start);
+    metrics_count(MC_ACCEPTED, 1);
+    __atomic_add_fetch(&w->active, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total_connections, 1, __ATOMIC_RELAXED);
+    active = __atomic_add_fetch(&active_connections, 1, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&peak_connections, __ATOMIC_RELAXED);
+    while (active > peak &&
+           !__atomic_compare_exchange_n(&peak_connections, &peak, active, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+  }
+}
+
+/******************************************************************************
+
+  Body of a worker thread.  Each worker binds its own listening socket to the
+  server port, builds its own SSL_CTX and runs an independent event loop, so
+  workers share nothing on the connection path.
+
+ ******************************************************************************/
+static void *worker_main(void *arg) {
+  struct worker *w = arg;
+  struct epoll_event ev, events[MAX_EVENTS];
+  int n, i;
+
+  // This will create a network socket and return a socket descriptor, which
+  // is and works just like a file descriptor, but for network communcations.
+  // Note we have to specify which TCP/UDP port on which we are communicating
+  // as an argument to our user-defined create_socket() function.
+  w->sockfd = create_socket(port, backlog, num_threads > 1);
+
+  // Create and configure this worker's SSL context
+  w->ssl_ctx = create_new_context();
+  configure_context(w->ssl_ctx);
+
+  w->epfd = epoll_create1(0);
+  if (w->epfd < 0) {
+    fprintf(stderr, "Server: Unable to create epoll instance: %s\n",
+            strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // The listening socket is the only entry without a connection attached,
+  // and the eventfd of the account pool is marked by its queue
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->sockfd, &ev);
+  ev.data.ptr = &w->done;
+  epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->done.efd, &ev);
+
+  // Wait for incoming connections and client data and handle them as they
+  // arrive, waking up in time to close connections that miss a deadline
+  while (1) {
+    resume_accepting(w);
+    n = epoll_wait(w->epfd, events, MAX_EVENTS, next_timeout(w));
+    if (n < 0 && errno != EINTR) {
+      LOG(LOGGER_ERROR, "Server: epoll_wait failed: %s", strerror(errno));
+      break;
+    }
+
+    for (i = 0; i < n; i++) {
+      if (events[i].data.ptr == NULL)
+        accept_connections(w);
+      else if (events[i].data.ptr == &w->done)
+        finish_jobs(w);
+      else
+        service_connection(w->epfd, events[i].data.ptr);
+    }
+    // Only after the batch, which may still refer to the connections closed
+    expire_connections(w);
+  }
+
+  // Tear down this worker's data structures before terminating
+  SSL_CTX_free(w->ssl_ctx);
+  close(w->epfd);
+  close(w->sockfd);
+  return NULL;
+}
+
+/******************************************************************************
+
+  Print the connection counters, so it is possible to watch how many
+  concurrent sessions the server is carrying.
+
+ ******************************************************************************/
+static void report_stats(struct worker *workers) {
+  char per_worker[MAX_THREADS * 12] = "";
+  struct cache_stats cache;
+  struct auth_stats auth;
+  struct wal_stats wal;
+  struct replica_stats replica;
+  unsigned long lookups;
+  uint64_t compressed_in, compressed_out;
+  int i, len = 0;
+
+  for (i = 0; i < num_threads; i++)
+    len += snprintf(per_worker + len, sizeof(per_worker) - len, " %lu",
+                    __atomic_load_n(&workers[i].active, __ATOMIC_RELAXED));
+  LOG(LOGGER_INFO,
+      "Server: connections active=%lu peak=%lu total=%lu per-worker:%s",
+      __atomic_load_n(&active_connections, __ATOMIC_RELAXED),
+      __atomic_load_n(&peak_connections, __ATOMIC_RELAXED),
+      __atomic_load_n(&total_connections, __ATOMIC_RELAXED), per_worker);
+  LOG(LOGGER_INFO, "Server: handshakes full=%llu resumed=%llu failed=%llu",
+      (unsigned long long)metrics_total(MC_HANDSHAKES_FULL),
+      (unsigned long long)metrics_total(MC_HANDSHAKES_RESUMED),
+      (unsigned long long)metrics_total(MC_HANDSHAKE_FAILURES));
+  LOG(LOGGER_INFO,
+      "Server: limits rejected-per-ip=%llu paused=%llu timeouts "
+      "handshake=%llu idle=%llu request=%llu",
+      (unsigned long long)metrics_total(MC_REJECTED_PER_IP),
+      (unsigned long long)metrics_total(MC_ACCEPT_PAUSES),
+      (unsigned long long)metrics_total(MC_TIMEOUTS_HANDSHAKE),
+      (unsigned long long)metrics_total(MC_TIMEOUTS_IDLE),
+      (unsigned long long)metrics_total(MC_TIMEOUTS_REQUEST));
+  compressed_in = metrics_total(MC_COMPRESS_BYTES_IN);
+  compressed_out = metrics_total(MC_COMPRESS_BYTES_OUT);
+  if (compressed_in > 0)
+    LOG(LOGGER_INFO,
+        "Server: compression bytes-in=%llu bytes-out=%llu ratio=%.2f",
+        (unsigned long long)compressed_in, (unsigned long long)compressed_out,
+        (double)compressed_in / compressed_out);
+
+  cache_get_stats(&cache);
+  lookups = cache.hits + cache.misses;
+  LOG(LOGGER_INFO,
+      "Server: cache entries=%lu hits=%lu misses=%lu hit-rate=%.1f%% "
+      "evictions=%lu",
+      cache.entries, cache.hits, cache.misses,
+      lookups ? 100.0 * cache.hits / lookups : 0.0, cache.evictions);
+
+  // Account requests wait in their own queue, so their latency is reported
+  // apart from that of watchlist requests
+  auth_get_stats(&auth);
+  LOG(LOGGER_INFO,
+      "Server: accounts completed=%lu rejected=%lu queued=%lu "
+      "peak-queued=%lu latency-mean=%.2fms latency-max=%.2fms",
+      auth.completed, auth.rejected, auth.depth, auth.peak_depth,
+      auth.mean_latency_ms, auth.max_latency_ms);
+
+  wal_get_stats(&wal);
+  LOG(LOGGER_INFO,
+      "Server: log commits=%lu records=%lu records/commit=%.1f "
+      "sync-mean=%.2fms checkpoints=%lu",
+      wal.commits, wal.records,
+      wal.commits ? (double)wal.records / wal.commits : 0.0,
+      wal.mean_sync_ms, wal.checkpoints);
+
+  // Replication lag in records, from whichever side(s) this server is on
+  replica_get_stats(&replica);
+  for (i = 0; i < replica.backups; i++)
+    LOG(LOGGER_INFO,
+        "Server: backup %s state=%s acked-lsn=%llu behind=%llu "
+        "snapshots=%lu",
+        replica.backup[i].name, replica.backup[i].state,
+        (unsigned long long)replica.backup[i].acked_lsn,
+        (unsigned long long)replica.backup[i].behind,
+        replica.backup[i].snapshots);
+  if (replica.following)
+    LOG(LOGGER_INFO,
+        "Server: following epoch=%016llx applied-lsn=%llu behind=%llu "
+        "heard=%.1fs ago",
+        (unsigned long long)replica.epoch,
+        (unsigned long long)replica.applied_lsn,
+        (unsigned long long)replica.behind, replica.heard_secs);
+}
+
+// engine_reporter for the server: the storage engines report to the log
+static void report_storage(const char *message) {
+  LOG(LOGGER_INFO, "%s", message);
+}
+
+/******************************************************************************
+
+  The sequence of steps required to establish a secure SSL/TLS connection is:
+
+  1.  Initialize the SSL algorithms
+  2.  Create and configure an SSL context object
+  3.  Create a new network socket in the traditional way
+  4.  Listen for incoming connections
+  5.  Accept incoming connections as they arrive
+  6.  Create a new SSL object for the newly arrived connection
+  7.  Bind the SSL object to the network socket descriptor
+
+  Once these steps are completed successfully, use the functions SSL_read() and
+  SSL_write() to read from/write to the socket, but using the SSL object rather
+  then the socket descriptor.  Once the session is complete, free the memory
+  allocated to the SSL object and close the socket descriptor.
+
+  Steps 2 through 7 and all reads and writes happen inside the event loop of
+  each worker thread, so each of them is retried whenever the socket becomes
+  ready instead of blocking the whole server.  The main thread only starts
+  the workers and reports the connection counters.
+
+ ******************************************************************************/
+int main(int argc, char **argv) {
+  const struct storage_engine *engine;
+  const char *engine_name = DEFAULT_ENGINE;
+  const char *level_name = "info";
+  enum logger_level level;
+  struct worker *workers;
+  int opt, i;
+  unsigned long total, active;
+  unsigned long last_total = 0, last_active = 0;
+  struct timespec interval = {STATS_INTERVAL, 0};
+  sigset_t stop;
+  bool replicating = false;
+  char trailing;
+
+  // Port can be specified on the command line. If it's not, use the default
+  // port. The listen backlog can be changed with -b, the number of entries
+  // the record cache holds with -c, the number of worker threads with -t,
+  // the number of account threads with -a, the group commit of the
+  // write-ahead log with -i and -g, the storage engine with -e, the
+  // backups to replicate to with -r, the admin socket with -s, the
+  // lowest level of messages logged with -l, the connection caps with -m
+  // and -p, the timeouts in seconds with -T and the smallest reply that is
+  // compressed with -z.
+  while ((opt = getopt(argc, argv, "a:b:c:e:g:i:l:m:p:r:s:t:T:z:")) != -1) {
+    switch (opt) {
+    case 'a':
+      auth_threads = atoi(optarg);
+      break;
+    case 'b':
+      backlog = atoi(optarg);
+      break;
+    case 'c':
+      cache_entries = atoi(optarg);
+      break;
+    case 'e':
+      engine_name = optarg;
+      break;
+    case 'g':
+      commit_batch = atoi(optarg);
+      break;
+    case 'i':
+      commit_interval = atol(optarg);
+      break;
+    case 'l':
+      level_name = optarg;
+      break;
+    case 'm':
+      max_connections = strtoul(optarg, NULL, 10);
+      break;
+    case 'p':
+      max_per_ip = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      if (!replica_add_backup(optarg)) {
+        fprintf(stderr, "Server: Bad or too many backups: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      replicating = true;
+      break;
+    case 's':
+      admin_socket = optarg;
+      break;
+    case 't':
+      num_threads = atoi(optarg);
+      break;
+    case 'T':
+      if (sscanf(optarg, "%u:%u:%u%c", &timeouts[TIMER_HANDSHAKE],
+                 &timeouts[TIMER_IDLE], &timeouts[TIMER_REQUEST],
+                 &trailing) != 3) {
+        fprintf(stderr, "Server: Bad timeouts: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'z':
+      compress_min = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "Usage: ssl-server [-a auth-threads] [-b backlog] "
+                      "[-c cache-entries] [-e gdbm|log] [-g commit-batch] "
+                      "[-i commit-interval] [-l debug|info|warn|error] "
+                      "[-m max-connections] [-p max-per-ip] "
+                      "[-r host:port]... [-s admin-socket] [-t threads] "
+                      "[-T handshake:idle:request] [-z compress-min] "
+                      "[port]\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (optind < argc)
+    port = atoi(argv[optind++]);
+  if (optind < argc || backlog <= 0 || cache_entries < 0 || num_threads < 1 ||
+      num_threads > MAX_THREADS || auth_threads < 1 || commit_batch < 1 ||
+      commit_interval < 0 || max_connections < 1 ||
+      (engine = storage_engine(engine_name)) == NULL ||
+      !logger_parse_level(level_name, &level)) {
+    fprintf(stderr, "Usage: ssl-server [-a auth-threads] [-b backlog] "
+                    "[-c cache-entries] [-e gdbm|log] [-g commit-batch] "
+                    "[-i commit-interval] [-l debug|info|warn|error] "
+                    "[-m max-connections] [-p max-per-ip] "
+                    "[-r host:port]... [-s admin-socket] [-t threads] "
+                    "[-T handshake:idle:request] [-z compress-min] "
+                    "[port]\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Stop cleanly on Ctrl-C or kill so the engine can flush and unlock its
+  // files. The signals are blocked before any thread starts, so every
+  // thread inherits the mask and only the main thread, waiting for them in
+  // sigtimedwait(), ever takes one.
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+  // From here on messages go through the log writer
+  logger_start(level);
+
+  // Count connections per client address if -p asks for it
+  peers_init();
+
+  // A client that disappears mid-write must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  // Open the users and watchlist databases once; every worker shares the
+  // handles. What the engines report goes to the log.
+  engine_reporter = report_storage;
+  storage_open(engine);
+  LOG(LOGGER_INFO, "Server: Using the %s storage engine", engine->name);
+
+  // Load the replication key; a primary keeps what the log commits from
+  // here on for its backups
+  replica_init();
+
+  // Replay the write-ahead log and log every change from here on
+  storage_start_log(commit_interval, commit_batch);
+
+  // Login tokens are signed with a key made up for this run
+  token_init();
+
+  // Size the record cache; -c 0 turns it off
+  cache_init(cache_entries);
+
+  // Build the secondary indexes in the background while we start serving
+  index_start();
+
+  // Start the threads that serve logins and registrations
+  auth_start(auth_threads);
+
+  // Initialize the SSL algorithms once; the contexts are per worker
+  init_openssl();
+
+  // Connect to the backups, if this is a primary
+  replica_start();
+
+  // Offer the metrics to local administrators
+  if (metrics_serve(admin_socket))
+    LOG(LOGGER_INFO, "Server: Metrics available on %s", admin_socket);
+
+  workers = calloc(num_threads, sizeof(*workers));
+  if (workers == NULL) {
+    fprintf(stderr, "Server: Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < num_threads; i++) {
+    workers[i].id = i;
+    auth_done_init(&workers[i].done);
+    if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) !=
+        0) {
+      fprintf(stderr, "Server: Unable to start worker thread %d\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  LOG(LOGGER_INFO, "Server: Started %d worker thread(s)", num_threads);
+
+  // Report the connection counters whenever they have changed, and every
+  // time while replicating so the lag can be watched. A SIGINT or SIGTERM
+  // ends the wait, so shutdown is noticed right away.
+  for (;;) {
+    i = sigtimedwait(&stop, NULL, &interval);
+    if (i == SIGINT || i == SIGTERM)
+      break;
+    total = __atomic_load_n(&total_connections, __ATOMIC_RELAXED);
+    active = __atomic_load_n(&active_connections, __ATOMIC_RELAXED);
+    if (total != last_total || active != last_active || replicating ||
+        replica_attached()) {
+      report_stats(workers);
+      last_total = total;
+      last_active = active;
+    }
+  }
+
+  // Tear down and clean up server data structures before terminating. The
+  // workers are left running; they stop at the database locks and exit with
+  // the process.
+  storage_close();
+  cleanup_openssl();
+  LOG(LOGGER_INFO, "server: closed successfully");
+  return 0;
+}
@@ -0,0 +1,206 @@
+/******************************************************************************
+
+PROGRAM:  storage.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Long-lived handles for the users and watchlist databases.  Opening
+          a database costs an open() plus reading its header or index, so
+          this is done once when the server starts rather than on every
+          login.  See storage.h for the locking rules and engine.h for the
+          storage engines.
+
+******************************************************************************/
+#include "storage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "wal.h"
+
+struct database users_db = {USERS_DB, NULL, NULL, PTHREAD_RWLOCK_INITIALIZER,
+                            false};
+struct database watchlist_db = {WATCHLIST_DB, NULL, NULL,
+                                PTHREAD_RWLOCK_INITIALIZER, false};
+
+static const struct storage_engine *engines[] = {&gdbm_engine, &log_engine};
+
+// The engine with the given name, or NULL if there is none
+const struct storage_engine *storage_engine(const char *name) {
+  for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+    if (strcmp(engines[i]->name, name) == 0)
+      return engines[i];
+  return NULL;
+}
+
+/******************************************************************************
+
+  Open the database for read/write, create if it doesn't already exist.  The
+  server cannot do anything useful without its databases, so the engines
+  treat failure here as fatal.
+
+ ******************************************************************************/
+static void open_database(struct database *db,
+                          const struct storage_engine *engine) {
+  char path[256];
+
+  snprintf(path, sizeof(path), "%s%s", db->name, engine->extension);
+  db->engine = engine;
+  db->handle = engine->open(path);
+}
+
+void storage_open(const struct storage_engine *engine) {
+  open_database(&users_db, engine);
+  open_database(&watchlist_db, engine);
+}
+
+// Redo one record of the log. Deleting what is not there is fine: the record
+// may have reached the database before the crash.
+static void replay(const struct wal_record *r) {
+  struct database *db = r->op >= WAL_USER_STORE ? &users_db : &watchlist_db;
+  datum k = {(char *)r->key, r->key_len};
+  datum v = {(char *)r->value, r->value_len};
+
+  if (r->op == WAL_STORE || r->op == WAL_USER_STORE)
+    db->engine->store(db->handle, k, v, STORAGE_REPLACE);
+  else if (r->op == WAL_DELETE || r->op == WAL_USER_DELETE)
+    db->engine->delete(db->handle, k);
+}
+
+// Called by the log's commit thread when the log has grown large: once
+// both databases are on disk the log can start over
+static void checkpoint(void) {
+  storage_wrlock(&users_db);
+  storage_wrlock(&watchlist_db);
+  storage_sync(&users_db);
+  storage_sync(&watchlist_db);
+  wal_reset();
+  storage_unlock(&watchlist_db);
+  storage_unlock(&users_db);
+}
+
+/******************************************************************************
+
+  Bring both databases up to date from the write-ahead log, which may hold
+  acknowledged writes that never reached a database file, and empty it.
+  The log keeps its old name, watchlist.wal, although users are logged too.
+  Returns the number of records replayed.  Called once after storage_open()
+  and before anything else touches the databases.
+
+ ******************************************************************************/
+long storage_recover(void) {
+  long records = wal_open(WATCHLIST_WAL, replay);
+
+  users_db.engine->sync(users_db.handle);
+  watchlist_db.engine->sync(watchlist_db.handle);
+  wal_reset();
+  return records;
+}
+
+// Recover, then log every change to both databases with the given group
+// commit settings.  Called once before the workers start.
+void storage_start_log(long commit_interval, int commit_batch) {
+  long records = storage_recover();
+
+  if (records > 0)
+    engine_report("Server: Replayed %ld records from %s", records,
+                  WATCHLIST_WAL);
+  wal_start(commit_interval, commit_batch, checkpoint);
+  users_db.logged = true;
+  watchlist_db.logged = true;
+}
+
+/******************************************************************************
+
+  Close both databases.  Taking the write locks first waits for any request
+  still using them to finish.  The locks are never released: this is only
+  called on the way out of the process and nothing may touch a closed handle.
+  The write-ahead log is left as it is and replayed at the next start.
+
+ ******************************************************************************/
+void storage_close(void) {
+  struct database *dbs[] = {&users_db, &watchlist_db};
+
+  for (int i = 0; i < 2; i++) {
+    storage_wrlock(dbs[i]);
+    if (dbs[i]->handle)
+      dbs[i]->engine->close(dbs[i]->handle);
+    dbs[i]->handle = NULL;
+  }
+}
+
+void storage_rdlock(struct database *db) { pthread_rwlock_rdlock(&db->lock); }
+
+void storage_wrlock(struct database *db) { pthread_rwlock_wrlock(&db->lock); }
+
+void storage_unlock(struct database *db) { pthread_rwlock_unlock(&db->lock); }
+
+/******************************************************************************
+
+  Calls into the database's engine, each timed into its own histogram (see
+  metrics.h).  Stores and deletes are logged while the caller still holds
+  the write lock, so the log has them in the order they were made.
+
+ ******************************************************************************/
+datum storage_fetch(struct database *db, datum key) {
+  uint64_t start = metrics_now();
+  datum value = db->engine->fetch(db->handle, key);
+
+  metrics_time(MT_FETCH, start);
+  return value;
+}
+
+int storage_exists(struct database *db, datum key) {
+  uint64_t start = metrics_now();
+  int ret = db->engine->exists(db->handle, key);
+
+  metrics_time(MT_EXISTS, start);
+  return ret;
+}
+
+int storage_store(struct database *db, datum key, datum value, int flag) {
+  uint64_t start = metrics_now();
+  int ret = db->engine->store(db->handle, key, value, flag);
+
+  metrics_time(MT_STORE, start);
+  if (ret == 0 && db->logged)
+    wal_append(db == &users_db ? WAL_USER_STORE : WAL_STORE, key.dptr,
+               key.dsize, value.dptr, value.dsize);
+  return ret;
+}
+
+int storage_delete(struct database *db, datum key) {
+  uint64_t start = metrics_now();
+  int ret = db->engine->delete(db->handle, key);
+
+  metrics_time(MT_DELETE, start);
+  if (ret == 0 && db->logged)
+    wal_append(db == &users_db ? WAL_USER_DELETE : WAL_DELETE, key.dptr,
+               key.dsize, "", 0);
+  return ret;
+}
+
+datum storage_firstkey(struct database *db) {
+  uint64_t start = metrics_now();
+  datum key = db->engine->firstkey(db->handle);
+
+  metrics_time(MT_FIRSTKEY, start);
+  return key;
+}
+
+datum storage_nextkey(struct database *db, datum key) {
+  uint64_t start = metrics_now();
+  datum next = db->engine->nextkey(db->handle, key);
+
+  metrics_time(MT_NEXTKEY, start);
+  return next;
+}
+
+// The caller holds db->lock exclusive
+void storage_sync(struct database *db) {
+  uint64_t start = metrics_now();
+
+  db->engine->sync(db->handle);
+  metrics_time(MT_SYNC, start);
+}
@@ -0,0 +1,66 @@
+/******************************************************************************
+
+PROGRAM:  storage.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Storage layer shared by the server's worker threads.  Both
+          databases are opened once at startup, with the storage engine
+          picked on the command line (see engine.h), and stay open until
+          shutdown.
+          Sessions share them through a reader/writer lock per database:
+          lookups and scans take it shared, anything that modifies the
+          database (or reads a record in order to rewrite it) takes it
+          exclusive.
+
+          Once storage_start_log() has run, every change to either database
+          also goes to the write-ahead log (see wal.h).
+
+******************************************************************************/
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "engine.h"
+
+// Database names; the engine adds the file name extension
+#define USERS_DB "users"
+#define WATCHLIST_DB "watchlist"
+#define DEFAULT_ENGINE "gdbm"
+
+// One open database and the lock that lets worker threads share it
+struct database {
+  const char *name;
+  const struct storage_engine *engine;
+  void *handle;          // the engine's
+  pthread_rwlock_t lock; // logical lock held across a whole request
+  bool logged;           // changes are appended to the write-ahead log
+};
+
+extern struct database users_db;
+extern struct database watchlist_db;
+
+const struct storage_engine *storage_engine(const char *name);
+
+void storage_open(const struct storage_engine *engine);
+long storage_recover(void);
+void storage_start_log(long commit_interval, int commit_batch);
+void storage_close(void);
+
+void storage_rdlock(struct database *db);
+void storage_wrlock(struct database *db);
+void storage_unlock(struct database *db);
+
+// The caller holds db->lock (shared is enough for fetch/exists/iteration).
+// Fetched values and keys are malloc'd and must be freed.  The flag of
+// storage_store() is STORAGE_INSERT or STORAGE_REPLACE.
+datum storage_fetch(struct database *db, datum key);
+int storage_exists(struct database *db, datum key);
+int storage_store(struct database *db, datum key, datum value, int flag);
+int storage_delete(struct database *db, datum key);
+datum storage_firstkey(struct database *db);
+datum storage_nextkey(struct database *db, datum key);
+void storage_sync(struct database *db);
+
+#endif
@@ -0,0 +1,106 @@
+/******************************************************************************
+
+PROGRAM:  ticket.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Rotating TLS session ticket keys, see ticket.h.  Tickets are
+          encrypted with AES-256-CBC and authenticated with HMAC-SHA256, as
+          OpenSSL does with its own keys.
+
+******************************************************************************/
+#include "ticket.h"
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TICKET_NAME_LENGTH 16
+
+struct ticket_key {
+  unsigned char name[TICKET_NAME_LENGTH];
+  unsigned char aes_key[32];
+  unsigned char hmac_key[32];
+  time_t created; // 0 if this slot holds no key yet
+};
+
+// keys[0] seals new tickets; keys[1] is the one it replaced
+static struct ticket_key keys[2];
+static pthread_mutex_t keys_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Start a new key if the current one is due, keeping the old one around
+static void rotate_keys(void) {
+  time_t now = time(NULL);
+
+  if (keys[0].created != 0 && now - keys[0].created < TICKET_KEY_LIFETIME)
+    return;
+  keys[1] = keys[0];
+  if (RAND_bytes(keys[0].name, sizeof(keys[0].name)) != 1 ||
+      RAND_bytes(keys[0].aes_key, sizeof(keys[0].aes_key)) != 1 ||
+      RAND_bytes(keys[0].hmac_key, sizeof(keys[0].hmac_key)) != 1) {
+    fprintf(stderr, "Server: Unable to generate a session ticket key\n");
+    exit(EXIT_FAILURE);
+  }
+  keys[0].created = now;
+}
+
+static int set_hmac_key(EVP_MAC_CTX *hctx, unsigned char *key, size_t len) {
+  OSSL_PARAM params[] = {
+      OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key, len),
+      OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+      OSSL_PARAM_construct_end()};
+
+  return EVP_MAC_CTX_set_params(hctx, params);
+}
+
+/******************************************************************************
+
+  OpenSSL's ticket key callback.  When sealing a ticket (enc = 1) it names
+  the current key and sets up the cipher and MAC with it.  When opening one
+  it looks the key up by name: 1 accepts the ticket, 2 accepts it and asks
+  for a new one under the current key, and 0 means the key is gone and the
+  client gets a full handshake.
+
+ ******************************************************************************/
+static int ticket_key_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+                         EVP_CIPHER_CTX *cctx, EVP_MAC_CTX *hctx, int enc) {
+  struct ticket_key key;
+  int ret = 1;
+
+  pthread_mutex_lock(&keys_lock);
+  rotate_keys();
+  if (enc) {
+    key = keys[0];
+  } else if (memcmp(name, keys[0].name, TICKET_NAME_LENGTH) == 0) {
+    key = keys[0];
+  } else if (keys[1].created != 0 &&
+             memcmp(name, keys[1].name, TICKET_NAME_LENGTH) == 0) {
+    key = keys[1];
+    ret = 2;
+  } else
+    ret = 0;
+  pthread_mutex_unlock(&keys_lock);
+  if (ret == 0)
+    return 0;
+
+  if (enc) {
+    memcpy(name, key.name, TICKET_NAME_LENGTH);
+    if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1 ||
+        !EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv))
+      return -1;
+  } else if (!EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key.aes_key,
+                                 iv))
+    return -1;
+  if (!set_hmac_key(hctx, key.hmac_key, sizeof(key.hmac_key)))
+    return -1;
+  return ret;
+}
+
+// Have a context seal and open session tickets with the shared keys
+void ticket_configure(SSL_CTX *ssl_ctx) {
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(ssl_ctx, ticket_key_cb);
+}
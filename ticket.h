@@ -0,0 +1,25 @@
+/******************************************************************************
+
+PROGRAM:  ticket.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: TLS session ticket keys shared by all worker threads.  Every
+          worker has its own SSL_CTX, so OpenSSL's default per-context
+          ticket keys would only let a client resume on the worker that
+          happened to issue its ticket.  Installing ticket_configure() on
+          each context makes all of them seal and open tickets with the
+          same keys.  A fresh key is started every TICKET_KEY_LIFETIME
+          seconds; tickets sealed with the one before are still accepted,
+          and renewed, for one more lifetime.
+
+******************************************************************************/
+#ifndef TICKET_H
+#define TICKET_H
+
+#include <openssl/ssl.h>
+
+#define TICKET_KEY_LIFETIME 3600
+
+void ticket_configure(SSL_CTX *ssl_ctx);
+
+#endif
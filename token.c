@@ -0,0 +1,92 @@
+/******************************************************************************
+
+PROGRAM:  token.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Signed, expiring login tokens, see token.h.  A token is
+
+            u8  version  TOKEN_VERSION
+            u32 expiry   seconds since the epoch, big-endian
+            u8  length   of the user name
+            ... name
+            MAC          HMAC-SHA256 of everything before it
+
+******************************************************************************/
+#include "token.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TOKEN_VERSION 1
+
+// Written once by token_init() before the workers start, then only read
+static unsigned char token_key[32];
+
+void token_init(void) {
+  if (RAND_bytes(token_key, sizeof(token_key)) != 1) {
+    fprintf(stderr, "Server: Unable to generate the login token key\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void sign(const uint8_t *data, size_t len, uint8_t *mac) {
+  unsigned int mac_len = TOKEN_MAC_LENGTH;
+
+  HMAC(EVP_sha256(), token_key, sizeof(token_key), data, len, mac, &mac_len);
+}
+
+// Write a token for the named user into 'token', which must have room for
+// TOKEN_MAX_LENGTH bytes, and return its length
+size_t token_issue(const char *name, size_t len, uint8_t *token) {
+  uint32_t expiry = time(NULL) + TOKEN_LIFETIME;
+  size_t n = 0;
+
+  if (len >= USERNAME_LENGTH)
+    len = USERNAME_LENGTH - 1;
+  token[n++] = TOKEN_VERSION;
+  token[n++] = expiry >> 24;
+  token[n++] = expiry >> 16;
+  token[n++] = expiry >> 8;
+  token[n++] = expiry;
+  token[n++] = len;
+  memcpy(token + n, name, len);
+  n += len;
+  sign(token, n, token + n);
+  return n + TOKEN_MAC_LENGTH;
+}
+
+/******************************************************************************
+
+  Check a token presented by a client.  Returns 0 and copies out the user
+  name if the token is ours, intact and not expired, -1 otherwise.  The MAC
+  is compared in constant time so the comparison leaks nothing about how
+  close a forgery came.
+
+ ******************************************************************************/
+int token_check(const uint8_t *token, size_t len, char *name, size_t size) {
+  uint8_t mac[TOKEN_MAC_LENGTH];
+  uint32_t expiry;
+  size_t name_len;
+
+  if (len < 6 + TOKEN_MAC_LENGTH || token[0] != TOKEN_VERSION)
+    return -1;
+  name_len = token[5];
+  if (len != 6 + name_len + TOKEN_MAC_LENGTH || name_len >= size)
+    return -1;
+  sign(token, 6 + name_len, mac);
+  if (CRYPTO_memcmp(mac, token + 6 + name_len, TOKEN_MAC_LENGTH) != 0)
+    return -1;
+  expiry = (uint32_t)token[1] << 24 | (uint32_t)token[2] << 16 |
+           (uint32_t)token[3] << 8 | token[4];
+  if ((uint32_t)time(NULL) >= expiry)
+    return -1;
+  memcpy(name, token + 6, name_len);
+  name[name_len] = '\0';
+  return 0;
+}
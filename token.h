@@ -0,0 +1,34 @@
+/******************************************************************************
+
+PROGRAM:  token.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Login session tokens.  After a successful login the server hands
+          the client a token naming the user and when it expires, signed
+          with HMAC-SHA256 under a key only the server knows.  A client that
+          presents it in its next WL_HELLO is logged in without the salt and
+          hash exchanges.  Checking a token is a MAC computation and a
+          constant-time comparison; users.db is not consulted.
+
+          The key is made up when the server starts, so a restart logs
+          everybody out.
+
+******************************************************************************/
+#ifndef TOKEN_H
+#define TOKEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+#define TOKEN_LIFETIME (12 * 60 * 60)
+#define TOKEN_MAC_LENGTH 32
+// version, expiry, name length, name, MAC
+#define TOKEN_MAX_LENGTH (1 + 4 + 1 + USERNAME_LENGTH + TOKEN_MAC_LENGTH)
+
+void token_init(void);
+size_t token_issue(const char *name, size_t len, uint8_t *token);
+int token_check(const uint8_t *token, size_t len, char *name, size_t size);
+
+#endif
@@ -0,0 +1,413 @@
+/******************************************************************************
+
+PROGRAM:  wal.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: The write-ahead log, see wal.h.  Each record in the file is
+
+            u32 length   of the rest of the record, checksum excluded
+            u8  op       enum wal_op
+            u16 key      length of the key
+            ... key
+            ... value    what is left of 'length', empty for WAL_DELETE
+            u32 check    FNV-1a of everything before it, from 'length' on
+
+          all integers big-endian.  Appended records collect in a memory
+          buffer; the commit thread swaps it for an empty one and writes it
+          out, so appending never waits for the disk.  A record cut short
+          by a crash fails its check, and replay stops there.
+
+******************************************************************************/
+#include "wal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RECORD_HEADER 7 // length, op and key length
+#define RECORD_CHECK 4
+
+struct log_buf {
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+};
+
+static int log_fd = -1;
+static off_t log_bytes; // size of the file; only the commit thread writes it
+
+// All protected by log_lock
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_ready; // the commit thread has something to do
+static struct log_buf pending;   // appended, not yet handed to the file
+static unsigned long pending_records;
+static uint64_t pending_since; // when the oldest pending record came, ns
+static uint64_t appended_lsn, durable_lsn;
+static struct auth_job *waiters; // struct wal_waiters, chained through 'next'
+static unsigned long commits, committed_records, checkpoints;
+static uint64_t sync_total; // ns
+
+static long commit_interval; // microseconds
+static int commit_batch;
+static void (*checkpoint_fn)(void);
+static void (*publish_fn)(const unsigned char *records, size_t len,
+                          uint64_t lsn);
+
+// The LSN of the last record appended by the calling thread
+static __thread uint64_t thread_lsn;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// FNV-1a
+static uint32_t checksum(const unsigned char *p, size_t len) {
+  uint32_t h = 2166136261u;
+
+  while (len--)
+    h = (h ^ *p++) * 16777619u;
+  return h;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void fail(const char *what) {
+  fprintf(stderr, "Server: Unable to %s %s: %s\n", what, WATCHLIST_WAL,
+          strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+// Write all of a buffer to the log file and make it durable
+static void write_out(const unsigned char *data, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = write(log_fd, data, len)) < 0) {
+      if (errno == EINTR)
+        continue;
+      fail("write");
+    }
+    data += n;
+    len -= n;
+    log_bytes += n;
+  }
+  if (fdatasync(log_fd) < 0)
+    fail("sync");
+}
+
+/******************************************************************************
+
+  Check the record at the front of 'data' and point 'r' into it.  Returns
+  the record's size, or 0 if 'data' does not start with a whole, intact
+  record.
+
+ ******************************************************************************/
+size_t wal_read(const unsigned char *data, size_t len, struct wal_record *r) {
+  size_t body, key_len;
+
+  if (len < RECORD_HEADER + RECORD_CHECK)
+    return 0;
+  body = get_u32(data);
+  key_len = data[5] << 8 | data[6];
+  if (body < RECORD_HEADER - 4 + key_len || body > len - 4 - RECORD_CHECK ||
+      get_u32(data + 4 + body) != checksum(data, 4 + body))
+    return 0;
+  r->op = data[4];
+  r->key = data + RECORD_HEADER;
+  r->key_len = key_len;
+  r->value = data + RECORD_HEADER + key_len;
+  r->value_len = body - 3 - key_len;
+  return 4 + body + RECORD_CHECK;
+}
+
+// Encode a record at 'p', which has room for WAL_RECORD_SIZE() bytes.
+// Returns its size.
+size_t wal_write(unsigned char *p, const struct wal_record *r) {
+  size_t body = 3 + r->key_len + r->value_len;
+
+  put_u32(p, body);
+  p[4] = r->op;
+  p[5] = r->key_len >> 8;
+  p[6] = r->key_len;
+  memcpy(p + RECORD_HEADER, r->key, r->key_len);
+  memcpy(p + RECORD_HEADER + r->key_len, r->value, r->value_len);
+  put_u32(p + 4 + body, checksum(p, 4 + body));
+  return 4 + body + RECORD_CHECK;
+}
+
+/******************************************************************************
+
+  Open the log, creating it if need be, and hand every intact record in it
+  to 'apply' in order.  A damaged tail, left by a crash in the middle of a
+  write, is cut off.  Returns the number of records replayed.  Called once
+  at startup before anything else touches the databases.
+
+ ******************************************************************************/
+long wal_open(const char *path, void (*apply)(const struct wal_record *r)) {
+  unsigned char *data = NULL;
+  struct wal_record r;
+  struct stat st;
+  size_t off = 0, size;
+  long records = 0;
+
+  if ((log_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0 ||
+      fstat(log_fd, &st) < 0)
+    fail("open");
+  if (st.st_size > 0) {
+    if ((data = malloc(st.st_size)) == NULL) {
+      fprintf(stderr, "Server: Out of memory replaying %s\n", path);
+      exit(EXIT_FAILURE);
+    }
+    if (pread(log_fd, data, st.st_size, 0) != st.st_size)
+      fail("read");
+  }
+
+  while ((size = wal_read(data + off, st.st_size - off, &r)) > 0) {
+    apply(&r);
+    off += size;
+    records++;
+  }
+  if (off < (size_t)st.st_size) {
+    fprintf(stderr, "Server: Discarding %zu damaged bytes at the end of %s\n",
+            (size_t)st.st_size - off, path);
+    if (ftruncate(log_fd, off) < 0)
+      fail("truncate");
+  }
+  free(data);
+  log_bytes = off;
+  lseek(log_fd, off, SEEK_SET);
+  return records;
+}
+
+/******************************************************************************
+
+  Append one record and return its LSN.  The caller holds the database's
+  write lock, so records reach the log in the order they were applied.
+
+ ******************************************************************************/
+uint64_t wal_append(enum wal_op op, const void *key, size_t key_len,
+                    const void *value, size_t value_len) {
+  struct wal_record r = {op, key, key_len, value, value_len};
+  size_t need, cap;
+  uint64_t lsn;
+
+  pthread_mutex_lock(&log_lock);
+  need = pending.len + WAL_RECORD_SIZE(key_len, value_len);
+  if (need > pending.cap) {
+    for (cap = pending.cap ? pending.cap : 65536; cap < need; cap *= 2)
+      ;
+    if ((pending.data = realloc(pending.data, cap)) == NULL) {
+      fprintf(stderr, "Server: Out of memory appending to the log\n");
+      exit(EXIT_FAILURE);
+    }
+    pending.cap = cap;
+  }
+  pending.len += wal_write(pending.data + pending.len, &r);
+
+  if (pending_records++ == 0)
+    pending_since = now_ns();
+  if (pending_records == 1 || pending_records == (unsigned long)commit_batch)
+    pthread_cond_signal(&log_ready);
+  lsn = thread_lsn = ++appended_lsn;
+  pthread_mutex_unlock(&log_lock);
+  return lsn;
+}
+
+uint64_t wal_thread_lsn(void) { return thread_lsn; }
+
+// The LSN of the last record appended by any thread
+uint64_t wal_last_lsn(void) {
+  uint64_t lsn;
+
+  pthread_mutex_lock(&log_lock);
+  lsn = appended_lsn;
+  pthread_mutex_unlock(&log_lock);
+  return lsn;
+}
+
+// Take the waiters whose records are durable now. Called with log_lock held.
+static struct auth_job *take_durable(void) {
+  struct auth_job **pp = &waiters, *done = NULL, *job;
+
+  while ((job = *pp) != NULL) {
+    if (((struct wal_waiter *)job)->lsn <= durable_lsn) {
+      *pp = job->next;
+      job->next = done;
+      done = job;
+    } else
+      pp = &job->next;
+  }
+  return done;
+}
+
+static void return_waiters(struct auth_job *job) {
+  struct auth_job *next;
+
+  for (; job != NULL; job = next) {
+    next = job->next;
+    auth_return(job);
+  }
+}
+
+/******************************************************************************
+
+  Have 'waiter' returned to its event loop once the log is durable up to
+  waiter->lsn.  Returns false, and keeps the waiter, if it already is.
+
+ ******************************************************************************/
+bool wal_wait(struct wal_waiter *waiter) {
+  pthread_mutex_lock(&log_lock);
+  if (waiter->lsn <= durable_lsn) {
+    pthread_mutex_unlock(&log_lock);
+    return false;
+  }
+  waiter->job.next = waiters;
+  waiters = &waiter->job;
+  pthread_mutex_unlock(&log_lock);
+  return true;
+}
+
+/******************************************************************************
+
+  Empty the log once the database file itself holds everything in it.  The
+  caller has just synced the database while holding its write lock, which
+  it still holds, so nothing can be appended meanwhile.  Records not yet
+  committed are as durable as the rest now and their waiters are released.
+
+ ******************************************************************************/
+void wal_reset(void) {
+  struct auth_job *done;
+
+  if (ftruncate(log_fd, 0) < 0 || fdatasync(log_fd) < 0)
+    fail("truncate");
+  lseek(log_fd, 0, SEEK_SET);
+  log_bytes = 0;
+
+  pthread_mutex_lock(&log_lock);
+  if (publish_fn && pending.len > 0)
+    publish_fn(pending.data, pending.len, appended_lsn);
+  pending.len = 0;
+  pending_records = 0;
+  durable_lsn = appended_lsn;
+  done = take_durable();
+  checkpoints++;
+  pthread_mutex_unlock(&log_lock);
+  return_waiters(done);
+}
+
+static void *commit_main(void *arg) {
+  struct log_buf out = {NULL, 0, 0}, swap;
+  struct auth_job *done;
+  struct timespec deadline;
+  uint64_t lsn, start, wait_until;
+
+  for (;;) {
+    pthread_mutex_lock(&log_lock);
+    while (pending_records == 0)
+      pthread_cond_wait(&log_ready, &log_lock);
+
+    // Give other sessions until the commit interval is up to add theirs,
+    // unless the batch is full already
+    wait_until = pending_since + commit_interval * 1000;
+    deadline.tv_sec = wait_until / 1000000000;
+    deadline.tv_nsec = wait_until % 1000000000;
+    while (pending_records < (unsigned long)commit_batch &&
+           now_ns() < wait_until)
+      pthread_cond_timedwait(&log_ready, &log_lock, &deadline);
+
+    swap = out;
+    out = pending;
+    pending = swap;
+    pending.len = 0;
+    committed_records += pending_records;
+    pending_records = 0;
+    lsn = appended_lsn;
+    pthread_mutex_unlock(&log_lock);
+
+    start = now_ns();
+    write_out(out.data, out.len);
+
+    pthread_mutex_lock(&log_lock);
+    if (lsn > durable_lsn)
+      durable_lsn = lsn;
+    done = take_durable();
+    commits++;
+    sync_total += now_ns() - start;
+    pthread_mutex_unlock(&log_lock);
+    return_waiters(done);
+    if (publish_fn)
+      publish_fn(out.data, out.len, lsn);
+
+    if (log_bytes > WAL_CHECKPOINT_BYTES)
+      checkpoint_fn();
+  }
+  return NULL;
+}
+
+/******************************************************************************
+
+  Start the commit thread.  'checkpoint' is called on it whenever the log
+  has grown past WAL_CHECKPOINT_BYTES; it must sync the database under the
+  database's write lock and then call wal_reset().
+
+ ******************************************************************************/
+void wal_start(long interval_us, int batch, void (*checkpoint)(void)) {
+  pthread_condattr_t attr;
+  pthread_t thread;
+
+  commit_interval = interval_us;
+  commit_batch = batch;
+  checkpoint_fn = checkpoint;
+
+  // Commit deadlines are on the monotonic clock
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&log_ready, &attr);
+  pthread_condattr_destroy(&attr);
+
+  if (pthread_create(&thread, NULL, commit_main, NULL) != 0) {
+    fprintf(stderr, "Server: Unable to start the log commit thread\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_detach(thread);
+}
+
+/******************************************************************************
+
+  Have 'publish' called with every run of records once they are durable,
+  in LSN order, together with the LSN of the last of them.  It is called on
+  the commit thread, sometimes with the log's own lock held, and must not
+  call back into the log.  Called once, before wal_start().
+
+ ******************************************************************************/
+void wal_subscribe(void (*publish)(const unsigned char *records, size_t len,
+                                   uint64_t lsn)) {
+  publish_fn = publish;
+}
+
+void wal_get_stats(struct wal_stats *stats) {
+  pthread_mutex_lock(&log_lock);
+  stats->commits = commits;
+  stats->records = committed_records;
+  stats->checkpoints = checkpoints;
+  stats->mean_sync_ms = commits ? sync_total / 1e6 / commits : 0.0;
+  pthread_mutex_unlock(&log_lock);
+}
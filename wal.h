@@ -0,0 +1,94 @@
+/******************************************************************************
+
+PROGRAM:  wal.h for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Write-ahead log with group commit for the users and watchlist
+          databases.
+
+          Every store and delete is applied to its database, which is not
+          synced, and appended to the log.  A commit thread writes the
+          appended records out and makes them durable with one fdatasync()
+          for however many arrived since the last commit, so writes from
+          many sessions share the cost of a disk flush.  A
+          session is only told its write succeeded once the log holds it
+          on disk: wal_wait() hands its struct wal_waiter back to the event
+          loop, the same way the account pool returns its jobs (auth.h),
+          when that has happened.
+
+          Records are numbered by log sequence numbers (LSNs), which only
+          grow.  Once the log passes WAL_CHECKPOINT_BYTES the databases are
+          synced and the log emptied.  At startup wal_open() replays
+          whatever the log still holds into the databases, so writes that
+          were acknowledged but never reached a database file on disk
+          survive a crash.  Replaying a record twice does no harm.
+
+          Durable records are also handed, in order, to whoever subscribed
+          with wal_subscribe(); that is how they reach backup servers (see
+          replica.h), in the same format.
+
+          A commit waits up to the commit interval for more records to
+          join it, and goes ahead early once it has the batch size.
+
+******************************************************************************/
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "auth.h"
+
+#define WATCHLIST_WAL "watchlist.wal"
+#define DEFAULT_COMMIT_INTERVAL 500 // microseconds
+#define DEFAULT_COMMIT_BATCH 64     // records
+#define WAL_CHECKPOINT_BYTES (16 * 1024 * 1024)
+
+// Stores and deletes of the watchlist, then of users
+enum wal_op { WAL_STORE = 1, WAL_DELETE, WAL_USER_STORE, WAL_USER_DELETE };
+
+// One record. key and value point into the buffer it was read from.
+struct wal_record {
+  enum wal_op op;
+  const void *key;
+  size_t key_len;
+  const void *value;
+  size_t value_len;
+};
+
+// Bytes taken by a record: length, op, key length, key, value, check
+#define WAL_RECORD_SIZE(key_len, value_len) (11 + (key_len) + (value_len))
+
+// Returned to its event loop once the log is durable up to 'lsn'
+struct wal_waiter {
+  struct auth_job job; // must come first
+  uint64_t lsn;
+};
+
+// Running totals since startup
+struct wal_stats {
+  unsigned long commits;
+  unsigned long records;
+  unsigned long checkpoints;
+  double mean_sync_ms; // write() plus fdatasync() of one commit
+};
+
+size_t wal_read(const unsigned char *data, size_t len, struct wal_record *r);
+size_t wal_write(unsigned char *p, const struct wal_record *r);
+
+long wal_open(const char *path, void (*apply)(const struct wal_record *r));
+void wal_subscribe(void (*publish)(const unsigned char *records, size_t len,
+                                   uint64_t lsn));
+void wal_start(long interval_us, int batch, void (*checkpoint)(void));
+
+uint64_t wal_append(enum wal_op op, const void *key, size_t key_len,
+                    const void *value, size_t value_len);
+uint64_t wal_thread_lsn(void);
+uint64_t wal_last_lsn(void);
+bool wal_wait(struct wal_waiter *waiter);
+void wal_reset(void);
+
+void wal_get_stats(struct wal_stats *stats);
+
+#endif
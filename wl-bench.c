@@ -0,0 +1,617 @@
+/******************************************************************************
+
+PROGRAM:  wl-bench.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Load generator for ssl-server.  It opens many TLS connections at
+          once, one thread each, logs them all in as one fresh user and
+          has them send a mix of create, find, display, top, update and
+          remove requests over titles drawn from a fixed key space, where a
+          top asks for the best rated page of the list, then reports
+          the throughput, the time the handshakes took and the latency of
+          every kind of request.
+
+          In the default closed-loop mode each connection sends its next
+          request as soon as the last one is answered, which measures how
+          much the server can do.  With -r the load is open-loop: the
+          requests are sent on a fixed schedule adding up to the given rate
+          across all connections, and the latency of each is measured from
+          when it was due rather than when it went out.  A connection still
+          waiting for a reply sends the next request late, but the delay
+          counts against the server, so queueing shows up in the tail
+          instead of slowing the load down unnoticed.
+
+          Latencies are kept in log-linear histograms with HIST_SUB buckets
+          per power of two, about 1.5% apart, so percentiles cost nothing
+          while the load runs.  -j prints the results as one JSON object
+          for comparing builds by script.
+
+          Usage: wl-bench [options] <server>[:<port>]
+
+            -c connections   concurrent connections (16)
+            -d seconds       length of the run (10)
+            -r rate          requests per second in all, open-loop
+            -m mix           weights of the requests, in the form
+                             create=10,find=60,display=5,update=20,remove=5
+                             and top, not in the default mix
+            -k keys          titles to draw from (10000)
+            -s bytes         length of the descriptions created (64)
+            -p               create every title once before the run
+            -j               print JSON instead of a table
+            -z               offer to take compressed replies
+
+******************************************************************************/
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "protocol.h"
+
+#define DEFAULT_PORT "4433"
+#define DEFAULT_CONNECTIONS 16
+#define DEFAULT_SECONDS 10
+#define DEFAULT_KEYS 10000
+#define DEFAULT_DESCRIPTION 64
+#define DEFAULT_MIX "create=10,find=60,display=5,update=20,remove=5"
+#define DISPLAY_LIMIT 20 // entries asked for by one display
+#define BUSY_RETRY 10000 // microseconds before retrying a busy login
+#define HIST_SUB_BITS 6
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+enum bench_op {
+  OP_CREATE,
+  OP_FIND,
+  OP_DISPLAY,
+  OP_TOP,
+  OP_UPDATE,
+  OP_REMOVE,
+  OPS
+};
+
+static const char *const op_names[OPS] = {"create", "find",   "display",
+                                          "top",    "update", "remove"};
+static const uint8_t op_types[OPS] = {WL_CREATE,  WL_FIND,   WL_DISPLAY,
+                                      WL_DISPLAY, WL_UPDATE, WL_REMOVE};
+
+// Latencies in nanoseconds
+struct histogram {
+  uint32_t counts[HIST_BUCKETS];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t max;
+};
+
+// One connection and its thread
+struct worker {
+  pthread_t thread;
+  int index;
+  int fd;
+  SSL *ssl;
+  struct wl_buf out, in;
+  uint32_t next_id;
+  uint64_t rng;
+  uint64_t handshake; // ns for the TCP connect and the TLS handshake
+  struct histogram latency[OPS];
+  unsigned long misses[OPS]; // answered NOT_FOUND or EXISTS
+  unsigned long errors[OPS]; // answered with anything else but OK
+};
+
+// The run, as given on the command line
+static char host[256];
+static const char *port = DEFAULT_PORT;
+static int connections = DEFAULT_CONNECTIONS;
+static int seconds = DEFAULT_SECONDS;
+static double rate; // 0 for closed-loop
+static int keys = DEFAULT_KEYS;
+static int description_len = DEFAULT_DESCRIPTION;
+static bool prefill, json, compression;
+static int weights[OPS], weight_total;
+
+static SSL_CTX *ctx;
+static uint8_t token[256]; // the login all connections share
+static size_t token_len;
+static pthread_barrier_t ready;
+static uint64_t run_start, run_end; // ns, CLOCK_MONOTONIC
+static char *description;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns) {
+  struct timespec ts = {ns / 1000000000, ns % 1000000000};
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+// xorshift64*, one state per thread
+static uint64_t next_random(uint64_t *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/******************************************************************************
+
+  Log-linear histogram buckets: values below 2 * HIST_SUB have one each,
+  and every power of two above that is split into HIST_SUB buckets.
+
+ ******************************************************************************/
+static size_t hist_bucket(uint64_t value) {
+  int shift;
+
+  if (value < 2 * HIST_SUB)
+    return value;
+  shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB + (value >> shift) - HIST_SUB;
+}
+
+// The highest value that falls in a bucket
+static uint64_t hist_value(size_t bucket) {
+  int shift;
+
+  if (bucket < 2 * HIST_SUB)
+    return bucket;
+  shift = bucket / HIST_SUB - 1;
+  return ((uint64_t)(bucket % HIST_SUB + HIST_SUB + 1) << shift) - 1;
+}
+
+static void hist_add(struct histogram *h, uint64_t value) {
+  h->counts[hist_bucket(value)]++;
+  h->total++;
+  h->sum += value;
+  if (value > h->max)
+    h->max = value;
+}
+
+static void hist_merge(struct histogram *into, const struct histogram *h) {
+  for (size_t i = 0; i < HIST_BUCKETS; i++)
+    into->counts[i] += h->counts[i];
+  into->total += h->total;
+  into->sum += h->sum;
+  if (h->max > into->max)
+    into->max = h->max;
+}
+
+// The value below which a fraction 'p' of the values fall
+static uint64_t hist_percentile(const struct histogram *h, double p) {
+  uint64_t want = p * h->total + 0.5, seen = 0;
+
+  if (want < 1)
+    want = 1;
+  for (size_t i = 0; i < HIST_BUCKETS; i++)
+    if ((seen += h->counts[i]) >= want)
+      return hist_value(i) < h->max ? hist_value(i) : h->max;
+  return h->max;
+}
+
+static void fail(const char *what) {
+  fprintf(stderr, "wl-bench: %s\n", what);
+  ERR_print_errors_fp(stderr);
+  exit(EXIT_FAILURE);
+}
+
+/******************************************************************************
+
+  Open a TCP connection to the server and establish TLS over it, timing
+  both together.
+
+ ******************************************************************************/
+static void connect_server(struct worker *w) {
+  struct addrinfo hints = {0}, *res, *ai;
+  uint64_t start = now_ns();
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &res) != 0)
+    fail("Cannot resolve the server's name");
+  w->fd = -1;
+  for (ai = res; ai != NULL; ai = ai->ai_next) {
+    if ((w->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+      continue;
+    if (connect(w->fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(w->fd);
+    w->fd = -1;
+  }
+  freeaddrinfo(res);
+  if (w->fd < 0)
+    fail("Cannot connect to the server");
+
+  w->ssl = SSL_new(ctx);
+  SSL_set_fd(w->ssl, w->fd);
+  if (SSL_connect(w->ssl) != 1)
+    fail("Cannot establish TLS with the server");
+  w->handshake = now_ns() - start;
+}
+
+// Send the frame built in w->out and wait for its reply, which the caller
+// consumes from w->in.  Returns the reply's size.
+static long exchange(struct worker *w, struct wl_frame *reply) {
+  long size;
+
+  if (wl_send(w->ssl, &w->out) < 0 ||
+      (size = wl_recv(w->ssl, &w->in, reply)) < 0)
+    fail("Lost the connection to the server");
+  return size;
+}
+
+/******************************************************************************
+
+  Say hello on a new connection, logging in with the shared token, or
+  registering the user that hands it out when there is none yet.
+
+ ******************************************************************************/
+static void log_in(struct worker *w) {
+  struct wl_frame reply;
+  struct wl_field f;
+  char user[USERNAME_LENGTH];
+  size_t start;
+  long size;
+
+  wl_buf_reserve(&w->out, WL_MAGIC_LEN);
+  memcpy(w->out.data, WL_MAGIC, WL_MAGIC_LEN);
+  w->out.len = WL_MAGIC_LEN;
+  start = wl_begin(&w->out, WL_HELLO, 0, 0, w->next_id++);
+  wl_put_u32(&w->out, WL_F_VERSION, WL_VERSION);
+  if (token_len > 0)
+    wl_put_bytes(&w->out, WL_F_TOKEN, token, token_len);
+  if (compression)
+    wl_put_u32(&w->out, WL_F_COMPRESS, WL_COMPRESS_ZLIB);
+  wl_end(&w->out, start);
+  size = exchange(w, &reply);
+  if (reply.status != WL_OK)
+    fail("The server does not speak the watchlist protocol");
+  if (token_len > 0) {
+    if (!wl_find(&reply, WL_F_USERNAME, &f))
+      fail("The server did not accept the login token");
+    wl_buf_consume(&w->in, size);
+    return;
+  }
+  wl_buf_consume(&w->in, size);
+
+  // The hash is never checked against a password, only compared
+  snprintf(user, sizeof(user), "bench-%ld-%ld", (long)getpid(),
+           (long)time(NULL));
+  do {
+    start = wl_begin(&w->out, WL_REGISTER, 0, 0, w->next_id++);
+    wl_put_str(&w->out, WL_F_USERNAME, user);
+    wl_put_str(&w->out, WL_F_HASH, "$1$wlbench$");
+    wl_put_str(&w->out, WL_F_SALT, "$1$wlbench");
+    wl_end(&w->out, start);
+    size = exchange(w, &reply);
+    if (reply.status == WL_BUSY) {
+      wl_buf_consume(&w->in, size);
+      usleep(BUSY_RETRY);
+    }
+  } while (reply.status == WL_BUSY);
+  if (reply.status != WL_OK || !wl_find(&reply, WL_F_TOKEN, &f) ||
+      f.len > sizeof(token))
+    fail("Cannot register the benchmark's user");
+  memcpy(token, f.data, f.len);
+  token_len = f.len;
+  wl_buf_consume(&w->in, size);
+}
+
+// Build one request of the given kind on a random title
+static void put_request(struct worker *w, enum bench_op op, long key) {
+  char title[TITLE_LENGTH];
+  size_t start;
+
+  snprintf(title, sizeof(title), "bench %ld", key);
+  start = wl_begin(&w->out, op_types[op], 0, 0, w->next_id++);
+  switch (op) {
+  case OP_CREATE:
+    wl_put_str(&w->out, WL_F_TITLE, title);
+    wl_put_u32(&w->out, WL_F_TYPE, 1 + next_random(&w->rng) % 4);
+    wl_put_str(&w->out, WL_F_DESCRIPTION, description);
+    wl_put_u32(&w->out, WL_F_STATUS, 1);
+    wl_put_u32(&w->out, WL_F_RATING, 0);
+    break;
+  case OP_UPDATE:
+    wl_put_str(&w->out, WL_F_TITLE, title);
+    wl_put_u32(&w->out, WL_F_RATING, 1 + next_random(&w->rng) % 5);
+    break;
+  case OP_DISPLAY:
+    wl_put_u32(&w->out, WL_F_LIMIT, DISPLAY_LIMIT);
+    break;
+  case OP_TOP:
+    wl_put_u32(&w->out, WL_F_ORDER, WL_ORDER_RATING);
+    wl_put_u32(&w->out, WL_F_LIMIT, DISPLAY_LIMIT);
+    break;
+  default:
+    wl_put_str(&w->out, WL_F_TITLE, title);
+  }
+  wl_end(&w->out, start);
+}
+
+// Send one request and count its reply; returns when the reply came, in ns
+static uint64_t run_request(struct worker *w, enum bench_op op, long key,
+                            uint64_t due) {
+  struct wl_frame reply;
+  uint64_t done;
+  long size;
+
+  put_request(w, op, key);
+  size = exchange(w, &reply);
+  done = now_ns();
+  hist_add(&w->latency[op], done - due);
+  if (reply.status == WL_NOT_FOUND || reply.status == WL_EXISTS)
+    w->misses[op]++;
+  else if (reply.status != WL_OK)
+    w->errors[op]++;
+  wl_buf_consume(&w->in, size);
+  return done;
+}
+
+static enum bench_op pick_op(struct worker *w) {
+  int n = next_random(&w->rng) % weight_total;
+  int op = 0;
+
+  while (n >= weights[op])
+    n -= weights[op++];
+  return op;
+}
+
+static void *worker_main(void *arg) {
+  struct worker *w = arg;
+  uint64_t due, interval = 0;
+  enum bench_op op;
+  long key;
+
+  connect_server(w);
+  log_in(w);
+  if (prefill)
+    for (key = w->index; key < keys; key += connections) {
+      put_request(w, OP_CREATE, key);
+      wl_buf_consume(&w->in, exchange(w, &(struct wl_frame){0}));
+    }
+
+  // Once everybody is connected main() sets the clock, then all start
+  pthread_barrier_wait(&ready);
+  pthread_barrier_wait(&ready);
+
+  // Open-loop connections take turns through one interval so their
+  // requests do not all go out at once
+  due = run_start;
+  if (rate > 0) {
+    interval = 1e9 * connections / rate;
+    due += interval * w->index / connections;
+  }
+
+  while (due < run_end) {
+    op = pick_op(w);
+    key = next_random(&w->rng) % keys;
+    if (rate > 0) {
+      sleep_until(due);
+      run_request(w, op, key, due);
+      due += interval;
+    } else
+      due = run_request(w, op, key, now_ns());
+  }
+
+  SSL_shutdown(w->ssl);
+  SSL_free(w->ssl);
+  close(w->fd);
+  wl_buf_free(&w->out);
+  wl_buf_free(&w->in);
+  return NULL;
+}
+
+static void parse_mix(const char *mix) {
+  char *copy = strdup(mix), *item, *save = NULL, *eq;
+  int op;
+
+  for (item = strtok_r(copy, ",", &save); item != NULL;
+       item = strtok_r(NULL, ",", &save)) {
+    if ((eq = strchr(item, '=')) == NULL)
+      fail("A mix is a list of op=weight");
+    *eq = '\0';
+    for (op = 0; op < OPS && strcmp(item, op_names[op]) != 0; op++)
+      ;
+    if (op == OPS || atoi(eq + 1) < 0)
+      fail("The mix names create, find, display, top, update and remove");
+    weights[op] = atoi(eq + 1);
+  }
+  free(copy);
+  weight_total = 0;
+  for (op = 0; op < OPS; op++)
+    weight_total += weights[op];
+  if (weight_total == 0)
+    fail("The mix has no weight");
+}
+
+static void usage(void) {
+  fprintf(stderr, "Usage: wl-bench [-c connections] [-d seconds] [-r rate] "
+                  "[-m mix] [-k keys] [-s bytes] [-p] [-j] [-z] "
+                  "<server>[:<port>]\n");
+  exit(EXIT_FAILURE);
+}
+
+// Print one histogram as a JSON member, in microseconds, with the counts
+// of misses and errors when there are any to tell
+static void print_json_hist(const char *name, const struct histogram *h,
+                            const unsigned long *misses,
+                            const unsigned long *errors) {
+  printf("\"%s\": {\"count\": %llu, ", name, (unsigned long long)h->total);
+  if (misses != NULL)
+    printf("\"misses\": %lu, \"errors\": %lu, ", *misses, *errors);
+  printf("\"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, "
+         "\"p999_us\": %.1f, \"max_us\": %.1f}",
+         h->total ? h->sum / 1e3 / h->total : 0.0,
+         hist_percentile(h, 0.50) / 1e3, hist_percentile(h, 0.99) / 1e3,
+         hist_percentile(h, 0.999) / 1e3, h->max / 1e3);
+}
+
+static void print_row(const char *name, const struct histogram *h,
+                      unsigned long misses, unsigned long errors) {
+  printf("%-10s %10llu %8lu %8lu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+         (unsigned long long)h->total, misses, errors,
+         h->total ? h->sum / 1e3 / h->total : 0.0,
+         hist_percentile(h, 0.50) / 1e3, hist_percentile(h, 0.99) / 1e3,
+         hist_percentile(h, 0.999) / 1e3, h->max / 1e3);
+}
+
+static void report(struct worker *workers, double elapsed) {
+  static struct histogram latency[OPS], handshake, all;
+  unsigned long misses[OPS] = {0}, errors[OPS] = {0};
+  unsigned long total_misses = 0, total_errors = 0;
+
+  for (int i = 0; i < connections; i++) {
+    hist_add(&handshake, workers[i].handshake);
+    for (int op = 0; op < OPS; op++) {
+      hist_merge(&latency[op], &workers[i].latency[op]);
+      misses[op] += workers[i].misses[op];
+      errors[op] += workers[i].errors[op];
+    }
+  }
+  for (int op = 0; op < OPS; op++) {
+    hist_merge(&all, &latency[op]);
+    total_misses += misses[op];
+    total_errors += errors[op];
+  }
+
+  if (json) {
+    printf("{\"server\": \"%s:%s\", \"mode\": \"%s\", \"connections\": %d, "
+           "\"rate\": %.0f, \"seconds\": %d, \"keys\": %d, "
+           "\"elapsed\": %.3f, \"requests\": %llu, \"errors\": %lu, "
+           "\"throughput\": %.1f, ",
+           host, port, rate > 0 ? "open" : "closed", connections, rate,
+           seconds, keys, elapsed, (unsigned long long)all.total,
+           total_errors, all.total / elapsed);
+    print_json_hist("handshake", &handshake, NULL, NULL);
+    printf(", \"latency\": {");
+    for (int op = 0; op < OPS; op++) {
+      print_json_hist(op_names[op], &latency[op], &misses[op], &errors[op]);
+      printf(", ");
+    }
+    print_json_hist("all", &all, &total_misses, &total_errors);
+    printf("}}\n");
+    return;
+  }
+
+  printf("%s-loop, %d connections, %.2f s: %llu requests, %.0f per second, "
+         "%lu errors\n\n",
+         rate > 0 ? "Open" : "Closed", connections, elapsed,
+         (unsigned long long)all.total, all.total / elapsed, total_errors);
+  printf("%-10s %10s %8s %8s %10s %10s %10s %10s %10s\n", "us", "count",
+         "misses", "errors", "mean", "p50", "p99", "p99.9", "max");
+  print_row("handshake", &handshake, 0, 0);
+  for (int op = 0; op < OPS; op++)
+    if (latency[op].total > 0)
+      print_row(op_names[op], &latency[op], misses[op], errors[op]);
+  print_row("all", &all, total_misses, total_errors);
+}
+
+int main(int argc, char **argv) {
+  const char *mix = DEFAULT_MIX;
+  struct worker *workers;
+  char *colon;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:d:r:m:k:s:pjz")) != -1) {
+    switch (opt) {
+    case 'c':
+      connections = atoi(optarg);
+      break;
+    case 'd':
+      seconds = atoi(optarg);
+      break;
+    case 'r':
+      rate = atof(optarg);
+      break;
+    case 'm':
+      mix = optarg;
+      break;
+    case 'k':
+      keys = atoi(optarg);
+      break;
+    case 's':
+      description_len = atoi(optarg);
+      break;
+    case 'p':
+      prefill = true;
+      break;
+    case 'j':
+      json = true;
+      break;
+    case 'z':
+      compression = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 1 || connections < 1 || seconds < 1 || keys < 1 ||
+      rate < 0 || description_len < 0 ||
+      description_len >= DESCRIPTION_LENGTH)
+    usage();
+  snprintf(host, sizeof(host), "%s", argv[optind]);
+  if ((colon = strrchr(host, ':')) != NULL) {
+    *colon = '\0';
+    port = colon + 1;
+  }
+  parse_mix(mix);
+
+  description = malloc(description_len + 1);
+  memset(description, 'x', description_len);
+  description[description_len] = '\0';
+
+  SSL_library_init();
+  if ((ctx = SSL_CTX_new(TLS_client_method())) == NULL)
+    fail("Unable to create a TLS context");
+  workers = calloc(connections, sizeof(*workers));
+  if (workers == NULL)
+    fail("Out of memory");
+  pthread_barrier_init(&ready, NULL, connections + 1);
+
+  // The first connection registers the user the others log in as
+  workers[0].next_id = 1;
+  workers[0].rng = 0x9e3779b97f4a7c15ULL;
+  connect_server(&workers[0]);
+  log_in(&workers[0]);
+  SSL_shutdown(workers[0].ssl);
+  SSL_free(workers[0].ssl);
+  close(workers[0].fd);
+  wl_buf_free(&workers[0].out);
+  wl_buf_free(&workers[0].in);
+
+  for (int i = 0; i < connections; i++) {
+    workers[i].index = i;
+    workers[i].next_id = 1;
+    workers[i].rng = 0x9e3779b97f4a7c15ULL * (i + 1) ^ now_ns();
+    if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) !=
+        0)
+      fail("Unable to start a connection's thread");
+  }
+
+  pthread_barrier_wait(&ready);
+  run_start = now_ns();
+  run_end = run_start + (uint64_t)seconds * 1000000000;
+  pthread_barrier_wait(&ready);
+  for (int i = 0; i < connections; i++)
+    pthread_join(workers[i].thread, NULL);
+
+  report(workers, (now_ns() - run_start) / 1e9);
+  SSL_CTX_free(ctx);
+  free(workers);
+  free(description);
+  return EXIT_SUCCESS;
+}
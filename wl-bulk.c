@@ -0,0 +1,429 @@
+/******************************************************************************
+
+PROGRAM:  wl-bulk.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Offline bulk import and export of the watchlist and users
+          databases, for seeding a server or moving its data elsewhere
+          without one network request per entry.
+
+          Both first replay whatever watchlist.wal still holds, as the
+          server would at its next start, so that an export misses nothing
+          and nothing older is replayed over an import later.  Imported
+          records are stored straight into the database through the
+          storage engine, with nothing logged and nothing synced until the
+          end: one sync and one reorganize of the file make the whole load
+          durable and compact.  An entry whose title is already there is
+          replaced.  Rows that cannot be read are reported with their line
+          number and skipped.
+
+          An export streams every record of the database, in the engine's
+          order, to the output.
+
+          Both directions read and write JSONL or CSV (see lines.h), with
+          the fields of the server's protocol:
+
+            watchlist  title, type, description, status, rating, added
+            users      username, hash, salt
+
+          'added' is when the entry was created, in seconds since the
+          epoch, which a listing in WL_ORDER_RECENT goes by.  An import
+          without it stamps the entry with the time of the import.
+
+          A CSV file may start with a header row naming them, which an
+          export always writes.  Progress and the rate are reported on
+          standard error every second.
+
+          Stop the server first: GDBM refuses to open a database the
+          server has open, but the log engine cannot tell.
+
+          Usage: wl-bulk import|export [-e gdbm|log] [-u] [-c] [file]
+
+          -e picks the storage engine (gdbm by default, as the server's),
+          -u works on the users database instead of the watchlist and -c
+          on CSV instead of JSONL, which is also chosen by a file name
+          ending in ".csv".  The file defaults to standard input or output.
+
+******************************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lines.h"
+#include "record.h"
+#include "storage.h"
+#include "wal.h"
+
+#define IO_BUFFER (1024 * 1024)
+#define MAX_FIELDS 8
+
+// The fields of a record of either database, in their CSV order
+static const char *const watchlist_fields[] = {
+    "title", "type", "description", "status", "rating", "added"};
+static const char *const user_fields[] = {"username", "hash", "salt"};
+
+static struct timespec started, reported;
+static unsigned long done_count;
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: wl-bulk import|export [-e gdbm|log] [-u] [-c] [file]\n");
+  exit(EXIT_FAILURE);
+}
+
+static double since(const struct timespec *t) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - t->tv_sec) + (now.tv_nsec - t->tv_nsec) / 1e9;
+}
+
+// Count one more record and report the rate once a second
+static void progress(void) {
+  if (++done_count % 4096 != 0 || since(&reported) < 1.0)
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &reported);
+  fprintf(stderr, "wl-bulk: %lu records, %.0f per second\n", done_count,
+          done_count / since(&started));
+}
+
+/******************************************************************************
+
+  Read the next record of the input into '*buf': one line, or for CSV as
+  many lines as a quoted field spans, without the final line break.
+  '*line' counts the lines read.  Returns false at the end of the input.
+
+ ******************************************************************************/
+static bool read_record(FILE *in, bool csv, char **buf, size_t *cap,
+                        unsigned long *line) {
+  static char *more;
+  static size_t more_cap;
+  ssize_t len, n;
+
+  if ((len = getline(buf, cap, in)) < 0)
+    return false;
+  (*line)++;
+  while (csv && !lines_csv_complete(*buf) &&
+         (n = getline(&more, &more_cap, in)) >= 0) {
+    (*line)++;
+    if ((size_t)(len + n + 1) > *cap) {
+      *cap = len + n + 1;
+      if ((*buf = realloc(*buf, *cap)) == NULL) {
+        fprintf(stderr, "wl-bulk: Out of memory\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    memcpy(*buf + len, more, n + 1);
+    len += n;
+  }
+  while (len > 0 && ((*buf)[len - 1] == '\n' || (*buf)[len - 1] == '\r'))
+    (*buf)[--len] = '\0';
+  return true;
+}
+
+/******************************************************************************
+
+  Put the fields of one record into 'values', in the order of 'names'.
+  Returns false if the record cannot be read or names a field the
+  database does not have.
+
+ ******************************************************************************/
+static bool split_record(char *record, bool csv, const char *const *names,
+                         int count, char **values) {
+  struct line_field fields[MAX_FIELDS];
+  char *row[MAX_FIELDS];
+  int n, i;
+
+  memset(values, 0, count * sizeof(*values));
+  if (csv) {
+    if ((n = lines_csv(record, row, MAX_FIELDS)) < 1 || n > count)
+      return false;
+    for (i = 0; i < n; i++)
+      values[i] = row[i];
+    return true;
+  }
+
+  if ((n = lines_json(record, fields, MAX_FIELDS)) < 0)
+    return false;
+  for (int f = 0; f < n; f++) {
+    for (i = 0; i < count && strcmp(fields[f].name, names[i]) != 0; i++)
+      ;
+    if (i == count)
+      return false;
+    values[i] = fields[f].value;
+  }
+  return true;
+}
+
+// Read a whole number field, where a missing one counts as 0
+static bool to_number(const char *s, int *value) {
+  char *end;
+  long n;
+
+  if (s == NULL || *s == '\0') {
+    *value = 0;
+    return true;
+  }
+  n = strtol(s, &end, 10);
+  if (*end != '\0' || n < 0 || n > 0x7fffffff)
+    return false;
+  *value = n;
+  return true;
+}
+
+// Read the creation time of an entry, where a missing one means now
+static bool to_time(const char *s, int64_t *value) {
+  char *end;
+  long long n;
+
+  if (s == NULL || *s == '\0') {
+    *value = time(NULL);
+    return true;
+  }
+  errno = 0;
+  n = strtoll(s, &end, 10);
+  if (*end != '\0' || n < 0 || errno != 0)
+    return false;
+  *value = n;
+  return true;
+}
+
+/******************************************************************************
+
+  Turn the fields of one imported record into the key and value stored for
+  it in 'db'.  Returns false if they do not make a valid record.
+
+ ******************************************************************************/
+static bool make_record(struct database *db, char **values, datum *key,
+                        datum *value, char *buf, size_t size) {
+  struct entry e;
+
+  if (db == &users_db) {
+    if (values[0] == NULL || values[1] == NULL || values[2] == NULL ||
+        *values[0] == '\0' || strlen(values[0]) >= USERNAME_LENGTH ||
+        strlen(values[1]) >= HASH_LENGTH || strlen(values[2]) >= SALT_LENGTH)
+      return false;
+    key->dptr = values[0];
+    key->dsize = strlen(values[0]);
+    value->dptr = buf;
+    value->dsize = snprintf(buf, size, "%s:%s", values[1], values[2]);
+    return true;
+  }
+
+  if (values[0] == NULL || *values[0] == '\0' ||
+      strlen(values[0]) >= TITLE_LENGTH ||
+      (values[2] != NULL && strlen(values[2]) >= DESCRIPTION_LENGTH) ||
+      !to_number(values[1], &e.type) || !to_number(values[3], &e.status) ||
+      !to_number(values[4], &e.rating) || !to_time(values[5], &e.added))
+    return false;
+  snprintf(e.description, sizeof(e.description), "%s",
+           values[2] ? values[2] : "");
+  key->dptr = values[0];
+  key->dsize = strlen(values[0]);
+  value->dptr = buf;
+  value->dsize = record_encode(&e, buf, size);
+  return true;
+}
+
+static void import(struct database *db, FILE *in, bool csv) {
+  const char *const *names = db == &users_db ? user_fields : watchlist_fields;
+  int count = db == &users_db ? 3 : 6;
+  char *values[MAX_FIELDS];
+  char value[RECORD_MAX + HASH_LENGTH];
+  char *buf = NULL;
+  size_t cap = 0;
+  unsigned long line = 0, rejected = 0;
+  datum k, v;
+
+  while (read_record(in, csv, &buf, &cap, &line)) {
+    if (buf[0] == '\0')
+      continue;
+    if (!split_record(buf, csv, names, count, values)) {
+      fprintf(stderr, "wl-bulk: Line %lu: cannot be read\n", line);
+      rejected++;
+      continue;
+    }
+    if (csv && line == 1 && strcmp(values[0], names[0]) == 0)
+      continue; // the header row
+    if (!make_record(db, values, &k, &v, value, sizeof(value))) {
+      fprintf(stderr, "wl-bulk: Line %lu: not a valid record\n", line);
+      rejected++;
+      continue;
+    }
+    if (storage_store(db, k, v, STORAGE_REPLACE) != 0) {
+      fprintf(stderr, "wl-bulk: Unable to store line %lu\n", line);
+      exit(EXIT_FAILURE);
+    }
+    progress();
+  }
+  free(buf);
+  if (ferror(in)) {
+    fprintf(stderr, "wl-bulk: Read error: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // The one sync of the whole import, then the space of whatever it
+  // replaced is given back
+  if (db->engine->sync(db->handle) != 0 ||
+      db->engine->reorganize(db->handle) != 0 ||
+      db->engine->sync(db->handle) != 0) {
+    fprintf(stderr, "wl-bulk: Unable to write %s%s\n", db->name,
+            db->engine->extension);
+    exit(EXIT_FAILURE);
+  }
+  fprintf(stderr,
+          "wl-bulk: Imported %lu records into %s%s in %.2f s (%.0f per "
+          "second), %lu rejected\n",
+          done_count, db->name, db->engine->extension, since(&started),
+          done_count / since(&started), rejected);
+}
+
+// Write one exported record's fields, 'values' being 'lens' bytes long
+static void put_record(FILE *out, bool csv, const char *const *names,
+                       int count, const char **values, const size_t *lens,
+                       const long long *numbers) {
+  if (!csv)
+    putc('{', out);
+  for (int i = 0; i < count; i++) {
+    if (i > 0)
+      fputs(csv ? "," : ", ", out);
+    if (!csv) {
+      lines_put_json(out, names[i], strlen(names[i]));
+      fputs(": ", out);
+    }
+    if (values[i] == NULL)
+      fprintf(out, "%lld", numbers[i]);
+    else if (csv)
+      lines_put_csv(out, values[i], lens[i]);
+    else
+      lines_put_json(out, values[i], lens[i]);
+  }
+  fputs(csv ? "\n" : "}\n", out);
+}
+
+static void export(struct database *db, FILE *out, bool csv) {
+  const char *const *names = db == &users_db ? user_fields : watchlist_fields;
+  int count = db == &users_db ? 3 : 6;
+  const char *values[MAX_FIELDS];
+  size_t lens[MAX_FIELDS];
+  long long numbers[MAX_FIELDS];
+  datum key, next, value;
+  struct entry e;
+  const char *colon;
+
+  if (csv)
+    for (int i = 0; i < count; i++)
+      fprintf(out, "%s%s", names[i], i < count - 1 ? "," : "\n");
+
+  for (key = storage_firstkey(db); key.dptr != NULL; key = next) {
+    value = storage_fetch(db, key);
+    if (value.dptr != NULL) {
+      values[0] = key.dptr;
+      lens[0] = key.dsize;
+      if (db == &users_db) {
+        // "hash:salt"; a hash from crypt() never has a colon
+        colon = memchr(value.dptr, ':', value.dsize);
+        lens[1] = colon ? colon - value.dptr : value.dsize;
+        values[1] = value.dptr;
+        values[2] = colon ? colon + 1 : "";
+        lens[2] = colon ? value.dsize - lens[1] - 1 : 0;
+      } else {
+        record_decode(value.dptr, value.dsize, &e);
+        values[1] = values[3] = values[4] = values[5] = NULL;
+        numbers[1] = e.type;
+        numbers[3] = e.status;
+        numbers[4] = e.rating;
+        numbers[5] = e.added;
+        values[2] = e.description;
+        lens[2] = strlen(e.description);
+      }
+      put_record(out, csv, names, count, values, lens, numbers);
+      free(value.dptr);
+      progress();
+    }
+    next = storage_nextkey(db, key);
+    free(key.dptr);
+  }
+  if (fflush(out) != 0 || ferror(out)) {
+    fprintf(stderr, "wl-bulk: Write error: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  fprintf(stderr,
+          "wl-bulk: Exported %lu records from %s%s in %.2f s (%.0f per "
+          "second)\n",
+          done_count, db->name, db->engine->extension, since(&started),
+          done_count / since(&started));
+}
+
+int main(int argc, char **argv) {
+  const struct storage_engine *engine;
+  const char *engine_name = DEFAULT_ENGINE;
+  const char *path = NULL;
+  struct database *db = &watchlist_db;
+  bool importing, csv = false;
+  FILE *fp;
+  long replayed;
+  int opt;
+
+  if (argc < 2)
+    usage();
+  if (strcmp(argv[1], "import") == 0)
+    importing = true;
+  else if (strcmp(argv[1], "export") == 0)
+    importing = false;
+  else
+    usage();
+  argv++;
+  argc--;
+
+  while ((opt = getopt(argc, argv, "e:uc")) != -1) {
+    switch (opt) {
+    case 'e':
+      engine_name = optarg;
+      break;
+    case 'u':
+      db = &users_db;
+      break;
+    case 'c':
+      csv = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind < argc)
+    path = argv[optind++];
+  if (optind < argc || (engine = storage_engine(engine_name)) == NULL)
+    usage();
+  if (path != NULL && strlen(path) > 4 &&
+      strcmp(path + strlen(path) - 4, ".csv") == 0)
+    csv = true;
+
+  if (path == NULL)
+    fp = importing ? stdin : stdout;
+  else if ((fp = fopen(path, importing ? "r" : "w")) == NULL) {
+    fprintf(stderr, "wl-bulk: %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  setvbuf(fp, NULL, _IOFBF, IO_BUFFER);
+
+  // Whatever the server left in its log belongs in the database first, and
+  // must not be replayed over an import at its next start
+  storage_open(engine);
+  if ((replayed = storage_recover()) > 0)
+    fprintf(stderr, "wl-bulk: Replayed %ld records from %s\n", replayed,
+            WATCHLIST_WAL);
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  reported = started;
+  if (importing)
+    import(db, fp, csv);
+  else
+    export(db, fp, csv);
+  storage_close();
+  if (fp != stdin && fp != stdout)
+    fclose(fp);
+  return EXIT_SUCCESS;
+}
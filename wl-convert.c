@@ -0,0 +1,121 @@
+/******************************************************************************
+
+PROGRAM:  wl-convert.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Offline converter that rewrites a watchlist database whose values
+          are still in the old "type:description:status:rating" text form
+          into the binary record format of record.h.
+
+          The database is read once from start to end and every record is
+          written, converted, to a new file next to it, which then replaces
+          the original with rename(), so an interrupted run leaves the old
+          database untouched.  Records that are binary already are copied
+          as they are, so running it twice does no harm.  The server reads
+          both formats, so converting is not required, only faster to read.
+
+          Stop the server first.  Anything left in watchlist.wal is replayed
+          by the server at its next start as usual.
+
+          Usage: wl-convert [-e gdbm|log] [database]
+
+          The database defaults to "watchlist" and the engine to gdbm, the
+          same as the server's; the engine adds the file extension.
+
+******************************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "record.h"
+#include "storage.h"
+
+static const struct storage_engine *engines[] = {&gdbm_engine, &log_engine};
+
+static void usage(void) {
+  fprintf(stderr, "Usage: wl-convert [-e gdbm|log] [database]\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  const struct storage_engine *engine = NULL;
+  const char *engine_name = DEFAULT_ENGINE;
+  const char *name = WATCHLIST_DB;
+  char path[256], temp[272];
+  char value[RECORD_MAX];
+  void *src, *dst;
+  datum key, next, old;
+  struct entry e;
+  unsigned long converted = 0, copied = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "e:")) != -1) {
+    switch (opt) {
+    case 'e':
+      engine_name = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind < argc)
+    name = argv[optind++];
+  if (optind < argc)
+    usage();
+  for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+    if (strcmp(engines[i]->name, engine_name) == 0)
+      engine = engines[i];
+  if (engine == NULL)
+    usage();
+
+  snprintf(path, sizeof(path), "%s%s", name, engine->extension);
+  snprintf(temp, sizeof(temp), "%s.convert", path);
+  if (access(path, F_OK) < 0) {
+    fprintf(stderr, "wl-convert: %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  unlink(temp); // left over from an interrupted run
+  src = engine->open(path);
+  dst = engine->open(temp);
+
+  for (key = engine->firstkey(src); key.dptr != NULL; key = next) {
+    old = engine->fetch(src, key);
+    if (old.dptr != NULL) {
+      datum out = old;
+
+      if (record_is_binary(old.dptr, old.dsize))
+        copied++;
+      else {
+        record_decode_text(old.dptr, old.dsize, &e);
+        out.dptr = value;
+        out.dsize = record_encode(&e, value, sizeof(value));
+        converted++;
+      }
+      if (engine->store(dst, key, out, STORAGE_REPLACE) != 0) {
+        fprintf(stderr, "wl-convert: Unable to write %s\n", temp);
+        exit(EXIT_FAILURE);
+      }
+      free(old.dptr);
+    }
+    next = engine->nextkey(src, key);
+    free(key.dptr);
+  }
+
+  if (engine->sync(dst) != 0) {
+    fprintf(stderr, "wl-convert: Unable to sync %s\n", temp);
+    exit(EXIT_FAILURE);
+  }
+  engine->close(dst);
+  engine->close(src);
+  if (rename(temp, path) < 0) {
+    fprintf(stderr, "wl-convert: Unable to replace %s: %s\n", path,
+            strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  printf("wl-convert: %s: %lu records converted, %lu already binary\n", path,
+         converted, copied);
+  return EXIT_SUCCESS;
+}
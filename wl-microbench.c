@@ -0,0 +1,533 @@
+/******************************************************************************
+
+PROGRAM:  wl-microbench.c for Watchlist Project
+AUTHOR:   Thomas, Riley, Stephanie
+COURSE:   CS469 - Distributed Systems (Regis University)
+SYNOPSIS: Microbenchmarks of the layers a request passes through, each run
+          on its own so a change to one can be measured without the others
+          in the way:
+
+            parse/     splitting a text protocol message with strtok(), as
+                       the server's handle_op() does, and parsing, reading
+                       and building binary protocol frames
+            record/    decoding and encoding watchlist values, both forms
+            <engine>/  fetch, store and the walk of a display, through
+                       each storage engine over a database of -n records
+            tls/       sealing one TLS record of a given size and opening
+                       it again, over an in-memory pair of connections
+
+          Every benchmark runs for at least -t seconds, raising its count
+          of iterations until it does, and reports nanoseconds and heap
+          allocations per operation.  Allocations are counted by wrapping
+          malloc(), calloc() and realloc() in this program, which catches
+          those made inside GDBM and OpenSSL too.
+
+          The databases are created in a fresh directory under -D, /dev/shm
+          by default, so the engines run on tmpfs and their numbers are not
+          the disk's; give a directory on disk to include it.  The TLS
+          benchmarks need the server's cert.pem and key.pem in the current
+          directory and are skipped without them.
+
+          Usage: wl-microbench [-n records] [-t seconds] [-D directory]
+                               [-j] [filter]
+
+          Only benchmarks whose names contain the filter are run.  -j
+          prints one JSON object per benchmark instead of a table.  What
+          the engines print themselves goes to standard error, so that the
+          results are all there is on standard output.
+
+******************************************************************************/
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "engine.h"
+#include "protocol.h"
+#include "record.h"
+
+#define DEFAULT_RECORDS 100000
+#define DEFAULT_SECONDS 0.5
+#define DEFAULT_DIRECTORY "/dev/shm"
+#define TEXT_BUFFER 256 // the server's BUFFER_SIZE for text messages
+#define TLS_BIO_SIZE (64 * 1024)
+
+// A create as the legacy text client sends it
+#define DESCRIPTION "A concierge and his lobby boy"
+#define TEXT_CREATE "c:The Grand Budapest Hotel:1:" DESCRIPTION ":3:5"
+
+static const struct storage_engine *engines[] = {&gdbm_engine, &log_engine};
+static const int tls_sizes[] = {64, 256, 4096, 16384};
+
+static long records = DEFAULT_RECORDS;
+static double min_seconds = DEFAULT_SECONDS;
+static const char *filter;
+static bool json;
+static volatile long sink; // keeps results from being optimized away
+static FILE *results;
+
+/******************************************************************************
+
+  Count the heap allocations of this thread by wrapping glibc's allocator.
+  free() is left alone; it is allocations that cost.
+
+ ******************************************************************************/
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static __thread unsigned long allocations;
+
+void *malloc(size_t size) {
+  allocations++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  allocations++;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+static bool selected(const char *name) {
+  return filter == NULL || strstr(name, filter) != NULL;
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************
+
+  Run 'fn' for 'n' iterations at a time, starting at one and growing 'n'
+  towards what should take the minimum time, until one run takes at least
+  that long, then report the last run.
+
+ ******************************************************************************/
+static void measure(const char *name, void (*fn)(long n, void *arg),
+                    void *arg) {
+  unsigned long before;
+  double start, secs;
+  long n = 1, next;
+
+  if (!selected(name))
+    return;
+  for (;;) {
+    before = allocations;
+    start = now();
+    fn(n, arg);
+    secs = now() - start;
+    if (secs >= min_seconds || n >= 1L << 40)
+      break;
+    next = secs > 0 ? n * (min_seconds * 1.2 / secs) : n * 100;
+    n = next > n * 100 ? n * 100 : next > n ? next : n + 1;
+  }
+
+  if (json)
+    fprintf(results,
+            "{\"name\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.1f, "
+            "\"allocs_per_op\": %.2f}\n",
+            name, n, secs * 1e9 / n, (double)(allocations - before) / n);
+  else
+    fprintf(results, "%-28s %12ld %12.1f %12.2f\n", name, n, secs * 1e9 / n,
+            (double)(allocations - before) / n);
+  fflush(results);
+}
+
+// Split a text create with strtok() and decode its value, as handle_op()
+static void bench_text_parse(long n, void *arg) {
+  char buffer[TEXT_BUFFER], *title, *ptr;
+  struct entry e;
+
+  for (long i = 0; i < n; i++) {
+    memcpy(buffer, TEXT_CREATE, sizeof(TEXT_CREATE));
+    strtok(buffer, ":");
+    title = strtok(NULL, ":");
+    ptr = strtok(NULL, "");
+    record_decode_text(ptr, strlen(ptr), &e);
+    sink += title[0] + e.rating;
+  }
+}
+
+// A WL_CREATE request, built into 'b'
+static void put_create(struct wl_buf *b) {
+  size_t start = wl_begin(b, WL_CREATE, 0, 0, 7);
+
+  wl_put_str(b, WL_F_TITLE, "The Grand Budapest Hotel");
+  wl_put_u32(b, WL_F_TYPE, 1);
+  wl_put_str(b, WL_F_DESCRIPTION, DESCRIPTION);
+  wl_put_u32(b, WL_F_STATUS, 3);
+  wl_put_u32(b, WL_F_RATING, 5);
+  wl_end(b, start);
+}
+
+// Parse a binary create and read its fields into an entry
+static void bench_frame_parse(long n, void *arg) {
+  struct wl_buf *b = arg;
+  struct wl_frame frame;
+  struct wl_field f;
+  struct entry e;
+  size_t pos;
+
+  for (long i = 0; i < n; i++) {
+    wl_parse(b->data, b->len, &frame);
+    pos = 0;
+    while (wl_next(&frame, &pos, &f) == 1)
+      switch (f.tag) {
+      case WL_F_TITLE:
+        wl_copy_str(&f, e.title, sizeof(e.title));
+        break;
+      case WL_F_TYPE:
+        e.type = wl_u32(&f);
+        break;
+      case WL_F_DESCRIPTION:
+        wl_copy_str(&f, e.description, sizeof(e.description));
+        break;
+      case WL_F_STATUS:
+        e.status = wl_u32(&f);
+        break;
+      case WL_F_RATING:
+        e.rating = wl_u32(&f);
+        break;
+      }
+    sink += e.title[0] + e.rating;
+  }
+}
+
+static void bench_frame_build(long n, void *arg) {
+  struct wl_buf *b = arg;
+
+  for (long i = 0; i < n; i++) {
+    b->len = 0;
+    put_create(b);
+  }
+  sink += b->len;
+}
+
+static void bench_record_decode(long n, void *arg) {
+  const datum *value = arg;
+  struct entry e;
+
+  for (long i = 0; i < n; i++) {
+    record_decode(value->dptr, value->dsize, &e);
+    sink += e.rating;
+  }
+}
+
+static void bench_record_encode(long n, void *arg) {
+  const struct entry *e = arg;
+  char value[RECORD_MAX];
+
+  for (long i = 0; i < n; i++)
+    sink += record_encode(e, value, sizeof(value));
+}
+
+// One engine's open database for the benchmarks below
+struct engine_bench {
+  const struct storage_engine *engine;
+  void *handle;
+  datum value;
+  uint64_t rng;
+};
+
+static uint64_t next_random(uint64_t *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static datum random_key(struct engine_bench *eb, char *buf, size_t size,
+                        bool present) {
+  long k = next_random(&eb->rng) % records;
+  datum key = {buf, snprintf(buf, size, present ? "title %ld" : "absent %ld",
+                             k)};
+  return key;
+}
+
+static void bench_fetch(long n, void *arg) {
+  struct engine_bench *eb = arg;
+  char buf[64];
+  datum value;
+
+  for (long i = 0; i < n; i++) {
+    value = eb->engine->fetch(eb->handle,
+                              random_key(eb, buf, sizeof(buf), true));
+    sink += value.dsize;
+    free(value.dptr);
+  }
+}
+
+static void bench_fetch_miss(long n, void *arg) {
+  struct engine_bench *eb = arg;
+  char buf[64];
+  datum value;
+
+  for (long i = 0; i < n; i++) {
+    value = eb->engine->fetch(eb->handle,
+                              random_key(eb, buf, sizeof(buf), false));
+    sink += value.dsize;
+    free(value.dptr);
+  }
+}
+
+// Overwrite random records, so the database keeps its size
+static void bench_store(long n, void *arg) {
+  struct engine_bench *eb = arg;
+  char buf[64];
+
+  for (long i = 0; i < n; i++)
+    sink += eb->engine->store(eb->handle,
+                              random_key(eb, buf, sizeof(buf), true),
+                              eb->value, STORAGE_REPLACE);
+}
+
+// Per entry of a display: the next key, its value and decoding it
+static void bench_display(long n, void *arg) {
+  struct engine_bench *eb = arg;
+  datum key = {NULL, 0}, next, value;
+  struct entry e;
+
+  for (long i = 0; i < n; i++) {
+    next = key.dptr == NULL ? eb->engine->firstkey(eb->handle)
+                            : eb->engine->nextkey(eb->handle, key);
+    free(key.dptr);
+    if ((key = next).dptr == NULL)
+      continue; // the walk starts over
+    value = eb->engine->fetch(eb->handle, key);
+    record_decode(value.dptr, value.dsize, &e);
+    sink += e.rating;
+    free(value.dptr);
+  }
+  free(key.dptr);
+}
+
+/******************************************************************************
+
+  Open a new database with each engine in 'dir', fill it with 'records'
+  entries and run the engine's benchmarks, removing the files after.
+
+ ******************************************************************************/
+static void bench_engines(const char *dir) {
+  struct entry e = {"", DESCRIPTION, 1, 3, 5};
+  char value[RECORD_MAX], path[512], key[64], name[64], file[560];
+  static const char *const benches[] = {"fetch", "fetch-miss", "store",
+                                        "display-entry"};
+  void (*const fns[])(long, void *) = {bench_fetch, bench_fetch_miss,
+                                       bench_store, bench_display};
+  struct engine_bench eb;
+  bool any;
+  double start;
+
+  for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+    // Loading the database is not worth it for nothing
+    any = false;
+    for (int b = 0; b < 4; b++) {
+      snprintf(name, sizeof(name), "%s/%s", engines[i]->name, benches[b]);
+      any |= selected(name);
+    }
+    if (!any)
+      continue;
+
+    eb.engine = engines[i];
+    eb.value.dptr = value;
+    eb.value.dsize = record_encode(&e, value, sizeof(value));
+    eb.rng = 0x9e3779b97f4a7c15ULL;
+    snprintf(path, sizeof(path), "%s/watchlist%s", dir, eb.engine->extension);
+    eb.handle = eb.engine->open(path);
+
+    start = now();
+    for (long k = 0; k < records; k++) {
+      datum d = {key, snprintf(key, sizeof(key), "title %ld", k)};
+      eb.engine->store(eb.handle, d, eb.value, STORAGE_REPLACE);
+    }
+    eb.engine->sync(eb.handle);
+    fprintf(stderr, "wl-microbench: %ld records loaded into %s in %.2f s\n",
+            records, eb.engine->name, now() - start);
+
+    for (int b = 0; b < 4; b++) {
+      snprintf(name, sizeof(name), "%s/%s", eb.engine->name, benches[b]);
+      measure(name, fns[b], &eb);
+    }
+
+    eb.engine->close(eb.handle);
+    unlink(path);
+    snprintf(file, sizeof(file), "%s.compact", path);
+    unlink(file);
+  }
+}
+
+// Both ends of an in-memory TLS connection
+struct tls_pair {
+  SSL *client, *server;
+  int size;
+  char *buf;
+};
+
+/******************************************************************************
+
+  Connect a client and a server SSL object through a BIO pair and run the
+  handshake between them.  Returns false if the server's certificate and
+  key are not in the current directory.
+
+ ******************************************************************************/
+static bool tls_connect(struct tls_pair *p) {
+  SSL_CTX *client_ctx = SSL_CTX_new(TLS_client_method());
+  SSL_CTX *server_ctx = SSL_CTX_new(TLS_server_method());
+  BIO *client_bio, *server_bio;
+  int c = 0, s = 0;
+
+  if (SSL_CTX_use_certificate_file(server_ctx, "cert.pem", SSL_FILETYPE_PEM) !=
+          1 ||
+      SSL_CTX_use_PrivateKey_file(server_ctx, "key.pem", SSL_FILETYPE_PEM) !=
+          1) {
+    ERR_clear_error();
+    return false;
+  }
+  BIO_new_bio_pair(&client_bio, TLS_BIO_SIZE, &server_bio, TLS_BIO_SIZE);
+  p->client = SSL_new(client_ctx);
+  p->server = SSL_new(server_ctx);
+  SSL_set_bio(p->client, client_bio, client_bio);
+  SSL_set_bio(p->server, server_bio, server_bio);
+  SSL_set_connect_state(p->client);
+  SSL_set_accept_state(p->server);
+  while (c != 1 || s != 1) {
+    if (c != 1)
+      c = SSL_do_handshake(p->client);
+    if (s != 1)
+      s = SSL_do_handshake(p->server);
+    if ((c <= 0 && SSL_get_error(p->client, c) != SSL_ERROR_WANT_READ) ||
+        (s <= 0 && SSL_get_error(p->server, s) != SSL_ERROR_WANT_READ)) {
+      fprintf(stderr, "wl-microbench: TLS handshake failed\n");
+      ERR_print_errors_fp(stderr);
+      exit(EXIT_FAILURE);
+    }
+  }
+  SSL_CTX_free(client_ctx);
+  SSL_CTX_free(server_ctx);
+  return true;
+}
+
+// Seal one record of p->size bytes on the client and open it on the server
+static void bench_tls(long n, void *arg) {
+  struct tls_pair *p = arg;
+
+  for (long i = 0; i < n; i++) {
+    if (SSL_write(p->client, p->buf, p->size) != p->size ||
+        SSL_read(p->server, p->buf, p->size) != p->size) {
+      fprintf(stderr, "wl-microbench: TLS record did not go through\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static void bench_tls_sizes(void) {
+  struct tls_pair p;
+  char name[64];
+  bool any = false;
+
+  for (size_t i = 0; i < sizeof(tls_sizes) / sizeof(tls_sizes[0]); i++) {
+    snprintf(name, sizeof(name), "tls/record-%d", tls_sizes[i]);
+    any |= selected(name);
+  }
+  if (!any)
+    return;
+  if (!tls_connect(&p)) {
+    fprintf(stderr, "wl-microbench: No cert.pem and key.pem here, skipping "
+                    "the TLS benchmarks\n");
+    return;
+  }
+  p.buf = calloc(1, tls_sizes[sizeof(tls_sizes) / sizeof(tls_sizes[0]) - 1]);
+  for (size_t i = 0; i < sizeof(tls_sizes) / sizeof(tls_sizes[0]); i++) {
+    p.size = tls_sizes[i];
+    snprintf(name, sizeof(name), "tls/record-%d", p.size);
+    measure(name, bench_tls, &p);
+  }
+  SSL_free(p.client);
+  SSL_free(p.server);
+  free(p.buf);
+}
+
+static void usage(void) {
+  fprintf(stderr, "Usage: wl-microbench [-n records] [-t seconds] "
+                  "[-D directory] [-j] [filter]\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  const char *base = DEFAULT_DIRECTORY;
+  struct entry e = {"The Grand Budapest Hotel", DESCRIPTION, 1, 3, 5};
+  struct wl_buf frame = {0};
+  char dir[512], binary[RECORD_MAX], text[] = "1:" DESCRIPTION ":3:5";
+  datum value;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:t:D:j")) != -1) {
+    switch (opt) {
+    case 'n':
+      records = atol(optarg);
+      break;
+    case 't':
+      min_seconds = atof(optarg);
+      break;
+    case 'D':
+      base = optarg;
+      break;
+    case 'j':
+      json = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind < argc)
+    filter = argv[optind++];
+  if (optind < argc || records < 1 || min_seconds <= 0)
+    usage();
+
+  results = fdopen(dup(STDOUT_FILENO), "w");
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+  if (!json)
+    fprintf(results, "%-28s %12s %12s %12s\n", "benchmark", "iterations",
+            "ns/op", "allocs/op");
+
+  measure("parse/text-strtok", bench_text_parse, NULL);
+  put_create(&frame);
+  measure("parse/frame", bench_frame_parse, &frame);
+  measure("parse/frame-build", bench_frame_build, &frame);
+  wl_buf_free(&frame);
+
+  value.dptr = binary;
+  value.dsize = record_encode(&e, binary, sizeof(binary));
+  measure("record/decode-binary", bench_record_decode, &value);
+  value.dptr = text;
+  value.dsize = strlen(text);
+  measure("record/decode-text", bench_record_decode, &value);
+  measure("record/encode", bench_record_encode, &e);
+
+  snprintf(dir, sizeof(dir), "%s/wl-microbench.XXXXXX", base);
+  if (mkdtemp(dir) == NULL) {
+    fprintf(stderr, "wl-microbench: Cannot create a directory in %s: %s\n",
+            base, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  bench_engines(dir);
+  rmdir(dir);
+
+  bench_tls_sizes();
+  return EXIT_SUCCESS;
+}